@@ -0,0 +1,31 @@
+/*
+ *  async.h
+ *  Asynchronous command definitions for the scsisim library.
+ *  This is an internal interface file for the scsisim library.
+ *
+ *  Copyright (c) 2017, Chris Coffey <kpuc@sdf.org>
+ *
+ *  Permission to use, copy, modify, and/or distribute this software
+ *  for any purpose with or without fee is hereby granted, provided
+ *  that the above copyright notice and this permission notice appear
+ *  in all copies.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL 
+ *  WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED
+ *  WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE
+ *  AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL
+ *  DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE, DATA
+ *  OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER
+ *  TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ *  PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifndef __SCSISIM_ASYNC_H__
+#define __SCSISIM_ASYNC_H__
+
+void async_free(struct scsisim_dev *device);
+
+#endif  /* __SCSISIM_ASYNC_H__ */
+
+/* EOF */
+
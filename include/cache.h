@@ -0,0 +1,79 @@
+/*
+ *  cache.h
+ *  File metadata cache definitions for the scsisim library.
+ *  This is an internal interface file for the scsisim library.
+ *
+ *  Copyright (c) 2017, Chris Coffey <kpuc@sdf.org>
+ *
+ *  Permission to use, copy, modify, and/or distribute this software
+ *  for any purpose with or without fee is hereby granted, provided
+ *  that the above copyright notice and this permission notice appear
+ *  in all copies.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL 
+ *  WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED
+ *  WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE
+ *  AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL
+ *  DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE, DATA
+ *  OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER
+ *  TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ *  PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifndef __SCSISIM_CACHE_H__
+#define __SCSISIM_CACHE_H__
+
+#include <stdbool.h>
+#include <stdint.h>
+
+int cache_create(struct scsisim_dev *device);
+
+void cache_free(struct scsisim_dev *device);
+
+void cache_invalidate(const struct scsisim_dev *device);
+
+void cache_forget_position(const struct scsisim_dev *device);
+
+void cache_forget_responses(const struct scsisim_dev *device);
+
+void cache_forget_selected(const struct scsisim_dev *device);
+
+int cache_get_position(const struct scsisim_dev *device,
+		       uint16_t *path,
+		       uint16_t *ef);
+
+int cache_select(const struct scsisim_dev *device, uint16_t file);
+
+void cache_selected(const struct scsisim_dev *device, uint16_t file, int ret);
+
+int cache_get_response(const struct scsisim_dev *device, uint8_t *data, uint8_t len);
+
+void cache_store_response(const struct scsisim_dev *device,
+			  const uint8_t *data,
+			  unsigned int len);
+
+/* Record map test for free ADN records; tests 0x00 to 0xff are leading
+ * bytes. See cache_record_matches(). */
+#define CACHE_MATCH_FREE_ADN	0x100
+
+int cache_get_record_map(const struct scsisim_dev *device,
+			 uint16_t file,
+			 unsigned int match,
+			 uint8_t *bitmap);
+
+void cache_store_record_map(const struct scsisim_dev *device,
+			    unsigned int match,
+			    uint8_t num_records,
+			    const uint8_t *bitmap);
+
+void cache_record_written(const struct scsisim_dev *device,
+			  uint8_t recno,
+			  const uint8_t *data,
+			  unsigned int len);
+
+bool cache_record_matches(unsigned int match, const uint8_t *data, unsigned int len);
+
+#endif  /* __SCSISIM_CACHE_H__ */
+
+/* EOF */
+
@@ -450,9 +450,10 @@ static const uint8_t celly_buf_2[4096] = {
  * Device initialization data - write buffer 3 */
 static const uint8_t celly_buf_3[4] = { 0x00, 0x20, 0x04, 0x2a };
 
-/* Device initialization data - read buffer 
- * (Generic - can be used by any device) */
-static uint8_t init_read_buf[4096] = { 0x00 };
+/* Longest read of any initialization command: scsisim_init_device() reads
+ * into a buffer of its own this long, so devices can be initialized from
+ * different threads at once */
+#define DEVICE_INIT_READ_LEN	4096
 
 /* Structure to hold everything necessary to send an initialization command
  * to the device */
@@ -467,8 +468,8 @@ struct device_init_cmd {
 	/* Length of data buffer */
 	unsigned int data_len;
 
-	/* Pointer to data buffer. The data can be output (for a write command)
-	 * or input (for a read command). */
+	/* Pointer to data buffer for a write command. A read command has 
+	 * NULL, and reads (and discards) up to DEVICE_INIT_READ_LEN bytes. */
 	uint8_t *data;
 };
 
@@ -527,6 +528,11 @@ struct device {
 	uint8_t CDB_verify_chv[MAX_CDB_LEN];
 	uint8_t verify_chv_chvnum_offset;
 
+	/* CDB and relevant offsets for the GSM SEEK command */
+	uint8_t CDB_seek[MAX_CDB_LEN];
+	uint8_t seek_type_mode_offset;
+	uint8_t seek_len_offset;
+
 	/* CDB and relevant offsets for raw, arbitrary GSM command */
 	uint8_t CDB_raw_cmd[MAX_CDB_LEN];
 	uint8_t raw_cmd_direction_offset;
@@ -655,6 +661,20 @@ static const struct device sim_devices[1] = {
 			GSM_CMD_VERIFY_CHV_DATA_LEN
 		},
 		.verify_chv_chvnum_offset = 8,
+		.CDB_seek = {
+			SCSI_CMD_WRITE_10,
+			CELLY_LBA_1,
+			CELLY_LBA_2,
+			CELLY_LBA_3,
+			CELLY_LBA_4,
+			GSM_CLASS,
+			GSM_CMD_SEEK,
+			0x00,
+			0x00,
+			0x00
+		},
+		.seek_type_mode_offset = 8,
+		.seek_len_offset = 9,
 		.CDB_raw_cmd = {
 			0x00,
 			CELLY_LBA_1,
@@ -680,25 +700,25 @@ static const struct device sim_devices[1] = {
 				SIM_READ,
 				{ SCSI_CMD_READ_10, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x01, 0x00 },
 				512,
-				init_read_buf
+				NULL
 			},
 			{
 				SIM_READ,
 				{ SCSI_CMD_READ_10, 0x00, 0x00, 0x00, 0x00, 0x40, 0x00, 0x00, 0x04, 0x00 },
 				2048,
-				init_read_buf
+				NULL
 			},
 			{
 				SIM_READ,
 				{ SCSI_CMD_READ_10, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x08, 0x00 },
 				4096,
-				init_read_buf
+				NULL
 			},
 			{
 				SIM_READ,
 				{ SCSI_CMD_READ_10, 0x00, 0x30, 0x00, 0x00, 0x00, 0x00, 0x00, 0x01, 0x00 },
 				512,
-				init_read_buf
+				NULL
 			},
 			{
 				SIM_WRITE,
@@ -716,7 +736,7 @@ static const struct device sim_devices[1] = {
 				SIM_READ,
 				{ SCSI_CMD_READ_10, 0x00, 0xd1, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x20 },
 				512,
-				init_read_buf
+				NULL
 			},
 			{
 				SIM_WRITE,
@@ -728,7 +748,7 @@ static const struct device sim_devices[1] = {
 				SIM_READ,
 				{ SCSI_CMD_READ_10, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x01, 0x00 },
 				512,
-				init_read_buf
+				NULL
 			},
 			{ SIM_NO_XFER }
 		}
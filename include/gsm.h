@@ -38,6 +38,11 @@
 #define GSM_CMD_UPDATE_BINARY		0xd6
 #define GSM_CMD_UPDATE_RECORD		0xdc
 #define GSM_CMD_VERIFY_CHV		0x20
+#define GSM_CMD_STATUS			0xf2
+#define GSM_CMD_SEEK			0xa2
+
+/* The first byte of a file ID tells MFs and DFs from EFs: see GSM spec, 6.2 */
+#define GSM_FILE_IS_DF(id)		(((id) >> 8) == 0x3f || ((id) >> 8) == 0x7f || ((id) >> 8) == 0x5f)
 
 /* Other GSM-related constants */
 #define GSM_CMD_SELECT_DATA_LEN		0x02	/* Two bytes of data for a
@@ -46,8 +51,26 @@
 						   VERIFY CHV command */
 
 #define GSM_ESCAPE_CHAR			0x1b	/* Escape character in GSM charset */
+#define GSM_EXTENSION_FLAG		0x80	/* When encoding: character is in the
+						   extension table */
+#define GSM_NOT_ENCODABLE		0xff	/* When encoding: character is not in
+						   the GSM alphabet */
+
+#define GSM_IEI_CONCAT_8BIT_REF		0x00	/* Concatenated SMS, 8-bit reference */
+#define GSM_IEI_CONCAT_16BIT_REF	0x08	/* Concatenated SMS, 16-bit reference */
 
 #define GSM_SMS_RECORD_LEN		176	/* Length of SMS record, in bytes */
+#define GSM_SMS_MAX_UD_LEN		140	/* Bytes of user data in an SMS */
+#define GSM_SMS_MAX_SEPTETS		160	/* Septets in a single SMS */
+#define GSM_SMS_CONCAT_UDH_LEN		7	/* Longest concatenated SMS User Data
+						   Header, with 16-bit reference */
+#define GSM_SMS_CONCAT_8BIT_UDH_LEN	6	/* Concatenated SMS User Data Header 
+						   with 8-bit reference */
+#define GSM_SMS_CONCAT_SEPTETS(udh_len)	(GSM_SMS_MAX_SEPTETS - ((udh_len) * 8 + (7 - 1)) / 7)
+						/* Septets in each part of a concatenated
+						   SMS, after a User Data Header of udh_len
+						   bytes: 153 with 8-bit reference, 152 
+						   with 16-bit */
 #define GSM_MAX_SMSC_LEN		10	/* Maximum SM Service Center length (TON/NPI
 						   disregarded); see GSM 04.11, section 8.2.5.1 */
 #define GSM_MIN_ADDRESS_LEN		2	/* Minimum length of TP-DA, TP-OA, or TP-RA */
@@ -63,8 +86,17 @@
 						   after selecting an MF or DF */
 
 
-extern const char *GSM_basic_charset[];
-extern const char *GSM_basic_charset_extension[];
+/* A GSM character as a UTF-8 sequence of up to 3 bytes (not 
+ * null-terminated) and its length */
+struct gsm_utf8 {
+	uint8_t len;
+	char seq[3];
+};
+
+#define GSM_UTF8(str)			{ sizeof(str) - 1, str }
+
+extern const struct gsm_utf8 GSM_basic_charset[];
+extern const struct gsm_utf8 GSM_basic_charset_extension[];
 extern const char *GSM_sms_status[];
 extern const char *GSM_file_type[];
 extern const char *GSM_ef_structure[];
@@ -39,10 +39,18 @@ struct scsi_cmd {
 	/* Output values */
 	unsigned int data_xfered;
 	uint8_t sense_xfered;
+	/* Asynchronous interface only: identifies the command */
+	int pack_id;
 };
 
 int scsi_send_cdb(const struct scsisim_dev *device, struct scsi_cmd *my_cmd);
 
+int scsi_submit_cdb(const struct scsisim_dev *device, struct scsi_cmd *my_cmd);
+
+int scsi_reap_cdb(const struct scsisim_dev *device,
+		  struct scsi_cmd **my_cmd,
+		  int timeout);
+
 #endif  /* __SCSISIM_SCSI_H__ */
 
 /* EOF */
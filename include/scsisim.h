@@ -69,6 +69,26 @@
 #define SCSISIM_GSM_SECURITY_ERROR		-39
 #define SCSISIM_GSM_INVALID_ADN_RECORD		-40
 
+/* API return values -- asynchronous interface */
+#define SCSISIM_SCSI_RECEIVE_ERROR		-41
+#define SCSISIM_TIMEOUT				-42
+#define SCSISIM_QUEUE_FULL			-43
+#define SCSISIM_NO_COMMANDS_PENDING		-44
+#define SCSISIM_REACTOR_ERROR			-45
+
+/* API return values -- whole-file operations */
+#define SCSISIM_BUFFER_TOO_SMALL		-46
+#define SCSISIM_PATH_UNKNOWN			-47
+
+/* API return values -- text encoding */
+#define SCSISIM_GSM_INVALID_CHAR		-48
+
+/* API return values -- writing records */
+#define SCSISIM_NO_FREE_RECORDS			-49
+
+/* API return values -- hotplug monitor */
+#define SCSISIM_MONITOR_ERROR			-50
+
 /* Master file and 'root' file IDs: use these
  * in scsisim_select_file() calls */
 #define GSM_FILE_MF			0x3f00
@@ -130,11 +150,119 @@
 #define GSM_FILE_EF_ECC			0x6fb7
 
 
+/* Transport backend used by a device (internal; see transport.h) */
+struct scsisim_transport;
+
+/* Opaque handle for an in-memory virtual SIM card: see scsisim_vcard_*() */
+struct scsisim_vcard;
+
+/* Commands in flight for a device (internal; see async.c) */
+struct scsisim_async;
+
+/* What is known about the card in a device (internal; see cache.c) */
+struct scsisim_cache;
+
+/* Opaque handle for an event loop driving many devices: see scsisim_reactor_*() */
+struct scsisim_reactor;
+
+/* Opaque handle for reassembling concatenated SMS: see scsisim_concat_*() */
+struct scsisim_concat;
+
+/* Opaque handle for a reader hotplug monitor: see scsisim_monitor_*() */
+struct scsisim_monitor;
+
+/* Opaque handle for a library context (logging settings): see 
+ * scsisim_ctx_*() */
+struct scsisim_ctx;
+
+/* Levels of the messages passed to a context's log handler */
+enum {
+	SCSISIM_LOG_INFO = 0,		/* scsisim_pinfo() */
+	SCSISIM_LOG_ERROR = 1		/* scsisim_perror() */
+};
+
+/* Maximum number of asynchronous commands in flight per device */
+#define SCSISIM_MAX_PENDING	16
+
+/* Deepest file on a GSM card: MF / DF / DF / EF */
+#define SCSISIM_MAX_PATH_DEPTH	4
+
+/* Longest path string, e.g., "3F00/7F10/5F3A/4F30", including the NUL */
+#define SCSISIM_MAX_PATH_LEN	(SCSISIM_MAX_PATH_DEPTH * 5)
+
+/* Largest READ BINARY / UPDATE BINARY transfer: P3 is a single byte */
+#define SCSISIM_MAX_CHUNK	255
+
+/* Size of a record bitmap: one bit for each of up to 255 records */
+#define SCSISIM_RECORD_BITMAP_LEN	32
+
+/* Check a record (starting at 1) in a record bitmap */
+#define SCSISIM_RECORD_IS_SET(bitmap, recno) \
+	(((bitmap)[((recno) - 1) / 8] >> (((recno) - 1) % 8)) & 1)
+
 /* Struct to hold SCSI generic device */
 struct scsisim_dev {
 	int fd;			/* File descriptor */
 	unsigned int index;	/* Index into sim_devices[] in device.h */
 	char *name;		/* Name, such as "sg3" */
+	const struct scsisim_transport *transport;	/* Backend that carries commands */
+	void *transport_data;	/* Backend-specific state */
+	struct scsisim_async *async;	/* Commands in flight, or NULL */
+	struct scsisim_cache *cache;	/* File metadata cache */
+	int init_state;		/* SCSISIM_INIT_*: how the reader was initialized */
+};
+
+/* How a reader was initialized: see scsisim_init_device_fast() */
+enum {
+	SCSISIM_INIT_NONE = 0,		/* Not yet, or initialization failed */
+	SCSISIM_INIT_FULL,		/* Full initialization sequence sent */
+	SCSISIM_INIT_PROBED		/* Found already initialized: nothing sent */
+};
+
+/* Lengths of the strings in a scsisim_device_info struct, including the NUL */
+#define SCSISIM_DEVICE_NAME_LEN		16
+#define SCSISIM_USB_PATH_LEN		32
+#define SCSISIM_USB_SERIAL_LEN		64
+
+/* Struct to hold a supported reader found by scsisim_enumerate_devices() */
+struct scsisim_device_info {
+	char name[SCSISIM_DEVICE_NAME_LEN];	/* Name for scsisim_open_device(),
+						   such as "sg3" */
+	char usb_path[SCSISIM_USB_PATH_LEN];	/* USB bus path (bus and port 
+						   chain), such as "1-3.2" */
+	char serial[SCSISIM_USB_SERIAL_LEN];	/* USB serial number, "" if none */
+	unsigned int vendor;		/* USB vendor number */
+	unsigned int product;		/* USB product number */
+	unsigned int index;		/* Index into sim_devices[] in device.h */
+};
+
+/* What happened to a reader: see scsisim_monitor_create() */
+enum {
+	SCSISIM_MONITOR_ADD = 1,	/* Plugged in, ready to open */
+	SCSISIM_MONITOR_REMOVE		/* Unplugged */
+};
+
+/* Struct to hold a hotplug event passed to a monitor's callback */
+struct scsisim_monitor_event {
+	int action;			/* SCSISIM_MONITOR_ADD or _REMOVE */
+	struct scsisim_device_info info;	/* The reader; on removal, as it
+						   was when it was added */
+};
+
+/* Struct to hold a completed asynchronous command: see scsisim_reap() */
+struct scsisim_request {
+	void *user_data;	/* As passed to scsisim_submit_*() */
+	int status;		/* What the synchronous function would return */
+	unsigned int data_xfered;	/* Bytes transferred to/from the data buffer */
+};
+
+/* Struct to hold a per-command completion callback for devices driven by
+ * a reactor: pass a pointer to one of these as the user_data of each
+ * scsisim_submit_*() call. Embed it at the start of your own per-command 
+ * struct to carry more context along. */
+struct scsisim_completion {
+	void (*callback)(struct scsisim_dev *device,
+			 const struct scsisim_request *req);
 };
 
 /* Struct to hold fields for master file and directory files:
@@ -168,6 +296,12 @@ struct GSM_EF {
 	uint8_t record_len;
 };
 
+/* Struct to hold fields for a SEEK command of type 2:
+ * See GSM spec, 9.2.7 SEEK command */
+struct GSM_seek {
+	uint8_t record_number;
+};
+
 /* Struct to hold everything from a GSM GET RESPONSE
  * command */
 struct GSM_response {
@@ -175,20 +309,182 @@ struct GSM_response {
 	union {
 		struct GSM_MF_DF mf_df;
 		struct GSM_EF ef;
+		struct GSM_seek seek;
 	} type;
 };
 
 
+/* Lengths of the strings in a decoded SMS, including the NUL: 10 bytes of
+ * BCD for the SMSC, and 12 bytes of BCD or 7-bit text for an address */
+#define SCSISIM_SMS_SMSC_LEN		21
+#define SCSISIM_SMS_ADDRESS_LEN		40
+
+/* Longest UTF-8 text of a decoded SMS, including the NUL: every septet of
+ * a 176-byte record, at up to 3 bytes each */
+#define SCSISIM_SMS_MAX_TEXT_LEN	(176 * 8 / 7 * 3 + 1)
+
+/* Struct to hold the time stamp of an SMS: see GSM 03.40, 9.2.3.11 */
+struct scsisim_sms_time {
+	uint16_t year;
+	uint8_t month;
+	uint8_t day;
+	uint8_t hour;
+	uint8_t minute;
+	uint8_t second;
+	int8_t timezone;		/* Quarters of an hour from GMT */
+};
+
+/* Struct to hold a decoded SMS record: see GSM spec, 10.5.3 for the 
+ * record and GSM 03.40, section 9.2 for the TPDU fields */
+struct scsisim_sms {
+	uint8_t status;			/* Record status: SIM_SMS_FREE, etc. */
+	uint8_t mti;			/* TP-MTI: SIM_SMS_MTI_* */
+	uint8_t smsc_ton_npi;
+	char smsc[SCSISIM_SMS_SMSC_LEN];
+	uint8_t address_ton_npi;
+	char address[SCSISIM_SMS_ADDRESS_LEN];	/* Sender (DELIVER) or
+						   recipient (SUBMIT), UTF-8 */
+	uint8_t message_ref;		/* TP-MR: all but DELIVER */
+	uint8_t pid;			/* TP-PID */
+	uint8_t dcs;			/* TP-DCS */
+	uint8_t charset;		/* From TP-DCS: SIM_SMS_CHARSET_* */
+	bool udhi;			/* TP-UDHI: user data starts with a header */
+	uint16_t concat_ref;		/* Concatenated SMS: reference number */
+	uint8_t concat_total;		/* Concatenated SMS: number of parts,
+					   0 if not concatenated */
+	uint8_t concat_seq;		/* Concatenated SMS: part number, from 1 */
+	bool has_timestamp;		/* DELIVER and STATUS-REPORT only */
+	struct scsisim_sms_time timestamp;	/* TP-SCTS */
+	struct scsisim_sms_time discharge_time;	/* TP-DT: STATUS-REPORT only */
+	uint8_t report_status;		/* TP-ST: STATUS-REPORT only */
+	uint8_t command_type;		/* TP-CT: COMMAND only */
+	uint8_t message_number;		/* TP-MN: COMMAND only */
+	uint8_t udl;			/* TP-UDL: septets or octets of user 
+					   data (TP-CDL for COMMAND) */
+	unsigned int text_len;		/* Bytes of UTF-8 text, without the NUL */
+};
+
+/* Struct to hold a whole (reassembled) SMS: see scsisim_concat_create() */
+struct scsisim_concat_sms {
+	struct scsisim_sms sms;		/* The first part received; text_len
+					   is that of the whole text */
+	uint8_t total;			/* Number of parts, 1 if not 
+					   concatenated */
+	uint8_t received;		/* Parts received: less than total 
+					   only if some never arrived */
+	const char *text;		/* Whole text in part order, UTF-8, 
+					   valid during the callback only */
+	unsigned int text_len;		/* Bytes of text, without the NUL */
+};
+
+/* SMS record status constants: see GSM spec, 10.5.3 */
+enum {
+	SIM_SMS_FREE = 0x00,
+	SIM_SMS_READ = 0x01,
+	SIM_SMS_UNREAD = 0x03,
+	SIM_SMS_SENT = 0x05,
+	SIM_SMS_UNSENT = 0x07
+};
+
+/* SMS message type (TP-MTI) constants: see GSM 03.40, 9.2.3.1 */
+enum {
+	SIM_SMS_MTI_DELIVER = 0,
+	SIM_SMS_MTI_SUBMIT = 1,
+	SIM_SMS_MTI_STATUS_REPORT = 2,	/* In a received record */
+	SIM_SMS_MTI_COMMAND = 2		/* In a sent record */
+};
+
+/* SMS character set constants: see 3GPP TS 23.038, section 4 */
+enum {
+	SIM_SMS_CHARSET_GSM = 0,	/* GSM 7-bit default alphabet */
+	SIM_SMS_CHARSET_8BIT = 1,
+	SIM_SMS_CHARSET_UCS2 = 2
+};
+
+/* Length of the number of a decoded ADN record, including the NUL: 10
+ * bytes of BCD */
+#define SCSISIM_ADN_NUMBER_LEN		21
+
+/* Longest UTF-8 alpha identifier of a decoded ADN record, including the 
+ * NUL: every byte of a 255-byte record but the 14 for the number, at up
+ * to 3 bytes each */
+#define SCSISIM_ADN_MAX_ALPHA_LEN	((255 - 14) * 3 + 1)
+
+/* Digits of a dialling number that fit in an ADN record, and in each 
+ * extension record (e.g., of EF-EXT1) chained from it */
+#define SCSISIM_ADN_MAX_DIGITS		20
+
+/* Length of an extension record: see GSM spec, 10.5.10 */
+#define SCSISIM_EXT_RECORD_LEN		13
+
+/* Struct to hold a decoded record of EF-ADN, or of any other EF with the
+ * same layout (EF-FDN, EF-SDN, EF-LND, EF-MSISDN and EF-BDN): see GSM 
+ * spec, 10.5.1 */
+struct scsisim_adn {
+	bool used;			/* false for an empty record */
+	uint8_t ton_npi;		/* Type of number / numbering plan */
+	char number[SCSISIM_ADN_NUMBER_LEN];	/* Dialling number, with the
+						   telecom digits *, # etc. */
+	uint8_t ccp;			/* EF-CCP record, 0xff if none */
+	uint8_t ext;			/* Extension (e.g., EF-EXT1) record, 
+					   0xff if none */
+	uint8_t comparison;		/* EF-BDN only: comparison method 
+					   pointer, 0xff if none */
+	unsigned int alpha_len;		/* Bytes of UTF-8 alpha identifier,
+					   without the NUL */
+};
+
+/* Struct to hold a contact to write with scsisim_import_adn() */
+struct scsisim_contact {
+	const char *name;		/* UTF-8 alpha identifier, NULL or "" 
+					   for none */
+	const char *number;		/* Dialling number, with the telecom
+					   digits *, # and , (pause), and an 
+					   optional leading '+'; NULL or "" 
+					   for none */
+	uint8_t ton_npi;		/* Type of number / numbering plan, 
+					   or 0 to pick from the number */
+};
+
 /* GET RESPONSE command constants */
 enum {
 	SIM_SELECT_EF = 1,
 	SIM_SELECT_MF_DF,
 	SIM_RUN_GSM_ALGORITHM,	/* $TODO */
-	SIM_SEEK,			/* $TODO */
+	SIM_SEEK,
 	SIM_INCREASE,		/* $TODO */
 	SIM_ENVELOPE		/* $TODO */
 };
 
+/* SEEK type and mode constants: see GSM spec, 9.2.7 */
+enum {
+	SIM_SEEK_TYPE_1 = 0x00,		/* Only set the record pointer */
+	SIM_SEEK_TYPE_2 = 0x10		/* Also return the record number */
+};
+
+enum {
+	SIM_SEEK_FROM_START = 0x0,	/* From the first record, forward */
+	SIM_SEEK_FROM_END = 0x1,	/* From the last record, backward */
+	SIM_SEEK_NEXT = 0x2,		/* From the record after the pointer, forward */
+	SIM_SEEK_PREVIOUS = 0x3		/* From the record before the pointer, backward */
+};
+
+/* EF structure constants: see GSM spec, 9.3 */
+enum {
+	SIM_EF_TRANSPARENT = 0,
+	SIM_EF_LINEAR_FIXED = 1,
+	SIM_EF_CYCLIC = 3
+};
+
+/* Access condition constants: see GSM spec, 9.3 */
+enum {
+	SIM_AC_ALWAYS = 0x0,
+	SIM_AC_CHV1 = 0x1,
+	SIM_AC_CHV2 = 0x2,
+	SIM_AC_ADM = 0x4,
+	SIM_AC_NEVER = 0xf
+};
+
 /* SCSI direction constants */
 enum {
 	SIM_NO_XFER = 0,
@@ -197,6 +493,56 @@ enum {
 };
 
 
+/**
+ * Function: scsisim_enumerate_devices
+ *
+ * Parameters:
+ * devices:	(Output, can be NULL if max is 0) Array for the readers found.
+ * max:		Number of entries in devices.
+ *
+ * Description: 
+ * Find every supported SIM card reader on the host, without opening or
+ * initializing anything: one pass over /sys/class/scsi_generic (under 
+ * the sysfs root of the calling thread's context; see 
+ * scsisim_ctx_set_sysfs_root()), matching each sg device's USB vendor 
+ * and product against the supported devices in device.h. Each entry 
+ * gets the sg name, USB bus path, serial number and device index. The 
+ * USB lookups are cached, so rescanning a host whose readers haven't 
+ * changed costs a directory read and one fstatat() per sg device. The 
+ * entries are sorted by name; if there are more than max readers, which 
+ * ones are returned is unspecified.
+ *
+ * Return values: 
+ * Number of supported readers found (which may be more than max), or 
+ * one of the following on failure:
+ * SCSISIM_INVALID_PARAM
+ * SCSISIM_SYSFS_CHDIR_FAILED
+ */
+int scsisim_enumerate_devices(struct scsisim_device_info *devices, unsigned int max);
+
+
+/**
+ * Function: scsisim_identify_device
+ *
+ * Parameters:
+ * dev_name:	Name of the sg device, such as "sg3".
+ * info:	(Output) What is known about the reader.
+ *
+ * Description: 
+ * Look up a single sg device in sysfs the way scsisim_enumerate_devices()
+ * does, without opening it, and check that it is a supported reader.
+ *
+ * Return values: 
+ * SCSISIM_SUCCESS
+ * SCSISIM_INVALID_PARAM
+ * SCSISIM_DEVICE_NOT_SUPPORTED
+ * SCSISIM_SYSFS_CHDIR_FAILED
+ * SCSISIM_USB_VENDOR_OPEN_FAILED
+ * SCSISIM_USB_PRODUCT_OPEN_FAILED
+ */
+int scsisim_identify_device(const char *dev_name, struct scsisim_device_info *info);
+
+
 /**
  * Function: scsisim_open_device
  *
@@ -221,6 +567,32 @@ enum {
 int scsisim_open_device(const char *dev_name, struct scsisim_dev *device);
 
 
+/**
+ * Function: scsisim_open_virtual_device
+ *
+ * Parameters:
+ * card:	Pointer to a virtual SIM card created by scsisim_vcard_create().
+ * device:	Pointer to scsisim_dev struct.
+ *
+ * Description: 
+ * Attach the given virtual SIM card to an scsisim_dev struct, as if it were
+ * inserted in a supported reader. All other scsisim_* functions then work on
+ * the virtual card exactly as they do on a real device, which makes it
+ * possible to test and profile applications without any hardware.
+ *
+ * The card remains owned by the caller: close the device with 
+ * scsisim_close_device() before destroying the card. A card must not be 
+ * attached to more than one open device at a time.
+ *
+ * Return values: 
+ * SCSISIM_SUCCESS
+ * SCSISIM_INVALID_PARAM
+ * SCSISIM_MEMORY_ALLOCATION_ERROR
+ */
+int scsisim_open_virtual_device(struct scsisim_vcard *card,
+				struct scsisim_dev *device);
+
+
 /**
  * Function: scsisim_close_device
  *
@@ -249,7 +621,8 @@ int scsisim_close_device(struct scsisim_dev *device);
  * Description: 
  * Given a pointer to an scsisim_dev struct, this function makes sure the 
  * attached USB device is supported, and if so, sends SCSI 
- * initialization commands to the device.
+ * initialization commands to the device. On success, device->init_state
+ * is SCSISIM_INIT_FULL.
  *
  * Return values: 
  * SCSISIM_SUCCESS
@@ -261,6 +634,29 @@ int scsisim_close_device(struct scsisim_dev *device);
 int scsisim_init_device(struct scsisim_dev *device);
 
 
+/**
+ * Function: scsisim_init_device_fast
+ *
+ * Parameters:
+ * device:	Pointer to scsisim_dev struct.
+ *
+ * Description: 
+ * Like scsisim_init_device(), but first probe whether the reader is 
+ * initialized already (it stays initialized until it is unplugged, e.g.,
+ * by an earlier process), by sending a GSM STATUS command and checking 
+ * that the card answers with MF or DF data. If it does, the 
+ * initialization sequence is skipped, and the device is ready after a 
+ * single round trip; otherwise the full sequence is sent as usual. 
+ * device->init_state records which happened. Use scsisim_init_device() 
+ * instead when the reader must be reset, e.g., after a card swap.
+ *
+ * Return values: 
+ * SCSISIM_SUCCESS
+ * Return value from scsisim_init_device
+ */
+int scsisim_init_device_fast(struct scsisim_dev *device);
+
+
 /**
  * Function: scsisim_select_file
  *
@@ -271,7 +667,9 @@ int scsisim_init_device(struct scsisim_dev *device);
  *		defined above).
  *
  * Description: 
- * Run the GSM SELECT command on the given file ID.
+ * Run the GSM SELECT command on the given file ID. If the file is 
+ * already selected and its response data is cached, nothing is sent to
+ * the card; see scsisim_cache_invalidate().
  * See GSM TS 100 977, sections 8.1 and 9.2.1
  *
  * Return values: 
@@ -284,6 +682,52 @@ int scsisim_init_device(struct scsisim_dev *device);
 int scsisim_select_file(const struct scsisim_dev *device, uint16_t file);
 
 
+/**
+ * Function: scsisim_select_path
+ *
+ * Parameters:
+ * device:	Pointer to scsisim_dev struct.
+ * path:	Path of file to select from the MF, e.g., "3F00/7F10/6F3A"
+ *		for EF-ADN. File IDs are four hex digits, separated by '/'.
+ *
+ * Description: 
+ * Select a file by its full path, using the fewest SELECT commands the
+ * GSM file selection rules allow from the current directory: e.g., going
+ * from DF-GSM to DF-TELECOM/EF-ADN takes two SELECTs, not three. The 
+ * current directory is tracked per device (see scsisim_cache_invalidate); 
+ * if it is unknown, the MF is selected first.
+ * See GSM TS 100 977, section 6.5
+ *
+ * Return values: 
+ * SCSISIM_INVALID_PARAM
+ * Return value from scsisim_select_file for the last file in the path
+ */
+int scsisim_select_path(const struct scsisim_dev *device, const char *path);
+
+
+/**
+ * Function: scsisim_get_current_path
+ *
+ * Parameters:
+ * device:	Pointer to scsisim_dev struct.
+ * path:	(Output) Buffer for the path of the current file.
+ * len:		Length of path buffer (SCSISIM_MAX_PATH_LEN is enough).
+ *
+ * Description: 
+ * Get the path of the currently selected file in the same format that 
+ * scsisim_select_path() takes, as far as the library knows.
+ *
+ * Return values: 
+ * SCSISIM_SUCCESS
+ * SCSISIM_INVALID_PARAM
+ * SCSISIM_BUFFER_TOO_SMALL
+ * SCSISIM_PATH_UNKNOWN
+ */
+int scsisim_get_current_path(const struct scsisim_dev *device,
+			     char *path,
+			     unsigned int len);
+
+
 /**
  * Function: scsisim_get_response
  *
@@ -295,7 +739,9 @@ int scsisim_select_file(const struct scsisim_dev *device, uint16_t file);
  * resp:	Pointer to GSM_response struct.
  *
  * Description: 
- * Run the GSM GET RESPONSE command.
+ * Run the GSM GET RESPONSE command. If the response data of the file 
+ * selected last is cached, nothing is sent to the card; see 
+ * scsisim_cache_invalidate().
  * See GSM TS 100 977, section 9.2.18
  *
  * Return values: 
@@ -311,6 +757,28 @@ int scsisim_get_response(const struct scsisim_dev *device,
 			 struct GSM_response *resp);
 
 
+/**
+ * Function: scsisim_cache_invalidate
+ *
+ * Parameters:
+ * device:	Pointer to scsisim_dev struct.
+ *
+ * Description: 
+ * Each device keeps a cache of which file is currently selected on the 
+ * card, and of the GET RESPONSE data of files selected before. This lets
+ * scsisim_select_file() skip a SELECT of the file that is already 
+ * current, and scsisim_get_response() skip the GET RESPONSE of a file it
+ * has seen before. The cache is flushed by scsisim_init_device(), by
+ * scsisim_send_raw_command(), and whenever the reader reports an error 
+ * that may mean the card was swapped. Call this function if you know 
+ * the card has changed behind the library's back.
+ *
+ * Return value: 
+ * None
+ */
+void scsisim_cache_invalidate(const struct scsisim_dev *device);
+
+
 /**
  * Function: scsisim_select_file_and_get_response
  *
@@ -443,6 +911,43 @@ int scsisim_update_binary(const struct scsisim_dev *device,
 			  uint8_t len);
 
 
+/**
+ * Function: scsisim_seek
+ *
+ * Parameters:
+ * device:	Pointer to scsisim_dev struct.
+ * type:	SIM_SEEK_TYPE_1 or SIM_SEEK_TYPE_2.
+ * mode:	SIM_SEEK_FROM_START, SIM_SEEK_FROM_END, SIM_SEEK_NEXT,
+ *		or SIM_SEEK_PREVIOUS.
+ * pattern:	Pattern to look for at the start of each record.
+ * len:		Length of pattern (at most the record length).
+ *
+ * Description: 
+ * Run the GSM SEEK command on the currently selected linear fixed or
+ * cyclic EF. The card compares the pattern with the first len bytes of
+ * each record in the direction given by mode, and moves the record 
+ * pointer to the first record that matches, so that a following 
+ * scsisim_read_record() or scsisim_update_record() in next/previous mode
+ * continues from there. For SIM_SEEK_TYPE_2, the matching record number
+ * is fetched with GET RESPONSE and returned.
+ * See GSM TS 100 977, sections 8.7 and 9.2.7
+ *
+ * Return values: 
+ * SCSISIM_SUCCESS (SIM_SEEK_TYPE_1: a record matched)
+ * Number of the matching record (SIM_SEEK_TYPE_2, records start at 1)
+ * SCSISIM_GSM_FILE_NOT_FOUND (no record matched)
+ * SCSISIM_INVALID_PARAM
+ * SCSISIM_INVALID_GSM_RESPONSE
+ * Return value from scsi_send_cdb
+ * Return value from sim_process_scsi_sense
+ */
+int scsisim_seek(const struct scsisim_dev *device,
+		 uint8_t type,
+		 uint8_t mode,
+		 const uint8_t *pattern,
+		 uint8_t len);
+
+
 /**
  * Function: scsisim_verify_chv
  *
@@ -506,126 +1011,1526 @@ int scsisim_send_raw_command(const struct scsisim_dev *device,
 
 
 /**
- * Function: scsisim_parse_sms
+ * Function: scsisim_read_file
  *
  * Parameters:
- * record:		Pointer to raw SMS record.
- * record_len:		Length of SMS record.
+ * device:	Pointer to scsisim_dev struct.
+ * file:	EF to read.
+ * data:	Buffer for file contents.
+ * len:		Length of data buffer.
+ * resp:	(Output) GET RESPONSE data of the EF.
+ * status:	(Output, can be NULL) Status of each read: one entry per 
+ *		record for linear fixed and cyclic files, or one entry per 
+ *		SCSISIM_MAX_CHUNK bytes for transparent files.
+ * num_status:	Number of entries in status array.
  *
  * Description: 
- * Given a pointer to an SMS record, parse out and print the 
- * following information:
- *	SMS status (unused space, message read, etc.)
- *	SMS Center number
- *	Sender / recipient number
- *	Message timestamp
- *	Message text
+ * Select an EF and read all of it into one contiguous buffer: a 
+ * transparent file is read in chunks of SCSISIM_MAX_CHUNK bytes, and a 
+ * record-based file is read record by record. Reads are pipelined using 
+ * the asynchronous interface, so the device must not have any commands 
+ * of its own in flight. The size of the file is taken from resp, which 
+ * is filled in even if the buffer is too small; so you can pass a NULL 
+ * data buffer first to find out how much to allocate.
  *
  * Return values: 
  * SCSISIM_SUCCESS
  * SCSISIM_INVALID_PARAM
- * SCSISIM_SMS_INVALID_STATUS
- * SCSISIM_SMS_INVALID_SMSC
- * SCSISIM_MEMORY_ALLOCATION_ERROR
- * SCSISIM_SMS_INVALID_ADDRESS
+ * SCSISIM_BUFFER_TOO_SMALL
+ * SCSISIM_GSM_FILE_INCONSISTENT_WITH_COMMAND (not an EF)
+ * Return value from scsisim_select_file_and_get_response
+ * Return value from scsisim_submit_* / scsisim_reap
+ * First error in the status array
  */
-int scsisim_parse_sms(const uint8_t *record, uint8_t record_len);
+int scsisim_read_file(struct scsisim_dev *device,
+		      uint16_t file,
+		      uint8_t *data,
+		      unsigned int len,
+		      struct GSM_response *resp,
+		      int *status,
+		      unsigned int num_status);
 
 
 /**
- * Function: scsisim_parse_adn
+ * Function: scsisim_read_records_range
  *
  * Parameters:
- * record:		Pointer to raw ADN record.
- * record_len:		Length of ADN record.
+ * device:	Pointer to scsisim_dev struct.
+ * file:	Linear fixed or cyclic EF to read.
+ * first:	First record to read (records start at 1, NOT zero!).
+ * count:	Number of records to read, or 0 for all remaining records.
+ * data:	Buffer for record data, filled with one record after another.
+ * len:		Length of data buffer.
+ * resp:	(Output) GET RESPONSE data of the EF.
+ * status:	(Output, can be NULL) Status of each record read.
+ * num_status:	Number of entries in status array.
  *
  * Description: 
- * Given a pointer to an ADN (abbreviated dialling number) record, 
- * parse out and print the number and name. "ADN" is just a fancy term 
- * for a contact.
+ * Like scsisim_read_file(), but read only a range of records.
  *
- * Return value: 
+ * Return values: 
  * SCSISIM_SUCCESS
- * SCSISIM_GSM_INVALID_ADN_RECORD
- * SCSISIM_MEMORY_ALLOCATION_ERROR
+ * SCSISIM_INVALID_PARAM
+ * SCSISIM_BUFFER_TOO_SMALL
+ * SCSISIM_GSM_INVALID_ADDRESS (range outside the file)
+ * SCSISIM_GSM_FILE_INCONSISTENT_WITH_COMMAND (not a record-based EF)
+ * Return value from scsisim_select_file_and_get_response
+ * Return value from scsisim_submit_* / scsisim_reap
+ * First error in the status array
  */
-int scsisim_parse_adn(const uint8_t *record, uint8_t record_len);
+int scsisim_read_records_range(struct scsisim_dev *device,
+			       uint16_t file,
+			       uint8_t first,
+			       uint8_t count,
+			       uint8_t *data,
+			       unsigned int len,
+			       struct GSM_response *resp,
+			       int *status,
+			       unsigned int num_status);
 
 
 /**
- * Function: scsisim_map_gsm_chars
+ * Function: scsisim_find_records
  *
  * Parameters:
- * src:			Pointer to unpacked buffer.
- * src_len:		Length of buffer.
+ * device:	Pointer to scsisim_dev struct.
+ * file:	File ID of a linear fixed or cyclic EF in the current DF,
+ *		e.g., GSM_FILE_EF_ADN or GSM_FILE_EF_SMS.
+ * lead:	Leading byte to look for, e.g., 0x00 for free SMS records
+ *		or 0x03 for unread SMS (the status byte of EF-SMS). Not 
+ *		for free ADN/FDN records: see scsisim_find_free_adn().
+ * bitmap:	(Output) Buffer for a bitmap of the matching records; test
+ *		it with SCSISIM_RECORD_IS_SET().
+ * len:		Length of bitmap buffer (SCSISIM_RECORD_BITMAP_LEN is 
+ *		always enough).
  *
  * Description: 
- * Given an unpacked source buffer of GSM character codes, map them to 
- * their corresponding characters. Handles basic and extended 
- * characters in the GSM 7-bit alphabet.
+ * Find the records of an EF that start with a given byte, without reading
+ * the whole file. The card is searched with SEEK, so this costs one SEEK 
+ * and one GET RESPONSE per matching record; if the card does not support
+ * SEEK, every record is read instead. The result is kept in the device's 
+ * metadata cache and kept up to date by scsisim_update_record() and 
+ * scsisim_submit_update_record(), so asking again costs no commands at 
+ * all. Like scsisim_read_file(), this uses the asynchronous interface 
+ * when it falls back to reading, so the device must not have any 
+ * commands pending.
  *
- * Return value: 
- * Pointer to null-terminated string. Caller's responsibility to free buffer when done.
+ * Return values: 
+ * Number of matching records (0 or more)
+ * SCSISIM_INVALID_PARAM
+ * SCSISIM_BUFFER_TOO_SMALL
+ * SCSISIM_MEMORY_ALLOCATION_ERROR
+ * SCSISIM_GSM_FILE_INCONSISTENT_WITH_COMMAND (not a record-based EF)
+ * Return value from scsisim_select_file_and_get_response
+ * Return value from scsisim_seek
+ * Return value from scsisim_read_records_range
  */
-char *scsisim_map_gsm_chars(const uint8_t *src, unsigned int src_len);
+int scsisim_find_records(struct scsisim_dev *device,
+			 uint16_t file,
+			 uint8_t lead,
+			 uint8_t *bitmap,
+			 unsigned int len);
 
 
 /**
- * Function: scsisim_get_gsm_text
+ * Function: scsisim_find_free_adn
  *
  * Parameters:
- * packed:		Pointer to buffer of packed septets.
- * packed_len:		Length of packed buffer.
- * num_septets:		Number of septets in packed buffer.
+ * device:	Pointer to scsisim_dev struct.
+ * file:	File ID of EF-ADN, EF-FDN or another EF with the same layout,
+ *		in the current DF.
+ * bitmap:	(Output) Buffer for a bitmap of the free records; test it
+ *		with SCSISIM_RECORD_IS_SET().
+ * len:		Length of bitmap buffer (SCSISIM_RECORD_BITMAP_LEN is 
+ *		always enough).
  *
  * Description: 
- * Given a binary array of packed septets, unpack the septets into octets (bytes),
- * and then map those values to their corresponding characters in the GSM alphabet.
+ * Find the free records of an ADN-style EF: those with neither a name 
+ * (the alpha identifier starts with 0xFF) nor a number (the length byte
+ * is 0xFF), as scsisim_decode_adn() sees them. A record that only holds 
+ * a number also starts with 0xFF, so SEEK only finds candidates here, 
+ * and each one is read back and checked; otherwise this works, and is 
+ * cached, like scsisim_find_records().
  *
- * Return value: 
- * Pointer to unpacked, null-terminated string. Caller's responsibility to free buffer when done.
+ * Return values: 
+ * Number of free records (0 or more)
+ * SCSISIM_GSM_FILE_INCONSISTENT_WITH_COMMAND (not a record-based EF, or
+ *	records too short)
+ * Return value from scsisim_read_record
+ * See scsisim_find_records()
  */
-char *scsisim_get_gsm_text(const uint8_t *packed,
-			   unsigned int packed_len,
-			   unsigned int num_septets);
+int scsisim_find_free_adn(struct scsisim_dev *device,
+			  uint16_t file,
+			  uint8_t *bitmap,
+			  unsigned int len);
 
 
 /**
- * Function: scsisim_packed_bcd_to_ascii
+ * Function: scsisim_write_free_records
  *
  * Parameters:
- * bcd:			Pointer to packed BCD buffer.
- * len:			Length of packed BCD buffer.
- * little_endian:	Whether the nibbles of each byte are little endian (true) or big endian (false).
- * strip_sign_flag:	Strip terminating sign flag (usually 0xf) from unpacked ASCII string.
- * use_telecom_digits:	Use telecom digits (*#, etc) in translation to ASCII chars.
+ * device:	Pointer to scsisim_dev struct.
+ * file:	File ID of a linear fixed EF in the current DF.
+ * lead:	Leading byte of a free record, e.g., 0x00 for SMS. For 
+ *		ADN/FDN, where that is not enough, use scsisim_import_adn().
+ * data:	Records to write, one after another.
+ * len:		Length of data buffer.
+ * count:	Number of records to write.
+ * recnos:	(Output, can be NULL) Record number each record went to.
+ * status:	(Output, can be NULL) Status of each record written.
  *
  * Description: 
- * Convert a packed BCD buffer to an ASCII string.
+ * Write records to the first free records of an EF in one batch. The 
+ * free records are found with scsisim_find_records() (so usually from 
+ * the metadata cache), and the records are written with up to 
+ * SCSISIM_MAX_PENDING UPDATE RECORD commands in flight, keeping the 
+ * reader busy instead of waiting a USB round trip for each. Nothing is 
+ * written unless there are count free records. The device must not 
+ * have any commands pending.
  *
- * Return value: 
- * Pointer to ASCII buffer. Caller's responsibility to free buffer when done.
+ * Return values: 
+ * SCSISIM_SUCCESS
+ * SCSISIM_INVALID_PARAM
+ * SCSISIM_BUFFER_TOO_SMALL
+ * SCSISIM_NO_FREE_RECORDS
+ * SCSISIM_GSM_FILE_INCONSISTENT_WITH_COMMAND (not a linear fixed EF)
+ * Return value from scsisim_find_records
+ * Return value from scsisim_submit_update_record / scsisim_reap
+ * First error in the status array
  */
-char *scsisim_packed_bcd_to_ascii(const uint8_t *bcd,
-				  const unsigned int len,
-				  bool little_endian,
-				  bool strip_sign_flag,
-				  bool use_telecom_digits);
+int scsisim_write_free_records(struct scsisim_dev *device,
+			       uint16_t file,
+			       uint8_t lead,
+			       uint8_t *data,
+			       unsigned int len,
+			       unsigned int count,
+			       uint8_t *recnos,
+			       int *status);
 
 
 /**
- * Function: scsisim_unpack_septets
+ * Function: scsisim_store_sms
  *
  * Parameters:
- * num_septets:		Number of septets in the packed buffer.
- * packed:		Pointer to buffer of packed septets.
- * packed_len:		Length of packed buffer in bytes.
- * unpacked:		(Output) Pointer to unpacked buffer of octets. 
- *			Caller's responsibility to free buffer when done.
- * unpacked_len:	(Output) Length of unpacked buffer.
+ * device:	Pointer to scsisim_dev struct.
+ * records:	SMS records to store, e.g., from scsisim_encode_sms().
+ * len:		Length of records buffer.
+ * count:	Number of records to store.
+ * recnos:	(Output, can be NULL) Record number each record went to.
+ * status:	(Output, can be NULL) Status of each record written.
  *
  * Description: 
- * Unpack a buffer of packed septets into a buffer of octets (bytes).
+ * Store SMS records in the free records of EF-SMS, which must be in the
+ * current DF (DF-TELECOM). This is scsisim_write_free_records() for 
+ * EF-SMS: encode any number of messages into one buffer, and store them
+ * all in one batch.
+ *
+ * Return values: 
+ * See scsisim_write_free_records()
+ */
+int scsisim_store_sms(struct scsisim_dev *device,
+		      uint8_t *records,
+		      unsigned int len,
+		      unsigned int count,
+		      uint8_t *recnos,
+		      int *status);
+
+
+/**
+ * Function: scsisim_import_adn
+ *
+ * Parameters:
+ * device:	Pointer to scsisim_dev struct.
+ * file:	File ID of EF-ADN, EF-FDN or another EF with the same layout,
+ *		in the current DF.
+ * ext_file:	File ID of its extension EF in the current DF (e.g., 
+ *		GSM_FILE_EF_EXT1 for EF-ADN or GSM_FILE_EF_EXT2 for EF-FDN),
+ *		only needed for numbers over SCSISIM_ADN_MAX_DIGITS digits.
+ * contacts:	Contacts to write.
+ * count:	Number of contacts.
+ * recnos:	(Output, can be NULL) Record number each contact went to.
+ * status:	(Output, can be NULL) Status of each record of file: 
+ *		SCSISIM_SCSI_SEND_ERROR if it was never sent.
+ *
+ * Description: 
+ * Write contacts to the first free records of an EF in one batch: the 
+ * batch counterpart of scsisim_encode_adn(), as scsisim_store_sms() is 
+ * for SMS. The free records of file are found with 
+ * scsisim_find_free_adn(), and those of ext_file with 
+ * scsisim_find_records() (so usually from the metadata cache), every 
+ * contact is encoded for the EF's record length before anything is 
+ * written, and the records are written as scsisim_write_free_records()
+ * does. Without long numbers, that takes one SELECT; with them, the 
+ * extension records are written first and the records of file last, so
+ * no record points to one that has not been written yet, for two more.
+ * Nothing is written unless there are enough free records in both EFs.
+ * If a write fails, the extension records of the contacts that did not
+ * make it are freed again (as far as the card lets us), so only the 
+ * contacts whose status is SCSISIM_SUCCESS are left on the card, each 
+ * with its extension records. The device must not have any commands 
+ * pending.
+ *
+ * Return values: 
+ * SCSISIM_SUCCESS
+ * SCSISIM_INVALID_PARAM
+ * SCSISIM_MEMORY_ALLOCATION_ERROR
+ * SCSISIM_NO_FREE_RECORDS
+ * SCSISIM_GSM_FILE_INCONSISTENT_WITH_COMMAND (not a linear fixed EF, or
+ *	records too short)
+ * Return value from scsisim_encode_adn
+ * Return value from scsisim_find_free_adn / scsisim_find_records
+ * Return value from scsisim_submit_update_record / scsisim_reap
+ * First error in the status array, or from writing the extension records
+ */
+int scsisim_import_adn(struct scsisim_dev *device,
+		       uint16_t file,
+		       uint16_t ext_file,
+		       const struct scsisim_contact *contacts,
+		       unsigned int count,
+		       uint8_t *recnos,
+		       int *status);
+
+
+/**
+ * Function: scsisim_submit_select_file
+ *
+ * Parameters:
+ * device:	Pointer to scsisim_dev struct.
+ * file:	File ID to select.
+ * user_data:	Caller's pointer, handed back by scsisim_reap().
+ *
+ * Description: 
+ * Queue a GSM SELECT command and return without waiting for it to 
+ * complete. This and the other scsisim_submit_*() functions let you keep 
+ * up to SCSISIM_MAX_PENDING commands in flight on a device, so the reader 
+ * does not sit idle for a full USB round trip between commands. Use 
+ * scsisim_reap() to collect the results. Commands are executed by the 
+ * card in the order they were submitted, so you can queue a SELECT 
+ * followed by several READ RECORD commands in one go. Any data buffer 
+ * passed to a scsisim_submit_*() function must remain valid until the 
+ * command has been reaped.
+ *
+ * Return values: 
+ * SCSISIM_SUCCESS
+ * SCSISIM_INVALID_PARAM
+ * SCSISIM_QUEUE_FULL
+ * SCSISIM_MEMORY_ALLOCATION_ERROR
+ * Return value from scsi_submit_cdb
+ */
+int scsisim_submit_select_file(struct scsisim_dev *device,
+			       uint16_t file,
+			       void *user_data);
+
+
+/**
+ * Function: scsisim_submit_get_response
+ *
+ * Parameters:
+ * device:	Pointer to scsisim_dev struct.
+ * data:	Buffer for response data.
+ * len:		Length of data buffer.
+ * command:	Command for which we are getting the response; one
+ *		of the SIM_* constants.
+ * resp:	Pointer to GSM_response struct, filled in when the 
+ *		command is reaped.
+ * user_data:	Caller's pointer, handed back by scsisim_reap().
+ *
+ * Description: 
+ * Queue a GSM GET RESPONSE command. See scsisim_get_response() and
+ * scsisim_submit_select_file().
+ *
+ * Return values: 
+ * SCSISIM_SUCCESS
+ * SCSISIM_INVALID_PARAM
+ * SCSISIM_QUEUE_FULL
+ * SCSISIM_MEMORY_ALLOCATION_ERROR
+ * Return value from scsi_submit_cdb
+ */
+int scsisim_submit_get_response(struct scsisim_dev *device,
+				uint8_t *data,
+				uint8_t len,
+				int command,
+				struct GSM_response *resp,
+				void *user_data);
+
+
+/**
+ * Function: scsisim_submit_read_record
+ *
+ * Parameters:
+ * device:	Pointer to scsisim_dev struct.
+ * recno:	Record number to read (records start at 1, NOT zero!).
+ * data:	Buffer for record data.
+ * len:		Length of data buffer.
+ * user_data:	Caller's pointer, handed back by scsisim_reap().
+ *
+ * Description: 
+ * Queue a GSM READ RECORD command. See scsisim_read_record() and
+ * scsisim_submit_select_file().
+ *
+ * Return values: 
+ * SCSISIM_SUCCESS
+ * SCSISIM_INVALID_PARAM
+ * SCSISIM_QUEUE_FULL
+ * SCSISIM_MEMORY_ALLOCATION_ERROR
+ * Return value from scsi_submit_cdb
+ */
+int scsisim_submit_read_record(struct scsisim_dev *device,
+			       uint8_t recno,
+			       uint8_t *data,
+			       uint8_t len,
+			       void *user_data);
+
+
+/**
+ * Function: scsisim_submit_read_binary
+ *
+ * Parameters:
+ * device:	Pointer to scsisim_dev struct.
+ * data:	Buffer for binary data.
+ * offset:	Offset from which to begin read (zero-based).
+ * len:		Length of data buffer.
+ * user_data:	Caller's pointer, handed back by scsisim_reap().
+ *
+ * Description: 
+ * Queue a GSM READ BINARY command. See scsisim_read_binary() and
+ * scsisim_submit_select_file().
+ *
+ * Return values: 
+ * SCSISIM_SUCCESS
+ * SCSISIM_INVALID_PARAM
+ * SCSISIM_QUEUE_FULL
+ * SCSISIM_MEMORY_ALLOCATION_ERROR
+ * Return value from scsi_submit_cdb
+ */
+int scsisim_submit_read_binary(struct scsisim_dev *device,
+			       uint8_t *data,
+			       uint16_t offset,
+			       uint8_t len,
+			       void *user_data);
+
+
+/**
+ * Function: scsisim_submit_update_record
+ *
+ * Parameters:
+ * device:	Pointer to scsisim_dev struct.
+ * recno:	Record number to update (records start at 1, NOT zero!).
+ * data:	Buffer for record data.
+ * len:		Length of data buffer.
+ * user_data:	Caller's pointer, handed back by scsisim_reap().
+ *
+ * Description: 
+ * Queue a GSM UPDATE RECORD command. See scsisim_update_record() and
+ * scsisim_submit_select_file().
+ *
+ * Return values: 
+ * SCSISIM_SUCCESS
+ * SCSISIM_INVALID_PARAM
+ * SCSISIM_QUEUE_FULL
+ * SCSISIM_MEMORY_ALLOCATION_ERROR
+ * Return value from scsi_submit_cdb
+ */
+int scsisim_submit_update_record(struct scsisim_dev *device,
+				 uint8_t recno,
+				 uint8_t *data,
+				 uint8_t len,
+				 void *user_data);
+
+
+/**
+ * Function: scsisim_submit_update_binary
+ *
+ * Parameters:
+ * device:	Pointer to scsisim_dev struct.
+ * data:	Buffer for binary data.
+ * offset:	Offset from which to begin write (zero-based).
+ * len:		Length of data buffer.
+ * user_data:	Caller's pointer, handed back by scsisim_reap().
+ *
+ * Description: 
+ * Queue a GSM UPDATE BINARY command. See scsisim_update_binary() and
+ * scsisim_submit_select_file().
+ *
+ * Return values: 
+ * SCSISIM_SUCCESS
+ * SCSISIM_INVALID_PARAM
+ * SCSISIM_QUEUE_FULL
+ * SCSISIM_MEMORY_ALLOCATION_ERROR
+ * Return value from scsi_submit_cdb
+ */
+int scsisim_submit_update_binary(struct scsisim_dev *device,
+				 uint8_t *data,
+				 uint16_t offset,
+				 uint8_t len,
+				 void *user_data);
+
+
+/**
+ * Function: scsisim_reap
+ *
+ * Parameters:
+ * device:	Pointer to scsisim_dev struct.
+ * req:		(Output) Pointer to scsisim_request struct.
+ * timeout:	Time to wait in milliseconds (-1 = forever, 0 = don't wait).
+ *
+ * Description: 
+ * Wait for a command queued with one of the scsisim_submit_*() functions
+ * to complete. On success, req->status holds exactly what the matching
+ * synchronous function would have returned (e.g., the number of response
+ * bytes available for a SELECT), and req->user_data identifies the command.
+ * Any failure other than SCSISIM_TIMEOUT abandons every command in flight
+ * (scsisim_pending() drops to 0), since there is no telling which one was
+ * lost; resubmit whatever you still need.
+ *
+ * Return values: 
+ * SCSISIM_SUCCESS
+ * SCSISIM_INVALID_PARAM
+ * SCSISIM_NO_COMMANDS_PENDING
+ * SCSISIM_TIMEOUT
+ * SCSISIM_SCSI_RECEIVE_ERROR
+ * Return value from scsi_reap_cdb
+ */
+int scsisim_reap(struct scsisim_dev *device,
+		 struct scsisim_request *req,
+		 int timeout);
+
+
+/**
+ * Function: scsisim_pending
+ *
+ * Parameters:
+ * device:	Pointer to scsisim_dev struct.
+ *
+ * Description: 
+ * Get the number of asynchronous commands in flight on a device.
+ *
+ * Return value: 
+ * Number of commands submitted but not yet reaped.
+ */
+unsigned int scsisim_pending(const struct scsisim_dev *device);
+
+
+/**
+ * Function: scsisim_reactor_create
+ *
+ * Parameters:
+ * reactor:	(Output) Pointer to new reactor.
+ *
+ * Description: 
+ * Create an event loop that drives any number of devices from a single 
+ * thread. Register open devices with scsisim_reactor_add(), queue 
+ * commands on them with the scsisim_submit_*() functions, and call 
+ * scsisim_reactor_run() to dispatch completions. Each command's 
+ * user_data must point to a scsisim_completion struct, whose callback
+ * is invoked when the command completes; callbacks may submit further 
+ * commands to keep the readers busy. Destroy the reactor with 
+ * scsisim_reactor_destroy() when done.
+ *
+ * Return values: 
+ * SCSISIM_SUCCESS
+ * SCSISIM_INVALID_PARAM
+ * SCSISIM_MEMORY_ALLOCATION_ERROR
+ * SCSISIM_REACTOR_ERROR
+ */
+int scsisim_reactor_create(struct scsisim_reactor **reactor);
+
+
+/**
+ * Function: scsisim_reactor_destroy
+ *
+ * Parameters:
+ * reactor:	Pointer to reactor (can be NULL).
+ *
+ * Description: 
+ * Free a reactor. Registered devices are not closed.
+ *
+ * Return value: 
+ * None
+ */
+void scsisim_reactor_destroy(struct scsisim_reactor *reactor);
+
+
+/**
+ * Function: scsisim_reactor_add
+ *
+ * Parameters:
+ * reactor:	Pointer to reactor.
+ * device:	Pointer to an open scsisim_dev struct.
+ *
+ * Description: 
+ * Register a device with a reactor. The scsisim_dev struct must stay 
+ * valid, and the device open, until it is removed with 
+ * scsisim_reactor_remove().
+ *
+ * Return values: 
+ * SCSISIM_SUCCESS
+ * SCSISIM_INVALID_PARAM
+ * SCSISIM_REACTOR_ERROR
+ */
+int scsisim_reactor_add(struct scsisim_reactor *reactor,
+			struct scsisim_dev *device);
+
+
+/**
+ * Function: scsisim_reactor_remove
+ *
+ * Parameters:
+ * reactor:	Pointer to reactor.
+ * device:	Pointer to a registered scsisim_dev struct.
+ *
+ * Description: 
+ * Unregister a device from a reactor. Call this before closing the 
+ * device. Commands still in flight are not dispatched any more; collect 
+ * them with scsisim_reap() if necessary.
+ *
+ * Return values: 
+ * SCSISIM_SUCCESS
+ * SCSISIM_INVALID_PARAM
+ * SCSISIM_REACTOR_ERROR
+ */
+int scsisim_reactor_remove(struct scsisim_reactor *reactor,
+			   struct scsisim_dev *device);
+
+
+/**
+ * Function: scsisim_reactor_run
+ *
+ * Parameters:
+ * reactor:	Pointer to reactor.
+ * timeout:	Time to wait in milliseconds (-1 = forever, 0 = don't wait).
+ *
+ * Description: 
+ * Wait until at least one registered device has completed commands, then
+ * reap every completed command on every ready device and invoke its 
+ * callback. Call this in a loop, e.g., until no commands are pending. 
+ * A device that fails to reap does not stop the others from being 
+ * serviced; the first such error is returned after dispatching.
+ *
+ * Return values: 
+ * Number of completions dispatched (0 if the timeout expired)
+ * SCSISIM_INVALID_PARAM
+ * SCSISIM_REACTOR_ERROR
+ * Return value from scsisim_reap
+ */
+int scsisim_reactor_run(struct scsisim_reactor *reactor, int timeout);
+
+
+/**
+ * Function: scsisim_monitor_create
+ *
+ * Parameters:
+ * monitor:	(Output) Pointer to new monitor.
+ * fd:		-1 to listen for the kernel's uevents, or a datagram (or 
+ *		seqpacket) socket to read uevents from instead, e.g., one end 
+ *		of a socketpair() fed with recorded uevents, for testing.
+ *		The monitor owns the socket and closes it when destroyed.
+ * callback:	Function to call for each event.
+ * user_data:	Passed to the callback.
+ *
+ * Description: 
+ * Create a monitor that reports supported readers as they are plugged in
+ * and unplugged, instead of polling scsisim_open_device(). It listens on a
+ * NETLINK_KOBJECT_UEVENT socket (no privileges needed) for scsi_generic 
+ * add and remove uevents, looks up each new sg device with 
+ * scsisim_identify_device(), and ignores anything that is not a 
+ * supported reader. Readers already present when the monitor is created 
+ * are reported as added by the first scsisim_monitor_dispatch(). If the 
+ * socket overflows and uevents are lost, the monitor rescans sysfs and 
+ * reports the difference. Sysfs lookups use the calling thread's context
+ * (see scsisim_ctx_set_sysfs_root()). Destroy the monitor with 
+ * scsisim_monitor_destroy() when done.
+ *
+ * Return values: 
+ * SCSISIM_SUCCESS
+ * SCSISIM_INVALID_PARAM
+ * SCSISIM_MEMORY_ALLOCATION_ERROR
+ * SCSISIM_MONITOR_ERROR
+ */
+int scsisim_monitor_create(struct scsisim_monitor **monitor,
+			   int fd,
+			   void (*callback)(const struct scsisim_monitor_event *event, void *user_data),
+			   void *user_data);
+
+
+/**
+ * Function: scsisim_monitor_destroy
+ *
+ * Parameters:
+ * monitor:	Pointer to monitor (can be NULL).
+ *
+ * Description: 
+ * Close a monitor's socket and free the monitor. Don't call this from 
+ * the monitor's callback.
+ *
+ * Return value: 
+ * None
+ */
+void scsisim_monitor_destroy(struct scsisim_monitor *monitor);
+
+
+/**
+ * Function: scsisim_monitor_get_fd
+ *
+ * Parameters:
+ * monitor:	Pointer to monitor.
+ *
+ * Description: 
+ * Get the monitor's socket, to wait on it in your own event loop along 
+ * with other descriptors; call scsisim_monitor_dispatch() with a timeout 
+ * of 0 when it becomes readable. Don't read from it yourself.
+ *
+ * Return values: 
+ * The socket
+ * SCSISIM_INVALID_PARAM
+ */
+int scsisim_monitor_get_fd(const struct scsisim_monitor *monitor);
+
+
+/**
+ * Function: scsisim_monitor_dispatch
+ *
+ * Parameters:
+ * monitor:	Pointer to monitor.
+ * timeout:	Time to wait in milliseconds (-1 = forever, 0 = don't wait).
+ *
+ * Description: 
+ * Wait for uevents, then read every one that is queued and invoke the 
+ * monitor's callback for each reader added or removed. The sg name in an
+ * add event is ready for scsisim_open_device(). A remove event is only 
+ * reported for a reader the monitor reported as added.
+ *
+ * Return values: 
+ * Number of events dispatched (0 if the timeout expired)
+ * SCSISIM_INVALID_PARAM
+ * SCSISIM_MEMORY_ALLOCATION_ERROR
+ * SCSISIM_SYSFS_CHDIR_FAILED
+ * SCSISIM_MONITOR_ERROR
+ */
+int scsisim_monitor_dispatch(struct scsisim_monitor *monitor, int timeout);
+
+
+/**
+ * Function: scsisim_vcard_create
+ *
+ * Parameters:
+ * card:	(Output) Pointer to new virtual SIM card.
+ *
+ * Description: 
+ * Create an empty virtual SIM card containing only the Master File. Use
+ * scsisim_vcard_add_df() and scsisim_vcard_add_ef() to build up the file 
+ * system, or scsisim_vcard_load_default() to get a typical GSM card. 
+ * Destroy the card with scsisim_vcard_destroy() when done.
+ *
+ * Return values: 
+ * SCSISIM_SUCCESS
+ * SCSISIM_INVALID_PARAM
+ * SCSISIM_MEMORY_ALLOCATION_ERROR
+ */
+int scsisim_vcard_create(struct scsisim_vcard **card);
+
+
+/**
+ * Function: scsisim_vcard_destroy
+ *
+ * Parameters:
+ * card:	Pointer to virtual SIM card.
+ *
+ * Description: 
+ * Free a virtual SIM card and all of its files.
+ *
+ * Return values: 
+ * None
+ */
+void scsisim_vcard_destroy(struct scsisim_vcard *card);
+
+
+/**
+ * Function: scsisim_vcard_add_df
+ *
+ * Parameters:
+ * card:	Pointer to virtual SIM card.
+ * parent:	ID of the MF or DF that will contain the new DF.
+ * file:	ID of the new DF.
+ *
+ * Description: 
+ * Add a dedicated file (directory) to a virtual SIM card.
+ *
+ * Return values: 
+ * SCSISIM_SUCCESS
+ * SCSISIM_INVALID_PARAM
+ * SCSISIM_GSM_FILE_NOT_FOUND
+ * SCSISIM_MEMORY_ALLOCATION_ERROR
+ */
+int scsisim_vcard_add_df(struct scsisim_vcard *card,
+			 uint16_t parent,
+			 uint16_t file);
+
+
+/**
+ * Function: scsisim_vcard_add_ef
+ *
+ * Parameters:
+ * card:	Pointer to virtual SIM card.
+ * parent:	ID of the MF or DF that will contain the new EF.
+ * file:	ID of the new EF.
+ * structure:	SIM_EF_TRANSPARENT, SIM_EF_LINEAR_FIXED or SIM_EF_CYCLIC.
+ * file_size:	Size of the EF in bytes.
+ * record_len:	Length of each record (ignored for transparent EFs).
+ * contents:	Initial contents of the EF (file_size bytes), or NULL to 
+ *		fill the EF with 0xff.
+ *
+ * Description: 
+ * Add an elementary file to a virtual SIM card. The new EF can be read 
+ * and updated with access condition SIM_AC_ALWAYS; use 
+ * scsisim_vcard_set_access() to change that.
+ *
+ * Return values: 
+ * SCSISIM_SUCCESS
+ * SCSISIM_INVALID_PARAM
+ * SCSISIM_GSM_FILE_NOT_FOUND
+ * SCSISIM_MEMORY_ALLOCATION_ERROR
+ */
+int scsisim_vcard_add_ef(struct scsisim_vcard *card,
+			 uint16_t parent,
+			 uint16_t file,
+			 uint8_t structure,
+			 uint16_t file_size,
+			 uint8_t record_len,
+			 const uint8_t *contents);
+
+
+/**
+ * Function: scsisim_vcard_set_access
+ *
+ * Parameters:
+ * card:	Pointer to virtual SIM card.
+ * parent:	ID of the MF or DF containing the EF.
+ * file:	ID of the EF.
+ * read_ac:	Access condition for READ (a SIM_AC_* constant).
+ * update_ac:	Access condition for UPDATE (a SIM_AC_* constant).
+ *
+ * Description: 
+ * Set the access conditions of an EF on a virtual SIM card.
+ *
+ * Return values: 
+ * SCSISIM_SUCCESS
+ * SCSISIM_INVALID_PARAM
+ * SCSISIM_GSM_FILE_NOT_FOUND
+ */
+int scsisim_vcard_set_access(struct scsisim_vcard *card,
+			     uint16_t parent,
+			     uint16_t file,
+			     uint8_t read_ac,
+			     uint8_t update_ac);
+
+
+/**
+ * Function: scsisim_vcard_set_chv
+ *
+ * Parameters:
+ * card:	Pointer to virtual SIM card.
+ * chv:		Number of CHV to set (i.e., CHV1, CHV2).
+ * pin:		PIN (up to 8 digits).
+ * enabled:	Whether the CHV is enabled. CHV2 is always enabled.
+ * attempts:	Number of verification attempts remaining (0 = blocked).
+ *
+ * Description: 
+ * Set up a CHV (PIN) on a virtual SIM card. CHVs are initially 
+ * uninitialized and CHV1 is disabled. Each wrong VERIFY CHV uses up an
+ * attempt, and a correct one restores the number set here.
+ *
+ * Return values: 
+ * SCSISIM_SUCCESS
+ * SCSISIM_INVALID_PARAM
+ * SCSISIM_INVALID_PIN
+ */
+int scsisim_vcard_set_chv(struct scsisim_vcard *card,
+			  uint8_t chv,
+			  const char *pin,
+			  bool enabled,
+			  uint8_t attempts);
+
+
+/**
+ * Function: scsisim_vcard_set_latency
+ *
+ * Parameters:
+ * card:	Pointer to virtual SIM card.
+ * usecs:	Latency in microseconds.
+ *
+ * Description: 
+ * Set the time it takes the virtual SIM card to complete each command. 
+ * The default is zero, so commands complete as fast as possible. Set this
+ * to a few milliseconds to model the round trip of a real USB reader.
+ *
+ * Return values: 
+ * None
+ */
+void scsisim_vcard_set_latency(struct scsisim_vcard *card, unsigned int usecs);
+
+
+/**
+ * Function: scsisim_vcard_set_reader_initialized
+ *
+ * Parameters:
+ * card:	Pointer to virtual SIM card.
+ * initialized:	Whether the reader holding the card is initialized.
+ *
+ * Description: 
+ * Model the state of the reader the virtual SIM card sits in. The default
+ * is initialized. An uninitialized reader doesn't pass GSM commands on to
+ * the card: it reads zeros and accepts writes without any sense data, 
+ * like the flash disk it pretends to be, until it has received the 
+ * device's full initialization sequence (see scsisim_init_device()).
+ *
+ * Return values: 
+ * None
+ */
+void scsisim_vcard_set_reader_initialized(struct scsisim_vcard *card, bool initialized);
+
+
+/**
+ * Function: scsisim_vcard_get_command_count
+ *
+ * Parameters:
+ * card:	Pointer to virtual SIM card.
+ *
+ * Description: 
+ * Get the number of commands the virtual SIM card has processed, 
+ * including device initialization commands.
+ *
+ * Return value: 
+ * Number of commands processed.
+ */
+unsigned long scsisim_vcard_get_command_count(const struct scsisim_vcard *card);
+
+
+/**
+ * Function: scsisim_vcard_load_default
+ *
+ * Parameters:
+ * card:	Pointer to an empty virtual SIM card.
+ *
+ * Description: 
+ * Populate a virtual SIM card with a typical GSM file system: EF-ICCID 
+ * under the MF; EF-ADN (250 records), EF-FDN, EF-SMS (50 records), 
+ * EF-MSISDN and EF-EXT1 under DF-TELECOM; and EF-IMSI and EF-SPN under 
+ * DF-GSM. A few sample contacts and SMS messages are included.
+ *
+ * Return values: 
+ * SCSISIM_SUCCESS
+ * Return value from scsisim_vcard_add_df
+ * Return value from scsisim_vcard_add_ef
+ */
+int scsisim_vcard_load_default(struct scsisim_vcard *card);
+
+
+/**
+ * Function: scsisim_decode_sms
+ *
+ * Parameters:
+ * record:		Pointer to raw SMS record.
+ * record_len:		Length of SMS record.
+ * sms:			(Output) Pointer to scsisim_sms struct.
+ * text:		(Output, can be NULL) Buffer for the message text, as
+ *			a null-terminated UTF-8 string.
+ * text_len:		Length of text buffer (SCSISIM_SMS_MAX_TEXT_LEN is 
+ *			always enough).
+ *
+ * Description: 
+ * Given a pointer to an SMS record, decode its status, SMS Center number,
+ * sender or recipient, protocol identifier, data coding scheme, time 
+ * stamp and text into a caller-supplied struct and buffer. Unlike 
+ * scsisim_parse_sms(), this prints nothing and does no heap allocation,
+ * so it is suitable for decoding records in bulk. Text is decoded for
+ * the GSM 7-bit alphabet and UCS-2; for 8-bit data, text is left 
+ * empty. A User Data Header is not part of the text; a concatenated SMS
+ * element in it fills in the concat_* fields. SMS-STATUS-REPORT records
+ * (received) fill in the message reference, recipient, time stamps and
+ * report status; SMS-COMMAND records (sent) fill in the message 
+ * reference, command type, message number and recipient. The command 
+ * data of an SMS-COMMAND is not decoded.
+ *
+ * Return values: 
+ * SCSISIM_SUCCESS
+ * SCSISIM_INVALID_PARAM
+ * SCSISIM_SMS_INVALID_STATUS
+ * SCSISIM_SMS_INVALID_SMSC
+ * SCSISIM_SMS_INVALID_ADDRESS
+ * SCSISIM_BUFFER_TOO_SMALL (text holds as much as fits)
+ */
+int scsisim_decode_sms(const uint8_t *record,
+		       uint8_t record_len,
+		       struct scsisim_sms *sms,
+		       char *text,
+		       unsigned int text_len);
+
+
+/**
+ * Function: scsisim_parse_sms
+ *
+ * Parameters:
+ * record:		Pointer to raw SMS record.
+ * record_len:		Length of SMS record.
+ *
+ * Description: 
+ * Given a pointer to an SMS record, parse out and print the 
+ * following information:
+ *	SMS status (unused space, message read, etc.)
+ *	SMS Center number
+ *	Sender / recipient number
+ *	Message timestamp
+ *	Message text
+ * This is a wrapper for scsisim_decode_sms().
+ *
+ * Return values: 
+ * SCSISIM_SUCCESS
+ * SCSISIM_INVALID_PARAM
+ * SCSISIM_SMS_INVALID_STATUS
+ * SCSISIM_SMS_INVALID_SMSC
+ * SCSISIM_SMS_INVALID_ADDRESS
+ */
+int scsisim_parse_sms(const uint8_t *record, uint8_t record_len);
+
+
+/**
+ * Function: scsisim_encode_sms
+ *
+ * Parameters:
+ * sms:			Pointer to scsisim_sms struct describing the message.
+ * text:		UTF-8 message text (need not be null-terminated).
+ * text_len:		Length of text in bytes.
+ * records:		(Output) Caller-supplied buffer for the SMS records.
+ * records_len:		Length of records buffer; GSM_SMS_RECORD_LEN bytes
+ *			per record.
+ *
+ * Description: 
+ * The inverse of scsisim_decode_sms(): build complete EF-SMS records, 
+ * ready for scsisim_update_record() or scsisim_store_sms(). These fields
+ * of sms are used:
+ *	status: SIM_SMS_READ or SIM_SMS_UNREAD make an SMS-DELIVER with 
+ *		timestamp as its TP-SCTS; SIM_SMS_SENT or SIM_SMS_UNSENT 
+ *		make an SMS-SUBMIT with message_ref as its TP-MR.
+ *	smsc, address: digits, with an optional leading '+'. An address
+ *		with a TON of 101 in address_ton_npi is alphanumeric text 
+ *		instead (e.g., the sender's name).
+ *	smsc_ton_npi, address_ton_npi: 0 picks 0x91 (international) for a
+ *		number with a leading '+', and 0x81 otherwise.
+ *	pid, dcs: TP-PID, and any message class in a general data coding 
+ *		TP-DCS; the character set bits are filled in.
+ *	charset: SIM_SMS_CHARSET_GSM uses the GSM 7-bit alphabet when the 
+ *		text fits it, and UCS-2 when it doesn't. SIM_SMS_CHARSET_UCS2
+ *		always uses UCS-2.
+ *	concat_ref: reference number for a text too long for one record.
+ *		Above 255, the 16-bit form of the header is used, which 
+ *		leaves 152 septets of GSM text per part instead of 153.
+ * A text too long for one record is split into a concatenated SMS: each
+ * record gets a User Data Header with the reference number, the number of
+ * parts and its part number, and escape sequences and surrogate pairs are
+ * never split between parts. The rest of each record is padded with 0xFF.
+ * This does not allocate.
+ *
+ * Return values: 
+ * Number of records written, or one of the following on failure:
+ * SCSISIM_INVALID_PARAM (including malformed UTF-8, or over 255 parts)
+ * SCSISIM_BUFFER_TOO_SMALL
+ * SCSISIM_SMS_INVALID_STATUS
+ * SCSISIM_SMS_INVALID_SMSC
+ * SCSISIM_SMS_INVALID_ADDRESS
+ */
+int scsisim_encode_sms(const struct scsisim_sms *sms,
+		       const char *text,
+		       unsigned int text_len,
+		       uint8_t *records,
+		       unsigned int records_len);
+
+
+/**
+ * Function: scsisim_concat_create
+ *
+ * Parameters:
+ * concat:		(Output) Pointer to new reassembly context.
+ * num_fragments:	Number of parts that can wait for the rest of their
+ *			message (at most 65535); e.g., the number of records
+ *			in EF-SMS.
+ * callback:		Function called with each whole message.
+ * user_data:		Passed to callback.
+ *
+ * Description: 
+ * Create a context for reassembling concatenated (multi-part) SMS. Feed
+ * it SMS records in any order with scsisim_concat_add(), e.g., every 
+ * record of EF-SMS, or a stream of archived records: each message is 
+ * passed to callback, with the text of its parts joined in part order, 
+ * as soon as its last part arrives. Messages in one part are passed on 
+ * at once. Parts are matched on sender (or recipient), reference number
+ * and number of parts, through a hash index. All memory is allocated 
+ * here: when all num_fragments fragments are taken, the message that 
+ * has waited longest is passed on incomplete to make room. Call 
+ * scsisim_concat_flush() at the end to pass on incomplete messages, 
+ * and scsisim_concat_destroy() when done.
+ *
+ * Return values: 
+ * SCSISIM_SUCCESS
+ * SCSISIM_INVALID_PARAM
+ * SCSISIM_MEMORY_ALLOCATION_ERROR
+ */
+int scsisim_concat_create(struct scsisim_concat **concat,
+			  unsigned int num_fragments,
+			  void (*callback)(const struct scsisim_concat_sms *msg, void *user_data),
+			  void *user_data);
+
+
+/**
+ * Function: scsisim_concat_destroy
+ *
+ * Parameters:
+ * concat:		Pointer to reassembly context (can be NULL).
+ *
+ * Description: 
+ * Free a reassembly context. Incomplete messages are dropped: call 
+ * scsisim_concat_flush() first to get them.
+ *
+ * Return values: 
+ * None
+ */
+void scsisim_concat_destroy(struct scsisim_concat *concat);
+
+
+/**
+ * Function: scsisim_concat_add
+ *
+ * Parameters:
+ * concat:		Pointer to reassembly context.
+ * record:		Pointer to raw SMS record.
+ * record_len:		Length of SMS record.
+ *
+ * Description: 
+ * Add an SMS record to a reassembly context. This calls the callback 
+ * for every message it completes (or gives up on to make room). Free 
+ * records, parts already seen, and SMS-STATUS-REPORT and SMS-COMMAND 
+ * records are ignored.
+ *
+ * Return values: 
+ * SCSISIM_SUCCESS
+ * SCSISIM_INVALID_PARAM
+ * Any error from scsisim_decode_sms() for an invalid record
+ */
+int scsisim_concat_add(struct scsisim_concat *concat,
+		       const uint8_t *record,
+		       uint8_t record_len);
+
+
+/**
+ * Function: scsisim_concat_flush
+ *
+ * Parameters:
+ * concat:		Pointer to reassembly context.
+ *
+ * Description: 
+ * Pass every incomplete message to the callback, oldest first, and 
+ * empty the context.
+ *
+ * Return values: 
+ * None
+ */
+void scsisim_concat_flush(struct scsisim_concat *concat);
+
+
+/**
+ * Function: scsisim_concat_pending
+ *
+ * Parameters:
+ * concat:		Pointer to reassembly context.
+ *
+ * Description: 
+ * Count the messages waiting for more parts.
+ *
+ * Return value: 
+ * Number of incomplete messages.
+ */
+unsigned int scsisim_concat_pending(const struct scsisim_concat *concat);
+
+
+/**
+ * Function: scsisim_decode_alpha
+ *
+ * Parameters:
+ * alpha:		Pointer to alpha identifier (or other alpha field,
+ *			e.g., the name in EF-SPN).
+ * alpha_len:		Length of alpha identifier.
+ * dest:		(Output) Caller-supplied buffer for the UTF-8 string.
+ * dest_len:		Length of dest buffer (alpha_len * 3 + 1 is 
+ *			always enough).
+ *
+ * Description: 
+ * Decode an alpha identifier to a null-terminated UTF-8 string in a 
+ * caller-supplied buffer, without allocating. Handles the GSM default 
+ * alphabet and the three UCS-2 codings of GSM 11.11, Annex B: 0x80 
+ * (UCS-2 characters), and 0x81 and 0x82 (GSM characters mixed with 
+ * offsets into a half page of UCS-2). Padding (0xff) is ignored. If dest 
+ * is too small, it holds as many whole characters as fit.
+ *
+ * Return values: 
+ * Length of the string written to dest, or one of the following on failure:
+ * SCSISIM_INVALID_PARAM
+ * SCSISIM_BUFFER_TOO_SMALL
+ */
+int scsisim_decode_alpha(const uint8_t *alpha,
+			 unsigned int alpha_len,
+			 char *dest,
+			 unsigned int dest_len);
+
+
+/**
+ * Function: scsisim_decode_adn
+ *
+ * Parameters:
+ * file:		File ID the record was read from, e.g., 
+ *			GSM_FILE_EF_ADN or GSM_FILE_EF_BDN.
+ * record:		Pointer to raw record.
+ * record_len:		Length of record.
+ * adn:			(Output) Pointer to scsisim_adn struct.
+ * alpha:		(Output, can be NULL) Buffer for the alpha identifier 
+ *			(the contact name), as a null-terminated UTF-8 string.
+ * alpha_len:		Length of alpha buffer (SCSISIM_ADN_MAX_ALPHA_LEN is 
+ *			always enough).
+ *
+ * Description: 
+ * Given a pointer to a record of EF-ADN, EF-FDN, EF-SDN, EF-LND, 
+ * EF-MSISDN or EF-BDN, which all share the same layout, decode its 
+ * alpha identifier (in any coding scsisim_decode_alpha() handles), type
+ * of number, dialling number, capability/configuration and extension 
+ * identifiers into a caller-supplied struct and buffer. Unlike 
+ * scsisim_parse_adn(), this prints nothing and does no heap allocation.
+ * Numbers continued in an extension record are only decoded up to the 
+ * end of the record itself.
+ *
+ * Return values: 
+ * SCSISIM_SUCCESS
+ * SCSISIM_GSM_INVALID_ADN_RECORD
+ * SCSISIM_BUFFER_TOO_SMALL (alpha holds as much as fits)
+ */
+int scsisim_decode_adn(uint16_t file,
+		       const uint8_t *record,
+		       uint8_t record_len,
+		       struct scsisim_adn *adn,
+		       char *alpha,
+		       unsigned int alpha_len);
+
+
+/**
+ * Function: scsisim_parse_adn
+ *
+ * Parameters:
+ * record:		Pointer to raw ADN record.
+ * record_len:		Length of ADN record.
+ *
+ * Description: 
+ * Given a pointer to an ADN (abbreviated dialling number) record, 
+ * parse out and print the number and name. "ADN" is just a fancy term 
+ * for a contact. This is a wrapper for scsisim_decode_adn().
+ *
+ * Return value: 
+ * SCSISIM_SUCCESS
+ * SCSISIM_GSM_INVALID_ADN_RECORD
+ */
+int scsisim_parse_adn(const uint8_t *record, uint8_t record_len);
+
+
+/**
+ * Function: scsisim_adn_ext_records
+ *
+ * Parameters:
+ * number:		Dialling number, as for scsisim_encode_adn().
+ *
+ * Description: 
+ * Count the extension records a dialling number needs: none for up to
+ * SCSISIM_ADN_MAX_DIGITS digits, and one more for each 
+ * SCSISIM_ADN_MAX_DIGITS digits after that.
+ *
+ * Return values: 
+ * Number of extension records, or SCSISIM_INVALID_PARAM if number has 
+ * a character that is not a telecom digit.
+ */
+int scsisim_adn_ext_records(const char *number);
+
+
+/**
+ * Function: scsisim_encode_adn
+ *
+ * Parameters:
+ * file:		File ID the record is for, e.g., GSM_FILE_EF_ADN or
+ *			GSM_FILE_EF_BDN.
+ * name:		(Can be NULL) UTF-8 alpha identifier (the contact name),
+ *			null-terminated.
+ * number:		(Can be NULL) Dialling number, null-terminated: digits
+ *			and the telecom digits *, # and , (pause), with an 
+ *			optional leading '+'.
+ * ton_npi:		Type of number and numbering plan, or 0 to pick 0x91 
+ *			(international) for a leading '+' and 0x81 otherwise.
+ * record:		(Output) Caller-supplied buffer for the record.
+ * record_len:		Record length of the EF, from its GET RESPONSE data.
+ * ext_recnos:		(Can be NULL if no extension records are needed) 
+ *			Record numbers of free records in the extension EF 
+ *			(EF-EXT1 for EF-ADN, EF-EXT2 for EF-FDN, ...).
+ * ext:			(Output, can be NULL if no extension records are 
+ *			needed) Buffer for the extension records.
+ * ext_len:		Length of ext buffer; SCSISIM_EXT_RECORD_LEN bytes per
+ *			record.
+ *
+ * Description: 
+ * The inverse of scsisim_decode_adn(): build a record of EF-ADN, EF-FDN,
+ * EF-SDN, EF-LND, EF-MSISDN or EF-BDN. The alpha identifier fills the 
+ * first record_len - 14 bytes (15 for EF-BDN): in the GSM default 
+ * alphabet if the name fits it, and otherwise in whichever UCS-2 coding 
+ * of GSM 11.11, Annex B is shortest (0x81 or 0x82 when the characters 
+ * outside the GSM alphabet are all within 128 code points of each 
+ * other, 0x80 if not). A name too long for the record is cut short at a 
+ * character boundary; the rest is padded with 0xFF. The number is 
+ * packed as swapped-nibble BCD, padded with 0xF. Digits after the first
+ * SCSISIM_ADN_MAX_DIGITS go in a chain of extension records (see 
+ * scsisim_adn_ext_records()), the first ext_recnos[0], the next 
+ * ext_recnos[1] and so on, which the caller writes to the extension EF 
+ * before writing record. The capability/configuration identifier and 
+ * EF-BDN's comparison method pointer are 0xFF (none). A record with 
+ * neither name nor number is an empty one. This does not allocate.
+ *
+ * Return values: 
+ * Number of extension records written to ext, or one of the following 
+ * on failure:
+ * SCSISIM_INVALID_PARAM (including malformed UTF-8 or a number with a 
+ *	character that is not a telecom digit)
+ * SCSISIM_BUFFER_TOO_SMALL (including too few ext_recnos)
+ * SCSISIM_GSM_INVALID_ADN_RECORD (record_len too short)
+ */
+int scsisim_encode_adn(uint16_t file,
+		       const char *name,
+		       const char *number,
+		       uint8_t ton_npi,
+		       uint8_t *record,
+		       uint8_t record_len,
+		       const uint8_t *ext_recnos,
+		       uint8_t *ext,
+		       unsigned int ext_len);
+
+
+/**
+ * Function: scsisim_map_gsm_chars
+ *
+ * Parameters:
+ * src:			Pointer to unpacked buffer.
+ * src_len:		Length of buffer.
+ *
+ * Description: 
+ * Given an unpacked source buffer of GSM character codes, map them to 
+ * their corresponding characters. Handles basic and extended 
+ * characters in the GSM 7-bit alphabet.
+ *
+ * Return value: 
+ * Pointer to null-terminated string. Caller's responsibility to free buffer when done.
+ */
+char *scsisim_map_gsm_chars(const uint8_t *src, unsigned int src_len);
+
+
+/**
+ * Function: scsisim_map_gsm_chars_buf
+ *
+ * Parameters:
+ * src:			Pointer to unpacked buffer.
+ * src_len:		Length of buffer.
+ * dest:		(Output) Caller-supplied buffer for the UTF-8 string.
+ * dest_len:		Length of dest buffer.
+ *
+ * Description: 
+ * Like scsisim_map_gsm_chars(), but writes the null-terminated UTF-8 
+ * string to a caller-supplied buffer instead of allocating one. Mapping
+ * stops at the first byte over 0x7f (e.g., 0xff padding). 
+ * scsisim_map_gsm_chars_len() + 1 bytes is exactly enough; if dest is 
+ * smaller, it holds as many whole characters as fit. On x86, runs of 
+ * plain ASCII characters are copied with SSE2 instructions.
+ *
+ * Return values: 
+ * Length of the string written to dest, or one of the following on failure:
+ * SCSISIM_INVALID_PARAM
+ * SCSISIM_BUFFER_TOO_SMALL
+ */
+int scsisim_map_gsm_chars_buf(const uint8_t *src,
+			      unsigned int src_len,
+			      char *dest,
+			      unsigned int dest_len);
+
+
+/**
+ * Function: scsisim_map_gsm_chars_len
+ *
+ * Parameters:
+ * src:			Pointer to unpacked buffer.
+ * src_len:		Length of buffer.
+ *
+ * Description: 
+ * Calculate the exact length of the UTF-8 string that 
+ * scsisim_map_gsm_chars_buf() makes of a buffer of GSM character codes,
+ * so the caller can size its buffer.
+ *
+ * Return value: 
+ * Length of the UTF-8 string in bytes, not counting the null-terminating 
+ * character.
+ */
+unsigned int scsisim_map_gsm_chars_len(const uint8_t *src, unsigned int src_len);
+
+
+/**
+ * Function: scsisim_encode_gsm_chars
+ *
+ * Parameters:
+ * src:			Pointer to UTF-8 text (need not be null-terminated).
+ * src_len:		Length of src in bytes.
+ * dest:		(Output) Caller-supplied buffer for GSM character codes.
+ * dest_len:		Length of dest buffer.
+ *
+ * Description: 
+ * Encode UTF-8 text in the GSM 03.38 default alphabet: the inverse of 
+ * scsisim_map_gsm_chars_buf(). Characters in the extension table (such 
+ * as the euro sign and square brackets) take two septets, the escape 
+ * character and their code. The output is one septet per byte and is 
+ * not null-terminated; use scsisim_pack_septets_buf() to pack it. 
+ * scsisim_gsm_septet_count() gives the exact length needed. This does 
+ * not allocate, and on x86, runs of plain ASCII characters are copied 
+ * with SSE2 instructions.
+ *
+ * Return values: 
+ * Number of septets written to dest, or one of the following on failure:
+ * SCSISIM_INVALID_PARAM
+ * SCSISIM_BUFFER_TOO_SMALL
+ * SCSISIM_GSM_INVALID_CHAR (malformed UTF-8, or a character that is not
+ * in the GSM alphabet)
+ */
+int scsisim_encode_gsm_chars(const char *src,
+			     unsigned int src_len,
+			     uint8_t *dest,
+			     unsigned int dest_len);
+
+
+/**
+ * Function: scsisim_gsm_septet_count
+ *
+ * Parameters:
+ * src:			Pointer to UTF-8 text (need not be null-terminated).
+ * src_len:		Length of src in bytes.
+ * concat_ref:		Reference number the parts would be sent with, as
+ *			in scsisim_sms: above 255 takes the 16-bit form.
+ * septets:		(Output) Number of septets the text encodes to.
+ * segments:		(Output) Number of SMS messages needed to send it.
+ *
+ * Description: 
+ * Calculate exactly how long UTF-8 text is in the GSM 03.38 default 
+ * alphabet, without encoding it. Up to 160 septets fit in one message;
+ * longer text is sent as a concatenated SMS of 153 septets per part 
+ * (152 with a 16-bit reference), and since an escape sequence can't be
+ * split between parts, a part may hold one less. Empty text is one 
+ * (empty) message.
+ *
+ * Return values: 
+ * SCSISIM_SUCCESS
+ * SCSISIM_INVALID_PARAM
+ * SCSISIM_GSM_INVALID_CHAR (the text can't be sent in the default 
+ * alphabet, and needs UCS-2)
+ */
+int scsisim_gsm_septet_count(const char *src,
+			     unsigned int src_len,
+			     uint16_t concat_ref,
+			     unsigned int *septets,
+			     unsigned int *segments);
+
+
+/**
+ * Function: scsisim_get_gsm_text
+ *
+ * Parameters:
+ * packed:		Pointer to buffer of packed septets.
+ * packed_len:		Length of packed buffer.
+ * num_septets:		Number of septets in packed buffer.
+ *
+ * Description: 
+ * Given a binary array of packed septets, unpack the septets into octets (bytes),
+ * and then map those values to their corresponding characters in the GSM alphabet.
+ *
+ * Return value: 
+ * Pointer to unpacked, null-terminated string. Caller's responsibility to free buffer when done.
+ */
+char *scsisim_get_gsm_text(const uint8_t *packed,
+			   unsigned int packed_len,
+			   unsigned int num_septets);
+
+
+/**
+ * Function: scsisim_packed_bcd_to_ascii
+ *
+ * Parameters:
+ * bcd:			Pointer to packed BCD buffer.
+ * len:			Length of packed BCD buffer.
+ * little_endian:	Whether the nibbles of each byte are little endian (true) or big endian (false).
+ * strip_sign_flag:	Strip terminating sign flag (usually 0xf) from unpacked ASCII string.
+ * use_telecom_digits:	Use telecom digits (*#, etc) in translation to ASCII chars.
+ *
+ * Description: 
+ * Convert a packed BCD buffer to an ASCII string.
+ *
+ * Return value: 
+ * Pointer to ASCII buffer. Caller's responsibility to free buffer when done.
+ */
+char *scsisim_packed_bcd_to_ascii(const uint8_t *bcd,
+				  const unsigned int len,
+				  bool little_endian,
+				  bool strip_sign_flag,
+				  bool use_telecom_digits);
+
+
+/**
+ * Function: scsisim_packed_bcd_to_ascii_buf
+ *
+ * Parameters:
+ * bcd:			Pointer to packed BCD buffer.
+ * len:			Length of packed BCD buffer.
+ * little_endian:	Whether the nibbles of each byte are little endian (true) or big endian (false).
+ * strip_sign_flag:	Strip terminating sign flag (usually 0xf) from unpacked ASCII string.
+ * use_telecom_digits:	Use telecom digits (*#, etc) in translation to ASCII chars.
+ * ascii:		(Output) Caller-supplied buffer for the ASCII string.
+ * ascii_len:		Length of ascii buffer; at least len * 2 + 1 bytes.
+ *
+ * Description: 
+ * Convert a packed BCD buffer to a null-terminated ASCII string in a 
+ * caller-supplied buffer, without allocating. On x86, this uses SSSE3 
+ * instructions when the CPU supports them.
+ *
+ * Return values: 
+ * Length of the ASCII string, or one of the following on failure:
+ * SCSISIM_INVALID_PARAM
+ * SCSISIM_BUFFER_TOO_SMALL
+ */
+int scsisim_packed_bcd_to_ascii_buf(const uint8_t *bcd,
+				    unsigned int len,
+				    bool little_endian,
+				    bool strip_sign_flag,
+				    bool use_telecom_digits,
+				    char *ascii,
+				    unsigned int ascii_len);
+
+
+/**
+ * Function: scsisim_unpack_septets
+ *
+ * Parameters:
+ * num_septets:		Number of septets in the packed buffer.
+ * packed:		Pointer to buffer of packed septets.
+ * packed_len:		Length of packed buffer in bytes.
+ * unpacked:		(Output) Pointer to unpacked buffer of octets. 
+ *			Caller's responsibility to free buffer when done.
+ * unpacked_len:	(Output) Length of unpacked buffer.
+ *
+ * Description: 
+ * Unpack a buffer of packed septets into a buffer of octets (bytes).
  *
  * Return values: 
  * None
@@ -637,6 +2542,112 @@ void scsisim_unpack_septets(const unsigned int num_septets,
 			    unsigned int *unpacked_len);
 
 
+/**
+ * Function: scsisim_unpack_septets_buf
+ *
+ * Parameters:
+ * num_septets:		Number of septets in the packed buffer.
+ * packed:		Pointer to buffer of packed septets.
+ * packed_len:		Length of packed buffer in bytes.
+ * unpacked:		(Output) Caller-supplied buffer for unpacked octets.
+ * unpacked_len:	Length of unpacked buffer in bytes.
+ *
+ * Description: 
+ * Unpack a buffer of packed septets into a caller-supplied buffer of 
+ * octets (bytes), without allocating. At most num_septets septets are 
+ * unpacked, and never more than packed_len * 8 / 7 or unpacked_len. 
+ * The output is not NUL-terminated. On x86, this uses SSSE3 or AVX2 
+ * instructions when the CPU supports them.
+ *
+ * Return values: 
+ * Number of septets unpacked.
+ */
+unsigned int scsisim_unpack_septets_buf(unsigned int num_septets,
+					const uint8_t *packed,
+					unsigned int packed_len,
+					uint8_t *unpacked,
+					unsigned int unpacked_len);
+
+
+/**
+ * Function: scsisim_pack_septets_buf
+ *
+ * Parameters:
+ * num_septets:		Number of septets to pack.
+ * unpacked:		Pointer to buffer of septets, one per byte.
+ * packed:		(Output) Caller-supplied buffer for packed septets.
+ * packed_len:		Length of packed buffer in bytes.
+ *
+ * Description: 
+ * Pack septets into a caller-supplied buffer, 8 septets to every 7 bytes:
+ * the inverse of scsisim_unpack_septets_buf(). The top bit of each 
+ * unpacked byte is ignored, and the unused bits of the last byte are 
+ * zero. At most packed_len * 8 / 7 septets are packed. On x86, this 
+ * uses SSSE3 or AVX2 instructions when the CPU supports them.
+ *
+ * Return values: 
+ * Number of bytes written to packed.
+ */
+unsigned int scsisim_pack_septets_buf(unsigned int num_septets,
+				      const uint8_t *unpacked,
+				      uint8_t *packed,
+				      unsigned int packed_len);
+
+
+/**
+ * Function: scsisim_ucs2_to_utf8
+ *
+ * Parameters:
+ * src:			Pointer to UCS-2 (UTF-16BE) buffer.
+ * src_len:		Length of src buffer in bytes.
+ * dest:		(Output) Caller-supplied buffer for the UTF-8 string.
+ * dest_len:		Length of dest buffer (src_len * 3 / 2 + 1 is enough).
+ *
+ * Description: 
+ * Convert UCS-2 text, as used in SMS messages with the UCS-2 character
+ * set, to a null-terminated UTF-8 string in a caller-supplied buffer, 
+ * without allocating. Surrogate pairs (UTF-16) become a single 
+ * character; a surrogate without its other half becomes U+FFFD. If dest
+ * is too small, it holds as many whole characters as fit. On x86, this 
+ * uses SSSE3 instructions when the CPU supports them.
+ *
+ * Return values: 
+ * Length of the string written to dest, or one of the following on failure:
+ * SCSISIM_INVALID_PARAM
+ * SCSISIM_BUFFER_TOO_SMALL
+ */
+int scsisim_ucs2_to_utf8(const uint8_t *src,
+			 unsigned int src_len,
+			 char *dest,
+			 unsigned int dest_len);
+
+
+/**
+ * Function: scsisim_utf8_to_ucs2
+ *
+ * Parameters:
+ * src:			Pointer to UTF-8 text (need not be null-terminated).
+ * src_len:		Length of src in bytes.
+ * dest:		(Output) Caller-supplied buffer for UCS-2 (UTF-16BE).
+ * dest_len:		Length of dest buffer (src_len * 2 is enough).
+ *
+ * Description: 
+ * The inverse of scsisim_ucs2_to_utf8(): convert UTF-8 text to UCS-2, as
+ * used for SMS messages and alpha identifiers that don't fit the GSM 
+ * alphabet. Characters past U+FFFF become UTF-16 surrogate pairs. The 
+ * output is not null-terminated.
+ *
+ * Return values: 
+ * Number of bytes written to dest, or one of the following on failure:
+ * SCSISIM_INVALID_PARAM (including malformed UTF-8)
+ * SCSISIM_BUFFER_TOO_SMALL
+ */
+int scsisim_utf8_to_ucs2(const char *src,
+			 unsigned int src_len,
+			 uint8_t *dest,
+			 unsigned int dest_len);
+
+
 /**
  * Function: scsisim_strerror
  *
@@ -645,6 +2656,8 @@ void scsisim_unpack_septets(const unsigned int num_septets,
  *
  * Description: 
  * Given an error code, return a corresponding human-readable string.
+ * The string is in a buffer of the calling thread, good until its next 
+ * call; see scsisim_strerror_r() to supply your own.
  *
  * Based in part on sample code from 'The Linux Programming Interface'
  * by Michael Kerrisk; see:
@@ -656,6 +2669,27 @@ void scsisim_unpack_septets(const unsigned int num_septets,
 char *scsisim_strerror(int err);
 
 
+/**
+ * Function: scsisim_strerror_r
+ *
+ * Parameters:
+ * err:			Error code number.
+ * buf:			(Output) Caller-supplied buffer for the message.
+ * len:			Length of buf.
+ *
+ * Description: 
+ * Reentrant scsisim_strerror(): write the human-readable string for an
+ * error code to a caller-supplied buffer, null-terminated. If buf is 
+ * too small, it holds as much of the message as fits.
+ *
+ * Return values: 
+ * SCSISIM_SUCCESS
+ * SCSISIM_INVALID_PARAM
+ * SCSISIM_BUFFER_TOO_SMALL
+ */
+int scsisim_strerror_r(int err, char *buf, unsigned int len);
+
+
 /**
  * Function: scsisim_perror
  *
@@ -665,7 +2699,8 @@ char *scsisim_strerror(int err);
  *
  * Description: 
  * Given an error code and an optional user-defined string, print 
- * a formatted error message to stderr (includes newline).
+ * a formatted error message to stderr (includes newline), or pass it to
+ * the log handler of the calling thread's context.
  *
  * Return values: 
  * None
@@ -681,7 +2716,10 @@ void scsisim_perror(const char *str, int err);
  * ...:			Optional arguments.
  *
  * Description: 
- * Print a formatted diagnostic message to stderr (includes newline). 
+ * Print a formatted diagnostic message to stderr (includes newline), or 
+ * pass it to the log handler of the calling thread's context. Each 
+ * message is written in one piece, so messages from different threads 
+ * do not interleave.
  *
  * Return values: 
  * None
@@ -711,7 +2749,7 @@ void scsisim_printf(const char* format, ...);
  * None
  *
  * Description: 
- * Determine if verbose output is enabled.
+ * Determine if verbose output is enabled in the calling thread's context.
  *
  * Return values: 
  * true if verbose output is enabled, false otherwise.
@@ -725,7 +2763,10 @@ bool scsisim_verbose(void);
  * None
  *
  * Description: 
- * Enable verbose output. Note that this results in A LOT of program output.
+ * Enable verbose output in the calling thread's context: the default 
+ * context, shared by every thread without one of its own, unless 
+ * scsisim_ctx_bind() says otherwise. Note that this results in A LOT of 
+ * program output.
  *
  * Return values: 
  * None
@@ -739,7 +2780,7 @@ void scsisim_verbose_enable(void);
  * None
  *
  * Description: 
- * Disable verbose output.
+ * Disable verbose output in the calling thread's context.
  *
  * Return values: 
  * None
@@ -747,6 +2788,110 @@ void scsisim_verbose_enable(void);
 void scsisim_verbose_disable(void);
 
 
+/**
+ * Function: scsisim_ctx_create
+ *
+ * Parameters:
+ * ctx:			(Output) Pointer to new context.
+ *
+ * Description: 
+ * Create a library context: the verbose setting and log handler that
+ * scsisim_verbose(), scsisim_pinfo() and scsisim_perror() use, and where
+ * to find sysfs. Every thread starts out using the default context, 
+ * which prints to stderr; a thread driving its own devices can bind its
+ * own context with scsisim_ctx_bind(), e.g., to turn on verbose output 
+ * for just those devices or to tag their messages. The library has no 
+ * other mutable global state: devices, virtual cards, reactors and 
+ * reassembly contexts each own their buffers, so different threads can
+ * use different ones at the same time. A new context has verbose output
+ * disabled and no log handler.
+ *
+ * Return values: 
+ * SCSISIM_SUCCESS
+ * SCSISIM_INVALID_PARAM
+ * SCSISIM_MEMORY_ALLOCATION_ERROR
+ */
+int scsisim_ctx_create(struct scsisim_ctx **ctx);
+
+
+/**
+ * Function: scsisim_ctx_destroy
+ *
+ * Parameters:
+ * ctx:			Context to free (can be NULL).
+ *
+ * Description: 
+ * Free a context. It must not be bound to any thread but the calling 
+ * one, from which it is unbound.
+ *
+ * Return values: 
+ * None
+ */
+void scsisim_ctx_destroy(struct scsisim_ctx *ctx);
+
+
+/**
+ * Function: scsisim_ctx_set_log
+ *
+ * Parameters:
+ * ctx:			Context.
+ * log:			(Can be NULL) Function to call with each message, 
+ *			instead of printing it to stderr: its level 
+ *			(SCSISIM_LOG_INFO or SCSISIM_LOG_ERROR) and text, 
+ *			without the brackets and newline.
+ * user_data:		Passed to log.
+ *
+ * Description: 
+ * Set the log handler of a context. Set it before binding the context
+ * to any thread; the verbose setting can be changed at any time.
+ *
+ * Return values: 
+ * None
+ */
+void scsisim_ctx_set_log(struct scsisim_ctx *ctx,
+			 void (*log)(void *user_data, int level, const char *msg),
+			 void *user_data);
+
+
+/**
+ * Function: scsisim_ctx_set_sysfs_root
+ *
+ * Parameters:
+ * ctx:			Context.
+ * root:		(Can be NULL) Where sysfs is mounted, or NULL for 
+ *			"/sys".
+ *
+ * Description: 
+ * Look up readers in a sysfs tree other than /sys, e.g., a fake one in a
+ * temporary directory for testing, or the host's sysfs bind-mounted into
+ * a container. Like the log handler, set it before binding the context
+ * to any thread.
+ *
+ * Return values: 
+ * SCSISIM_SUCCESS
+ * SCSISIM_INVALID_PARAM
+ * SCSISIM_MEMORY_ALLOCATION_ERROR
+ */
+int scsisim_ctx_set_sysfs_root(struct scsisim_ctx *ctx, const char *root);
+
+
+/**
+ * Function: scsisim_ctx_bind
+ *
+ * Parameters:
+ * ctx:			(Can be NULL) Context for the calling thread, or NULL
+ *			for the default context.
+ *
+ * Description: 
+ * Make ctx the context of the calling thread, for every library call it
+ * makes from now on. The same context can be bound to several threads.
+ *
+ * Return values: 
+ * The context bound before, or NULL if it was the default context.
+ */
+struct scsisim_ctx *scsisim_ctx_bind(struct scsisim_ctx *ctx);
+
+
 #endif /* __SCSISIM_H__ */
 
 /* EOF */
@@ -0,0 +1,69 @@
+/*
+ *  sim.h
+ *  SIM-related definitions for the scsisim library.
+ *  This is an internal interface file for the scsisim library.
+ *
+ *  Copyright (c) 2017, Chris Coffey <kpuc@sdf.org>
+ *
+ *  Permission to use, copy, modify, and/or distribute this software
+ *  for any purpose with or without fee is hereby granted, provided
+ *  that the above copyright notice and this permission notice appear
+ *  in all copies.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL 
+ *  WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED
+ *  WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE
+ *  AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL
+ *  DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE, DATA
+ *  OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER
+ *  TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ *  PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifndef __SCSISIM_SIM_H__
+#define __SCSISIM_SIM_H__
+
+#include <stdint.h>
+
+int sim_process_scsi_sense(const struct scsisim_dev *device,
+			   const uint8_t *sense,
+			   unsigned int len);
+
+void sim_prepare_select_file(const struct scsisim_dev *device,
+			     uint8_t *cdb,
+			     uint8_t *data,
+			     uint16_t file);
+
+void sim_prepare_get_response(const struct scsisim_dev *device,
+			      uint8_t *cdb,
+			      uint8_t len);
+
+void sim_prepare_read_record(const struct scsisim_dev *device,
+			     uint8_t *cdb,
+			     uint8_t recno,
+			     uint8_t len);
+
+void sim_prepare_read_binary(const struct scsisim_dev *device,
+			     uint8_t *cdb,
+			     uint16_t offset,
+			     uint8_t len);
+
+void sim_prepare_update_record(const struct scsisim_dev *device,
+			       uint8_t *cdb,
+			       uint8_t recno,
+			       uint8_t len);
+
+void sim_prepare_update_binary(const struct scsisim_dev *device,
+			       uint8_t *cdb,
+			       uint16_t offset,
+			       uint8_t len);
+
+void sim_prepare_seek(const struct scsisim_dev *device,
+		      uint8_t *cdb,
+		      uint8_t type_mode,
+		      uint8_t len);
+
+#endif  /* __SCSISIM_SIM_H__ */
+
+/* EOF */
+
@@ -0,0 +1,83 @@
+/*
+ *  simd.h
+ *  Definitions for the SIMD kernels in the scsisim library.
+ *  This is an internal interface file for the scsisim library.
+ *
+ *  Copyright (c) 2017, Chris Coffey <kpuc@sdf.org>
+ *
+ *  Permission to use, copy, modify, and/or distribute this software
+ *  for any purpose with or without fee is hereby granted, provided
+ *  that the above copyright notice and this permission notice appear
+ *  in all copies.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL 
+ *  WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED
+ *  WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE
+ *  AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL
+ *  DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE, DATA
+ *  OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER
+ *  TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ *  PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifndef __SCSISIM_SIMD_H__
+#define __SCSISIM_SIMD_H__
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/* The SIMD kernels are only built for x86 with GCC or Clang, which let us
+ * compile single functions for a newer instruction set than the rest of 
+ * the library, and pick one at run time. Everywhere else, callers use 
+ * their scalar code only. */
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define SIMD_X86	1
+#endif
+
+#ifdef SIMD_X86
+
+#define simd_have_sse2()	__builtin_cpu_supports("sse2")
+#define simd_have_ssse3()	__builtin_cpu_supports("ssse3")
+#define simd_have_avx2()	__builtin_cpu_supports("avx2")
+
+unsigned int simd_unpack_septets_ssse3(const uint8_t *packed,
+				       unsigned int packed_len,
+				       uint8_t *unpacked,
+				       unsigned int count);
+
+unsigned int simd_unpack_septets_avx2(const uint8_t *packed,
+				      unsigned int packed_len,
+				      uint8_t *unpacked,
+				      unsigned int count);
+
+unsigned int simd_pack_septets_ssse3(const uint8_t *unpacked,
+				     unsigned int count,
+				     uint8_t *packed,
+				     unsigned int packed_len);
+
+unsigned int simd_pack_septets_avx2(const uint8_t *unpacked,
+				    unsigned int count,
+				    uint8_t *packed,
+				    unsigned int packed_len);
+
+unsigned int simd_bcd_to_ascii_ssse3(const uint8_t *bcd,
+				     unsigned int len,
+				     bool little_endian,
+				     const char *digits,
+				     char *ascii);
+
+unsigned int simd_gsm_ascii_sse2(const uint8_t *src,
+				 unsigned int len,
+				 char *dest);
+
+unsigned int simd_ucs2_to_utf8_ssse3(const uint8_t *src,
+				     unsigned int src_len,
+				     char *dest,
+				     unsigned int dest_len,
+				     unsigned int *used);
+
+#endif  /* SIMD_X86 */
+
+#endif  /* __SCSISIM_SIMD_H__ */
+
+/* EOF */
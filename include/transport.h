@@ -0,0 +1,71 @@
+/*
+ *  transport.h
+ *  Transport backend definitions for the scsisim library.
+ *  This is an internal interface file for the scsisim library.
+ *
+ *  Copyright (c) 2017, Chris Coffey <kpuc@sdf.org>
+ *
+ *  Permission to use, copy, modify, and/or distribute this software
+ *  for any purpose with or without fee is hereby granted, provided
+ *  that the above copyright notice and this permission notice appear
+ *  in all copies.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL 
+ *  WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED
+ *  WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE
+ *  AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL
+ *  DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE, DATA
+ *  OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER
+ *  TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ *  PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifndef __SCSISIM_TRANSPORT_H__
+#define __SCSISIM_TRANSPORT_H__
+
+#include "scsi.h"
+
+/* Structure to hold the operations of a transport backend. Every SCSI 
+ * command sent by the library goes through scsi_send_cdb(), which hands 
+ * it to the backend of the device. If you want to carry commands over 
+ * something other than the SCSI generic driver, this is the place to do it. */
+struct scsisim_transport {
+
+	/* Name of the backend, for diagnostic output */
+	const char *name;
+
+	/* Obtain the USB vendor and product ID of the reader */
+	int (*get_vendor_product)(const struct scsisim_dev *device,
+				  unsigned int *vendor,
+				  unsigned int *product);
+
+	/* Send a CDB to the device and wait for it to complete. Fills in
+	 * data_xfered and sense_xfered in the scsi_cmd struct. */
+	int (*send_cdb)(const struct scsisim_dev *device,
+			struct scsi_cmd *my_cmd);
+
+	/* Queue a CDB without waiting for it to complete. The scsi_cmd struct
+	 * and its buffers must stay valid until reap_cdb hands it back. */
+	int (*submit_cdb)(const struct scsisim_dev *device,
+			  struct scsi_cmd *my_cmd);
+
+	/* Wait up to 'timeout' milliseconds (-1 = forever, 0 = don't wait)
+	 * for a queued CDB to complete, and hand it back. Fills in
+	 * data_xfered and sense_xfered. */
+	int (*reap_cdb)(const struct scsisim_dev *device,
+			struct scsi_cmd **my_cmd,
+			int timeout);
+
+	/* Release the device and any backend-specific state */
+	int (*close)(struct scsisim_dev *device);
+};
+
+/* SCSI generic (sg) backend for real readers; see scsi.c */
+extern const struct scsisim_transport scsi_sg_transport;
+
+/* In-memory virtual SIM card backend; see vcard.c */
+extern const struct scsisim_transport vcard_transport;
+
+#endif  /* __SCSISIM_TRANSPORT_H__ */
+
+/* EOF */
@@ -25,12 +25,20 @@
 
 #include <stdbool.h>
 
-#define SYSFS_SG_BASE_PATH	"/sys/class/scsi_generic"
+#define SYSFS_SG_CLASS_DIR	"class/scsi_generic"	/* Under the sysfs root */
 
 int usb_get_vendor_product(const struct scsisim_dev *device,
 			   unsigned int *vendor,
 			   unsigned int *product);
 
+int usb_enumerate_devices(const unsigned int supported_devices[][3],
+			  struct scsisim_device_info *devices,
+			  unsigned int max);
+
+int usb_identify_device(const unsigned int supported_devices[][3],
+			const char *name,
+			struct scsisim_device_info *info);
+
 bool usb_is_device_supported(struct scsisim_dev *device,
 			     unsigned int vendor,
 			     unsigned int product,
@@ -29,10 +29,25 @@
 #define MIN(x,y) (((x) < (y)) ? (x) : (y))
 #define MAX(x,y) (((x) > (y)) ? (x) : (y))
 
+/* Where sysfs is mounted, unless the context says otherwise */
+#define SYSFS_ROOT	"/sys"
+
 void print_binary_buffer(const uint8_t *buf, const unsigned int len);
 
 bool is_digit_string(const char *str);
 
+unsigned int utf8_encode(uint32_t ch, char *utf8);
+
+unsigned int utf8_decode(const char *utf8, unsigned int len, uint32_t *ch);
+
+int utf8_to_ucs2(const char *src,
+		 unsigned int src_len,
+		 uint8_t *dest,
+		 unsigned int dest_len,
+		 unsigned int *consumed);
+
+const char *utils_sysfs_root(void);
+
 #endif  /* __SCSISIM_UTILS_H__ */
 
 /* EOF */
@@ -0,0 +1,472 @@
+/*
+ *  async.c
+ *  Asynchronous (pipelined) command submission for the scsisim library.
+ *
+ *  Copyright (c) 2017, Chris Coffey <kpuc@sdf.org>
+ *
+ *  Permission to use, copy, modify, and/or distribute this software
+ *  for any purpose with or without fee is hereby granted, provided
+ *  that the above copyright notice and this permission notice appear
+ *  in all copies.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL 
+ *  WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED
+ *  WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE
+ *  AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL
+ *  DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE, DATA
+ *  OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER
+ *  TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ *  PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdbool.h>
+
+#include "scsisim.h"
+#include "gsm.h"
+#include "scsi.h"
+#include "device.h"
+#include "utils.h"
+#include "sim.h"
+#include "async.h"
+#include "cache.h"
+
+#define ASYNC_MAX_SENSE_LEN	64
+#define ASYNC_DRAIN_TIMEOUT	1000	/* Milliseconds to wait for each command
+					   abandoned after a reap error */
+
+/* What to do with the result of a command when it is reaped */
+enum {
+	ASYNC_CMD_SELECT = 0,
+	ASYNC_CMD_GET_RESPONSE,
+	ASYNC_CMD_UPDATE_RECORD,
+	ASYNC_CMD_OTHER
+};
+
+/* Structure to hold one command in flight. Everything the transport
+ * backend needs must live here, since the caller's stack frame is gone
+ * by the time the command completes. */
+struct async_slot {
+	bool busy;
+	int kind;			/* ASYNC_CMD_* constant */
+	struct scsi_cmd cmd;
+	uint8_t cdb[MAX_CDB_LEN];
+	uint8_t sense[ASYNC_MAX_SENSE_LEN];
+	uint8_t select_data[GSM_CMD_SELECT_DATA_LEN];
+	int command;			/* GET RESPONSE only */
+	struct GSM_response *resp;	/* GET RESPONSE only */
+	void *user_data;
+};
+
+struct scsisim_async {
+	struct async_slot slot[SCSISIM_MAX_PENDING];
+	unsigned int pending;
+};
+
+static int async_get_slot(struct scsisim_dev *device, struct async_slot **slot);
+static int async_submit(struct scsisim_dev *device,
+			struct async_slot *slot,
+			int direction,
+			uint8_t *data,
+			unsigned int len);
+static void async_abandon(struct scsisim_dev *device);
+
+
+/**
+ * For information about this function, see scsisim.h
+ */
+int scsisim_submit_select_file(struct scsisim_dev *device,
+			       uint16_t file,
+			       void *user_data)
+{
+	int ret;
+	struct async_slot *slot;
+
+	if (device == NULL)
+		return SCSISIM_INVALID_PARAM;
+
+	if ((ret = async_get_slot(device, &slot)) != SCSISIM_SUCCESS)
+		return ret;
+
+	sim_prepare_select_file(device, slot->cdb, slot->select_data, file);
+
+	/* The metadata cache does not follow asynchronous SELECTs */
+	cache_forget_position(device);
+
+	slot->kind = ASYNC_CMD_SELECT;
+	slot->user_data = user_data;
+
+	return async_submit(device, slot, SIM_WRITE, slot->select_data, sizeof(slot->select_data));
+}
+
+/**
+ * For information about this function, see scsisim.h
+ */
+int scsisim_submit_get_response(struct scsisim_dev *device,
+				uint8_t *data,
+				uint8_t len,
+				int command,
+				struct GSM_response *resp,
+				void *user_data)
+{
+	int ret;
+	struct async_slot *slot;
+
+	if (device == NULL || data == NULL || len == 0 || resp == NULL)
+		return SCSISIM_INVALID_PARAM;
+
+	if ((ret = async_get_slot(device, &slot)) != SCSISIM_SUCCESS)
+		return ret;
+
+	sim_prepare_get_response(device, slot->cdb, len);
+
+	slot->kind = ASYNC_CMD_GET_RESPONSE;
+	slot->command = command;
+	slot->resp = resp;
+	slot->user_data = user_data;
+
+	return async_submit(device, slot, SIM_READ, data, len);
+}
+
+/**
+ * For information about this function, see scsisim.h
+ */
+int scsisim_submit_read_record(struct scsisim_dev *device,
+			       uint8_t recno,
+			       uint8_t *data,
+			       uint8_t len,
+			       void *user_data)
+{
+	int ret;
+	struct async_slot *slot;
+
+	if (device == NULL || recno == 0 || data == NULL || len == 0)
+		return SCSISIM_INVALID_PARAM;
+
+	if ((ret = async_get_slot(device, &slot)) != SCSISIM_SUCCESS)
+		return ret;
+
+	sim_prepare_read_record(device, slot->cdb, recno, len);
+
+	slot->kind = ASYNC_CMD_OTHER;
+	slot->user_data = user_data;
+
+	return async_submit(device, slot, SIM_READ, data, len);
+}
+
+/**
+ * For information about this function, see scsisim.h
+ */
+int scsisim_submit_read_binary(struct scsisim_dev *device,
+			       uint8_t *data,
+			       uint16_t offset,
+			       uint8_t len,
+			       void *user_data)
+{
+	int ret;
+	struct async_slot *slot;
+
+	if (device == NULL || data == NULL || len == 0)
+		return SCSISIM_INVALID_PARAM;
+
+	if ((ret = async_get_slot(device, &slot)) != SCSISIM_SUCCESS)
+		return ret;
+
+	sim_prepare_read_binary(device, slot->cdb, offset, len);
+
+	slot->kind = ASYNC_CMD_OTHER;
+	slot->user_data = user_data;
+
+	return async_submit(device, slot, SIM_READ, data, len);
+}
+
+/**
+ * For information about this function, see scsisim.h
+ */
+int scsisim_submit_update_record(struct scsisim_dev *device,
+				 uint8_t recno,
+				 uint8_t *data,
+				 uint8_t len,
+				 void *user_data)
+{
+	int ret;
+	struct async_slot *slot;
+
+	if (device == NULL || recno == 0 || data == NULL || len == 0)
+		return SCSISIM_INVALID_PARAM;
+
+	if ((ret = async_get_slot(device, &slot)) != SCSISIM_SUCCESS)
+		return ret;
+
+	sim_prepare_update_record(device, slot->cdb, recno, len);
+
+	slot->kind = ASYNC_CMD_UPDATE_RECORD;
+	slot->user_data = user_data;
+
+	return async_submit(device, slot, SIM_WRITE, data, len);
+}
+
+/**
+ * For information about this function, see scsisim.h
+ */
+int scsisim_submit_update_binary(struct scsisim_dev *device,
+				 uint8_t *data,
+				 uint16_t offset,
+				 uint8_t len,
+				 void *user_data)
+{
+	int ret;
+	struct async_slot *slot;
+
+	if (device == NULL || data == NULL || len == 0)
+		return SCSISIM_INVALID_PARAM;
+
+	if ((ret = async_get_slot(device, &slot)) != SCSISIM_SUCCESS)
+		return ret;
+
+	sim_prepare_update_binary(device, slot->cdb, offset, len);
+
+	slot->kind = ASYNC_CMD_OTHER;
+	slot->user_data = user_data;
+
+	return async_submit(device, slot, SIM_WRITE, data, len);
+}
+
+/**
+ * For information about this function, see scsisim.h
+ */
+int scsisim_reap(struct scsisim_dev *device,
+		 struct scsisim_request *req,
+		 int timeout)
+{
+	int ret;
+	struct scsi_cmd *my_cmd;
+	struct async_slot *slot;
+
+	if (device == NULL || req == NULL)
+		return SCSISIM_INVALID_PARAM;
+
+	if (device->async == NULL || device->async->pending == 0)
+		return SCSISIM_NO_COMMANDS_PENDING;
+
+	if ((ret = scsi_reap_cdb(device, &my_cmd, timeout)) != SCSISIM_SUCCESS)
+	{
+		/* A command may have been lost: we can't tell which, so we
+		 * can't wait for the rest either */
+		if (ret != SCSISIM_TIMEOUT)
+			async_abandon(device);
+
+		return ret;
+	}
+
+	/* The pack ID is the slot index; see async_submit() */
+	if (my_cmd->pack_id < 0 || my_cmd->pack_id >= SCSISIM_MAX_PENDING ||
+	    device->async->slot[my_cmd->pack_id].busy == false)
+	{
+		async_abandon(device);
+		return SCSISIM_SCSI_RECEIVE_ERROR;
+	}
+
+	slot = &device->async->slot[my_cmd->pack_id];
+
+	/* Work out the same return value the synchronous function would */
+	switch (slot->kind)
+	{
+		case ASYNC_CMD_SELECT:
+			/* There should ALWAYS be sense data after selecting a file */
+			if (my_cmd->sense_xfered)
+				req->status = sim_process_scsi_sense(device, my_cmd->sense, my_cmd->sense_xfered);
+			else
+				req->status = SCSISIM_SCSI_NO_SENSE_DATA;
+			break;
+		case ASYNC_CMD_GET_RESPONSE:
+			slot->resp->command = slot->command;
+
+			if ((req->status = gsm_parse_response(my_cmd->data, my_cmd->data_len, slot->resp)) != SCSISIM_SUCCESS)
+				scsisim_perror("scsisim_reap()", req->status);
+
+			if (my_cmd->sense_xfered)
+				req->status = sim_process_scsi_sense(device, my_cmd->sense, my_cmd->sense_xfered);
+			break;
+		default:
+			if (my_cmd->sense_xfered)
+				req->status = sim_process_scsi_sense(device, my_cmd->sense, my_cmd->sense_xfered);
+			else
+				req->status = SCSISIM_SUCCESS;
+
+			/* Keep the record maps in the metadata cache up to date */
+			if (slot->kind == ASYNC_CMD_UPDATE_RECORD && req->status == SCSISIM_SUCCESS)
+				cache_record_written(device,
+						     slot->cdb[sim_devices[device->index].update_record_rec_offset],
+						     my_cmd->data,
+						     my_cmd->data_len);
+			break;
+	}
+
+	req->user_data = slot->user_data;
+	req->data_xfered = my_cmd->data_xfered;
+
+	slot->busy = false;
+	device->async->pending--;
+
+	return SCSISIM_SUCCESS;
+}
+
+/**
+ * For information about this function, see scsisim.h
+ */
+unsigned int scsisim_pending(const struct scsisim_dev *device)
+{
+	if (device == NULL || device->async == NULL)
+		return 0;
+
+	return device->async->pending;
+}
+
+/**
+ * Function: async_free
+ *
+ * Parameters:
+ * device:	Pointer to scsisim_dev struct.
+ *
+ * Description: 
+ * Free the asynchronous command state of a device. Called when the 
+ * device is closed; any commands still in flight are abandoned.
+ *
+ * Return value: 
+ * None
+ */
+void async_free(struct scsisim_dev *device)
+{
+	free(device->async);
+	device->async = NULL;
+}
+
+/**
+ * Function: async_get_slot
+ *
+ * Parameters:
+ * device:	Pointer to scsisim_dev struct.
+ * slot:	(Output) Pointer to a free slot.
+ *
+ * Description: 
+ * Find a free slot for a new command, allocating the asynchronous 
+ * command state of the device on first use.
+ *
+ * Return values: 
+ * SCSISIM_SUCCESS
+ * SCSISIM_QUEUE_FULL
+ * SCSISIM_MEMORY_ALLOCATION_ERROR
+ */
+static int async_get_slot(struct scsisim_dev *device, struct async_slot **slot)
+{
+	int i;
+
+	if (device->async == NULL &&
+	    (device->async = calloc(1, sizeof(struct scsisim_async))) == NULL)
+		return SCSISIM_MEMORY_ALLOCATION_ERROR;
+
+	for (i = 0; i < SCSISIM_MAX_PENDING; i++)
+	{
+		if (device->async->slot[i].busy == false)
+		{
+			*slot = &device->async->slot[i];
+			return SCSISIM_SUCCESS;
+		}
+	}
+
+	return SCSISIM_QUEUE_FULL;
+}
+
+/**
+ * Function: async_submit
+ *
+ * Parameters:
+ * device:	Pointer to scsisim_dev struct.
+ * slot:	Slot holding the prepared CDB.
+ * direction:	SIM_READ or SIM_WRITE.
+ * data:	Data buffer for command.
+ * len:		Length of data buffer.
+ *
+ * Description: 
+ * Set up the command block of a slot and queue it on the device. The 
+ * slot index doubles as the pack ID, so scsisim_reap() can find the slot
+ * again when the command completes.
+ *
+ * Return values: 
+ * SCSISIM_SUCCESS
+ * Return value from scsi_submit_cdb
+ */
+static int async_submit(struct scsisim_dev *device,
+			struct async_slot *slot,
+			int direction,
+			uint8_t *data,
+			unsigned int len)
+{
+	int ret;
+	struct scsi_cmd *my_cmd = &slot->cmd;
+
+	memset(my_cmd, 0, sizeof(struct scsi_cmd));
+	memset(slot->sense, 0, sizeof(slot->sense));
+
+	/* Set up the command block */
+	my_cmd->direction = direction;
+	my_cmd->cdb = slot->cdb;
+	my_cmd->cdb_len = sim_devices[device->index].cdb_len;
+	my_cmd->data = data;
+	my_cmd->data_len = len;
+	my_cmd->sense = slot->sense;
+	my_cmd->sense_len = MIN(sim_devices[device->index].sense_len, ASYNC_MAX_SENSE_LEN);
+	my_cmd->pack_id = (int)(slot - device->async->slot);
+
+	/* Queue the command */
+	if ((ret = scsi_submit_cdb(device, my_cmd)) == SCSISIM_SUCCESS)
+	{
+		slot->busy = true;
+		device->async->pending++;
+	}
+
+	return ret;
+}
+
+/**
+ * Function: async_abandon
+ *
+ * Parameters:
+ * device:	Pointer to scsisim_dev struct.
+ *
+ * Description: 
+ * Give up on every command in flight after a reap error, so that the 
+ * device is usable again. Commands that still complete within 
+ * ASYNC_DRAIN_TIMEOUT are collected and discarded first, so they can't 
+ * turn up later in a slot that has been reused. Whether any of them 
+ * changed the card is unknown, so the metadata cache is flushed too.
+ *
+ * Return value: 
+ * None
+ */
+static void async_abandon(struct scsisim_dev *device)
+{
+	unsigned int i;
+	struct scsi_cmd *my_cmd;
+
+	for (i = 0; i < device->async->pending; i++)
+	{
+		if (scsi_reap_cdb(device, &my_cmd, ASYNC_DRAIN_TIMEOUT) != SCSISIM_SUCCESS)
+			break;
+	}
+
+	if (scsisim_verbose())
+		scsisim_pinfo("%s: %s: abandoned %u commands", __func__,
+			      device->name, device->async->pending);
+
+	for (i = 0; i < SCSISIM_MAX_PENDING; i++)
+		device->async->slot[i].busy = false;
+
+	device->async->pending = 0;
+	cache_invalidate(device);
+}
+
+/* EOF */
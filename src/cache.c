@@ -0,0 +1,759 @@
+/*
+ *  cache.c
+ *  File metadata cache for the scsisim library.
+ *
+ *  Copyright (c) 2017, Chris Coffey <kpuc@sdf.org>
+ *
+ *  Permission to use, copy, modify, and/or distribute this software
+ *  for any purpose with or without fee is hereby granted, provided
+ *  that the above copyright notice and this permission notice appear
+ *  in all copies.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL 
+ *  WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED
+ *  WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE
+ *  AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL
+ *  DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE, DATA
+ *  OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER
+ *  TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ *  PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdbool.h>
+
+#include "scsisim.h"
+#include "gsm.h"
+#include "utils.h"
+#include "cache.h"
+
+#define CACHE_MAX_DEPTH		SCSISIM_MAX_PATH_DEPTH
+#define CACHE_MAX_ENTRIES	32
+#define CACHE_MAX_RESPONSE_LEN	64
+#define CACHE_MAX_RECORD_MAPS	16
+
+/* Structure to hold the GET RESPONSE data of one file, keyed by its path
+ * from the MF. A depth of 0 marks an unused entry. */
+struct cache_entry {
+	uint16_t path[CACHE_MAX_DEPTH];
+	uint8_t depth;
+	uint8_t response_len;		/* 0 if not fetched yet */
+	uint8_t response[CACHE_MAX_RESPONSE_LEN];
+};
+
+/* Structure to hold which records of an EF match a test (start with a 
+ * given byte, or are free ADN records; see cache_record_matches()), keyed
+ * by the path of the EF and the test. A depth of 0 marks an unused map. */
+struct cache_record_map {
+	uint16_t path[CACHE_MAX_DEPTH];
+	uint8_t depth;
+	unsigned int match;
+	uint8_t num_records;
+	uint8_t bitmap[SCSISIM_RECORD_BITMAP_LEN];
+};
+
+/* Structure to hold what we know about the card behind a device: which DF
+ * and EF are currently selected, the response data of files we have
+ * selected before, and record maps of EFs we have searched before. */
+struct scsisim_cache {
+	uint16_t df_path[CACHE_MAX_DEPTH];	/* Path of the current DF */
+	uint8_t df_depth;			/* 0 if unknown */
+	uint16_t ef;				/* Current EF, 0 if none */
+	struct cache_entry *selected;		/* File selected last, or NULL */
+	uint8_t selected_len;			/* Response length it reported */
+	struct cache_entry entry[CACHE_MAX_ENTRIES];
+	unsigned int next_victim;
+	struct cache_record_map map[CACHE_MAX_RECORD_MAPS];
+	unsigned int next_map_victim;
+};
+
+
+/**
+ * For information about this function, see scsisim.h
+ */
+void scsisim_cache_invalidate(const struct scsisim_dev *device)
+{
+	if (device != NULL)
+		cache_invalidate(device);
+}
+
+/**
+ * Function: cache_create
+ *
+ * Parameters:
+ * device:	Pointer to scsisim_dev struct.
+ *
+ * Description: 
+ * Allocate an empty metadata cache for a newly opened device.
+ *
+ * Return values: 
+ * SCSISIM_SUCCESS
+ * SCSISIM_MEMORY_ALLOCATION_ERROR
+ */
+int cache_create(struct scsisim_dev *device)
+{
+	if ((device->cache = calloc(1, sizeof(struct scsisim_cache))) == NULL)
+		return SCSISIM_MEMORY_ALLOCATION_ERROR;
+
+	return SCSISIM_SUCCESS;
+}
+
+/**
+ * Function: cache_free
+ *
+ * Parameters:
+ * device:	Pointer to scsisim_dev struct.
+ *
+ * Description: 
+ * Free the metadata cache of a device.
+ *
+ * Return value: 
+ * None
+ */
+void cache_free(struct scsisim_dev *device)
+{
+	free(device->cache);
+	device->cache = NULL;
+}
+
+/**
+ * Function: cache_invalidate
+ *
+ * Parameters:
+ * device:	Pointer to scsisim_dev struct.
+ *
+ * Description: 
+ * Forget everything we know about the card, e.g., because the reader was
+ * reinitialized or the card may have been swapped.
+ *
+ * Return value: 
+ * None
+ */
+void cache_invalidate(const struct scsisim_dev *device)
+{
+	if (device->cache == NULL)
+		return;
+
+	if (scsisim_verbose())
+		scsisim_pinfo("%s: metadata cache invalidated", __func__);
+
+	memset(device->cache, 0, sizeof(struct scsisim_cache));
+}
+
+/**
+ * Function: cache_forget_position
+ *
+ * Parameters:
+ * device:	Pointer to scsisim_dev struct.
+ *
+ * Description: 
+ * Forget which file is currently selected, e.g., because a SELECT went
+ * out that the cache did not see the result of. The response data of
+ * files is kept.
+ *
+ * Return value: 
+ * None
+ */
+void cache_forget_position(const struct scsisim_dev *device)
+{
+	if (device->cache == NULL)
+		return;
+
+	device->cache->df_depth = 0;
+	device->cache->ef = 0;
+	device->cache->selected = NULL;
+}
+
+/**
+ * Function: cache_forget_responses
+ *
+ * Parameters:
+ * device:	Pointer to scsisim_dev struct.
+ *
+ * Description: 
+ * Forget the response data of all files, e.g., because a VERIFY CHV 
+ * changed the CHV status reported for the MF and DFs. The current 
+ * position is kept.
+ *
+ * Return value: 
+ * None
+ */
+void cache_forget_responses(const struct scsisim_dev *device)
+{
+	int i;
+
+	if (device->cache == NULL)
+		return;
+
+	for (i = 0; i < CACHE_MAX_ENTRIES; i++)
+		device->cache->entry[i].response_len = 0;
+}
+
+/**
+ * Function: cache_forget_selected
+ *
+ * Parameters:
+ * device:	Pointer to scsisim_dev struct.
+ *
+ * Description: 
+ * A command other than SELECT has left its own response data on the 
+ * card (e.g., a SEEK of type 2), so the next GET RESPONSE is not about
+ * the file selected last and must not be served from the cache. The
+ * current position and the response data of files are kept.
+ *
+ * Return value: 
+ * None
+ */
+void cache_forget_selected(const struct scsisim_dev *device)
+{
+	if (device->cache == NULL)
+		return;
+
+	device->cache->selected = NULL;
+}
+
+/**
+ * Function: cache_get_position
+ *
+ * Parameters:
+ * device:	Pointer to scsisim_dev struct.
+ * path:	(Output) Path of the current DF from the MF; room for
+ *		SCSISIM_MAX_PATH_DEPTH entries.
+ * ef:		(Output) Current EF, or 0 if none.
+ *
+ * Description: 
+ * Get the current position on the card, as far as the cache knows.
+ *
+ * Return value: 
+ * Depth of the current DF (1 = MF), or 0 if unknown.
+ */
+int cache_get_position(const struct scsisim_dev *device,
+		       uint16_t *path,
+		       uint16_t *ef)
+{
+	struct scsisim_cache *cache = device->cache;
+
+	*ef = 0;
+
+	if (cache == NULL || cache->df_depth == 0)
+		return 0;
+
+	memcpy(path, cache->df_path, cache->df_depth * sizeof(uint16_t));
+	*ef = cache->ef;
+
+	return cache->df_depth;
+}
+
+/**
+ * Function: cache_path_of
+ *
+ * Parameters:
+ * cache:	Pointer to metadata cache.
+ * file:	File ID.
+ * path:	(Output) Path of the file from the MF.
+ * depth:	(Output) Number of entries in path.
+ *
+ * Description: 
+ * Work out where a file would be selected from the current DF. The first
+ * byte of a file ID tells its level in the tree (see GSM spec, 6.2): 3F 
+ * is the MF, 7F a DF under the MF, 5F a DF under a 7F DF, and 2F, 6F and 
+ * 4F are EFs under the MF, a 7F DF and a 5F DF, respectively.
+ *
+ * Return values: 
+ * true - The path is known.
+ * false - The path can't be determined.
+ */
+static bool cache_path_of(const struct scsisim_cache *cache,
+			  uint16_t file,
+			  uint16_t *path,
+			  uint8_t *depth)
+{
+	uint8_t parent_depth;
+
+	switch (file >> 8)
+	{
+		case 0x3f:
+			path[0] = file;
+			*depth = 1;
+			return true;
+		case 0x7f:
+			path[0] = GSM_FILE_MF;
+			path[1] = file;
+			*depth = 2;
+			return true;
+		case 0x5f:
+			/* Selectable from its parent DF or a sibling */
+			if (cache->df_depth < 2)
+				return false;
+			memcpy(path, cache->df_path, 2 * sizeof(uint16_t));
+			path[2] = file;
+			*depth = 3;
+			return true;
+		case 0x2f:
+			parent_depth = 1;
+			break;
+		case 0x6f:
+			parent_depth = 2;
+			break;
+		case 0x4f:
+			parent_depth = 3;
+			break;
+		default:
+			return false;
+	}
+
+	/* An EF can only be selected from its own DF */
+	if (cache->df_depth != parent_depth)
+		return false;
+
+	memcpy(path, cache->df_path, parent_depth * sizeof(uint16_t));
+	path[parent_depth] = file;
+	*depth = parent_depth + 1;
+
+	return true;
+}
+
+/**
+ * Function: cache_find
+ *
+ * Parameters:
+ * cache:	Pointer to metadata cache.
+ * path:	Path of the file from the MF.
+ * depth:	Number of entries in path.
+ * create:	Whether to create the entry if it does not exist.
+ *
+ * Description: 
+ * Look up the entry for a path. New entries replace old ones round-robin
+ * once the cache is full.
+ *
+ * Return value: 
+ * Pointer to the entry, or NULL if not found.
+ */
+static struct cache_entry *cache_find(struct scsisim_cache *cache,
+				      const uint16_t *path,
+				      uint8_t depth,
+				      bool create)
+{
+	int i;
+	struct cache_entry *entry;
+
+	for (i = 0; i < CACHE_MAX_ENTRIES; i++)
+	{
+		entry = &cache->entry[i];
+
+		if (entry->depth == depth &&
+		    memcmp(entry->path, path, depth * sizeof(uint16_t)) == 0)
+			return entry;
+	}
+
+	if (create == false)
+		return NULL;
+
+	entry = &cache->entry[cache->next_victim];
+	cache->next_victim = (cache->next_victim + 1) % CACHE_MAX_ENTRIES;
+
+	if (entry == cache->selected)
+		cache->selected = NULL;
+
+	memset(entry, 0, sizeof(struct cache_entry));
+	memcpy(entry->path, path, depth * sizeof(uint16_t));
+	entry->depth = depth;
+
+	return entry;
+}
+
+/**
+ * Function: cache_select
+ *
+ * Parameters:
+ * device:	Pointer to scsisim_dev struct.
+ * file:	File ID about to be selected.
+ *
+ * Description: 
+ * Check whether a SELECT can be skipped, because the file is already the
+ * current one and we have its response data.
+ *
+ * Return values: 
+ * Length of the response data (the SELECT can be skipped)
+ * 0 (the SELECT must be sent)
+ */
+int cache_select(const struct scsisim_dev *device, uint16_t file)
+{
+	struct scsisim_cache *cache = device->cache;
+	struct cache_entry *entry;
+	uint16_t path[CACHE_MAX_DEPTH];
+	uint8_t depth;
+
+	if (cache == NULL || cache->df_depth == 0 ||
+	    cache_path_of(cache, file, path, &depth) == false)
+		return 0;
+
+	/* Selecting a DF also deselects the current EF, so it can only be 
+	 * skipped if there is no current EF */
+	if ((depth == cache->df_depth && cache->ef == 0 &&
+	     memcmp(path, cache->df_path, depth * sizeof(uint16_t)) == 0) ||
+	    (depth == cache->df_depth + 1 && cache->ef == file))
+	{
+		if ((entry = cache_find(cache, path, depth, false)) != NULL &&
+		    entry->response_len)
+		{
+			if (scsisim_verbose())
+				scsisim_pinfo("%s: %04x is already selected", __func__, file);
+
+			cache->selected = entry;
+			cache->selected_len = entry->response_len;
+			return entry->response_len;
+		}
+	}
+
+	return 0;
+}
+
+/**
+ * Function: cache_selected
+ *
+ * Parameters:
+ * device:	Pointer to scsisim_dev struct.
+ * file:	File ID that was selected.
+ * ret:		Return value of the SELECT.
+ *
+ * Description: 
+ * Update the current position after a SELECT went out to the card.
+ *
+ * Return value: 
+ * None
+ */
+void cache_selected(const struct scsisim_dev *device, uint16_t file, int ret)
+{
+	struct scsisim_cache *cache = device->cache;
+	uint16_t path[CACHE_MAX_DEPTH];
+	uint8_t depth;
+
+	if (cache == NULL)
+		return;
+
+	cache->selected = NULL;
+
+	/* A failed SELECT leaves the current file as it was */
+	if (ret <= 0)
+		return;
+
+	if (cache_path_of(cache, file, path, &depth) == false)
+	{
+		cache_forget_position(device);
+		return;
+	}
+
+	if (GSM_FILE_IS_DF(file))
+	{
+		memcpy(cache->df_path, path, depth * sizeof(uint16_t));
+		cache->df_depth = depth;
+		cache->ef = 0;
+	}
+	else
+		cache->ef = file;
+
+	cache->selected = cache_find(cache, path, depth, true);
+	cache->selected_len = (uint8_t)ret;
+
+	/* The card says the response has changed size: don't trust ours */
+	if (cache->selected->response_len != cache->selected_len)
+		cache->selected->response_len = 0;
+}
+
+/**
+ * Function: cache_get_response
+ *
+ * Parameters:
+ * device:	Pointer to scsisim_dev struct.
+ * data:	Buffer for response data.
+ * len:		Length of data buffer.
+ *
+ * Description: 
+ * Check whether a GET RESPONSE can be skipped, because we already have 
+ * the response data of the file selected last.
+ *
+ * Return values: 
+ * Number of bytes copied to data (the GET RESPONSE can be skipped)
+ * 0 (the GET RESPONSE must be sent)
+ */
+int cache_get_response(const struct scsisim_dev *device, uint8_t *data, uint8_t len)
+{
+	struct scsisim_cache *cache = device->cache;
+	unsigned int copy;
+
+	if (cache == NULL || cache->selected == NULL || cache->selected->response_len == 0)
+		return 0;
+
+	copy = MIN(len, cache->selected->response_len);
+	memcpy(data, cache->selected->response, copy);
+
+	return copy;
+}
+
+/**
+ * Function: cache_store_response
+ *
+ * Parameters:
+ * device:	Pointer to scsisim_dev struct.
+ * data:	Response data from the card.
+ * len:		Number of bytes received.
+ *
+ * Description: 
+ * Remember the response data of the file selected last. Only complete
+ * responses are kept, so a later caller asking for more bytes still
+ * gets all of them.
+ *
+ * Return value: 
+ * None
+ */
+void cache_store_response(const struct scsisim_dev *device,
+			  const uint8_t *data,
+			  unsigned int len)
+{
+	struct scsisim_cache *cache = device->cache;
+
+	if (cache == NULL || cache->selected == NULL ||
+	    len != cache->selected_len || len > CACHE_MAX_RESPONSE_LEN)
+		return;
+
+	memcpy(cache->selected->response, data, len);
+	cache->selected->response_len = (uint8_t)len;
+}
+
+/**
+ * Function: cache_current_ef
+ *
+ * Parameters:
+ * cache:	Pointer to metadata cache.
+ * path:	(Output) Path of the current EF from the MF.
+ * depth:	(Output) Number of entries in path.
+ *
+ * Description: 
+ * Get the path of the current EF.
+ *
+ * Return values: 
+ * true - The path is known.
+ * false - No EF is selected, or we don't know which one.
+ */
+static bool cache_current_ef(const struct scsisim_cache *cache,
+			     uint16_t *path,
+			     uint8_t *depth)
+{
+	if (cache->df_depth == 0 || cache->df_depth >= CACHE_MAX_DEPTH || cache->ef == 0)
+		return false;
+
+	memcpy(path, cache->df_path, cache->df_depth * sizeof(uint16_t));
+	path[cache->df_depth] = cache->ef;
+	*depth = cache->df_depth + 1;
+
+	return true;
+}
+
+/**
+ * Function: cache_find_record_map
+ *
+ * Parameters:
+ * cache:	Pointer to metadata cache.
+ * path:	Path of the EF from the MF.
+ * depth:	Number of entries in path.
+ * match:	Test the map is about: see cache_record_matches().
+ *
+ * Description: 
+ * Look up the record map of an EF for a test.
+ *
+ * Return value: 
+ * Pointer to the map, or NULL if not found.
+ */
+static struct cache_record_map *cache_find_record_map(struct scsisim_cache *cache,
+						      const uint16_t *path,
+						      uint8_t depth,
+						      unsigned int match)
+{
+	int i;
+	struct cache_record_map *map;
+
+	for (i = 0; i < CACHE_MAX_RECORD_MAPS; i++)
+	{
+		map = &cache->map[i];
+
+		if (map->depth == depth && map->match == match &&
+		    memcmp(map->path, path, depth * sizeof(uint16_t)) == 0)
+			return map;
+	}
+
+	return NULL;
+}
+
+/**
+ * Function: cache_get_record_map
+ *
+ * Parameters:
+ * device:	Pointer to scsisim_dev struct.
+ * file:	File ID of a record-based EF.
+ * match:	Test the records must pass: see cache_record_matches().
+ * bitmap:	(Output) Buffer of SCSISIM_RECORD_BITMAP_LEN bytes.
+ *
+ * Description: 
+ * Check whether we already know which records of an EF pass a test. 
+ * The EF must be selectable from the current DF, but it does not need 
+ * to be selected.
+ *
+ * Return values: 
+ * Number of records in the EF (the bitmap was copied)
+ * 0 (the records must be searched)
+ */
+int cache_get_record_map(const struct scsisim_dev *device,
+			 uint16_t file,
+			 unsigned int match,
+			 uint8_t *bitmap)
+{
+	struct scsisim_cache *cache = device->cache;
+	struct cache_record_map *map;
+	uint16_t path[CACHE_MAX_DEPTH];
+	uint8_t depth;
+
+	if (cache == NULL || GSM_FILE_IS_DF(file) ||
+	    cache_path_of(cache, file, path, &depth) == false ||
+	    (map = cache_find_record_map(cache, path, depth, match)) == NULL)
+		return 0;
+
+	memcpy(bitmap, map->bitmap, SCSISIM_RECORD_BITMAP_LEN);
+
+	return map->num_records;
+}
+
+/**
+ * Function: cache_store_record_map
+ *
+ * Parameters:
+ * device:	Pointer to scsisim_dev struct.
+ * match:	Test the records passed: see cache_record_matches().
+ * num_records:	Number of records in the EF.
+ * bitmap:	Records that passed, SCSISIM_RECORD_BITMAP_LEN bytes.
+ *
+ * Description: 
+ * Remember which records of the current EF pass a test. 
+ * New maps replace old ones round-robin once the cache is full.
+ *
+ * Return value: 
+ * None
+ */
+void cache_store_record_map(const struct scsisim_dev *device,
+			    unsigned int match,
+			    uint8_t num_records,
+			    const uint8_t *bitmap)
+{
+	struct scsisim_cache *cache = device->cache;
+	struct cache_record_map *map;
+	uint16_t path[CACHE_MAX_DEPTH];
+	uint8_t depth;
+
+	if (cache == NULL || num_records == 0 ||
+	    cache_current_ef(cache, path, &depth) == false)
+		return;
+
+	if ((map = cache_find_record_map(cache, path, depth, match)) == NULL)
+	{
+		map = &cache->map[cache->next_map_victim];
+		cache->next_map_victim = (cache->next_map_victim + 1) % CACHE_MAX_RECORD_MAPS;
+
+		memcpy(map->path, path, depth * sizeof(uint16_t));
+		map->depth = depth;
+		map->match = match;
+	}
+
+	map->num_records = num_records;
+	memcpy(map->bitmap, bitmap, SCSISIM_RECORD_BITMAP_LEN);
+}
+
+/**
+ * Function: cache_record_written
+ *
+ * Parameters:
+ * device:	Pointer to scsisim_dev struct.
+ * recno:	Record of the current EF that was updated.
+ * data:	New contents of the record.
+ * len:		Length of the record.
+ *
+ * Description: 
+ * Keep the record maps of the current EF up to date after an UPDATE 
+ * RECORD. If we don't know which EF is current, all record maps are
+ * dropped, since any of them may be stale now.
+ *
+ * Return value: 
+ * None
+ */
+void cache_record_written(const struct scsisim_dev *device,
+			  uint8_t recno,
+			  const uint8_t *data,
+			  unsigned int len)
+{
+	struct scsisim_cache *cache = device->cache;
+	struct cache_record_map *map;
+	uint16_t path[CACHE_MAX_DEPTH];
+	uint8_t depth;
+	int i;
+
+	if (cache == NULL || recno == 0 || len == 0)
+		return;
+
+	if (cache_current_ef(cache, path, &depth) == false)
+	{
+		memset(cache->map, 0, sizeof(cache->map));
+		return;
+	}
+
+	for (i = 0; i < CACHE_MAX_RECORD_MAPS; i++)
+	{
+		map = &cache->map[i];
+
+		if (map->depth != depth || recno > map->num_records ||
+		    memcmp(map->path, path, depth * sizeof(uint16_t)) != 0)
+			continue;
+
+		if (cache_record_matches(map->match, data, len))
+			map->bitmap[(recno - 1) / 8] |= 1 << ((recno - 1) % 8);
+		else
+			map->bitmap[(recno - 1) / 8] &= ~(1 << ((recno - 1) % 8));
+	}
+}
+
+/**
+ * Function: cache_record_matches
+ *
+ * Parameters:
+ * match:	A leading byte (0x00 to 0xff), or CACHE_MATCH_FREE_ADN.
+ * data:	Contents of a record.
+ * len:		Length of the record.
+ *
+ * Description: 
+ * Test a record the way a record map does. A leading byte only suits 
+ * records that start with a status byte, like EF-SMS. An ADN (or FDN, 
+ * SDN, ...) record starts with its name instead, which a number-only 
+ * contact leaves empty, so a free one must have neither a name nor a 
+ * number: see GSM spec, 10.5.1.
+ *
+ * Return values: 
+ * true - The record matches.
+ * false - It does not.
+ */
+bool cache_record_matches(unsigned int match, const uint8_t *data, unsigned int len)
+{
+	unsigned int alpha_len;
+
+	if (match != CACHE_MATCH_FREE_ADN)
+		return len > 0 && data[0] == match;
+
+	if (len < GSM_ADN_NUMBER_BUFFER_LEN)
+		return false;
+
+	alpha_len = len - GSM_ADN_NUMBER_BUFFER_LEN;
+
+	/* No name, and a number length of 0xff */
+	return (alpha_len == 0 || data[0] == 0xff) && data[alpha_len] == 0xff;
+}
+
+/* EOF */
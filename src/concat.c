@@ -0,0 +1,499 @@
+/*
+ *  concat.c
+ *  Reassembly of concatenated (multi-part) SMS for the scsisim library.
+ *
+ *  Copyright (c) 2017, Chris Coffey <kpuc@sdf.org>
+ *
+ *  Permission to use, copy, modify, and/or distribute this software
+ *  for any purpose with or without fee is hereby granted, provided
+ *  that the above copyright notice and this permission notice appear
+ *  in all copies.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL 
+ *  WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED
+ *  WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE
+ *  AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL
+ *  DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE, DATA
+ *  OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER
+ *  TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ *  PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "scsisim.h"
+#include "gsm.h"
+#include "utils.h"
+
+#define CONCAT_NONE		-1	/* End of a list of fragments or messages */
+#define CONCAT_MAX_PARTS	255	/* Parts of a concatenated SMS: 8 bits */
+
+/* A part of a message, waiting for the rest */
+struct concat_fragment {
+	int next;			/* Next part of the message, in part 
+					   order, or next free fragment */
+	uint8_t seq;			/* Part number */
+	uint8_t record[GSM_SMS_RECORD_LEN];
+};
+
+/* A message with at least one part received */
+struct concat_message {
+	int next_in_bucket;		/* Hash chain, or next free message */
+	int older, newer;		/* Order of arrival of the first part */
+	int fragments;			/* First part received, in part order */
+	unsigned int hash;
+	char address[SCSISIM_SMS_ADDRESS_LEN];
+	uint16_t ref;
+	uint8_t total;
+	uint8_t received;
+};
+
+struct scsisim_concat {
+	void (*callback)(const struct scsisim_concat_sms *msg, void *user_data);
+	void *user_data;
+	unsigned int num_fragments;
+	unsigned int num_buckets;	/* A power of 2 */
+	struct concat_fragment *fragment;
+	struct concat_message *message;
+	int *bucket;
+	int free_fragments;
+	int free_messages;
+	int oldest, newest;
+	char *text;			/* Text of the message being emitted */
+	unsigned int text_len;
+};
+
+static unsigned int concat_hash(const struct scsisim_sms *sms);
+static int concat_find(const struct scsisim_concat *concat,
+		       const struct scsisim_sms *sms,
+		       unsigned int hash);
+static int concat_new_message(struct scsisim_concat *concat,
+			      const struct scsisim_sms *sms,
+			      unsigned int hash);
+static void concat_emit(struct scsisim_concat *concat, int msg);
+static void concat_release(struct scsisim_concat *concat, int msg);
+
+
+/**
+ * For information about this function, see scsisim.h
+ */
+int scsisim_concat_create(struct scsisim_concat **concat,
+			  unsigned int num_fragments,
+			  void (*callback)(const struct scsisim_concat_sms *msg, void *user_data),
+			  void *user_data)
+{
+	struct scsisim_concat *new_concat;
+	unsigned int i;
+
+	if (concat == NULL || num_fragments == 0 || num_fragments > 0xffff || callback == NULL)
+		return SCSISIM_INVALID_PARAM;
+
+	if ((new_concat = calloc(1, sizeof(struct scsisim_concat))) == NULL)
+		return SCSISIM_MEMORY_ALLOCATION_ERROR;
+
+	new_concat->callback = callback;
+	new_concat->user_data = user_data;
+	new_concat->num_fragments = num_fragments;
+
+	/* Keep the hash chains short: at least two buckets per message */
+	for (new_concat->num_buckets = 1; new_concat->num_buckets < num_fragments * 2; )
+		new_concat->num_buckets <<= 1;
+
+	/* A message never has more parts waiting than there are fragments */
+	new_concat->text_len = MIN(num_fragments, CONCAT_MAX_PARTS) * SCSISIM_SMS_MAX_TEXT_LEN;
+
+	/* Every message holds at least one fragment, so there are never 
+	 * more messages than fragments */
+	new_concat->fragment = malloc(num_fragments * sizeof(struct concat_fragment));
+	new_concat->message = malloc(num_fragments * sizeof(struct concat_message));
+	new_concat->bucket = malloc(new_concat->num_buckets * sizeof(int));
+	new_concat->text = malloc(new_concat->text_len);
+
+	if (new_concat->fragment == NULL || new_concat->message == NULL ||
+	    new_concat->bucket == NULL || new_concat->text == NULL)
+	{
+		scsisim_concat_destroy(new_concat);
+		return SCSISIM_MEMORY_ALLOCATION_ERROR;
+	}
+
+	for (i = 0; i < num_fragments; i++)
+	{
+		new_concat->fragment[i].next = (i + 1 < num_fragments) ? (int)i + 1 : CONCAT_NONE;
+		new_concat->message[i].next_in_bucket = (i + 1 < num_fragments) ? (int)i + 1 : CONCAT_NONE;
+	}
+
+	for (i = 0; i < new_concat->num_buckets; i++)
+		new_concat->bucket[i] = CONCAT_NONE;
+
+	new_concat->free_fragments = 0;
+	new_concat->free_messages = 0;
+	new_concat->oldest = CONCAT_NONE;
+	new_concat->newest = CONCAT_NONE;
+
+	*concat = new_concat;
+
+	return SCSISIM_SUCCESS;
+}
+
+/**
+ * For information about this function, see scsisim.h
+ */
+void scsisim_concat_destroy(struct scsisim_concat *concat)
+{
+	if (concat == NULL)
+		return;
+
+	free(concat->fragment);
+	free(concat->message);
+	free(concat->bucket);
+	free(concat->text);
+	free(concat);
+}
+
+/**
+ * For information about this function, see scsisim.h
+ */
+int scsisim_concat_add(struct scsisim_concat *concat,
+		       const uint8_t *record,
+		       uint8_t record_len)
+{
+	struct scsisim_sms sms;
+	struct scsisim_concat_sms single;
+	struct concat_fragment *frag;
+	unsigned int hash;
+	int ret, msg, new_frag, *link;
+
+	if (concat == NULL || record == NULL || record_len != GSM_SMS_RECORD_LEN)
+		return SCSISIM_INVALID_PARAM;
+
+	/* The rest of a free record is whatever was left there, so it 
+	 * is not decoded at all */
+	if (record[0] == SIM_SMS_FREE)
+		return SCSISIM_SUCCESS;
+
+	/* Only the header for now: the text is decoded when the 
+	 * message is complete */
+	if ((ret = scsisim_decode_sms(record, record_len, &sms, NULL, 0)) != SCSISIM_SUCCESS)
+		return ret;
+
+	if (sms.mti != SIM_SMS_MTI_DELIVER && sms.mti != SIM_SMS_MTI_SUBMIT)
+		return SCSISIM_SUCCESS;
+
+	/* A message in one part needs no reassembly */
+	if (sms.concat_total <= 1)
+	{
+		memset(&single, 0, sizeof(single));
+		scsisim_decode_sms(record, record_len, &single.sms, concat->text, concat->text_len);
+		single.total = 1;
+		single.received = 1;
+		single.text = concat->text;
+		single.text_len = single.sms.text_len;
+		concat->callback(&single, concat->user_data);
+
+		return SCSISIM_SUCCESS;
+	}
+
+	hash = concat_hash(&sms);
+	msg = concat_find(concat, &sms, hash);
+
+	/* Ignore a part we already have */
+	if (msg != CONCAT_NONE)
+	{
+		for (new_frag = concat->message[msg].fragments;
+		     new_frag != CONCAT_NONE;
+		     new_frag = concat->fragment[new_frag].next)
+		{
+			if (concat->fragment[new_frag].seq == sms.concat_seq)
+				return SCSISIM_SUCCESS;
+		}
+	}
+
+	/* When the pool is full, make room by giving up on the message 
+	 * that has waited longest: emit what there is of it */
+	if (concat->free_fragments == CONCAT_NONE)
+	{
+		if (concat->oldest == msg)
+			msg = CONCAT_NONE;
+
+		concat_emit(concat, concat->oldest);
+		concat_release(concat, concat->oldest);
+	}
+
+	if (msg == CONCAT_NONE)
+		msg = concat_new_message(concat, &sms, hash);
+
+	/* Take a fragment off the free list */
+	new_frag = concat->free_fragments;
+	frag = &concat->fragment[new_frag];
+	concat->free_fragments = frag->next;
+
+	frag->seq = sms.concat_seq;
+	memcpy(frag->record, record, GSM_SMS_RECORD_LEN);
+
+	/* Insert it in part order */
+	for (link = &concat->message[msg].fragments;
+	     *link != CONCAT_NONE && concat->fragment[*link].seq < frag->seq;
+	     link = &concat->fragment[*link].next)
+		;
+
+	frag->next = *link;
+	*link = new_frag;
+
+	if (++concat->message[msg].received == concat->message[msg].total)
+	{
+		concat_emit(concat, msg);
+		concat_release(concat, msg);
+	}
+
+	return SCSISIM_SUCCESS;
+}
+
+/**
+ * For information about this function, see scsisim.h
+ */
+void scsisim_concat_flush(struct scsisim_concat *concat)
+{
+	if (concat == NULL)
+		return;
+
+	while (concat->oldest != CONCAT_NONE)
+	{
+		concat_emit(concat, concat->oldest);
+		concat_release(concat, concat->oldest);
+	}
+}
+
+/**
+ * For information about this function, see scsisim.h
+ */
+unsigned int scsisim_concat_pending(const struct scsisim_concat *concat)
+{
+	unsigned int count = 0;
+	int msg;
+
+	if (concat == NULL)
+		return 0;
+
+	for (msg = concat->oldest; msg != CONCAT_NONE; msg = concat->message[msg].newer)
+		count++;
+
+	return count;
+}
+
+/**
+ * Function: concat_hash
+ *
+ * Parameters:
+ * sms:		Pointer to a decoded part of a concatenated SMS.
+ *
+ * Description: 
+ * Hash the key of a concatenated SMS: its sender (or recipient), 
+ * reference number and number of parts. FNV-1a.
+ *
+ * Return value: 
+ * Hash value.
+ */
+static unsigned int concat_hash(const struct scsisim_sms *sms)
+{
+	unsigned int hash = 2166136261u;
+	const char *ptr;
+
+	for (ptr = sms->address; *ptr != '\0'; ptr++)
+		hash = (hash ^ (uint8_t)*ptr) * 16777619u;
+
+	hash = (hash ^ (sms->concat_ref >> 8)) * 16777619u;
+	hash = (hash ^ (sms->concat_ref & 0xff)) * 16777619u;
+	hash = (hash ^ sms->concat_total) * 16777619u;
+
+	return hash;
+}
+
+/**
+ * Function: concat_find
+ *
+ * Parameters:
+ * concat:	Pointer to reassembly context.
+ * sms:		Pointer to a decoded part of a concatenated SMS.
+ * hash:	Hash of the part's key; see concat_hash().
+ *
+ * Description: 
+ * Look up the message a part belongs to.
+ *
+ * Return value: 
+ * Index of the message, or CONCAT_NONE if no part of it has been seen.
+ */
+static int concat_find(const struct scsisim_concat *concat,
+		       const struct scsisim_sms *sms,
+		       unsigned int hash)
+{
+	const struct concat_message *m;
+	int msg;
+
+	for (msg = concat->bucket[hash & (concat->num_buckets - 1)];
+	     msg != CONCAT_NONE;
+	     msg = m->next_in_bucket)
+	{
+		m = &concat->message[msg];
+
+		if (m->hash == hash &&
+		    m->ref == sms->concat_ref &&
+		    m->total == sms->concat_total &&
+		    strcmp(m->address, sms->address) == 0)
+			return msg;
+	}
+
+	return CONCAT_NONE;
+}
+
+/**
+ * Function: concat_new_message
+ *
+ * Parameters:
+ * concat:	Pointer to reassembly context.
+ * sms:		Pointer to the first decoded part received of the message.
+ * hash:	Hash of the part's key; see concat_hash().
+ *
+ * Description: 
+ * Take a message off the free list, add it to the index and make it the
+ * newest. There is always a free message while there is a free 
+ * fragment.
+ *
+ * Return value: 
+ * Index of the message.
+ */
+static int concat_new_message(struct scsisim_concat *concat,
+			      const struct scsisim_sms *sms,
+			      unsigned int hash)
+{
+	struct concat_message *m;
+	int msg, *bucket;
+
+	msg = concat->free_messages;
+	m = &concat->message[msg];
+	concat->free_messages = m->next_in_bucket;
+
+	m->hash = hash;
+	m->ref = sms->concat_ref;
+	m->total = sms->concat_total;
+	m->received = 0;
+	m->fragments = CONCAT_NONE;
+	memcpy(m->address, sms->address, sizeof(m->address));
+
+	bucket = &concat->bucket[hash & (concat->num_buckets - 1)];
+	m->next_in_bucket = *bucket;
+	*bucket = msg;
+
+	m->older = concat->newest;
+	m->newer = CONCAT_NONE;
+
+	if (concat->newest != CONCAT_NONE)
+		concat->message[concat->newest].newer = msg;
+	else
+		concat->oldest = msg;
+
+	concat->newest = msg;
+
+	return msg;
+}
+
+/**
+ * Function: concat_emit
+ *
+ * Parameters:
+ * concat:	Pointer to reassembly context.
+ * msg:		Index of the message.
+ *
+ * Description: 
+ * Decode the parts received of a message in part order, join their 
+ * text, and pass the result to the callback.
+ *
+ * Return values: 
+ * None
+ */
+static void concat_emit(struct scsisim_concat *concat, int msg)
+{
+	struct scsisim_concat_sms joined;
+	struct scsisim_sms part;
+	unsigned int used = 0;
+	int frag;
+
+	memset(&joined, 0, sizeof(joined));
+	concat->text[0] = '\0';
+
+	for (frag = concat->message[msg].fragments;
+	     frag != CONCAT_NONE;
+	     frag = concat->fragment[frag].next)
+	{
+		scsisim_decode_sms(concat->fragment[frag].record,
+				   GSM_SMS_RECORD_LEN,
+				   &part,
+				   concat->text + used,
+				   concat->text_len - used);
+
+		/* The header of the message is that of its first part */
+		if (frag == concat->message[msg].fragments)
+			joined.sms = part;
+
+		used += part.text_len;
+	}
+
+	joined.sms.text_len = used;
+	joined.total = concat->message[msg].total;
+	joined.received = concat->message[msg].received;
+	joined.text = concat->text;
+	joined.text_len = used;
+
+	concat->callback(&joined, concat->user_data);
+}
+
+/**
+ * Function: concat_release
+ *
+ * Parameters:
+ * concat:	Pointer to reassembly context.
+ * msg:		Index of the message.
+ *
+ * Description: 
+ * Remove a message from the index and the order of arrival, and return 
+ * it and its fragments to the free lists.
+ *
+ * Return values: 
+ * None
+ */
+static void concat_release(struct scsisim_concat *concat, int msg)
+{
+	struct concat_message *m = &concat->message[msg];
+	int frag, next, *link;
+
+	for (frag = m->fragments; frag != CONCAT_NONE; frag = next)
+	{
+		next = concat->fragment[frag].next;
+		concat->fragment[frag].next = concat->free_fragments;
+		concat->free_fragments = frag;
+	}
+
+	for (link = &concat->bucket[m->hash & (concat->num_buckets - 1)];
+	     *link != msg;
+	     link = &concat->message[*link].next_in_bucket)
+		;
+
+	*link = m->next_in_bucket;
+
+	if (m->older != CONCAT_NONE)
+		concat->message[m->older].newer = m->newer;
+	else
+		concat->oldest = m->newer;
+
+	if (m->newer != CONCAT_NONE)
+		concat->message[m->newer].older = m->older;
+	else
+		concat->newest = m->older;
+
+	m->next_in_bucket = concat->free_messages;
+	concat->free_messages = msg;
+}
+
+/* EOF */
@@ -26,6 +26,7 @@
 #include <string.h>
 #include <unistd.h>
 #include <ctype.h>
+#include <stdbool.h>
 
 /* Include scsisim.h for API access */
 #include "scsisim.h"
@@ -33,9 +34,14 @@
 /* Command-line options */
 static char *opt_pin;
 static char *opt_device;
+static bool opt_virtual;
 
 /* Internal functions */
 static void parse_cmd_opts (int argc, char *argv[]);
+static int dump_records(struct scsisim_dev *device,
+			uint16_t file,
+			const char *name,
+			int (*parse)(const uint8_t *, uint8_t));
 static void print_usage_and_exit(void);
 
 
@@ -46,7 +52,9 @@ static void print_usage_and_exit(void);
  * the following:
  *
  * 1. Open the device with scsisim_open_device() using the SCSI generic device 
- *    name provided as a command-line argument (for example, "sg3").
+ *    name provided as a command-line argument (for example, "sg3"). With the
+ *    -s option, open a virtual SIM card with scsisim_open_virtual_device() 
+ *    instead.
  *
  * 2. Initialize the device with scsisim_init_device().
  *
@@ -62,19 +70,34 @@ static void print_usage_and_exit(void);
  */
 int main(int argc, char *argv[])
 {
-	int ret, i, num_records;
-	uint8_t *tmp_buf, bin_buf[128] = { 0 };
+	int ret, i;
+	uint8_t bin_buf[128] = { 0 };
 	char *tmp_str;
+	char alpha_str[sizeof(bin_buf) * 3 + 1];
 	struct scsisim_dev device;		/* defined in scsisim.h */
 	struct GSM_response resp;	/* defined in scsisim.h */
+	struct scsisim_vcard *vcard = NULL;
 
 	/* Process command-line arguments. */
 	parse_cmd_opts(argc, argv);
 
+	if (opt_virtual)
+	{
+		/* Create a virtual SIM card with a typical GSM file system, and
+		 * attach it to the 'device' struct as if it were inserted in a
+		 * real reader. */
+		if ((ret = scsisim_vcard_create(&vcard)) != SCSISIM_SUCCESS ||
+		    (ret = scsisim_vcard_load_default(vcard)) != SCSISIM_SUCCESS ||
+		    (ret = scsisim_open_virtual_device(vcard, &device)) != SCSISIM_SUCCESS)
+		{
+			scsisim_perror(__func__, ret);
+			goto exit;
+		}
+	}
 	/* Open the device with the specified SCSI generic name. This function
 	 * fills in the 'device' struct with data needed by other scsisim API 
 	 * functions that interact directly with the SIM card. */
-	if ((ret = scsisim_open_device(opt_device, &device)) != SCSISIM_SUCCESS)
+	else if ((ret = scsisim_open_device(opt_device, &device)) != SCSISIM_SUCCESS)
 	{
 		scsisim_perror(__func__, ret);
 		goto exit;
@@ -203,15 +226,14 @@ int main(int argc, char *argv[])
 					       0,
 					       resp.type.ef.file_size)) == SCSISIM_SUCCESS)
 		{
-			/* Map the character codes to their printable GSM 
-			 * alphabet counterparts */
-			tmp_str = scsisim_map_gsm_chars(bin_buf+1, resp.type.ef.file_size-1);
-
-			scsisim_printf("SPN = %s\n", tmp_str);
-
-			/* Caller's responsibility to free memory from a 
-			 * scsisim_map_gsm_chars() return value */
-			free(tmp_str);
+			/* Decode the name after the display condition byte: it 
+			 * may be in the GSM alphabet or in UCS-2 */
+			scsisim_decode_alpha(bin_buf+1,
+					     resp.type.ef.file_size-1,
+					     alpha_str,
+					     sizeof(alpha_str));
+
+			scsisim_printf("SPN = %s\n", alpha_str);
 		}
 		else
 			scsisim_perror("Read EF-SPN failed", ret);
@@ -219,118 +241,111 @@ int main(int argc, char *argv[])
 	else
 		scsisim_perror("Select EF-SPN failed", ret);
 
-	/* Select the Master File (root) directory */
-	if ((ret = scsisim_select_file_and_get_response(&device,
-							GSM_FILE_MF,
-							bin_buf,
-							sizeof(bin_buf),
-							SIM_SELECT_MF_DF,
-							&resp)) != SCSISIM_SUCCESS)
+	/* Select the TELECOM directory. It is a sibling of the GSM directory, 
+	 * so scsisim_select_path() gets there without going through the 
+	 * Master File first. */
+	if ((ret = scsisim_select_path(&device, "3F00/7F10")) < 0)
 	{
-		scsisim_perror("Select MF failed", ret);
+		scsisim_perror("Select DF-TELECOM failed", ret);
 		goto close_device;
 	}
 
-	/* Select the TELECOM directory */
-	if ((ret = scsisim_select_file_and_get_response(&device,
-							GSM_FILE_DF_TELECOM,
-							bin_buf,
-							sizeof(bin_buf),
-							SIM_SELECT_MF_DF,
-							&resp)) != SCSISIM_SUCCESS)
-	{
-		scsisim_perror("Select DF-TELECOM failed", ret);
+	/* Read the ADN (Abbreviated Dialing Numbers - AKA the "contacts") file */
+	if ((ret = dump_records(&device, GSM_FILE_EF_ADN, "ADN", scsisim_parse_adn)) != SCSISIM_SUCCESS)
 		goto close_device;
-	}
 
-	/* Select the ADN (Abbreviated Dialing Numbers - AKA the "contacts") file */
-	if ((ret = scsisim_select_file_and_get_response(&device,
-							GSM_FILE_EF_ADN,
-							bin_buf,
-							sizeof(bin_buf),
-							SIM_SELECT_EF,
-							&resp)) == SCSISIM_SUCCESS)
-	{
-		/* Allocate space for an ADN record based on its size on the
-		 * card */
-		if ((tmp_buf = malloc((size_t)resp.type.ef.record_len)) == NULL)
-			goto close_device;
+	/* Read the SMS (Short Message Service) file */
+	dump_records(&device, GSM_FILE_EF_SMS, "SMS", scsisim_parse_sms);
 
-		/* Calculate how many records the ADN file contains, which
-		 * varies by SIM card manufacturer */
-		num_records = resp.type.ef.file_size / resp.type.ef.record_len;
+close_device:
+	/* Close the device */
+	ret = scsisim_close_device(&device);
 
-		/* Go through all of the records in the ADN file */
-		for (i = 1; i <= num_records; i++)
-		{
-			scsisim_printf("====================\nADN record #%i\n", i);
+exit:
+	/* Destroy the virtual SIM card, if any, after closing the device */
+	scsisim_vcard_destroy(vcard);
 
-			/* Read the current record */
-			if (scsisim_read_record(&device,
-						i,
-						tmp_buf,
-						resp.type.ef.record_len) == SCSISIM_SUCCESS)
-			{
-				/* Parse the current ADN record */
-				if ((ret = scsisim_parse_adn(tmp_buf,
-							     resp.type.ef.record_len)) != SCSISIM_SUCCESS)
-					scsisim_perror("ADN record parse failed", ret);
-			}
-		}
+	return ret;
+}
+
+
+/**
+ * Function: dump_records
+ *
+ * Parameters:
+ * device:	Pointer to scsisim_dev struct.
+ * file:	Linear fixed EF to dump.
+ * name:	Name of the file, for output.
+ * parse:	Function to parse and print one record.
+ *
+ * Description: 
+ * Read every record of a linear fixed EF with scsisim_read_file(), and 
+ * parse it. The first call, with no buffer, only tells us how big the 
+ * file is.
+ *
+ * Return values: 
+ * SCSISIM_SUCCESS
+ * SCSISIM_MEMORY_ALLOCATION_ERROR
+ * Return value from scsisim_read_file
+ */
+static int dump_records(struct scsisim_dev *device,
+			uint16_t file,
+			const char *name,
+			int (*parse)(const uint8_t *, uint8_t))
+{
+	int ret, i, num_records, *status;
+	uint8_t *records, len;
+	char msg[32];
+	struct GSM_response resp;
+
+	snprintf(msg, sizeof(msg), "Read EF-%s failed", name);
 
-		free(tmp_buf);
+	if ((ret = scsisim_read_file(device, file, NULL, 0, &resp, NULL, 0)) != SCSISIM_BUFFER_TOO_SMALL)
+	{
+		/* Either an error, or a file that isn't record-based */
+		scsisim_perror(msg, ret);
+		return SCSISIM_SUCCESS;
 	}
-	else
-		scsisim_perror("Select EF-ADN failed", ret);
 
-	/* Select the SMS (Short Message Service) file */
-	if ((ret = scsisim_select_file_and_get_response(&device,
-							GSM_FILE_EF_SMS,
-							bin_buf,
-							sizeof(bin_buf),
-							SIM_SELECT_EF,
-							&resp)) == SCSISIM_SUCCESS)
+	/* How many records the file contains varies by SIM card manufacturer */
+	len = resp.type.ef.record_len;
+	num_records = resp.type.ef.file_size / len;
+
+	records = malloc((size_t)resp.type.ef.file_size);
+	status = malloc(num_records * sizeof(int));
+
+	if (records == NULL || status == NULL)
 	{
-		/* Allocate space for an SMS record based on its size on the
-		 * card */
-		if ((tmp_buf = malloc((size_t)resp.type.ef.record_len)) == NULL)
-			goto close_device;
+		ret = SCSISIM_MEMORY_ALLOCATION_ERROR;
+		goto done;
+	}
 
-		/* Calculate how many records the SMS file contains -- this
-		 * varies by SIM card manufacturer */
-		num_records = resp.type.ef.file_size / resp.type.ef.record_len;
+	/* Read the whole file in one go. Individual records can fail (e.g.,
+	 * without the right CHV), so check the status of each one */
+	if ((ret = scsisim_read_file(device, file, records, resp.type.ef.file_size,
+				     &resp, status, num_records)) != SCSISIM_SUCCESS)
+		scsisim_perror(msg, ret);
 
-		/* Go through all of the records in the SMS file */
-		for (i = 1; i <= num_records; i++)
-		{
-			scsisim_printf("====================\nSMS record #%i\n", i);
+	snprintf(msg, sizeof(msg), "%s record parse failed", name);
 
-			/* Read the current record */
-			if (scsisim_read_record(&device,
-						i,
-						tmp_buf,
-						resp.type.ef.record_len) == SCSISIM_SUCCESS)
-			{
-				/* Parse the current SMS record */
-				if ((ret = scsisim_parse_sms(tmp_buf,
-							     resp.type.ef.record_len)) != SCSISIM_SUCCESS)
-					scsisim_perror("SMS record parse failed", ret);
-			}
-		}
-		free(tmp_buf);
+	for (i = 0; i < num_records; i++)
+	{
+		scsisim_printf("====================\n%s record #%i\n", name, i + 1);
+
+		if (status[i] == SCSISIM_SUCCESS &&
+		    (ret = parse(records + i * len, len)) != SCSISIM_SUCCESS)
+			scsisim_perror(msg, ret);
 	}
-	else
-		scsisim_perror("Select EF-SMS failed", ret);
 
-close_device:
-	/* Close the device */
-	ret = scsisim_close_device(&device);
+	ret = SCSISIM_SUCCESS;
+
+done:
+	free(status);
+	free(records);
 
-exit:
 	return ret;
 }
 
-
 /**
  * Function: parse_cmd_opts
  *
@@ -347,7 +362,7 @@ static void parse_cmd_opts (int argc, char *argv[])
 {
 	int cmdopt;
 
-	while ((cmdopt = getopt(argc, argv, "p:v")) != -1)
+	while ((cmdopt = getopt(argc, argv, "p:sv")) != -1)
 	{
 		switch (cmdopt)
 		{
@@ -355,6 +370,10 @@ static void parse_cmd_opts (int argc, char *argv[])
 				opt_pin = optarg;
 				break;
 
+			case 's':
+				opt_virtual = true;
+				break;
+
 			case 'v':
 				scsisim_verbose_enable();
 				break;
@@ -375,7 +394,7 @@ static void parse_cmd_opts (int argc, char *argv[])
 	/* Use first non-option argument as device name, ignore anything else */
 	if (optind < argc)
 		opt_device = argv[optind];
-	else
+	else if (opt_virtual == false)
 		print_usage_and_exit();
 }
 
@@ -399,11 +418,14 @@ static void print_usage_and_exit(void)
 	fprintf(stderr, "Options:\n\n");
 	fprintf(stderr, "  [DEVICE]\tSCSI generic device name (for example, 'sg1')\n");
 	fprintf(stderr, "  -p [PIN]\tSpecify PIN number to access card\n");
+	fprintf(stderr, "  -s\t\tUse a simulated (virtual) SIM card instead of [DEVICE]\n");
 	fprintf(stderr, "  -v\t\tDisplay verbose information\n");
 	fprintf(stderr, "\n");
 	fprintf(stderr, "Example:\n\n");
 	fprintf(stderr, "  ./demo sg2 -p 1234 -v\n");
 	fprintf(stderr, "  (Open SCSI generic device sg2, use PIN 1234, and display verbose information)\n");
+	fprintf(stderr, "  ./demo -s\n");
+	fprintf(stderr, "  (Run against a virtual SIM card, no reader required)\n");
 	fprintf(stderr, "\n");
 	exit(EXIT_FAILURE);
 }
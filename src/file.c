@@ -0,0 +1,973 @@
+/*
+ *  file.c
+ *  Whole-file operations for the scsisim library.
+ *
+ *  Copyright (c) 2017, Chris Coffey <kpuc@sdf.org>
+ *
+ *  Permission to use, copy, modify, and/or distribute this software
+ *  for any purpose with or without fee is hereby granted, provided
+ *  that the above copyright notice and this permission notice appear
+ *  in all copies.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL 
+ *  WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED
+ *  WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE
+ *  AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL
+ *  DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE, DATA
+ *  OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER
+ *  TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ *  PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdbool.h>
+
+#include "scsisim.h"
+#include "gsm.h"
+#include "utils.h"
+#include "cache.h"
+
+#define FILE_TYPE_EF		0x04	/* See GSM spec, 9.3 */
+#define FILE_MAX_RESPONSE_LEN	64
+#define FILE_SEEK_MIN_MATCHES	4	/* Matches to see before judging SEEK */
+
+static int file_select_ef(struct scsisim_dev *device,
+			  uint16_t file,
+			  struct GSM_response *resp);
+static int file_read_records(struct scsisim_dev *device,
+			     const struct GSM_response *resp,
+			     uint8_t first,
+			     uint8_t count,
+			     uint8_t *data,
+			     unsigned int len,
+			     int *status,
+			     unsigned int num_status);
+static int file_read_pipelined(struct scsisim_dev *device,
+			       bool records,
+			       unsigned int first,
+			       unsigned int count,
+			       unsigned int unit,
+			       unsigned int size,
+			       uint8_t *data,
+			       int *status);
+static int file_find_records(struct scsisim_dev *device,
+			     uint16_t file,
+			     unsigned int match,
+			     uint8_t *bitmap,
+			     unsigned int len);
+static int file_take_free_records(struct scsisim_dev *device,
+				  uint16_t file,
+				  unsigned int match,
+				  unsigned int count,
+				  uint8_t *slots);
+static int file_write_pipelined(struct scsisim_dev *device,
+				const uint8_t *recnos,
+				unsigned int count,
+				unsigned int unit,
+				uint8_t *data,
+				int *status);
+static int file_free_ext_records(struct scsisim_dev *device,
+				 uint16_t ext_file,
+				 const uint8_t *ext_slots,
+				 unsigned int num_ext);
+static int file_seek_records(struct scsisim_dev *device,
+			     const struct GSM_response *resp,
+			     unsigned int match,
+			     unsigned int num_records,
+			     uint8_t *bitmap);
+static int file_scan_records(struct scsisim_dev *device,
+			     const struct GSM_response *resp,
+			     unsigned int match,
+			     unsigned int first,
+			     unsigned int num_records,
+			     uint8_t *bitmap);
+
+
+/**
+ * For information about this function, see scsisim.h
+ */
+int scsisim_read_file(struct scsisim_dev *device,
+		      uint16_t file,
+		      uint8_t *data,
+		      unsigned int len,
+		      struct GSM_response *resp,
+		      int *status,
+		      unsigned int num_status)
+{
+	int ret;
+	unsigned int count;
+
+	if (device == NULL || resp == NULL)
+		return SCSISIM_INVALID_PARAM;
+
+	if ((ret = file_select_ef(device, file, resp)) != SCSISIM_SUCCESS)
+		return ret;
+
+	if (resp->type.ef.structure != SIM_EF_TRANSPARENT)
+		return file_read_records(device, resp, 1, 0, data, len, status, num_status);
+
+	count = (resp->type.ef.file_size + SCSISIM_MAX_CHUNK - 1) / SCSISIM_MAX_CHUNK;
+
+	if (data == NULL || len < resp->type.ef.file_size ||
+	    (status != NULL && num_status < count))
+		return SCSISIM_BUFFER_TOO_SMALL;
+
+	return file_read_pipelined(device, false, 0, count, SCSISIM_MAX_CHUNK,
+				   resp->type.ef.file_size, data, status);
+}
+
+/**
+ * For information about this function, see scsisim.h
+ */
+int scsisim_read_records_range(struct scsisim_dev *device,
+			       uint16_t file,
+			       uint8_t first,
+			       uint8_t count,
+			       uint8_t *data,
+			       unsigned int len,
+			       struct GSM_response *resp,
+			       int *status,
+			       unsigned int num_status)
+{
+	int ret;
+
+	if (device == NULL || resp == NULL || first == 0)
+		return SCSISIM_INVALID_PARAM;
+
+	if ((ret = file_select_ef(device, file, resp)) != SCSISIM_SUCCESS)
+		return ret;
+
+	return file_read_records(device, resp, first, count, data, len, status, num_status);
+}
+
+/**
+ * For information about this function, see scsisim.h
+ */
+int scsisim_find_records(struct scsisim_dev *device,
+			 uint16_t file,
+			 uint8_t lead,
+			 uint8_t *bitmap,
+			 unsigned int len)
+{
+	return file_find_records(device, file, lead, bitmap, len);
+}
+
+/**
+ * For information about this function, see scsisim.h
+ */
+int scsisim_find_free_adn(struct scsisim_dev *device,
+			  uint16_t file,
+			  uint8_t *bitmap,
+			  unsigned int len)
+{
+	return file_find_records(device, file, CACHE_MATCH_FREE_ADN, bitmap, len);
+}
+
+/**
+ * For information about this function, see scsisim.h
+ */
+int scsisim_write_free_records(struct scsisim_dev *device,
+			       uint16_t file,
+			       uint8_t lead,
+			       uint8_t *data,
+			       unsigned int len,
+			       unsigned int count,
+			       uint8_t *recnos,
+			       int *status)
+{
+	int ret;
+	struct GSM_response resp;
+	uint8_t slots[SCSISIM_RECORD_BITMAP_LEN * 8];
+
+	if (device == NULL || data == NULL)
+		return SCSISIM_INVALID_PARAM;
+
+	if (count == 0)
+		return SCSISIM_SUCCESS;
+
+	/* Find the free records first (usually from the cache)... */
+	if ((ret = file_take_free_records(device, file, lead, count, slots)) != SCSISIM_SUCCESS)
+		return ret;
+
+	/* ...which may not have selected the file */
+	if ((ret = file_select_ef(device, file, &resp)) != SCSISIM_SUCCESS)
+		return ret;
+
+	if (resp.type.ef.structure != SIM_EF_LINEAR_FIXED || resp.type.ef.record_len == 0)
+		return SCSISIM_GSM_FILE_INCONSISTENT_WITH_COMMAND;
+
+	if (len < count * resp.type.ef.record_len)
+		return SCSISIM_BUFFER_TOO_SMALL;
+
+	if (recnos != NULL)
+		memcpy(recnos, slots, count);
+
+	return file_write_pipelined(device, slots, count, resp.type.ef.record_len, data, status);
+}
+
+/**
+ * For information about this function, see scsisim.h
+ */
+int scsisim_store_sms(struct scsisim_dev *device,
+		      uint8_t *records,
+		      unsigned int len,
+		      unsigned int count,
+		      uint8_t *recnos,
+		      int *status)
+{
+	return scsisim_write_free_records(device,
+					  GSM_FILE_EF_SMS,
+					  SIM_SMS_FREE,
+					  records,
+					  len,
+					  count,
+					  recnos,
+					  status);
+}
+
+/**
+ * For information about this function, see scsisim.h
+ */
+int scsisim_import_adn(struct scsisim_dev *device,
+		       uint16_t file,
+		       uint16_t ext_file,
+		       const struct scsisim_contact *contacts,
+		       unsigned int count,
+		       uint8_t *recnos,
+		       int *status)
+{
+	int ret;
+	unsigned int i, num_ext = 0, used_ext = 0, num_unused = 0, record_len;
+	struct GSM_response resp;
+	uint8_t slots[SCSISIM_RECORD_BITMAP_LEN * 8];
+	uint8_t ext_slots[SCSISIM_RECORD_BITMAP_LEN * 8];
+	uint8_t *records = NULL, *ext = NULL;
+	int *written = NULL;
+
+	if (device == NULL || contacts == NULL)
+		return SCSISIM_INVALID_PARAM;
+
+	if (count == 0)
+		return SCSISIM_SUCCESS;
+
+	/* Count the extension records the long numbers need */
+	for (i = 0; i < count; i++)
+	{
+		if ((ret = scsisim_adn_ext_records(contacts[i].number)) < 0)
+			return ret;
+
+		num_ext += ret;
+	}
+
+	/* Find the free records of both EFs (usually from the cache). A 
+	 * contact with a number but no name also starts with 0xff, so free 
+	 * ADN records are told by their number; a free extension record is 
+	 * all 0xff, so its first byte is enough */
+	if ((ret = file_take_free_records(device, file, CACHE_MATCH_FREE_ADN, count, slots)) != SCSISIM_SUCCESS)
+		return ret;
+
+	if (num_ext > 0 &&
+	    (ret = file_take_free_records(device, ext_file, 0xff, num_ext, ext_slots)) != SCSISIM_SUCCESS)
+		return ret;
+
+	/* Encode every contact for the actual record length before writing
+	 * anything */
+	if ((ret = file_select_ef(device, file, &resp)) != SCSISIM_SUCCESS)
+		return ret;
+
+	if (resp.type.ef.structure != SIM_EF_LINEAR_FIXED ||
+	    resp.type.ef.record_len < GSM_ADN_NUMBER_BUFFER_LEN)
+		return SCSISIM_GSM_FILE_INCONSISTENT_WITH_COMMAND;
+
+	record_len = resp.type.ef.record_len;
+
+	if ((records = malloc(count * record_len)) == NULL ||
+	    (written = malloc(count * sizeof(int))) == NULL ||
+	    (num_ext > 0 && (ext = malloc(num_ext * SCSISIM_EXT_RECORD_LEN)) == NULL))
+	{
+		ret = SCSISIM_MEMORY_ALLOCATION_ERROR;
+		goto out;
+	}
+
+	/* A record that is never submitted gets no status */
+	for (i = 0; i < count; i++)
+		written[i] = SCSISIM_SCSI_SEND_ERROR;
+
+	for (i = 0; i < count; i++)
+	{
+		if ((ret = scsisim_encode_adn(file,
+					      contacts[i].name,
+					      contacts[i].number,
+					      contacts[i].ton_npi,
+					      records + i * record_len,
+					      record_len,
+					      ext_slots + used_ext,
+					      ext + used_ext * SCSISIM_EXT_RECORD_LEN,
+					      (num_ext - used_ext) * SCSISIM_EXT_RECORD_LEN)) < 0)
+			goto out;
+
+		used_ext += ret;
+	}
+
+	/* Write the extension records first, so no ADN record ever points
+	 * to one that has not been written... */
+	if (num_ext > 0)
+	{
+		if ((ret = file_select_ef(device, ext_file, &resp)) != SCSISIM_SUCCESS)
+			goto out;
+
+		if (resp.type.ef.structure != SIM_EF_LINEAR_FIXED ||
+		    resp.type.ef.record_len != SCSISIM_EXT_RECORD_LEN)
+		{
+			ret = SCSISIM_GSM_FILE_INCONSISTENT_WITH_COMMAND;
+			goto out;
+		}
+
+		if ((ret = file_write_pipelined(device,
+						ext_slots,
+						num_ext,
+						SCSISIM_EXT_RECORD_LEN,
+						ext,
+						NULL)) != SCSISIM_SUCCESS)
+		{
+			/* Some may have been written: free them all */
+			file_free_ext_records(device, ext_file, ext_slots, num_ext);
+			goto out;
+		}
+
+		if ((ret = file_select_ef(device, file, &resp)) != SCSISIM_SUCCESS)
+		{
+			file_free_ext_records(device, ext_file, ext_slots, num_ext);
+			goto out;
+		}
+	}
+
+	if (recnos != NULL)
+		memcpy(recnos, slots, count);
+
+	/* ...and the ADN records last */
+	ret = file_write_pipelined(device, slots, count, record_len, records, written);
+
+	if (ret == SCSISIM_SUCCESS || num_ext == 0)
+		goto out;
+
+	/* Free the extension records of the contacts that were not written,
+	 * keeping those of the ones that were */
+	for (i = 0, used_ext = 0; i < count; i++)
+	{
+		num_ext = (unsigned int)scsisim_adn_ext_records(contacts[i].number);
+
+		if (written[i] != SCSISIM_SUCCESS)
+		{
+			memmove(ext_slots + num_unused, ext_slots + used_ext, num_ext);
+			num_unused += num_ext;
+		}
+
+		used_ext += num_ext;
+	}
+
+	if (num_unused > 0)
+		file_free_ext_records(device, ext_file, ext_slots, num_unused);
+
+out:
+	if (status != NULL && written != NULL)
+		memcpy(status, written, count * sizeof(int));
+
+	free(records);
+	free(written);
+	free(ext);
+
+	return ret;
+}
+
+/**
+ * Function: file_free_ext_records
+ *
+ * Parameters:
+ * device:	Pointer to scsisim_dev struct.
+ * ext_file:	File ID of the extension EF in the current DF.
+ * ext_slots:	Record numbers to free.
+ * num_ext:	Number of records to free.
+ *
+ * Description: 
+ * Undo part of a failed scsisim_import_adn(): overwrite extension 
+ * records with 0xff, so they are free again. This is a best effort; 
+ * whatever failed first is what the caller reports.
+ *
+ * Return values: 
+ * SCSISIM_SUCCESS
+ * SCSISIM_MEMORY_ALLOCATION_ERROR
+ * Return value from file_select_ef / file_write_pipelined
+ */
+static int file_free_ext_records(struct scsisim_dev *device,
+				 uint16_t ext_file,
+				 const uint8_t *ext_slots,
+				 unsigned int num_ext)
+{
+	int ret;
+	struct GSM_response resp;
+	uint8_t *blank;
+
+	if ((ret = file_select_ef(device, ext_file, &resp)) != SCSISIM_SUCCESS)
+		return ret;
+
+	if ((blank = malloc(num_ext * SCSISIM_EXT_RECORD_LEN)) == NULL)
+		return SCSISIM_MEMORY_ALLOCATION_ERROR;
+
+	memset(blank, 0xff, num_ext * SCSISIM_EXT_RECORD_LEN);
+	ret = file_write_pipelined(device, ext_slots, num_ext, SCSISIM_EXT_RECORD_LEN, blank, NULL);
+	free(blank);
+
+	return ret;
+}
+
+/**
+ * Function: file_find_records
+ *
+ * Parameters:
+ * device:	Pointer to scsisim_dev struct.
+ * file:	File ID of a record-based EF in the current DF.
+ * match:	Test the records must pass: see cache_record_matches().
+ * bitmap:	(Output) Buffer for a bitmap of the matching records.
+ * len:		Length of bitmap buffer.
+ *
+ * Description: 
+ * Find the records of an EF that pass a test, from the metadata cache 
+ * if possible, or else with SEEK or by reading them. See 
+ * scsisim_find_records() and scsisim_find_free_adn().
+ *
+ * Return values: 
+ * Number of matching records (0 or more)
+ * SCSISIM_INVALID_PARAM
+ * SCSISIM_BUFFER_TOO_SMALL
+ * SCSISIM_MEMORY_ALLOCATION_ERROR
+ * SCSISIM_GSM_FILE_INCONSISTENT_WITH_COMMAND
+ * Return value from file_select_ef
+ * Return value from file_seek_records
+ */
+static int file_find_records(struct scsisim_dev *device,
+			     uint16_t file,
+			     unsigned int match,
+			     uint8_t *bitmap,
+			     unsigned int len)
+{
+	int ret, count = 0;
+	unsigned int num_records, recno;
+	struct GSM_response resp;
+	uint8_t map[SCSISIM_RECORD_BITMAP_LEN] = { 0 };
+
+	if (device == NULL || bitmap == NULL)
+		return SCSISIM_INVALID_PARAM;
+
+	/* No need to talk to the card if we have searched this file before */
+	if ((num_records = cache_get_record_map(device, file, match, map)) == 0)
+	{
+		if ((ret = file_select_ef(device, file, &resp)) != SCSISIM_SUCCESS)
+			return ret;
+
+		if (resp.type.ef.structure == SIM_EF_TRANSPARENT || resp.type.ef.record_len == 0 ||
+		    (match == CACHE_MATCH_FREE_ADN && resp.type.ef.record_len < GSM_ADN_NUMBER_BUFFER_LEN))
+			return SCSISIM_GSM_FILE_INCONSISTENT_WITH_COMMAND;
+
+		num_records = MIN(resp.type.ef.file_size / resp.type.ef.record_len, 0xffu);
+
+		ret = file_seek_records(device, &resp, match, num_records, map);
+
+		/* Not every card implements SEEK */
+		if (ret == SCSISIM_GSM_UNKNOWN_INSTRUCTION ||
+		    ret == SCSISIM_GSM_WRONG_INSTRUCTION_CLASS ||
+		    ret == SCSISIM_GSM_ERROR_PARAM_1_OR_2)
+		{
+			memset(map, 0, sizeof(map));
+			ret = file_scan_records(device, &resp, match, 1, num_records, map);
+		}
+
+		if (ret != SCSISIM_SUCCESS)
+			return ret;
+
+		cache_store_record_map(device, match, num_records, map);
+	}
+
+	if (len < (num_records + 7) / 8)
+		return SCSISIM_BUFFER_TOO_SMALL;
+
+	memcpy(bitmap, map, (num_records + 7) / 8);
+
+	for (recno = 1; recno <= num_records; recno++)
+		count += SCSISIM_RECORD_IS_SET(map, recno);
+
+	return count;
+}
+
+/**
+ * Function: file_take_free_records
+ *
+ * Parameters:
+ * device:	Pointer to scsisim_dev struct.
+ * file:	File ID of a record-based EF in the current DF.
+ * match:	Test a free record passes: see cache_record_matches().
+ * count:	Number of free records needed.
+ * slots:	(Output) Buffer of SCSISIM_RECORD_BITMAP_LEN * 8 bytes for
+ *		the record numbers.
+ *
+ * Description: 
+ * Find the first count free records of an EF with file_find_records(),
+ * which may or may not leave the EF selected.
+ *
+ * Return values: 
+ * SCSISIM_SUCCESS
+ * SCSISIM_NO_FREE_RECORDS
+ * Return value from file_find_records
+ */
+static int file_take_free_records(struct scsisim_dev *device,
+				  uint16_t file,
+				  unsigned int match,
+				  unsigned int count,
+				  uint8_t *slots)
+{
+	int ret;
+	unsigned int recno, i = 0;
+	uint8_t bitmap[SCSISIM_RECORD_BITMAP_LEN] = { 0 };
+
+	if ((ret = file_find_records(device, file, match, bitmap, sizeof(bitmap))) < 0)
+		return ret;
+
+	if ((unsigned int)ret < count)
+		return SCSISIM_NO_FREE_RECORDS;
+
+	/* Take the free records in order */
+	for (recno = 1; recno < SCSISIM_RECORD_BITMAP_LEN * 8 && i < count; recno++)
+	{
+		if (SCSISIM_RECORD_IS_SET(bitmap, recno))
+			slots[i++] = recno;
+	}
+
+	return SCSISIM_SUCCESS;
+}
+
+/**
+ * Function: file_read_records
+ *
+ * Parameters:
+ * device:	Pointer to scsisim_dev struct.
+ * resp:	GET RESPONSE data of the currently selected EF.
+ * first:	First record to read.
+ * count:	Number of records to read, or 0 for all remaining records.
+ * data:	Buffer for record data.
+ * len:		Length of data buffer.
+ * status:	(Output, can be NULL) Status of each record read.
+ * num_status:	Number of entries in status array.
+ *
+ * Description: 
+ * Check a range of records against the currently selected EF, and read
+ * them. See scsisim_read_records_range().
+ *
+ * Return values: 
+ * SCSISIM_SUCCESS
+ * SCSISIM_BUFFER_TOO_SMALL
+ * SCSISIM_GSM_INVALID_ADDRESS
+ * SCSISIM_GSM_FILE_INCONSISTENT_WITH_COMMAND
+ * Return value from file_read_pipelined
+ */
+static int file_read_records(struct scsisim_dev *device,
+			     const struct GSM_response *resp,
+			     uint8_t first,
+			     uint8_t count,
+			     uint8_t *data,
+			     unsigned int len,
+			     int *status,
+			     unsigned int num_status)
+{
+	unsigned int num_records, total;
+
+	if (resp->type.ef.structure == SIM_EF_TRANSPARENT || resp->type.ef.record_len == 0)
+		return SCSISIM_GSM_FILE_INCONSISTENT_WITH_COMMAND;
+
+	num_records = resp->type.ef.file_size / resp->type.ef.record_len;
+
+	if (first > num_records)
+		return SCSISIM_GSM_INVALID_ADDRESS;
+
+	/* A count of zero means "up to the last record" */
+	total = (count == 0) ? num_records - first + 1 : count;
+
+	if (first + total - 1 > num_records)
+		return SCSISIM_GSM_INVALID_ADDRESS;
+
+	if (data == NULL || len < total * resp->type.ef.record_len ||
+	    (status != NULL && num_status < total))
+		return SCSISIM_BUFFER_TOO_SMALL;
+
+	return file_read_pipelined(device, true, first, total, resp->type.ef.record_len,
+				   total * resp->type.ef.record_len, data, status);
+}
+
+/**
+ * Function: file_select_ef
+ *
+ * Parameters:
+ * device:	Pointer to scsisim_dev struct.
+ * file:	EF to select.
+ * resp:	(Output) GET RESPONSE data of the EF.
+ *
+ * Description: 
+ * Select an EF and get its response data, making sure it really is an EF.
+ *
+ * Return values: 
+ * SCSISIM_SUCCESS
+ * SCSISIM_GSM_FILE_INCONSISTENT_WITH_COMMAND
+ * Return value from scsisim_select_file_and_get_response
+ */
+static int file_select_ef(struct scsisim_dev *device,
+			  uint16_t file,
+			  struct GSM_response *resp)
+{
+	int ret;
+	uint8_t buf[FILE_MAX_RESPONSE_LEN];
+
+	memset(resp, 0, sizeof(struct GSM_response));
+
+	if ((ret = scsisim_select_file_and_get_response(device,
+							file,
+							buf,
+							sizeof(buf),
+							SIM_SELECT_EF,
+							resp)) != SCSISIM_SUCCESS)
+		return ret;
+
+	if (resp->type.ef.file_type != FILE_TYPE_EF)
+		return SCSISIM_GSM_FILE_INCONSISTENT_WITH_COMMAND;
+
+	return SCSISIM_SUCCESS;
+}
+
+/**
+ * Function: file_read_pipelined
+ *
+ * Parameters:
+ * device:	Pointer to scsisim_dev struct.
+ * records:	true = READ RECORD, false = READ BINARY.
+ * first:	First record number (READ RECORD only).
+ * count:	Number of reads.
+ * unit:	Bytes per read (record length, or chunk size).
+ * size:	Total number of bytes to read.
+ * data:	Buffer for the data.
+ * status:	(Output, can be NULL) Status of each read.
+ *
+ * Description: 
+ * Read a file with up to SCSISIM_MAX_PENDING reads in flight. Read 'i'
+ * lands at data + i * unit, and its status in status[i].
+ *
+ * Return values: 
+ * SCSISIM_SUCCESS
+ * SCSISIM_INVALID_PARAM (commands already in flight)
+ * Return value from scsisim_submit_* / scsisim_reap
+ * First error in the status array
+ */
+static int file_read_pipelined(struct scsisim_dev *device,
+			       bool records,
+			       unsigned int first,
+			       unsigned int count,
+			       unsigned int unit,
+			       unsigned int size,
+			       uint8_t *data,
+			       int *status)
+{
+	int ret = SCSISIM_SUCCESS, first_err = SCSISIM_SUCCESS, reap;
+	unsigned int next = 0, i;
+	struct scsisim_request req;
+
+	/* We identify our reads by index, so we can't share the queue */
+	if (scsisim_pending(device))
+		return SCSISIM_INVALID_PARAM;
+
+	for (;;)
+	{
+		/* Keep the queue full */
+		while (ret == SCSISIM_SUCCESS && next < count &&
+		       scsisim_pending(device) < SCSISIM_MAX_PENDING)
+		{
+			if (records)
+				ret = scsisim_submit_read_record(device,
+								 first + next,
+								 data + next * unit,
+								 unit,
+								 (void *)(uintptr_t)next);
+			else
+				ret = scsisim_submit_read_binary(device,
+								 data + next * unit,
+								 next * unit,
+								 MIN(unit, size - next * unit),
+								 (void *)(uintptr_t)next);
+
+			if (ret == SCSISIM_SUCCESS)
+				next++;
+		}
+
+		if (scsisim_pending(device) == 0)
+			break;
+
+		/* On failure, stop submitting, but keep reaping until
+		 * nothing is left in flight */
+		if ((reap = scsisim_reap(device, &req, -1)) != SCSISIM_SUCCESS)
+		{
+			if (ret == SCSISIM_SUCCESS)
+				ret = reap;
+
+			continue;
+		}
+
+		i = (unsigned int)(uintptr_t)req.user_data;
+
+		if (status != NULL)
+			status[i] = req.status;
+
+		if (req.status != SCSISIM_SUCCESS && first_err == SCSISIM_SUCCESS)
+			first_err = req.status;
+	}
+
+	if (scsisim_verbose())
+		scsisim_pinfo("%s: read %u bytes with %u %s commands",
+			      __func__, size, next, records ? "READ RECORD" : "READ BINARY");
+
+	return (ret != SCSISIM_SUCCESS) ? ret : first_err;
+}
+
+/**
+ * Function: file_write_pipelined
+ *
+ * Parameters:
+ * device:	Pointer to scsisim_dev struct.
+ * recnos:	Record number to write each record to.
+ * count:	Number of records to write.
+ * unit:	Record length.
+ * data:	Record data, one record after another.
+ * status:	(Output, can be NULL) Status of each write.
+ *
+ * Description: 
+ * The counterpart of file_read_pipelined(): write records of the 
+ * currently selected EF with up to SCSISIM_MAX_PENDING UPDATE RECORD 
+ * commands in flight. Record 'i' comes from data + i * unit, and its 
+ * status goes in status[i].
+ *
+ * Return values: 
+ * SCSISIM_SUCCESS
+ * SCSISIM_INVALID_PARAM (commands already in flight)
+ * Return value from scsisim_submit_update_record / scsisim_reap
+ * First error in the status array
+ */
+static int file_write_pipelined(struct scsisim_dev *device,
+				const uint8_t *recnos,
+				unsigned int count,
+				unsigned int unit,
+				uint8_t *data,
+				int *status)
+{
+	int ret = SCSISIM_SUCCESS, first_err = SCSISIM_SUCCESS, reap;
+	unsigned int next = 0, i;
+	struct scsisim_request req;
+
+	/* We identify our writes by index, so we can't share the queue */
+	if (scsisim_pending(device))
+		return SCSISIM_INVALID_PARAM;
+
+	for (;;)
+	{
+		/* Keep the queue full */
+		while (ret == SCSISIM_SUCCESS && next < count &&
+		       scsisim_pending(device) < SCSISIM_MAX_PENDING)
+		{
+			ret = scsisim_submit_update_record(device,
+							   recnos[next],
+							   data + next * unit,
+							   unit,
+							   (void *)(uintptr_t)next);
+
+			if (ret == SCSISIM_SUCCESS)
+				next++;
+		}
+
+		if (scsisim_pending(device) == 0)
+			break;
+
+		/* On failure, stop submitting, but keep reaping until
+		 * nothing is left in flight */
+		if ((reap = scsisim_reap(device, &req, -1)) != SCSISIM_SUCCESS)
+		{
+			if (ret == SCSISIM_SUCCESS)
+				ret = reap;
+
+			continue;
+		}
+
+		i = (unsigned int)(uintptr_t)req.user_data;
+
+		if (status != NULL)
+			status[i] = req.status;
+
+		if (req.status != SCSISIM_SUCCESS && first_err == SCSISIM_SUCCESS)
+			first_err = req.status;
+	}
+
+	if (scsisim_verbose())
+		scsisim_pinfo("%s: wrote %u records with %u UPDATE RECORD commands",
+			      __func__, count, next);
+
+	return (ret != SCSISIM_SUCCESS) ? ret : first_err;
+}
+
+/**
+ * Function: file_seek_records
+ *
+ * Parameters:
+ * device:	Pointer to scsisim_dev struct.
+ * resp:	GET RESPONSE data of the currently selected EF.
+ * match:	Test the records must pass: see cache_record_matches().
+ * num_records:	Number of records in the currently selected EF.
+ * bitmap:	(Output) Bitmap of matching records, cleared by the caller.
+ *
+ * Description: 
+ * Find the records of the currently selected EF that pass a test, by 
+ * stepping through the records that start with the right byte with type
+ * 2 SEEKs. Each match costs a SEEK and a GET RESPONSE, so once more than
+ * half of the records searched so far have matched (and there are enough
+ * matches to tell), reading the rest of the file is cheaper. A SEEK only
+ * looks at the first byte, so for free ADN records (which start with 
+ * 0xff) each candidate is read back and checked in full.
+ *
+ * Return values: 
+ * SCSISIM_SUCCESS
+ * SCSISIM_INVALID_GSM_RESPONSE
+ * SCSISIM_MEMORY_ALLOCATION_ERROR
+ * Return value from scsisim_seek
+ * Return value from scsisim_read_record
+ * Return value from file_scan_records
+ */
+static int file_seek_records(struct scsisim_dev *device,
+			     const struct GSM_response *resp,
+			     unsigned int match,
+			     unsigned int num_records,
+			     uint8_t *bitmap)
+{
+	int ret, prev = 0, found = 0;
+	bool scanned = false;
+	unsigned int recno;
+	uint8_t mode = SIM_SEEK_FROM_START;
+	uint8_t lead = (match == CACHE_MATCH_FREE_ADN) ? 0xff : match;
+	uint8_t candidates[SCSISIM_RECORD_BITMAP_LEN] = { 0 };
+	uint8_t *record;
+
+	while ((ret = scsisim_seek(device, SIM_SEEK_TYPE_2, mode, &lead, 1)) > prev &&
+	       ret <= (int)num_records)
+	{
+		candidates[(ret - 1) / 8] |= 1 << ((ret - 1) % 8);
+		prev = ret;
+		mode = SIM_SEEK_NEXT;
+
+		if (++found >= FILE_SEEK_MIN_MATCHES && 2 * found > prev && prev < (int)num_records)
+		{
+			if ((ret = file_scan_records(device, resp, match, prev + 1, num_records, bitmap)) != SCSISIM_SUCCESS)
+				return ret;
+
+			scanned = true;
+			break;
+		}
+	}
+
+	if (!scanned)
+	{
+		/* A type 2 SEEK must tell us where it stopped */
+		if (ret == SCSISIM_SUCCESS)
+			return SCSISIM_INVALID_GSM_RESPONSE;
+
+		/* Either no more matches, or the search wrapped around a cyclic EF */
+		if (ret != SCSISIM_GSM_FILE_NOT_FOUND && ret <= 0)
+			return ret;
+	}
+
+	if (match != CACHE_MATCH_FREE_ADN)
+	{
+		for (recno = 0; recno < SCSISIM_RECORD_BITMAP_LEN; recno++)
+			bitmap[recno] |= candidates[recno];
+
+		return SCSISIM_SUCCESS;
+	}
+
+	if ((record = malloc(resp->type.ef.record_len)) == NULL)
+		return SCSISIM_MEMORY_ALLOCATION_ERROR;
+
+	ret = SCSISIM_SUCCESS;
+
+	for (recno = 1; recno <= (unsigned int)prev && ret == SCSISIM_SUCCESS; recno++)
+	{
+		if (SCSISIM_RECORD_IS_SET(candidates, recno) == 0)
+			continue;
+
+		ret = scsisim_read_record(device, recno, record, resp->type.ef.record_len);
+
+		if (ret == SCSISIM_SUCCESS && cache_record_matches(match, record, resp->type.ef.record_len))
+			bitmap[(recno - 1) / 8] |= 1 << ((recno - 1) % 8);
+	}
+
+	free(record);
+
+	return ret;
+}
+
+/**
+ * Function: file_scan_records
+ *
+ * Parameters:
+ * device:	Pointer to scsisim_dev struct.
+ * resp:	GET RESPONSE data of the currently selected EF.
+ * match:	Test the records must pass: see cache_record_matches().
+ * first:	First record to read.
+ * num_records:	Number of records in the EF.
+ * bitmap:	(Output) Bitmap of matching records, cleared by the caller.
+ *
+ * Description: 
+ * Find the records of the currently selected EF, from record first on, 
+ * that pass a test the hard way, by reading all of them.
+ *
+ * Return values: 
+ * SCSISIM_SUCCESS
+ * SCSISIM_MEMORY_ALLOCATION_ERROR
+ * Return value from file_read_records
+ */
+static int file_scan_records(struct scsisim_dev *device,
+			     const struct GSM_response *resp,
+			     unsigned int match,
+			     unsigned int first,
+			     unsigned int num_records,
+			     uint8_t *bitmap)
+{
+	int ret;
+	unsigned int i, count = num_records - first + 1;
+	unsigned int size = count * resp->type.ef.record_len;
+	uint8_t *data;
+
+	if (scsisim_verbose())
+		scsisim_pinfo("%s: reading records %u to %u", __func__, first, num_records);
+
+	if ((data = malloc(size)) == NULL)
+		return SCSISIM_MEMORY_ALLOCATION_ERROR;
+
+	if ((ret = file_read_records(device, resp, first, count, data, size, NULL, 0)) == SCSISIM_SUCCESS)
+	{
+		for (i = 0; i < count; i++)
+		{
+			if (cache_record_matches(match,
+						 data + i * resp->type.ef.record_len,
+						 resp->type.ef.record_len))
+				bitmap[(first - 1 + i) / 8] |= 1 << ((first - 1 + i) % 8);
+		}
+	}
+
+	free(data);
+
+	return ret;
+}
+
+/* EOF */
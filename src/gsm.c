@@ -28,77 +28,211 @@
 #include "scsisim.h"
 #include "gsm.h"
 #include "utils.h"
+#include "simd.h"
 
 static void dump_gsm_response(const struct GSM_response *resp);
-
-const char *GSM_basic_charset[] = {
+static inline uint8_t gsm_bcd_value(uint8_t bcd);
+static void gsm_parse_udh(const uint8_t *udh, unsigned int udh_len, struct scsisim_sms *sms);
+static int gsm_decode_address(const uint8_t **ptr, struct scsisim_sms *sms);
+static void gsm_decode_timestamp(const uint8_t *ptr, struct scsisim_sms_time *time);
+static const char *gsm_report_status(uint8_t status);
+static inline unsigned int gsm_encode_char(const char *src, unsigned int len, uint8_t *code);
+static int gsm_encode_chars(const char *src,
+			    unsigned int src_len,
+			    uint8_t *dest,
+			    unsigned int dest_len,
+			    unsigned int *consumed);
+static int gsm_encode_address(const char *address, uint8_t ton_npi, bool smsc, uint8_t *ptr);
+static void gsm_encode_timestamp(const struct scsisim_sms_time *time, uint8_t *ptr);
+static inline uint8_t gsm_telecom_digit(char digit);
+static void gsm_encode_bcd(const char *digits, unsigned int count, uint8_t *ptr, unsigned int len);
+static int gsm_encode_alpha(const char *name, uint8_t *alpha, unsigned int alpha_len);
+
+/* Each entry holds the UTF-8 sequence inline, so mapping a character 
+ * never leaves the table (512 bytes for each of the two) */
+const struct gsm_utf8 GSM_basic_charset[] = {
 	/* 0x00 to 0x07: */
-	"@", "\u00a3", "$", "\u00a5", "\u00e8", "\u00e9", "\u00f9", "\u00ec",
+	GSM_UTF8("@"), GSM_UTF8("\u00a3"), GSM_UTF8("$"), GSM_UTF8("\u00a5"),
+	GSM_UTF8("\u00e8"), GSM_UTF8("\u00e9"), GSM_UTF8("\u00f9"), GSM_UTF8("\u00ec"),
 	/* 0x08 to 0x0f: */
-	"\u00f2", "\u00c7", "\n", "\u00d8", "\u00f8", "\r", "\u00c5", "\u00e5",
+	GSM_UTF8("\u00f2"), GSM_UTF8("\u00c7"), GSM_UTF8("\n"), GSM_UTF8("\u00d8"),
+	GSM_UTF8("\u00f8"), GSM_UTF8("\r"), GSM_UTF8("\u00c5"), GSM_UTF8("\u00e5"),
 	/* 0x10 to 0x17: */
-	"\u0394", "_", "\u03a6", "\u0393", "\u039b", "\u03a9", "\u03a0", "\u03a8",
+	GSM_UTF8("\u0394"), GSM_UTF8("_"), GSM_UTF8("\u03a6"), GSM_UTF8("\u0393"),
+	GSM_UTF8("\u039b"), GSM_UTF8("\u03a9"), GSM_UTF8("\u03a0"), GSM_UTF8("\u03a8"),
 	/* 0x18 to 0x1f: */
-	"\u03a3", "\u0398", "\u039e", "\uffff", "\u00c6", "\u00e6", "\u00df", "\u00c9",
+	GSM_UTF8("\u03a3"), GSM_UTF8("\u0398"), GSM_UTF8("\u039e"), GSM_UTF8("\uffff"),
+	GSM_UTF8("\u00c6"), GSM_UTF8("\u00e6"), GSM_UTF8("\u00df"), GSM_UTF8("\u00c9"),
 	/* 0x20 to 0x27: */
-	" ", "!", "\"", "#", "\u00a4", "%", "&", "'",
+	GSM_UTF8(" "), GSM_UTF8("!"), GSM_UTF8("\""), GSM_UTF8("#"),
+	GSM_UTF8("\u00a4"), GSM_UTF8("%"), GSM_UTF8("&"), GSM_UTF8("'"),
 	/* 0x28 to 0x2f: */
-	"(", ")", "*", "+", ",", "-", ".", "/",
+	GSM_UTF8("("), GSM_UTF8(")"), GSM_UTF8("*"), GSM_UTF8("+"),
+	GSM_UTF8(","), GSM_UTF8("-"), GSM_UTF8("."), GSM_UTF8("/"),
 	/* 0x30 to 0x37: */
-	"0", "1", "2", "3", "4", "5", "6", "7",
+	GSM_UTF8("0"), GSM_UTF8("1"), GSM_UTF8("2"), GSM_UTF8("3"),
+	GSM_UTF8("4"), GSM_UTF8("5"), GSM_UTF8("6"), GSM_UTF8("7"),
 	/* 0x38 to 0x3f: */
-	"8", "9", ":", ";", "<", "=", ">", "?",
+	GSM_UTF8("8"), GSM_UTF8("9"), GSM_UTF8(":"), GSM_UTF8(";"),
+	GSM_UTF8("<"), GSM_UTF8("="), GSM_UTF8(">"), GSM_UTF8("?"),
 	/* 0x40 to 0x47: */
-	"\u00a1", "A", "B", "C", "D", "E", "F", "G",
+	GSM_UTF8("\u00a1"), GSM_UTF8("A"), GSM_UTF8("B"), GSM_UTF8("C"),
+	GSM_UTF8("D"), GSM_UTF8("E"), GSM_UTF8("F"), GSM_UTF8("G"),
 	/* 0x48 to 0x4f: */
-	"H", "I", "J", "K", "L", "M", "N", "O",
+	GSM_UTF8("H"), GSM_UTF8("I"), GSM_UTF8("J"), GSM_UTF8("K"),
+	GSM_UTF8("L"), GSM_UTF8("M"), GSM_UTF8("N"), GSM_UTF8("O"),
 	/* 0x50 to 0x57: */
-	"P", "Q", "R", "S", "T", "U", "V", "W",
+	GSM_UTF8("P"), GSM_UTF8("Q"), GSM_UTF8("R"), GSM_UTF8("S"),
+	GSM_UTF8("T"), GSM_UTF8("U"), GSM_UTF8("V"), GSM_UTF8("W"),
 	/* 0x58 to 0x5f: */
-	"X", "Y", "Z", "\u00c4", "\u00d6", "\u00d1", "\u00dc", "\u00a7",
+	GSM_UTF8("X"), GSM_UTF8("Y"), GSM_UTF8("Z"), GSM_UTF8("\u00c4"),
+	GSM_UTF8("\u00d6"), GSM_UTF8("\u00d1"), GSM_UTF8("\u00dc"), GSM_UTF8("\u00a7"),
 	/* 0x60 to 0x67: */
-	"\u00bf", "a", "b", "c", "d", "e", "f", "g",
+	GSM_UTF8("\u00bf"), GSM_UTF8("a"), GSM_UTF8("b"), GSM_UTF8("c"),
+	GSM_UTF8("d"), GSM_UTF8("e"), GSM_UTF8("f"), GSM_UTF8("g"),
 	/* 0x68 to 0x6f: */
-	"h", "i", "j", "k", "l", "m", "n", "o",
+	GSM_UTF8("h"), GSM_UTF8("i"), GSM_UTF8("j"), GSM_UTF8("k"),
+	GSM_UTF8("l"), GSM_UTF8("m"), GSM_UTF8("n"), GSM_UTF8("o"),
 	/* 0x70 to 0x77: */
-	"p", "q", "r", "s", "t", "u", "v", "w",
+	GSM_UTF8("p"), GSM_UTF8("q"), GSM_UTF8("r"), GSM_UTF8("s"),
+	GSM_UTF8("t"), GSM_UTF8("u"), GSM_UTF8("v"), GSM_UTF8("w"),
 	/* 0x78 to 0x7f */
-	"x", "y", "z", "\u00e4", "\u00f6", "\u00f1", "\u00fc", "\u00e0"
+	GSM_UTF8("x"), GSM_UTF8("y"), GSM_UTF8("z"), GSM_UTF8("\u00e4"),
+	GSM_UTF8("\u00f6"), GSM_UTF8("\u00f1"), GSM_UTF8("\u00fc"), GSM_UTF8("\u00e0")
 };
 
-const char *GSM_basic_charset_extension[] = {
+const struct gsm_utf8 GSM_basic_charset_extension[] = {
 	/* 0x00 to 0x07: */
-	" ", " ", " ", " ", " ", " ", " ", " ",
+	GSM_UTF8(" "), GSM_UTF8(" "), GSM_UTF8(" "), GSM_UTF8(" "),
+	GSM_UTF8(" "), GSM_UTF8(" "), GSM_UTF8(" "), GSM_UTF8(" "),
 	/* 0x08 to 0x0f: */
-	" ", " ", "\f", " ", " ", " ", " ", " ",
+	GSM_UTF8(" "), GSM_UTF8(" "), GSM_UTF8("\f"), GSM_UTF8(" "),
+	GSM_UTF8(" "), GSM_UTF8(" "), GSM_UTF8(" "), GSM_UTF8(" "),
 	/* 0x10 to 0x17: */
-	" ", " ", " ", " ", "^", " ", " ", " ",
+	GSM_UTF8(" "), GSM_UTF8(" "), GSM_UTF8(" "), GSM_UTF8(" "),
+	GSM_UTF8("^"), GSM_UTF8(" "), GSM_UTF8(" "), GSM_UTF8(" "),
 	/* 0x18 to 0x1f: */
-	" ", " ", " ", " ", " ", " ", " ", " ",
+	GSM_UTF8(" "), GSM_UTF8(" "), GSM_UTF8(" "), GSM_UTF8(" "),
+	GSM_UTF8(" "), GSM_UTF8(" "), GSM_UTF8(" "), GSM_UTF8(" "),
 	/* 0x20 to 0x27: */
-	" ", " ", " ", " ", " ", " ", " ", " ",
+	GSM_UTF8(" "), GSM_UTF8(" "), GSM_UTF8(" "), GSM_UTF8(" "),
+	GSM_UTF8(" "), GSM_UTF8(" "), GSM_UTF8(" "), GSM_UTF8(" "),
 	/* 0x28 to 0x2f: */
-	"{", "}", " ", " ", " ", " ", " ", "\\",
+	GSM_UTF8("{"), GSM_UTF8("}"), GSM_UTF8(" "), GSM_UTF8(" "),
+	GSM_UTF8(" "), GSM_UTF8(" "), GSM_UTF8(" "), GSM_UTF8("\\"),
 	/* 0x30 to 0x37: */
-	" ", " ", " ", " ", " ", " ", " ", " ",
+	GSM_UTF8(" "), GSM_UTF8(" "), GSM_UTF8(" "), GSM_UTF8(" "),
+	GSM_UTF8(" "), GSM_UTF8(" "), GSM_UTF8(" "), GSM_UTF8(" "),
 	/* 0x38 to 0x3f: */
-	" ", " ", " ", " ", "[", "~", "]", " ",
+	GSM_UTF8(" "), GSM_UTF8(" "), GSM_UTF8(" "), GSM_UTF8(" "),
+	GSM_UTF8("["), GSM_UTF8("~"), GSM_UTF8("]"), GSM_UTF8(" "),
 	/* 0x40 to 0x47: */
-	"|", " ", " ", " ", " ", " ", " ", " ",
+	GSM_UTF8("|"), GSM_UTF8(" "), GSM_UTF8(" "), GSM_UTF8(" "),
+	GSM_UTF8(" "), GSM_UTF8(" "), GSM_UTF8(" "), GSM_UTF8(" "),
 	/* 0x48 to 0x4f: */
-	" ", " ", " ", " ", " ", " ", " ", " ",
+	GSM_UTF8(" "), GSM_UTF8(" "), GSM_UTF8(" "), GSM_UTF8(" "),
+	GSM_UTF8(" "), GSM_UTF8(" "), GSM_UTF8(" "), GSM_UTF8(" "),
 	/* 0x50 to 0x57: */
-	" ", " ", " ", " ", " ", " ", " ", " ",
+	GSM_UTF8(" "), GSM_UTF8(" "), GSM_UTF8(" "), GSM_UTF8(" "),
+	GSM_UTF8(" "), GSM_UTF8(" "), GSM_UTF8(" "), GSM_UTF8(" "),
 	/* 0x58 to 0x5f: */
-	" ", " ", " ", " ", " ", " ", " ", " ",
+	GSM_UTF8(" "), GSM_UTF8(" "), GSM_UTF8(" "), GSM_UTF8(" "),
+	GSM_UTF8(" "), GSM_UTF8(" "), GSM_UTF8(" "), GSM_UTF8(" "),
 	/* 0x60 to 0x67: */
-	" ", " ", " ", " ", " ", "\u20ac", " ", " ",
+	GSM_UTF8(" "), GSM_UTF8(" "), GSM_UTF8(" "), GSM_UTF8(" "),
+	GSM_UTF8(" "), GSM_UTF8("\u20ac"), GSM_UTF8(" "), GSM_UTF8(" "),
 	/* 0x68 to 0x6f: */
-	" ", " ", " ", " ", " ", " ", " ", " ",
+	GSM_UTF8(" "), GSM_UTF8(" "), GSM_UTF8(" "), GSM_UTF8(" "),
+	GSM_UTF8(" "), GSM_UTF8(" "), GSM_UTF8(" "), GSM_UTF8(" "),
 	/* 0x70 to 0x77: */
-	" ", " ", " ", " ", " ", " ", " ", " ",
+	GSM_UTF8(" "), GSM_UTF8(" "), GSM_UTF8(" "), GSM_UTF8(" "),
+	GSM_UTF8(" "), GSM_UTF8(" "), GSM_UTF8(" "), GSM_UTF8(" "),
 	/* 0x78 to 0x7f */
-	" ", " ", " ", " ", " ", " ", " ", " "
+	GSM_UTF8(" "), GSM_UTF8(" "), GSM_UTF8(" "), GSM_UTF8(" "),
+	GSM_UTF8(" "), GSM_UTF8(" "), GSM_UTF8(" "), GSM_UTF8(" ")
+};
+
+/* The reverse of the two tables above, for encoding: the GSM character
+ * code of each ASCII character, with GSM_EXTENSION_FLAG set for those 
+ * in the extension table, or GSM_NOT_ENCODABLE */
+static const uint8_t GSM_ascii_reverse[] = {
+	/* 0x00 to 0x07: */
+	0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+	/* 0x08 to 0x0f: */
+	0xff, 0xff, 0x0a, 0xff, 0x8a, 0x0d, 0xff, 0xff,
+	/* 0x10 to 0x17: */
+	0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+	/* 0x18 to 0x1f: */
+	0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+	/* 0x20 to 0x27: */
+	0x20, 0x21, 0x22, 0x23, 0x02, 0x25, 0x26, 0x27,
+	/* 0x28 to 0x2f: */
+	0x28, 0x29, 0x2a, 0x2b, 0x2c, 0x2d, 0x2e, 0x2f,
+	/* 0x30 to 0x37: */
+	0x30, 0x31, 0x32, 0x33, 0x34, 0x35, 0x36, 0x37,
+	/* 0x38 to 0x3f: */
+	0x38, 0x39, 0x3a, 0x3b, 0x3c, 0x3d, 0x3e, 0x3f,
+	/* 0x40 to 0x47: */
+	0x00, 0x41, 0x42, 0x43, 0x44, 0x45, 0x46, 0x47,
+	/* 0x48 to 0x4f: */
+	0x48, 0x49, 0x4a, 0x4b, 0x4c, 0x4d, 0x4e, 0x4f,
+	/* 0x50 to 0x57: */
+	0x50, 0x51, 0x52, 0x53, 0x54, 0x55, 0x56, 0x57,
+	/* 0x58 to 0x5f: */
+	0x58, 0x59, 0x5a, 0xbc, 0xaf, 0xbe, 0x94, 0x11,
+	/* 0x60 to 0x67: */
+	0xff, 0x61, 0x62, 0x63, 0x64, 0x65, 0x66, 0x67,
+	/* 0x68 to 0x6f: */
+	0x68, 0x69, 0x6a, 0x6b, 0x6c, 0x6d, 0x6e, 0x6f,
+	/* 0x70 to 0x77: */
+	0x70, 0x71, 0x72, 0x73, 0x74, 0x75, 0x76, 0x77,
+	/* 0x78 to 0x7f: */
+	0x78, 0x79, 0x7a, 0xa8, 0xc0, 0xa9, 0xbd, 0xff
+};
+
+/* ...and of every other character in the GSM alphabet, in a perfect 
+ * hash over the code points: GSM_CHAR_HASH() puts each of them in a 
+ * slot of its own, so a lookup is one multiply and one compare. The 
+ * multiplier was found by trying them in turn against the code points 
+ * in the tables above. */
+#define GSM_CHAR_HASH(ch)		((((ch) * 0xe62b) >> 12) & 0x3f)
+
+static const struct {
+	uint16_t ch;
+	uint8_t code;
+} GSM_unicode_reverse[64] = {
+	/* 0 to 3: */
+	{ 0x20ac, 0xe5 }, { 0x0000, 0xff }, { 0x00ec, 0x07 }, { 0x00c4, 0x5b },
+	/* 4 to 7: */
+	{ 0x0000, 0xff }, { 0x00a5, 0x03 }, { 0x00d6, 0x5c }, { 0x00df, 0x1e },
+	/* 8 to 11: */
+	{ 0x039e, 0x1a }, { 0x00e8, 0x04 }, { 0x00f1, 0x7d }, { 0x00c9, 0x1f },
+	/* 12 to 15: */
+	{ 0x00a1, 0x40 }, { 0x0000, 0xff }, { 0x0000, 0xff }, { 0x00e4, 0x7b },
+	/* 16 to 19: */
+	{ 0x03a3, 0x18 }, { 0x00c5, 0x0e }, { 0x00f6, 0x7c }, { 0x0000, 0xff },
+	/* 20 to 23: */
+	{ 0x0000, 0xff }, { 0x0000, 0xff }, { 0x00e0, 0x7f }, { 0x00e9, 0x05 },
+	/* 24 to 27: */
+	{ 0x03a8, 0x17 }, { 0x00f2, 0x08 }, { 0x0000, 0xff }, { 0x0000, 0xff },
+	/* 28 to 31: */
+	{ 0x00dc, 0x5e }, { 0x039b, 0x14 }, { 0x00e5, 0x0f }, { 0x0000, 0xff },
+	/* 32 to 35: */
+	{ 0x00c6, 0x1c }, { 0x0000, 0xff }, { 0x00a7, 0x5f }, { 0x00d8, 0x0b },
+	/* 36 to 39: */
+	{ 0x0000, 0xff }, { 0x03a0, 0x16 }, { 0x0000, 0xff }, { 0x03a9, 0x15 },
+	/* 40 to 43: */
+	{ 0x00a3, 0x01 }, { 0x00fc, 0x7e }, { 0x0393, 0x13 }, { 0x0000, 0xff },
+	/* 44 to 47: */
+	{ 0x00e6, 0x1d }, { 0x0000, 0xff }, { 0x00c7, 0x09 }, { 0x00f8, 0x0c },
+	/* 48 to 51: */
+	{ 0x0000, 0xff }, { 0x0000, 0xff }, { 0x0398, 0x19 }, { 0x0000, 0xff },
+	/* 52 to 55: */
+	{ 0x0000, 0xff }, { 0x0000, 0xff }, { 0x0000, 0xff }, { 0x00a4, 0x24 },
+	/* 56 to 59: */
+	{ 0x0000, 0xff }, { 0x0394, 0x10 }, { 0x0000, 0xff }, { 0x00bf, 0x60 },
+	/* 60 to 63: */
+	{ 0x03a6, 0x12 }, { 0x00f9, 0x06 }, { 0x00d1, 0x5d }, { 0x0000, 0xff }
 };
 
 const char *GSM_sms_status[] = {
@@ -131,307 +265,538 @@ const char *GSM_ef_structure[] = {
 /**
  * For information about this function, see scsisim.h
  */
-int scsisim_parse_sms(const uint8_t *record, uint8_t record_len)
+int scsisim_decode_sms(const uint8_t *record,
+		       uint8_t record_len,
+		       struct scsisim_sms *sms,
+		       char *text,
+		       unsigned int text_len)
 {
-	/* $FIXUP: This mega-function is just a quick and dirty way to parse 
-	 * SMS records. It should be chopped down to size and split into 
-	 * multiple functions. */
-
 	const uint8_t *ptr = record;
-	unsigned int smsc_len, address_len, msg_len, num_septets, bytes_used, bytes_remaining;
-	uint8_t sms_status, charset, *tmp = NULL;
-	uint8_t year, month, day, hours, minutes, seconds;
-	char *tmp_str1 = NULL, *tmp_str2 = NULL, *tmp_str3 = NULL, *buf = NULL;
-	bool is_alphanum = false;
+	unsigned int smsc_len, msg_len, num_septets, bytes_remaining;
+	unsigned int udh_len, udh_septets = 0;
+	uint8_t first_octet, parameters, septets[GSM_SMS_RECORD_LEN * 8 / 7];
+	int ret;
 
-	if (ptr == NULL || record_len != GSM_SMS_RECORD_LEN)
-	{
-		if (scsisim_verbose())
-			scsisim_pinfo("%s: Invalid SMS record or length (%d bytes)",
-				      __func__, record_len);
+	if (ptr == NULL || sms == NULL || record_len != GSM_SMS_RECORD_LEN)
 		return SCSISIM_INVALID_PARAM;
-	}
 
-	/* Now iterate through the entire SMS record, plucking out whatever is
-	 * of interest to us, and skipping the rest. See the GSM spec for more
-	 * information about the various fields. */
+	memset(sms, 0, sizeof(struct scsisim_sms));
+
+	if (text != NULL && text_len > 0)
+		text[0] = '\0';
+
+	/* Iterate through the SMS record, plucking out whatever is of
+	 * interest to us, and skipping the rest. See GSM spec, 10.5.3 for 
+	 * the record and GSM 03.40, section 9.2 for the TPDU. */
 
 	/* Get SMS status */
 	if (*ptr > sizeof(GSM_sms_status) / sizeof(GSM_sms_status[0]) - 1)
-	{
-		if (scsisim_verbose())
-			scsisim_pinfo("%s: Invalid SMS status %d",
-				      __func__, *ptr);
 		return SCSISIM_SMS_INVALID_STATUS;
-	}
 
-	scsisim_printf("Status:\t%s\n", GSM_sms_status[*ptr++]);
+	sms->status = *ptr++;
 
-	/* Get SMS Center (SMSC) length: subtract 1 byte for TON/NPI, which we
-	 * ignore */
+	/* Get SMS Center (SMSC) length: subtract 1 byte for TON/NPI */
 	smsc_len = *ptr++ - 1;
 
-	if (scsisim_verbose())
-		scsisim_pinfo("%s: SMS Center length is %d bytes",
-			      __func__, smsc_len);
-
 	if (smsc_len <= 0 || smsc_len > GSM_MAX_SMSC_LEN)
 	{
 		/* The entire record is probably free space or invalid, but
 		   we'll press on a bit more to make sure */
-		if (scsisim_verbose())
-			scsisim_pinfo("%s: Invalid SMS Center length - forcing to %d bytes",
-				      __func__, GSM_MAX_SMSC_LEN);
-
 		smsc_len = GSM_MAX_SMSC_LEN;
 	}
 
-	/* Skip TON (Type of number) */
-	ptr++;
+	sms->smsc_ton_npi = *ptr++;
 
 	/* Determine if SMSC number contains valid data */
-	if ( *ptr == 0xff )
+	if (*ptr == 0xff)
+		return SCSISIM_SMS_INVALID_SMSC;
+
+	scsisim_packed_bcd_to_ascii_buf(ptr,
+					smsc_len,
+					true,
+					true,
+					false,
+					sms->smsc,
+					sizeof(sms->smsc));
+	ptr += smsc_len;
+
+	/* TPDU type */
+	first_octet = *ptr++;
+	sms->mti = first_octet & 0x03;
+	sms->udhi = (first_octet & 0x40) ? true : false;
+
+	if (sms->mti == SIM_SMS_MTI_COMMAND &&
+	    (sms->status == SIM_SMS_SENT || sms->status == SIM_SMS_UNSENT))
 	{
-		if (scsisim_verbose())
-			scsisim_pinfo("%s: Invalid SMS Center number - aborting parsing for this record",
-				      __func__);
+		/* SMS-COMMAND: see GSM 03.40, 9.2.2.4 */
+		sms->message_ref = *ptr++;
+		sms->pid = *ptr++;
+		sms->command_type = *ptr++;
+		sms->message_number = *ptr++;
 
-		return SCSISIM_SMS_INVALID_SMSC;
+		if ((ret = gsm_decode_address(&ptr, sms)) != SCSISIM_SUCCESS)
+			return ret;
+
+		/* TP-CDL: the command data itself is not decoded */
+		sms->udl = *ptr;
+
+		return SCSISIM_SUCCESS;
 	}
+	else if (sms->mti == SIM_SMS_MTI_STATUS_REPORT)
+	{
+		/* SMS-STATUS-REPORT: see GSM 03.40, 9.2.2.3 */
+		sms->message_ref = *ptr++;
 
-	if ((tmp = malloc((size_t)smsc_len)) == NULL)
-		return SCSISIM_MEMORY_ALLOCATION_ERROR;
+		/* TP-RA (Recipient Address) */
+		if ((ret = gsm_decode_address(&ptr, sms)) != SCSISIM_SUCCESS)
+			return ret;
 
-	memcpy(tmp, ptr, (size_t)smsc_len);
+		/* TP-SCTS (when the Service Centre got the message), and 
+		 * TP-DT (when it was delivered, or the delivery failed) */
+		sms->has_timestamp = true;
+		gsm_decode_timestamp(ptr, &sms->timestamp);
+		ptr += 7;
+		gsm_decode_timestamp(ptr, &sms->discharge_time);
+		ptr += 7;
 
-	/* Unpack the SMSC number */
-	buf = scsisim_packed_bcd_to_ascii(tmp, smsc_len, true, true, false);
+		sms->report_status = *ptr++;
 
-	scsisim_printf("SMSC:\t%s\n", buf);
-	free(tmp);
-	free(buf);
+		/* TP-PI (Parameter Indicator) is optional, and tells if 
+		 * TP-PID, TP-DCS and TP-UDL follow; 0xff is padding */
+		parameters = *ptr;
 
-	/* Advance past SMSC number */
-	ptr += smsc_len;
+		if (parameters == 0xff || (parameters & 0x07) == 0)
+			return SCSISIM_SUCCESS;
+
+		ptr++;
+
+		if (parameters & 0x01)
+			sms->pid = *ptr++;
 
-	/* TPDU type: get SMS status */
-	sms_status = *ptr++ & 0x03;
-	switch (sms_status)
+		if (parameters & 0x02)
+			sms->dcs = *ptr++;
+
+		if ((parameters & 0x04) == 0)
+			return SCSISIM_SUCCESS;
+	}
+	else if (sms->mti == SIM_SMS_MTI_DELIVER || sms->mti == SIM_SMS_MTI_SUBMIT)
 	{
-		case 0:		/* SMS-DELIVER, SMS-DELIVER-REPORT */
-		case 1:		/* SMS-SUBMIT, SMS-SUBMIT-REPORT */
+		/* TP-MR (Message Reference) for SUBMIT records */
+		if (sms->mti == SIM_SMS_MTI_SUBMIT)
+			sms->message_ref = *ptr++;
 
-			/* Skip TP-MR (Message Reference) for SUBMIT records */
-			if (sms_status == 1)
-				ptr++;
+		/* TP-OA (Originating Address) or TP-DA (Destination Address) */
+		if ((ret = gsm_decode_address(&ptr, sms)) != SCSISIM_SUCCESS)
+			return ret;
 
-			/* Length of TP-OA (Originating Address) or
-			 * TP-DA (Destination Address) in nibbles */
-			address_len = (*ptr++ + (2 - 1)) / 2;
+		sms->pid = *ptr++;
+		sms->dcs = *ptr++;
 
-			if (address_len < GSM_MIN_ADDRESS_LEN ||
-			    address_len > GSM_MAX_ADDRESS_LEN)
+		if (sms->mti == SIM_SMS_MTI_SUBMIT)
+		{
+			/* Skip TP-VP (Validity Period): its format is in TP-VPF */
+			switch ((first_octet >> 3) & 0x03)
 			{
-				if (scsisim_verbose())
-					scsisim_pinfo("%s: Invalid address length (%d bytes)",
-						      __func__, address_len);
-				return SCSISIM_SMS_INVALID_ADDRESS;
+				case 0:		/* Not present */
+					break;
+				case 2:		/* Relative */
+					ptr++;
+					break;
+				default:	/* Enhanced or absolute */
+					ptr += 7;
+					break;
 			}
+		}
+		else
+		{
+			/* TP-SCTS (Service Centre Time Stamp) */
+			sms->has_timestamp = true;
+			gsm_decode_timestamp(ptr, &sms->timestamp);
+			ptr += 7;
+		}
+	}
+	else
+	{
+		/* Reserved message type */
+		return SCSISIM_SUCCESS;
+	}
 
-			if (scsisim_verbose())
-				scsisim_pinfo("%s: Valid address length (%d bytes)",
-					      __func__, address_len);
+	/* Get text length and data */
+	sms->udl = *ptr++;
 
-			/* TON / NPI: all we care about is if message is in
-			 * GSM 7-bit alphanumeric instead of BCD digits, 
-			 * so examine bits 4-6 */
-			if ( (*ptr++ & 0x70) == 0x50 )
-				is_alphanum = true;
+	/* See 3GPP TS 23.038, section 4, "SMS Data Coding Scheme" */
+	sms->charset = (sms->dcs & 0x0c) >> 2;
 
-			/* Get address name or number */
-			if ((tmp = malloc((size_t)address_len)) == NULL)
-			    return SCSISIM_MEMORY_ALLOCATION_ERROR;
+	if (sms->charset == SIM_SMS_CHARSET_GSM)
+		msg_len = (sms->udl * 7 + (8 - 1)) / 8;
+	else
+		msg_len = sms->udl;
 
-			memcpy(tmp, ptr, (size_t)address_len);
+	/* Make sure we don't walk off the end of the record buffer */
+	bytes_remaining = GSM_SMS_RECORD_LEN - (ptr - record);
 
-			if ( is_alphanum )
-			{
-				/* Convert to GSM 7-bit alphanumeric chars */
-				num_septets = address_len * 8 / 7;
-				buf = scsisim_get_gsm_text(tmp, address_len, num_septets);
-			}
-			else
-			{
-				/* Unpack BCD buffer */
-				buf = scsisim_packed_bcd_to_ascii(tmp,
-								  address_len,
-								  true,
-								  true,
-								  false);
-			}
+	if (msg_len > bytes_remaining)
+	{
+		/* This should only happen in rare cases, e.g., a corrupted SIM card */
+		if (scsisim_verbose())
+			scsisim_pinfo("%s: Parsed message length (%d bytes) exceeds bytes remaining in record by %d bytes, truncating message text to %d bytes",
+				      __func__, msg_len, msg_len - bytes_remaining, bytes_remaining);
 
-			scsisim_printf("%s:\t%s\n",
-				       (sms_status == 1) ? "Recipient": "Sender", buf);
-			free(buf);
-			free(tmp);
+		msg_len = bytes_remaining;
+	}
 
-			/* Advance past address number */
-			ptr += address_len;
+	/* The user data may start with a header: its length, then the 
+	 * information elements. It is padded to a whole number of septets 
+	 * in the GSM 7-bit alphabet. */
+	if (sms->udhi && msg_len > 0 && ptr[0] < msg_len)
+	{
+		udh_len = ptr[0] + 1;
+		gsm_parse_udh(ptr + 1, ptr[0], sms);
 
-			/* Skip TP-PID (Protocol Identifier) */
-			ptr++;
+		if (sms->charset == SIM_SMS_CHARSET_GSM)
+			udh_septets = (udh_len * 8 + (7 - 1)) / 7;
+		else
+		{
+			ptr += udh_len;
+			msg_len -= udh_len;
+		}
+	}
 
-			/* TP-DCS (Data Coding Scheme): bits 2-3 */
-			charset = (*ptr++ & 0x0c) >> 2;
+	if (msg_len == 0 || text == NULL || text_len == 0)
+		return SCSISIM_SUCCESS;
 
-			if (sms_status == 1)
+	switch (sms->charset)
+	{
+		case SIM_SMS_CHARSET_GSM:
+			num_septets = scsisim_unpack_septets_buf(sms->udl,
+								 ptr,
+								 msg_len,
+								 septets,
+								 sizeof(septets));
+
+			/* Skip the septets holding the header */
+			if (udh_septets > num_septets)
+				udh_septets = num_septets;
+
+			if ((ret = scsisim_map_gsm_chars_buf(septets + udh_septets,
+							     num_septets - udh_septets,
+							     text,
+							     text_len)) < 0)
 			{
-				/* Skip TP-VP (Validity Period) for SUBMIT records */
-				ptr++;
+				sms->text_len = strlen(text);
+				return ret;
 			}
-			else
+
+			sms->text_len = ret;
+			break;
+		case SIM_SMS_CHARSET_UCS2:
+			if ((ret = scsisim_ucs2_to_utf8(ptr, msg_len, text, text_len)) < 0)
 			{
-				/* Get date */
-				year = *ptr++;
-				month = *ptr++;
-				day = *ptr++;
-				tmp_str1 = scsisim_packed_bcd_to_ascii(&month,
-								       1,
-								       true,
-								       false,
-								       false);
-				tmp_str2 = scsisim_packed_bcd_to_ascii(&day,
-								       1,
-								       true,
-								       false,
-								       false);
-				tmp_str3 = scsisim_packed_bcd_to_ascii(&year,
-								       1,
-								       true,
-								       false,
-								       false);
-
-				scsisim_printf("Date:\t%s/%s/20%s\n",
-					       tmp_str1, tmp_str2, tmp_str3);
-
-				free(tmp_str1);
-				free(tmp_str2);
-				free(tmp_str3);
-
-				/* Get time */
-				hours = *ptr++;
-				minutes = *ptr++;
-				seconds = *ptr++;
-				tmp_str1 = scsisim_packed_bcd_to_ascii(&hours,
-								       1,
-								       true,
-								       false,
-								       false);
-				tmp_str2 = scsisim_packed_bcd_to_ascii(&minutes,
-								       1,
-								       true,
-								       false,
-								       false);
-				tmp_str3 = scsisim_packed_bcd_to_ascii(&seconds,
-								       1,
-								       true,
-								       false,
-								       false);
-
-				scsisim_printf("Time:\t%s:%s:%s\n",
-					       tmp_str1, tmp_str2, tmp_str3);
-
-				free(tmp_str1);
-				free(tmp_str2);
-				free(tmp_str3);
-
-				/* Get timezone */
-				scsisim_printf("Timezone: %02d\n", *ptr++);
+				sms->text_len = strlen(text);
+				return ret;
 			}
 
-			/* Get text length and data */
-			num_septets = *ptr++;
-			msg_len = (num_septets * 7 + (8 - 1)) / 8;
+			sms->text_len = ret;
+			break;
+		default:
+			/* $TODO: Add support for 8-bit data */
+			if (scsisim_verbose())
+				scsisim_pinfo("%s: Character set code %d unsupported",
+					      __func__, sms->charset);
+			break;
+	}
 
-			/* Make sure we don't walk off the end of the record buffer */
-			bytes_used = ptr - record;
-			bytes_remaining = GSM_SMS_RECORD_LEN - bytes_used;
+	return SCSISIM_SUCCESS;
+}
 
-			if (scsisim_verbose())
-				scsisim_pinfo("%s: Currently at offset %d in record. %d bytes remaining.",
-					      __func__,bytes_used, bytes_remaining);
 
-			if (msg_len <= 0)
-			{
-				scsisim_printf("Message is empty\n");
-				return SCSISIM_SUCCESS;
-			}
-			else if (msg_len > bytes_remaining)
-			{
-				/* This should only happen in rare cases, e.g., a corrupted SIM card */
-				scsisim_pinfo("%s: Parsed message length (%d bytes) exceeds bytes remaining in record by %d bytes, truncating message text to %d bytes",
-					      __func__,
-					      msg_len,
-					      msg_len - bytes_remaining,
-					      bytes_remaining);
-
-				/* Truncate message text to however many bytes remain in record */
-				msg_len = bytes_remaining;
-			}
-			else
-			{
-				if (scsisim_verbose())
-					scsisim_pinfo("%s: TP-UD has %d septets packed into %d bytes",
-						      __func__, num_septets, msg_len);
-			}
+/**
+ * For information about this function, see scsisim.h
+ */
+int scsisim_parse_sms(const uint8_t *record, uint8_t record_len)
+{
+	struct scsisim_sms sms;
+	char text[SCSISIM_SMS_MAX_TEXT_LEN];
+	int ret;
 
-			/* $TODO: Add multi-part SMS support. Currently we only
-			 * process single, discrete SMS messages. */
+	ret = scsisim_decode_sms(record, record_len, &sms, text, sizeof(text));
 
-			if ((tmp = malloc((size_t)msg_len)) == NULL)
-				return SCSISIM_MEMORY_ALLOCATION_ERROR;
+	if (ret == SCSISIM_INVALID_PARAM || ret == SCSISIM_SMS_INVALID_STATUS)
+	{
+		if (scsisim_verbose())
+			scsisim_pinfo("%s: Invalid SMS record, length (%d bytes) or status",
+				      __func__, record_len);
+		return ret;
+	}
 
-			memcpy(tmp, ptr, (size_t)msg_len);
+	scsisim_printf("Status:\t%s\n", GSM_sms_status[sms.status]);
 
-			/* See 3GPP TS 23.038, section 4, "SMS Data Coding Scheme" */
-			switch (charset)
-			{
-				case 0:		/* 7-bit GSM alphabet */
-					if (scsisim_verbose())
-						scsisim_pinfo("%s: Using 7-bit GSM character set",
-							      __func__);
+	if (ret == SCSISIM_SMS_INVALID_SMSC)
+	{
+		if (scsisim_verbose())
+			scsisim_pinfo("%s: Invalid SMS Center number - aborting parsing for this record",
+				      __func__);
+		return ret;
+	}
 
-					buf = scsisim_get_gsm_text(tmp, msg_len, num_septets);
+	scsisim_printf("SMSC:\t%s\n", sms.smsc);
 
-					scsisim_printf("Message: %s\n", buf);
+	if (sms.mti != SIM_SMS_MTI_DELIVER && sms.mti != SIM_SMS_MTI_SUBMIT &&
+	    sms.mti != SIM_SMS_MTI_STATUS_REPORT)
+		return SCSISIM_SUCCESS;
 
-					free(buf);
-					break;
-				case 1:		/* 8-bit data */
-				case 2:		/* $TODO: Add support for UTF-16/UCS-2 */
-				case 3:		/* Reserved for Future Use */
-				default:
-					scsisim_printf("Message: [Unsupported character set]\n");
-
-					if (scsisim_verbose())
-						scsisim_pinfo("%s: Character set code %d unsupported",
-							      __func__, charset);
-					break;
-			}
+	if (ret == SCSISIM_SMS_INVALID_ADDRESS)
+	{
+		if (scsisim_verbose())
+			scsisim_pinfo("%s: Invalid address length", __func__);
+		return ret;
+	}
+
+	if (sms.mti == SIM_SMS_MTI_COMMAND &&
+	    (sms.status == SIM_SMS_SENT || sms.status == SIM_SMS_UNSENT))
+	{
+		scsisim_printf("Command: 0x%02x for message %d (reference %d)\n",
+			       sms.command_type, sms.message_number, sms.message_ref);
+		scsisim_printf("Recipient:\t%s\n", sms.address);
+		return ret;
+	}
+
+	if (sms.mti == SIM_SMS_MTI_STATUS_REPORT)
+	{
+		scsisim_printf("Report:\t%s (0x%02x) for message %d\n",
+			       gsm_report_status(sms.report_status),
+			       sms.report_status, sms.message_ref);
+		scsisim_printf("Recipient:\t%s\n", sms.address);
+		scsisim_printf("Discharged: %02d/%02d/%04d %02d:%02d:%02d\n",
+			       sms.discharge_time.month, sms.discharge_time.day,
+			       sms.discharge_time.year, sms.discharge_time.hour,
+			       sms.discharge_time.minute, sms.discharge_time.second);
+	}
+	else
+		scsisim_printf("%s:\t%s\n",
+			       (sms.mti == SIM_SMS_MTI_SUBMIT) ? "Recipient": "Sender", sms.address);
 
-			free(tmp);
+	if (sms.has_timestamp)
+	{
+		scsisim_printf("Date:\t%02d/%02d/%04d\n",
+			       sms.timestamp.month, sms.timestamp.day, sms.timestamp.year);
+		scsisim_printf("Time:\t%02d:%02d:%02d\n",
+			       sms.timestamp.hour, sms.timestamp.minute, sms.timestamp.second);
+		scsisim_printf("Timezone: %02d\n", sms.timestamp.timezone);
+	}
+
+	if (sms.concat_total > 0)
+		scsisim_printf("Part:\t%d of %d (reference %d)\n",
+			       sms.concat_seq, sms.concat_total, sms.concat_ref);
+
+	/* User data is optional in a status report */
+	if (sms.udl == 0 && sms.mti == SIM_SMS_MTI_STATUS_REPORT)
+		return ret;
+
+	if (sms.udl == 0)
+		scsisim_printf("Message is empty\n");
+	else if (sms.charset == SIM_SMS_CHARSET_GSM || sms.charset == SIM_SMS_CHARSET_UCS2)
+		scsisim_printf("Message: %s\n", text);
+	else
+		scsisim_printf("Message: [Unsupported character set]\n");
+
+	return ret;
+}
+
+
+/**
+ * For information about this function, see scsisim.h
+ */
+int scsisim_encode_sms(const struct scsisim_sms *sms,
+		       const char *text,
+		       unsigned int text_len,
+		       uint8_t *records,
+		       unsigned int records_len)
+{
+	uint8_t header[GSM_SMS_RECORD_LEN], udh[GSM_SMS_CONCAT_UDH_LEN];
+	uint8_t septets[GSM_SMS_MAX_UD_LEN * 8 / 7], *record;
+	unsigned int header_len, first_octet, capacity, part_septets, consumed = 0, done = 0;
+	unsigned int udh_len = 0, udh_septets = 0, num_septets, segments, num_records = 0, i;
+	uint8_t charset, dcs;
+	bool concat = false;
+	int ret;
+
+	if (sms == NULL || records == NULL || (text == NULL && text_len > 0))
+		return SCSISIM_INVALID_PARAM;
+
+	/* Build everything up to TP-UDL, which is the same in every 
+	 * part: see GSM spec, 10.5.3 for the record and GSM 03.40, 
+	 * section 9.2 for the TPDU */
+	header[0] = sms->status;
 
+	if ((ret = gsm_encode_address(sms->smsc, sms->smsc_ton_npi, true, header + 1)) < 0)
+		return ret;
+
+	header_len = 1 + ret;
+	first_octet = header_len;
+
+	switch (sms->status)
+	{
+		case SIM_SMS_READ:
+		case SIM_SMS_UNREAD:
+			/* SMS-DELIVER, with TP-MMS set (no more messages) */
+			header[header_len++] = SIM_SMS_MTI_DELIVER | 0x04;
 			break;
-		case 2:		/* SMS-COMMAND, SMS-STATUS-REPORT */
-			/* $TODO: Add support for these SMS statuses */
+		case SIM_SMS_SENT:
+		case SIM_SMS_UNSENT:
+			/* SMS-SUBMIT, without a validity period */
+			header[header_len++] = SIM_SMS_MTI_SUBMIT;
+			header[header_len++] = sms->message_ref;
 			break;
 		default:
-			/* Reserved for Future Use */
-			break;
+			return SCSISIM_SMS_INVALID_STATUS;
+	}
+
+	if ((ret = gsm_encode_address(sms->address, sms->address_ton_npi, false, header + header_len)) < 0)
+		return ret;
+
+	header_len += ret;
+
+	/* Use the GSM alphabet unless UCS-2 is asked for, or needed */
+	if (sms->charset == SIM_SMS_CHARSET_UCS2)
+		charset = SIM_SMS_CHARSET_UCS2;
+	else if (sms->charset != SIM_SMS_CHARSET_GSM)
+		return SCSISIM_INVALID_PARAM;
+	else if ((ret = scsisim_gsm_septet_count(text, text_len, sms->concat_ref, &num_septets, &segments)) == SCSISIM_SUCCESS)
+		charset = SIM_SMS_CHARSET_GSM;
+	else if (ret == SCSISIM_GSM_INVALID_CHAR)
+		charset = SIM_SMS_CHARSET_UCS2;
+	else
+		return ret;
+
+	/* Keep the message class and such from a general data coding DCS; 
+	 * see 3GPP TS 23.038, section 4 */
+	dcs = ((sms->dcs & 0xc0) == 0) ? (sms->dcs & 0xf3) : 0;
+	dcs |= charset << 2;
+
+	header[header_len++] = sms->pid;
+	header[header_len++] = dcs;
+
+	if (sms->status == SIM_SMS_READ || sms->status == SIM_SMS_UNREAD)
+	{
+		gsm_encode_timestamp(&sms->timestamp, header + header_len);
+		header_len += 7;
+	}
+
+	/* A long SMSC and address may leave less than the usual 140 bytes
+	 * of user data */
+	capacity = MIN(GSM_SMS_MAX_UD_LEN, GSM_SMS_RECORD_LEN - header_len - 1);
 
+	/* Does it fit in one record? */
+	if (charset == SIM_SMS_CHARSET_GSM)
+		concat = (num_septets > capacity * 8 / 7);
+	else if (text_len > capacity / 2)
+	{
+		/* UCS-2 is at most twice as long as UTF-8, so only longer 
+		 * text needs converting to find out */
+		if ((ret = utf8_to_ucs2(text, text_len, septets, capacity, &consumed)) < 0)
+			return ret;
+
+		concat = (consumed < text_len);
 	}
 
-	return SCSISIM_SUCCESS;
+	/* If not, each part starts with a User Data Header: see GSM 03.40,
+	 * 9.2.3.24.1. A reference number that won't fit in 8 bits takes 
+	 * the 16-bit form. */
+	if (concat)
+	{
+		udh[udh_len++] = 0;
+		if (sms->concat_ref > 0xff)
+		{
+			udh[udh_len++] = GSM_IEI_CONCAT_16BIT_REF;
+			udh[udh_len++] = 4;
+			udh[udh_len++] = sms->concat_ref >> 8;
+		}
+		else
+		{
+			udh[udh_len++] = GSM_IEI_CONCAT_8BIT_REF;
+			udh[udh_len++] = 3;
+		}
+		udh[udh_len++] = sms->concat_ref & 0xff;
+		udh[udh_len++] = 0;	/* Number of parts: filled in at the end */
+		udh[udh_len++] = 0;	/* Part number */
+		udh[0] = udh_len - 1;
+
+		/* The text is padded to the next septet boundary */
+		udh_septets = (udh_len * 8 + (7 - 1)) / 7;
+	}
+
+	/* GSM_SMS_CONCAT_SEPTETS(udh_len) septets per part, or fewer after
+	 * a long SMSC and address */
+	part_septets = capacity * 8 / 7 - udh_septets;
+
+	do
+	{
+		if ((num_records + 1) * GSM_SMS_RECORD_LEN > records_len)
+			return SCSISIM_BUFFER_TOO_SMALL;
+
+		/* The part number is only 8 bits */
+		if (num_records == 0xff)
+			return SCSISIM_INVALID_PARAM;
+
+		record = records + num_records * GSM_SMS_RECORD_LEN;
+		memcpy(record, header, header_len);
+		memset(record + header_len, 0xff, GSM_SMS_RECORD_LEN - header_len);
+
+		if (concat)
+		{
+			record[first_octet] |= 0x40;	/* TP-UDHI */
+			udh[udh_len - 1] = num_records + 1;
+		}
+
+		if (charset == SIM_SMS_CHARSET_GSM)
+		{
+			/* Leave zeroed septets for the header to be copied over */
+			memset(septets, 0, udh_septets);
+
+			if ((ret = gsm_encode_chars(text + done,
+						    text_len - done,
+						    septets + udh_septets,
+						    part_septets,
+						    &consumed)) < 0)
+				return ret;
+
+			num_septets = udh_septets + ret;
+			record[header_len] = num_septets;
+			scsisim_pack_septets_buf(num_septets,
+						 septets,
+						 record + header_len + 1,
+						 capacity);
+		}
+		else
+		{
+			/* Keep the UCS-2 text to whole characters */
+			if ((ret = utf8_to_ucs2(text + done,
+						text_len - done,
+						record + header_len + 1 + udh_len,
+						(capacity - udh_len) & ~1,
+						&consumed)) < 0)
+				return ret;
+
+			record[header_len] = udh_len + ret;
+		}
+
+		memcpy(record + header_len + 1, udh, udh_len);
+
+		/* Make sure a part too small for even one character 
+		 * doesn't keep us here forever */
+		if (consumed == 0 && done < text_len)
+			return SCSISIM_INVALID_PARAM;
+
+		done += consumed;
+		num_records++;
+	} while (done < text_len);
+
+	/* Now that we know how many parts there are */
+	for (i = 0; concat && i < num_records; i++)
+		records[i * GSM_SMS_RECORD_LEN + header_len + 1 + udh_len - 2] = num_records;
+
+	return num_records;
 }
 
 
@@ -470,21 +835,94 @@ char *scsisim_get_gsm_text(const uint8_t *packed,
  */
 char *scsisim_map_gsm_chars(const uint8_t *src, unsigned int src_len)
 {
-	unsigned int i;
-	char *result = NULL, *dest;
-	const char *ptr;
-	bool escapeChar = false;
+	char *result = NULL;
+	unsigned int len;
 
-	/* Allocate maximum of 4 bytes per Unicode character, 
-	 * plus a null-terminating character: */
-	if (src == NULL || src_len <= 0 ||
-	    (result = malloc((size_t)src_len * 4 + 1)) == NULL)
+	if (src == NULL || src_len <= 0)
 		return NULL;
 
-	dest = result;
+	/* Allocate exactly what the string needs, plus a 
+	 * null-terminating character: */
+	len = scsisim_map_gsm_chars_len(src, src_len);
+
+	if ((result = malloc((size_t)len + 1)) == NULL)
+		return NULL;
+
+	scsisim_map_gsm_chars_buf(src, src_len, result, len + 1);
+
+	return result;
+}
+
+
+/**
+ * For information about this function, see scsisim.h
+ */
+unsigned int scsisim_map_gsm_chars_len(const uint8_t *src, unsigned int src_len)
+{
+	unsigned int i, len = 0;
+	bool escapeChar = false;
+
+	if (src == NULL)
+		return 0;
+
+	for (i = 0; i < src_len && src[i] <= 0x7f; i++)
+	{
+		if (src[i] == GSM_ESCAPE_CHAR)
+			escapeChar = true;
+		else if (escapeChar == true)
+		{
+			len += GSM_basic_charset_extension[src[i]].len;
+			escapeChar = false;
+		}
+		else
+			len += GSM_basic_charset[src[i]].len;
+	}
+
+	return len;
+}
+
+
+/**
+ * For information about this function, see scsisim.h
+ */
+int scsisim_map_gsm_chars_buf(const uint8_t *src,
+			      unsigned int src_len,
+			      char *dest,
+			      unsigned int dest_len)
+{
+	unsigned int i, used = 0, simd_from = 0;
+	const struct gsm_utf8 *utf8;
+	bool escapeChar = false;
+
+	if (src == NULL || dest == NULL)
+		return SCSISIM_INVALID_PARAM;
+
+	if (dest_len == 0)
+		return SCSISIM_BUFFER_TOO_SMALL;
 
 	for (i = 0; i < src_len; i++)
 	{
+#ifdef SIMD_X86
+		/* Copy runs of characters that are the same in ASCII 16 at 
+		 * a time, leaving room for the null-terminating character. 
+		 * After a short run, give the scalar code the next 16 
+		 * characters, so text that is mostly not ASCII doesn't pay 
+		 * for a failed vector compare on every character. */
+		if (i >= simd_from && escapeChar == false && src_len - i >= 16 &&
+		    dest_len - used > 16 && simd_have_sse2())
+		{
+			unsigned int run = simd_gsm_ascii_sse2(src + i,
+							       MIN(src_len - i, dest_len - used - 1),
+							       dest + used);
+			i += run;
+			used += run;
+			simd_from = i + 16;
+
+			if (i == src_len)
+				break;
+		}
+#endif
+
 		/* Check for invalid character index */
 		if (src[i] > 0x7f)
 		{
@@ -504,88 +942,459 @@ char *scsisim_map_gsm_chars(const uint8_t *src, unsigned int src_len)
 		if (escapeChar == true)
 		{
 			/* Look up the extended character code */
-			ptr = GSM_basic_charset_extension[src[i]];
+			utf8 = &GSM_basic_charset_extension[src[i]];
 			escapeChar = false;
 		}
 		else
 		{
 			/* Look up the basic character code */
-			ptr = GSM_basic_charset[src[i]];
+			utf8 = &GSM_basic_charset[src[i]];
+		}
+
+		/* Leave room for the null-terminating character */
+		if (used + utf8->len >= dest_len)
+		{
+			dest[used] = '\0';
+			return SCSISIM_BUFFER_TOO_SMALL;
 		}
 
-		/* Avoid repetitive strcat'ing (AKA Shlemiel's algorithm) */
-		while ((*dest++ = *ptr++) != '\0')
-			;
+		/* A fixed-size copy is cheaper than one of utf8->len bytes */
+		if (dest_len - used > sizeof(utf8->seq))
+			memcpy(dest + used, utf8->seq, sizeof(utf8->seq));
+		else
+			memcpy(dest + used, utf8->seq, utf8->len);
 
-		/* Back up to null character for next concatenation */
-		dest--;
+		used += utf8->len;
 	}
 
-	return result;
+	dest[used] = '\0';
+
+	return used;
 }
 
 
 /**
  * For information about this function, see scsisim.h
  */
-int scsisim_parse_adn(const uint8_t *record, uint8_t record_len)
+int scsisim_encode_gsm_chars(const char *src,
+			     unsigned int src_len,
+			     uint8_t *dest,
+			     unsigned int dest_len)
 {
-	const uint8_t* ptr = record;
-	unsigned int name_len, number_len;
-	uint8_t *tmp = NULL;
-	char *buf = NULL;
-
-	/* Check record_len: 14 bytes (required) for number buffer, 
-	 * plus at least one byte for the name */
-	if (ptr == NULL || record_len < GSM_ADN_NUMBER_BUFFER_LEN + 1u)
-	{
-		return SCSISIM_GSM_INVALID_ADN_RECORD;
-	}
-
-	/* Calculate the name length */
-	name_len = record_len - GSM_ADN_NUMBER_BUFFER_LEN;
+	unsigned int consumed;
+	int ret;
 
-	if (*ptr == 0xff)
-	{
-		scsisim_printf("ADN record unused\n");
-		return SCSISIM_SUCCESS;
-	}
+	if (src == NULL || dest == NULL)
+		return SCSISIM_INVALID_PARAM;
 
-	/* Get the name */
-	buf = scsisim_map_gsm_chars(ptr, name_len);
-	scsisim_printf("Contact name:\t%s\n", buf);
-	free(buf);
+	ret = gsm_encode_chars(src, src_len, dest, dest_len, &consumed);
 
-	ptr += name_len;
+	if (ret >= 0 && consumed < src_len)
+		return SCSISIM_BUFFER_TOO_SMALL;
 
-	/* Get the number length: subtract 1 byte for TON/NPI, which we ignore */
-	number_len = *ptr++ - 1;
+	return ret;
+}
 
-	if (number_len <= 0 || number_len > GSM_MAX_ADN_NUMBER_LEN )
-	{
-		scsisim_pinfo("%s: Invalid number_len %d, forcing to %d",
-			      __func__, number_len, GSM_MAX_ADN_NUMBER_LEN);
-		number_len = GSM_MAX_ADN_NUMBER_LEN;
-	}
 
-	/* Skip TON/NPI */
-	ptr++;
+/**
+ * For information about this function, see scsisim.h
+ */
+int scsisim_gsm_septet_count(const char *src,
+			     unsigned int src_len,
+			     uint16_t concat_ref,
+			     unsigned int *septets,
+			     unsigned int *segments)
+{
+	unsigned int i = 0, n, width, total = 0, parts = 1, part_used = 0, simd_from = 0;
+	unsigned int part_max;
+	uint8_t code;
 
-	if ((tmp = malloc((size_t)number_len)) == NULL)
-		return SCSISIM_MEMORY_ALLOCATION_ERROR;
+	if (src == NULL || septets == NULL || segments == NULL)
+		return SCSISIM_INVALID_PARAM;
 
-	memcpy(tmp, ptr, (size_t)number_len);
+	/* The 16-bit reference takes one more byte of each part's header */
+	part_max = GSM_SMS_CONCAT_SEPTETS((concat_ref > 0xff) ? GSM_SMS_CONCAT_UDH_LEN
+							      : GSM_SMS_CONCAT_8BIT_UDH_LEN);
+
+	while (i < src_len)
+	{
+#ifdef SIMD_X86
+		/* Count runs of characters that are the same in ASCII
+		 * 16 at a time, without copying them anywhere */
+		if (i >= simd_from && src_len - i >= 16 && simd_have_sse2())
+		{
+			unsigned int run = simd_gsm_ascii_sse2((const uint8_t *)src + i,
+							       src_len - i,
+							       NULL);
+			i += run;
+			total += run;
+			simd_from = i + 16;
+
+			/* A run of one-septet characters fills 
+			 * parts in turn */
+			part_used += run;
+			while (part_used > part_max)
+			{
+				part_used -= part_max;
+				parts++;
+			}
+
+			if (i == src_len)
+				break;
+		}
+#endif
+
+		if ((n = gsm_encode_char(src + i, src_len - i, &code)) == 0)
+			return SCSISIM_GSM_INVALID_CHAR;
+
+		width = (code & GSM_EXTENSION_FLAG) ? 2 : 1;
+		total += width;
+
+		/* An escape sequence can't be split between parts */
+		if (part_used + width > part_max)
+		{
+			part_used = width;
+			parts++;
+		}
+		else
+			part_used += width;
+
+		i += n;
+	}
+
+	*septets = total;
+	*segments = (total <= GSM_SMS_MAX_SEPTETS) ? 1 : parts;
+
+	return SCSISIM_SUCCESS;
+}
+
+
+/**
+ * For information about this function, see scsisim.h
+ */
+int scsisim_decode_alpha(const uint8_t *alpha,
+			 unsigned int alpha_len,
+			 char *dest,
+			 unsigned int dest_len)
+{
+	unsigned int i, count, used = 0, len;
+	uint32_t base, ch;
+	const uint8_t *ptr;
+	const struct gsm_utf8 *gsm;
+	char utf8[4];
+	bool escapeChar = false;
+
+	if ((alpha == NULL && alpha_len > 0) || dest == NULL)
+		return SCSISIM_INVALID_PARAM;
+
+	if (dest_len == 0)
+		return SCSISIM_BUFFER_TOO_SMALL;
+
+	dest[0] = '\0';
+
+	/* See GSM 11.11, Annex B for the three UCS-2 codings. Anything 
+	 * else is in the GSM default alphabet. */
+	if (alpha_len == 0 || alpha[0] < 0x80)
+		return scsisim_map_gsm_chars_buf(alpha, alpha_len, dest, dest_len);
+
+	switch (alpha[0])
+	{
+		case 0x80:
+			/* UCS-2 characters, padded with 0xffff */
+			for (len = 1; len + 1 < alpha_len; len += 2)
+			{
+				if (alpha[len] == 0xff && alpha[len + 1] == 0xff)
+					break;
+			}
+
+			return scsisim_ucs2_to_utf8(alpha + 1, len - 1, dest, dest_len);
+		case 0x81:
+			/* Number of characters, then bits 15 to 8 of a base 
+			 * pointer to a half page of UCS-2 */
+			if (alpha_len < 3)
+				return 0;
+
+			count = alpha[1];
+			base = alpha[2] << 7;
+			ptr = alpha + 3;
+			break;
+		case 0x82:
+			/* Number of characters, then a 16-bit base pointer */
+			if (alpha_len < 4)
+				return 0;
+
+			count = alpha[1];
+			base = (alpha[2] << 8) | alpha[3];
+			ptr = alpha + 4;
+			break;
+		default:
+			if (scsisim_verbose())
+				scsisim_pinfo("%s: Unknown alpha identifier coding (0x%02x)",
+					      __func__, alpha[0]);
+			return 0;
+	}
+
+	count = MIN(count, alpha_len - (ptr - alpha));
+
+	/* Each byte is either a character in the GSM default alphabet or, 
+	 * with bit 8 set, an offset into the half page. The latter needs no
+	 * table: the offset just gets added to the base pointer. */
+	for (i = 0; i < count; i++)
+	{
+		if (ptr[i] & 0x80)
+		{
+			ch = base + (ptr[i] & 0x7f);
+
+			if ((ch >= 0xd800 && ch <= 0xdfff) || ch > 0xffff)
+				ch = 0xfffd;
+
+			len = utf8_encode(ch, utf8);
+			escapeChar = false;
+		}
+		else if (ptr[i] == GSM_ESCAPE_CHAR)
+		{
+			escapeChar = true;
+			continue;
+		}
+		else
+		{
+			gsm = escapeChar ? &GSM_basic_charset_extension[ptr[i]] : &GSM_basic_charset[ptr[i]];
+			memcpy(utf8, gsm->seq, sizeof(gsm->seq));
+			len = gsm->len;
+			escapeChar = false;
+		}
+
+		/* Leave room for the null-terminating character */
+		if (used + len >= dest_len)
+		{
+			dest[used] = '\0';
+			return SCSISIM_BUFFER_TOO_SMALL;
+		}
+
+		memcpy(dest + used, utf8, len);
+		used += len;
+	}
+
+	dest[used] = '\0';
+
+	return used;
+}
+
+
+/**
+ * For information about this function, see scsisim.h
+ */
+int scsisim_decode_adn(uint16_t file,
+		       const uint8_t *record,
+		       uint8_t record_len,
+		       struct scsisim_adn *adn,
+		       char *alpha,
+		       unsigned int alpha_len)
+{
+	const uint8_t *ptr;
+	unsigned int tail_len, name_len, number_len;
+	int ret = SCSISIM_SUCCESS;
+
+	/* EF-BDN records have a comparison method pointer at the end */
+	tail_len = GSM_ADN_NUMBER_BUFFER_LEN + ((file == GSM_FILE_EF_BDN) ? 1 : 0);
+
+	if (record == NULL || adn == NULL || record_len < tail_len)
+		return SCSISIM_GSM_INVALID_ADN_RECORD;
+
+	memset(adn, 0, sizeof(struct scsisim_adn));
+
+	/* Calculate the alpha identifier length: it may be zero */
+	name_len = record_len - tail_len;
+	ptr = record + name_len;
+
+	/* Get the alpha identifier */
+	if (alpha != NULL && alpha_len > 0)
+	{
+		if ((ret = scsisim_decode_alpha(record,
+						name_len,
+						alpha,
+						alpha_len)) < 0)
+			adn->alpha_len = strlen(alpha);
+		else
+		{
+			adn->alpha_len = ret;
+			ret = SCSISIM_SUCCESS;
+		}
+	}
+
+	/* Get the number length: it includes 1 byte for TON/NPI, and 0xff
+	 * means there is no number */
+	number_len = *ptr++;
+
+	adn->used = (number_len != 0xff && number_len != 0) ||
+		    (name_len > 0 && record[0] != 0xff);
+
+	if (number_len == 0xff || number_len == 0)
+		number_len = 0;
+	else if (--number_len > GSM_MAX_ADN_NUMBER_LEN)
+		number_len = GSM_MAX_ADN_NUMBER_LEN;
+
+	adn->ton_npi = *ptr++;
 
 	/* Get the number */
-	buf = scsisim_packed_bcd_to_ascii(tmp, number_len, true, true, true);
-	scsisim_printf("Contact number:\t%s\n", buf);
-	free(buf);
-	free(tmp);
+	scsisim_packed_bcd_to_ascii_buf(ptr,
+					number_len,
+					true,
+					true,
+					true,
+					adn->number,
+					sizeof(adn->number));
+	ptr += GSM_MAX_ADN_NUMBER_LEN;
+
+	adn->ccp = *ptr++;
+	adn->ext = *ptr++;
+
+	if (file == GSM_FILE_EF_BDN)
+		adn->comparison = *ptr;
+	else
+		adn->comparison = 0xff;
+
+	return ret;
+}
+
+
+/**
+ * For information about this function, see scsisim.h
+ */
+int scsisim_parse_adn(const uint8_t *record, uint8_t record_len)
+{
+	struct scsisim_adn adn;
+	char alpha[SCSISIM_ADN_MAX_ALPHA_LEN];
+
+	/* Check record_len: 14 bytes (required) for number buffer, 
+	 * plus at least one byte for the name */
+	if (record == NULL || record_len < GSM_ADN_NUMBER_BUFFER_LEN + 1u)
+		return SCSISIM_GSM_INVALID_ADN_RECORD;
+
+	scsisim_decode_adn(GSM_FILE_EF_ADN, record, record_len, &adn, alpha, sizeof(alpha));
+
+	if (adn.used == false)
+	{
+		scsisim_printf("ADN record unused\n");
+		return SCSISIM_SUCCESS;
+	}
+
+	scsisim_printf("Contact name:\t%s\n", alpha);
+	scsisim_printf("Contact number:\t%s\n", adn.number);
 
 	return SCSISIM_SUCCESS;
 }
 
 
+/**
+ * For information about this function, see scsisim.h
+ */
+int scsisim_adn_ext_records(const char *number)
+{
+	unsigned int i, len;
+
+	if (number == NULL)
+		return 0;
+
+	if (number[0] == '+')
+		number++;
+
+	len = strlen(number);
+
+	for (i = 0; i < len; i++)
+	{
+		if (gsm_telecom_digit(number[i]) == 0xff)
+			return SCSISIM_INVALID_PARAM;
+	}
+
+	if (len <= SCSISIM_ADN_MAX_DIGITS)
+		return 0;
+
+	return (len - 1) / SCSISIM_ADN_MAX_DIGITS;
+}
+
+
+/**
+ * For information about this function, see scsisim.h
+ */
+int scsisim_encode_adn(uint16_t file,
+		       const char *name,
+		       const char *number,
+		       uint8_t ton_npi,
+		       uint8_t *record,
+		       uint8_t record_len,
+		       const uint8_t *ext_recnos,
+		       uint8_t *ext,
+		       unsigned int ext_len)
+{
+	uint8_t *ptr;
+	unsigned int i, tail_len, name_len, len, count;
+	int ret, num_ext;
+
+	tail_len = GSM_ADN_NUMBER_BUFFER_LEN + ((file == GSM_FILE_EF_BDN) ? 1 : 0);
+
+	if (record == NULL)
+		return SCSISIM_INVALID_PARAM;
+
+	if (record_len < tail_len)
+		return SCSISIM_GSM_INVALID_ADN_RECORD;
+
+	if ((num_ext = scsisim_adn_ext_records(number)) < 0)
+		return num_ext;
+
+	if (num_ext > 0 &&
+	    (ext_recnos == NULL || ext == NULL || ext_len < num_ext * SCSISIM_EXT_RECORD_LEN))
+		return SCSISIM_BUFFER_TOO_SMALL;
+
+	memset(record, 0xff, record_len);
+
+	/* Get the alpha identifier */
+	name_len = record_len - tail_len;
+
+	if (name != NULL && (ret = gsm_encode_alpha(name, record, name_len)) < 0)
+		return ret;
+
+	ptr = record + name_len;
+
+	if (number == NULL || number[0] == '\0')
+		return 0;
+
+	/* The number length includes 1 byte for TON/NPI */
+	if (ton_npi == 0)
+		ton_npi = (number[0] == '+') ? 0x91 : 0x81;
+
+	if (number[0] == '+')
+		number++;
+
+	len = strlen(number);
+	count = MIN(len, SCSISIM_ADN_MAX_DIGITS);
+
+	ptr[0] = (count + 1) / 2 + 1;
+	ptr[1] = ton_npi;
+	gsm_encode_bcd(number, count, ptr + 2, GSM_MAX_ADN_NUMBER_LEN);
+
+	if (num_ext > 0)
+		ptr[GSM_ADN_NUMBER_BUFFER_LEN - 1] = ext_recnos[0];
+
+	/* The rest of the number goes in a chain of extension records of
+	 * type "additional data": see GSM spec, 10.5.10 */
+	for (i = 0; i < (unsigned int)num_ext; i++)
+	{
+		number += count;
+		len -= count;
+		count = MIN(len, SCSISIM_ADN_MAX_DIGITS);
+
+		ptr = ext + i * SCSISIM_EXT_RECORD_LEN;
+		ptr[0] = 0x02;
+		ptr[1] = (count + 1) / 2;
+		gsm_encode_bcd(number, count, ptr + 2, GSM_MAX_ADN_NUMBER_LEN);
+		ptr[SCSISIM_EXT_RECORD_LEN - 1] = (i + 1 < (unsigned int)num_ext) ? ext_recnos[i + 1] : 0xff;
+	}
+
+	return num_ext;
+}
+
+
 /**
  * Function: gsm_parse_response
  *
@@ -598,7 +1407,8 @@ int scsisim_parse_adn(const uint8_t *record, uint8_t record_len)
  * Given an array of raw GSM GET RESPONSE data, parse it out into its components
  * and load it into a GSM_response struct. 
  * See GSM spec, section 9.2.1 (SELECT command) for detailed information about 
- * all of the fields parsed by this function.
+ * all of the fields parsed by this function, and section 9.2.7 (SEEK command) 
+ * for the record number returned by a SEEK of type 2.
  *
  * Return values: 
  * SCSISIM_SUCCESS
@@ -612,7 +1422,8 @@ int gsm_parse_response(const uint8_t *response,
 
 	if (response == NULL ||
 	    (resp->command == SIM_SELECT_EF && response_len < GSM_MIN_EF_RESPONSE_LEN) ||
-	    (resp->command == SIM_SELECT_MF_DF && response_len < GSM_MIN_MF_DF_RESPONSE_LEN))
+	    (resp->command == SIM_SELECT_MF_DF && response_len < GSM_MIN_MF_DF_RESPONSE_LEN) ||
+	    (resp->command == SIM_SEEK && response_len < 1))
 		return SCSISIM_INVALID_GSM_RESPONSE;
 
 	switch (resp->command)
@@ -651,6 +1462,10 @@ int gsm_parse_response(const uint8_t *response,
 			resp->type.mf_df.CHV2_unblock_attempts_remaining = response[21] & 0x0f;
 			break;
 
+		case SIM_SEEK:
+			resp->type.seek.record_number = response[0];
+			break;
+
 		default:
 			scsisim_pinfo("%s: Unsupported response type", __func__);
 			break;
@@ -725,6 +1540,13 @@ static void dump_gsm_response(const struct GSM_response *resp)
 			scsisim_pinfo("======== End Response Data =======");
 			break;
 
+		case SIM_SEEK:
+			scsisim_pinfo("====== GSM SEEK Response Data ====");
+			scsisim_pinfo("Record number: %d",
+				      resp->type.seek.record_number);
+			scsisim_pinfo("======== End Response Data =======");
+			break;
+
 		default:
 			scsisim_pinfo("%s: Unsupported response type", __func__);
 			break;
@@ -733,5 +1555,618 @@ static void dump_gsm_response(const struct GSM_response *resp)
 }
 
 
-/* EOF */
+/**
+ * Function: gsm_parse_udh
+ *
+ * Parameters:
+ * udh:		Pointer to the information elements of a User Data Header.
+ * udh_len:	Length of the information elements (UDHL).
+ * sms:		(Output) Pointer to scsisim_sms struct.
+ *
+ * Description: 
+ * Walk the information elements of a User Data Header, and fill in the 
+ * concatenation fields of the struct from a concatenated short message 
+ * element: IEI 0x00 (8-bit reference) or 0x08 (16-bit reference). See 
+ * GSM 03.40, 9.2.3.24. Other elements are skipped.
+ *
+ * Return values: 
+ * None
+ */
+static void gsm_parse_udh(const uint8_t *udh, unsigned int udh_len, struct scsisim_sms *sms)
+{
+	unsigned int i, iei_len;
+
+	for (i = 0; i + 2 <= udh_len; i += 2 + iei_len)
+	{
+		iei_len = udh[i + 1];
+
+		if (i + 2 + iei_len > udh_len)
+			break;
+
+		if (udh[i] == GSM_IEI_CONCAT_8BIT_REF && iei_len == 3)
+		{
+			sms->concat_ref = udh[i + 2];
+			sms->concat_total = udh[i + 3];
+			sms->concat_seq = udh[i + 4];
+		}
+		else if (udh[i] == GSM_IEI_CONCAT_16BIT_REF && iei_len == 4)
+		{
+			sms->concat_ref = (udh[i + 2] << 8) | udh[i + 3];
+			sms->concat_total = udh[i + 4];
+			sms->concat_seq = udh[i + 5];
+		}
+	}
+
+	/* A part number of 0 or past the total means the element should 
+	 * be ignored */
+	if (sms->concat_seq == 0 || sms->concat_seq > sms->concat_total)
+	{
+		sms->concat_ref = 0;
+		sms->concat_total = 0;
+		sms->concat_seq = 0;
+	}
+}
+
+
+/**
+ * Function: gsm_decode_address
+ *
+ * Parameters:
+ * ptr:		(Input/Output) Pointer to pointer to the address field;
+ *		advanced past it.
+ * sms:		(Output) Pointer to scsisim_sms struct.
+ *
+ * Description: 
+ * Decode a TP-OA, TP-DA or TP-RA address field (see GSM 03.40, 9.1.2.5)
+ * into the address and address_ton_npi fields of the struct.
+ *
+ * Return values: 
+ * SCSISIM_SUCCESS
+ * SCSISIM_SMS_INVALID_ADDRESS
+ */
+static int gsm_decode_address(const uint8_t **ptr, struct scsisim_sms *sms)
+{
+	const uint8_t *p = *ptr;
+	unsigned int num_nibbles, address_len, num_septets;
+	uint8_t septets[GSM_MAX_ADDRESS_LEN * 8 / 7];
+
+	/* The length is given in nibbles (semi-octets); round up to bytes */
+	num_nibbles = *p++;
+	address_len = (num_nibbles + (2 - 1)) / 2;
+
+	if (address_len < GSM_MIN_ADDRESS_LEN ||
+	    address_len > GSM_MAX_ADDRESS_LEN)
+		return SCSISIM_SMS_INVALID_ADDRESS;
+
+	sms->address_ton_npi = *p++;
+
+	/* A TON of 101 means the address is in the GSM 7-bit alphabet
+	 * instead of BCD digits. Only the septets that fit whole in the
+	 * nibble count are characters: the last byte may hold padding */
+	if ((sms->address_ton_npi & 0x70) == 0x50)
+	{
+		num_septets = scsisim_unpack_septets_buf(num_nibbles * 4 / 7,
+							 p,
+							 address_len,
+							 septets,
+							 sizeof(septets));
+		scsisim_map_gsm_chars_buf(septets,
+					  num_septets,
+					  sms->address,
+					  sizeof(sms->address));
+	}
+	else
+		scsisim_packed_bcd_to_ascii_buf(p,
+						address_len,
+						true,
+						true,
+						false,
+						sms->address,
+						sizeof(sms->address));
+
+	*ptr = p + address_len;
+
+	return SCSISIM_SUCCESS;
+}
+
+
+/**
+ * Function: gsm_decode_timestamp
+ *
+ * Parameters:
+ * ptr:		Pointer to a 7-byte time stamp (e.g., TP-SCTS or TP-DT).
+ * time:	(Output) Pointer to scsisim_sms_time struct.
+ *
+ * Description: 
+ * Decode a time stamp in swapped-nibble BCD: see GSM 03.40, 9.2.3.11.
+ *
+ * Return values: 
+ * None
+ */
+static void gsm_decode_timestamp(const uint8_t *ptr, struct scsisim_sms_time *time)
+{
+	time->year = 2000 + gsm_bcd_value(ptr[0]);
+	time->month = gsm_bcd_value(ptr[1]);
+	time->day = gsm_bcd_value(ptr[2]);
+	time->hour = gsm_bcd_value(ptr[3]);
+	time->minute = gsm_bcd_value(ptr[4]);
+	time->second = gsm_bcd_value(ptr[5]);
+
+	/* Quarters of an hour, with the sign in bit 3 */
+	time->timezone = gsm_bcd_value(ptr[6] & 0xf7);
+	if (ptr[6] & 0x08)
+		time->timezone = -time->timezone;
+}
+
+
+/**
+ * Function: gsm_report_status
+ *
+ * Parameters:
+ * status:	TP-ST value of an SMS-STATUS-REPORT.
+ *
+ * Description: 
+ * Classify a TP-ST value: see GSM 03.40, 9.2.3.15.
+ *
+ * Return value: 
+ * Description of the status.
+ */
+static const char *gsm_report_status(uint8_t status)
+{
+	switch (status & 0x60)
+	{
+		case 0x00:
+			return "Delivered";
+		case 0x20:
+			return "Pending (temporary error, still trying)";
+		case 0x40:
+			return "Failed (permanent error)";
+		default:
+			return "Failed (temporary error, no longer trying)";
+	}
+}
+
+
+/**
+ * Function: gsm_bcd_value
+ *
+ * Parameters:
+ * bcd:		Byte holding two BCD digits, least significant digit first.
+ *
+ * Description: 
+ * Get the value of a byte of swapped-nibble BCD, as used in the 
+ * TP-SCTS time stamp. See GSM 03.40, section 9.2.3.11
+ *
+ * Return value: 
+ * Value from 0 to 99 (more for invalid digits).
+ */
+static inline uint8_t gsm_bcd_value(uint8_t bcd)
+{
+	return (bcd & 0x0f) * 10 + (bcd >> 4);
+}
+
+
+/**
+ * Function: gsm_encode_char
+ *
+ * Parameters:
+ * src:		Pointer to UTF-8 text.
+ * len:		Number of bytes available at src.
+ * code:	(Output) GSM character code, with GSM_EXTENSION_FLAG set if 
+ *		the character is in the extension table.
+ *
+ * Description: 
+ * Look up the GSM character code of the next UTF-8 character: ASCII 
+ * characters in GSM_ascii_reverse, and the rest in the perfect hash 
+ * GSM_unicode_reverse.
+ *
+ * Return value: 
+ * Length of the UTF-8 character in bytes, or 0 if it is malformed or 
+ * not in the GSM alphabet.
+ */
+static inline unsigned int gsm_encode_char(const char *src, unsigned int len, uint8_t *code)
+{
+	unsigned int n;
+	uint32_t ch;
 
+	if ((uint8_t)src[0] < 0x80)
+	{
+		*code = GSM_ascii_reverse[(uint8_t)src[0]];
+		return (*code == GSM_NOT_ENCODABLE) ? 0 : 1;
+	}
+
+	/* Every character of the alphabet but the euro sign is a 
+	 * two-byte sequence, so decode those here */
+	if ((uint8_t)src[0] >= 0xc2 && (uint8_t)src[0] < 0xe0 && len >= 2 &&
+	    ((uint8_t)src[1] & 0xc0) == 0x80)
+	{
+		ch = ((uint8_t)src[0] & 0x1f) << 6 | ((uint8_t)src[1] & 0x3f);
+		n = 2;
+	}
+	else if ((n = utf8_decode(src, len, &ch)) == 0)
+		return 0;
+
+	if (GSM_unicode_reverse[GSM_CHAR_HASH(ch)].ch != ch)
+		return 0;
+
+	*code = GSM_unicode_reverse[GSM_CHAR_HASH(ch)].code;
+
+	return n;
+}
+
+
+/**
+ * Function: gsm_encode_chars
+ *
+ * Parameters:
+ * src:		Pointer to UTF-8 text.
+ * src_len:	Length of src in bytes.
+ * dest:	(Output) Buffer for GSM character codes.
+ * dest_len:	Length of dest buffer.
+ * consumed:	(Output) Number of bytes of src encoded.
+ *
+ * Description: 
+ * Encode as much UTF-8 text in the GSM default alphabet as fits in dest,
+ * never splitting an escape sequence. Stopping early is not an error, 
+ * so a long text can be encoded one SMS at a time.
+ *
+ * Return values: 
+ * Number of septets written to dest, or SCSISIM_GSM_INVALID_CHAR.
+ */
+static int gsm_encode_chars(const char *src,
+			    unsigned int src_len,
+			    uint8_t *dest,
+			    unsigned int dest_len,
+			    unsigned int *consumed)
+{
+	unsigned int i = 0, used = 0, n, simd_from = 0;
+	uint8_t code;
+
+	while (i < src_len)
+	{
+#ifdef SIMD_X86
+		/* Copy runs of characters that are the same in ASCII 16 at 
+		 * a time, as scsisim_map_gsm_chars_buf() does the other way */
+		if (i >= simd_from && src_len - i >= 16 && dest_len - used >= 16 &&
+		    simd_have_sse2())
+		{
+			unsigned int run = simd_gsm_ascii_sse2((const uint8_t *)src + i,
+							       MIN(src_len - i, dest_len - used),
+							       (char *)dest + used);
+			i += run;
+			used += run;
+			simd_from = i + 16;
+
+			if (i == src_len)
+				break;
+		}
+#endif
+
+		if ((n = gsm_encode_char(src + i, src_len - i, &code)) == 0)
+			return SCSISIM_GSM_INVALID_CHAR;
+
+		if (code & GSM_EXTENSION_FLAG)
+		{
+			if (dest_len - used < 2)
+				break;
+
+			dest[used++] = GSM_ESCAPE_CHAR;
+			dest[used++] = code & ~GSM_EXTENSION_FLAG;
+		}
+		else
+		{
+			if (dest_len - used < 1)
+				break;
+
+			dest[used++] = code;
+		}
+
+		i += n;
+	}
+
+	*consumed = i;
+
+	return used;
+}
+
+
+/**
+ * Function: gsm_encode_address
+ *
+ * Parameters:
+ * address:	Digits of the address, optionally with a leading '+', or
+ *		for an alphanumeric address (TON 101), UTF-8 text.
+ * ton_npi:	Type of number and numbering plan, or 0 to pick 0x91 
+ *		(international) for a leading '+' and 0x81 otherwise.
+ * smsc:	true for an SMSC address (length in bytes, counting the
+ *		TON/NPI byte), false for TP-OA or TP-DA (length in digits).
+ * ptr:		(Output) Buffer of at least 2 + GSM_MAX_ADDRESS_LEN bytes.
+ *
+ * Description: 
+ * Encode an address, the inverse of gsm_decode_address(): see GSM 
+ * 04.11, 8.2.5.1 and GSM 03.40, 9.1.2.5.
+ *
+ * Return values: 
+ * Number of bytes written, or one of the following on failure:
+ * SCSISIM_SMS_INVALID_SMSC
+ * SCSISIM_SMS_INVALID_ADDRESS
+ */
+static int gsm_encode_address(const char *address, uint8_t ton_npi, bool smsc, uint8_t *ptr)
+{
+	uint8_t septets[GSM_MAX_ADDRESS_LEN * 8 / 7];
+	unsigned int i, len, consumed, max_len = smsc ? GSM_MAX_SMSC_LEN : GSM_MAX_ADDRESS_LEN;
+	int err = smsc ? SCSISIM_SMS_INVALID_SMSC : SCSISIM_SMS_INVALID_ADDRESS;
+	int ret;
+
+	if (ton_npi == 0)
+		ton_npi = (address[0] == '+') ? 0x91 : 0x81;
+
+	ptr[1] = ton_npi;
+
+	if (smsc == false && (ton_npi & 0x70) == 0x50)
+	{
+		/* Alphanumeric: packed GSM 7-bit, its length in semi-octets */
+		if ((ret = gsm_encode_chars(address,
+					    strlen(address),
+					    septets,
+					    sizeof(septets),
+					    &consumed)) <= 0 ||
+		    consumed < strlen(address))
+			return err;
+
+		len = scsisim_pack_septets_buf(ret, septets, ptr + 2, max_len);
+		ptr[0] = (ret * 7 + (4 - 1)) / 4;
+	}
+	else
+	{
+		if (address[0] == '+')
+			address++;
+
+		len = strlen(address);
+
+		if (len == 0 || (len + 1) / 2 > max_len || is_digit_string(address) == false)
+			return err;
+
+		/* Swapped-nibble BCD, padded with 0xf */
+		for (i = 0; i < len; i++)
+		{
+			if (i % 2 == 0)
+				ptr[2 + i / 2] = 0xf0 | (address[i] - '0');
+			else
+				ptr[2 + i / 2] = (ptr[2 + i / 2] & 0x0f) | (address[i] - '0') << 4;
+		}
+
+		ptr[0] = smsc ? (len + 1) / 2 + 1 : len;
+		len = (len + 1) / 2;
+	}
+
+	/* Keep to what gsm_decode_address() accepts */
+	if (smsc == false && len < GSM_MIN_ADDRESS_LEN)
+		return err;
+
+	return 2 + len;
+}
+
+
+/**
+ * Function: gsm_encode_timestamp
+ *
+ * Parameters:
+ * time:	Pointer to scsisim_sms_time struct.
+ * ptr:		(Output) Buffer of 7 bytes.
+ *
+ * Description: 
+ * Encode a time stamp in swapped-nibble BCD, the inverse of 
+ * gsm_decode_timestamp().
+ *
+ * Return values: 
+ * None
+ */
+static void gsm_encode_timestamp(const struct scsisim_sms_time *time, uint8_t *ptr)
+{
+	unsigned int i, tz = (time->timezone < 0) ? -time->timezone : time->timezone;
+	uint8_t values[7] = { time->year % 100, time->month, time->day, time->hour,
+			      time->minute, time->second, tz };
+
+	for (i = 0; i < 7; i++)
+		ptr[i] = (values[i] % 10) << 4 | (values[i] / 10 % 10);
+
+	/* Quarters of an hour, with the sign in bit 3 */
+	if (time->timezone < 0)
+		ptr[6] |= 0x08;
+}
+
+
+/**
+ * Function: gsm_telecom_digit
+ *
+ * Parameters:
+ * digit:	Character of a dialling number.
+ *
+ * Description: 
+ * Get the BCD value of a digit or telecom digit, the inverse of 
+ * BCD_telecom_digits.
+ *
+ * Return value: 
+ * BCD value, or 0xff if digit is not one.
+ */
+static inline uint8_t gsm_telecom_digit(char digit)
+{
+	switch (digit)
+	{
+		case '*':
+			return 0x0a;
+		case '#':
+			return 0x0b;
+		case ',':
+			return 0x0c;
+		default:
+			return (digit >= '0' && digit <= '9') ? digit - '0' : 0xff;
+	}
+}
+
+
+/**
+ * Function: gsm_encode_bcd
+ *
+ * Parameters:
+ * digits:	Telecom digits, already checked with gsm_telecom_digit().
+ * count:	Number of digits (at most len * 2).
+ * ptr:		(Output) Buffer for the BCD.
+ * len:		Length of ptr buffer.
+ *
+ * Description: 
+ * Pack digits as swapped-nibble BCD, padded with 0xf to len bytes.
+ *
+ * Return value: 
+ * None
+ */
+static void gsm_encode_bcd(const char *digits, unsigned int count, uint8_t *ptr, unsigned int len)
+{
+	unsigned int i;
+
+	memset(ptr, 0xff, len);
+
+	for (i = 0; i < count; i++)
+	{
+		if (i % 2 == 0)
+			ptr[i / 2] = 0xf0 | gsm_telecom_digit(digits[i]);
+		else
+			ptr[i / 2] = (ptr[i / 2] & 0x0f) | gsm_telecom_digit(digits[i]) << 4;
+	}
+}
+
+
+/**
+ * Function: gsm_encode_alpha
+ *
+ * Parameters:
+ * name:	Null-terminated UTF-8 text.
+ * alpha:	(Output) Buffer for the alpha identifier, already padded 
+ *		with 0xff.
+ * alpha_len:	Length of alpha buffer.
+ *
+ * Description: 
+ * Encode an alpha identifier, the inverse of scsisim_decode_alpha(): 
+ * one GSM character per byte if all of name is in the GSM alphabet, and 
+ * otherwise the shortest of the UCS-2 codings of GSM 11.11, Annex B. The 
+ * half-page codings (0x81 and 0x82) store GSM characters as they are 
+ * and the rest as offsets from a base pointer, so they work when those
+ * characters are within 128 code points of each other; 0x81 has a 
+ * shorter header but needs the half page to start on a multiple of 128
+ * below U+8000. Stops at the last whole character that fits.
+ *
+ * Return values: 
+ * Number of bytes written, or SCSISIM_INVALID_PARAM if name is not valid
+ * UTF-8.
+ */
+static int gsm_encode_alpha(const char *name, uint8_t *alpha, unsigned int alpha_len)
+{
+	unsigned int i, n, len = strlen(name), consumed, half_len = 0, ucs2_len = 1;
+	unsigned int header, used, others = 0;
+	uint32_t ch, base, min = 0xffffffff, max = 0;
+	uint8_t code;
+	int ret;
+
+	if (alpha_len == 0)
+		return 0;
+
+	/* Find the characters outside the GSM alphabet, and how long each
+	 * coding would be */
+	for (i = 0; i < len; i += n)
+	{
+		if ((n = gsm_encode_char(name + i, len - i, &code)) > 0)
+		{
+			half_len += (code & GSM_EXTENSION_FLAG) ? 2 : 1;
+			ucs2_len += 2;
+			continue;
+		}
+
+		if ((n = utf8_decode(name + i, len - i, &ch)) == 0)
+			return SCSISIM_INVALID_PARAM;
+
+		min = MIN(min, ch);
+		max = MAX(max, ch);
+		half_len++;
+		ucs2_len += (ch > 0xffff) ? 4 : 2;
+		others++;
+	}
+
+	if (others == 0)
+		return gsm_encode_chars(name, len, alpha, alpha_len, &consumed);
+
+	/* Pick a half-page coding if one fits the characters, and is 
+	 * shorter */
+	if (max < 0x8000 && (min >> 7) == (max >> 7))
+	{
+		header = 3;
+		base = min & 0x7f80;
+	}
+	else
+	{
+		header = 4;
+		base = min;
+	}
+
+	if (max > 0xffff || max - min >= 0x80 || ucs2_len <= half_len + header)
+	{
+		alpha[0] = 0x80;
+
+		if ((ret = utf8_to_ucs2(name, len, alpha + 1, alpha_len - 1, &consumed)) < 0)
+			return ret;
+
+		return ret + 1;
+	}
+
+	if (alpha_len < header)
+		return 0;
+
+	alpha[0] = (header == 3) ? 0x81 : 0x82;
+
+	if (header == 3)
+		alpha[2] = base >> 7;
+	else
+	{
+		alpha[2] = base >> 8;
+		alpha[3] = base & 0xff;
+	}
+
+	used = header;
+
+	for (i = 0; i < len; i += n)
+	{
+		if ((n = gsm_encode_char(name + i, len - i, &code)) > 0)
+		{
+			if (code & GSM_EXTENSION_FLAG)
+			{
+				if (alpha_len - used < 2)
+					break;
+
+				alpha[used++] = GSM_ESCAPE_CHAR;
+				alpha[used++] = code & ~GSM_EXTENSION_FLAG;
+			}
+			else
+			{
+				if (alpha_len - used < 1)
+					break;
+
+				alpha[used++] = code;
+			}
+
+			continue;
+		}
+
+		if (alpha_len - used < 1)
+			break;
+
+		n = utf8_decode(name + i, len - i, &ch);
+		alpha[used++] = 0x80 | (ch - base);
+	}
+
+	/* The number of characters (bytes) after the header */
+	alpha[1] = used - header;
+
+	return used;
+}
+
+/* EOF */
@@ -0,0 +1,556 @@
+/*
+ *  monitor.c
+ *  Hotplug monitor for SIM card readers for the scsisim library.
+ *
+ *  Copyright (c) 2017, Chris Coffey <kpuc@sdf.org>
+ *
+ *  Permission to use, copy, modify, and/or distribute this software
+ *  for any purpose with or without fee is hereby granted, provided
+ *  that the above copyright notice and this permission notice appear
+ *  in all copies.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL
+ *  WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED
+ *  WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE
+ *  AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL
+ *  DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE, DATA
+ *  OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER
+ *  TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ *  PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <linux/netlink.h>
+
+#include "scsisim.h"
+#include "utils.h"
+
+#define MONITOR_MSG_LEN		8192		/* Largest uevent we read */
+#define MONITOR_RCVBUF		(1024 * 1024)	/* Room for a burst of uevents */
+#define MONITOR_UEVENT_GROUP	1		/* Kernel (not udev) uevents */
+
+struct scsisim_monitor {
+	int fd;
+	bool netlink;		/* fd is our own NETLINK_KOBJECT_UEVENT socket */
+	bool resync;		/* Rescan sysfs before reading more uevents */
+	void (*callback)(const struct scsisim_monitor_event *event, void *user_data);
+	void *user_data;
+	struct scsisim_device_info *readers;	/* Supported readers present */
+	unsigned int count;
+	unsigned int max;
+};
+
+static int monitor_open_netlink(void);
+static int monitor_resync(struct scsisim_monitor *monitor);
+static int monitor_handle_uevent(struct scsisim_monitor *monitor,
+				 const char *msg,
+				 unsigned int len);
+static int monitor_add(struct scsisim_monitor *monitor,
+		       const struct scsisim_device_info *info);
+static int monitor_remove(struct scsisim_monitor *monitor, const char *name);
+static int monitor_find(const struct scsisim_monitor *monitor, const char *name);
+static bool monitor_same_reader(const struct scsisim_device_info *a,
+				const struct scsisim_device_info *b);
+static void monitor_notify(const struct scsisim_monitor *monitor,
+			   int action,
+			   const struct scsisim_device_info *info);
+
+
+/**
+ * For information about this function, see scsisim.h
+ */
+int scsisim_monitor_create(struct scsisim_monitor **monitor,
+			   int fd,
+			   void (*callback)(const struct scsisim_monitor_event *event, void *user_data),
+			   void *user_data)
+{
+	struct scsisim_monitor *new_monitor;
+
+	if (monitor == NULL || callback == NULL || fd < -1)
+		return SCSISIM_INVALID_PARAM;
+
+	if ((new_monitor = calloc(1, sizeof(struct scsisim_monitor))) == NULL)
+		return SCSISIM_MEMORY_ALLOCATION_ERROR;
+
+	if (fd == -1)
+	{
+		if ((fd = monitor_open_netlink()) < 0)
+		{
+			free(new_monitor);
+			return SCSISIM_MONITOR_ERROR;
+		}
+
+		new_monitor->netlink = true;
+	}
+
+	new_monitor->fd = fd;
+	new_monitor->callback = callback;
+	new_monitor->user_data = user_data;
+
+	/* The socket is listening already, so the readers found by the first
+	 * scan can't slip between it and the uevents that follow */
+	new_monitor->resync = true;
+
+	*monitor = new_monitor;
+
+	return SCSISIM_SUCCESS;
+}
+
+/**
+ * For information about this function, see scsisim.h
+ */
+void scsisim_monitor_destroy(struct scsisim_monitor *monitor)
+{
+	if (monitor == NULL)
+		return;
+
+	close(monitor->fd);
+	free(monitor->readers);
+	free(monitor);
+}
+
+/**
+ * For information about this function, see scsisim.h
+ */
+int scsisim_monitor_get_fd(const struct scsisim_monitor *monitor)
+{
+	if (monitor == NULL)
+		return SCSISIM_INVALID_PARAM;
+
+	return monitor->fd;
+}
+
+/**
+ * For information about this function, see scsisim.h
+ */
+int scsisim_monitor_dispatch(struct scsisim_monitor *monitor, int timeout)
+{
+	int ret, dispatched = 0;
+	ssize_t len;
+	char msg[MONITOR_MSG_LEN];
+	struct pollfd pfd;
+	struct sockaddr_nl addr;
+	socklen_t addr_len;
+
+	if (monitor == NULL)
+		return SCSISIM_INVALID_PARAM;
+
+	if (monitor->resync)
+	{
+		if ((ret = monitor_resync(monitor)) < 0)
+			return ret;
+
+		/* Don't keep the caller waiting once there is news */
+		if ((dispatched = ret) > 0)
+			timeout = 0;
+	}
+
+	pfd.fd = monitor->fd;
+	pfd.events = POLLIN;
+
+	if ((ret = poll(&pfd, 1, timeout)) <= 0)
+		return (ret == 0 || errno == EINTR) ? dispatched : SCSISIM_MONITOR_ERROR;
+
+	while (1)
+	{
+		addr_len = sizeof(addr);
+		memset(&addr, 0, sizeof(addr));
+
+		len = recvfrom(monitor->fd, msg, sizeof(msg) - 1, MSG_DONTWAIT,
+			       (struct sockaddr *)&addr, &addr_len);
+
+		if (len < 0)
+		{
+			if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)
+				break;
+
+			/* The socket overflowed and uevents were lost, so we
+			 * can't trust what we know any more: rescan */
+			if (errno == ENOBUFS)
+			{
+				if (scsisim_verbose())
+					scsisim_pinfo("%s: uevents lost, rescanning", __func__);
+
+				if ((ret = monitor_resync(monitor)) < 0)
+					return ret;
+
+				dispatched += ret;
+				continue;
+			}
+
+			return SCSISIM_MONITOR_ERROR;
+		}
+
+		/* An injected socket whose peer has closed reads as empty */
+		if (len == 0 && monitor->netlink == false)
+			break;
+
+		/* Only the kernel may speak on the uevent multicast group */
+		if (monitor->netlink && (addr_len != sizeof(addr) || addr.nl_pid != 0))
+			continue;
+
+		msg[len] = '\0';
+
+		if ((ret = monitor_handle_uevent(monitor, msg, len)) < 0)
+			return ret;
+
+		dispatched += ret;
+	}
+
+	return dispatched;
+}
+
+/**
+ * Function: monitor_open_netlink
+ *
+ * Parameters:
+ * None
+ *
+ * Description:
+ * Open a non-blocking NETLINK_KOBJECT_UEVENT socket and join the kernel's
+ * uevent multicast group. This needs no privileges.
+ *
+ * Return values:
+ * The socket, or -1 on failure.
+ */
+static int monitor_open_netlink(void)
+{
+	int fd, rcvbuf = MONITOR_RCVBUF;
+	struct sockaddr_nl addr = { 0 };
+
+	if ((fd = socket(AF_NETLINK, SOCK_DGRAM | SOCK_CLOEXEC | SOCK_NONBLOCK,
+			 NETLINK_KOBJECT_UEVENT)) < 0)
+		return -1;
+
+	addr.nl_family = AF_NETLINK;
+	addr.nl_groups = MONITOR_UEVENT_GROUP;
+
+	if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0)
+	{
+		close(fd);
+		return -1;
+	}
+
+	/* Plugging in a hub full of readers produces a burst of uevents for
+	 * every layer of each device; if they still overflow, we rescan */
+	setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof(rcvbuf));
+
+	return fd;
+}
+
+/**
+ * Function: monitor_resync
+ *
+ * Parameters:
+ * monitor:	Pointer to monitor.
+ *
+ * Description:
+ * Scan sysfs for the supported readers that are present, and report the
+ * difference from what the monitor knew: a remove event for each reader
+ * that is gone, then an add event for each new one.
+ *
+ * Return values:
+ * Number of events dispatched, or one of the following on failure:
+ * SCSISIM_MEMORY_ALLOCATION_ERROR
+ * SCSISIM_SYSFS_CHDIR_FAILED
+ */
+static int monitor_resync(struct scsisim_monitor *monitor)
+{
+	int ret, dispatched = 0;
+	unsigned int i, j, max = 0;
+	struct scsisim_device_info *found = NULL, *tmp;
+
+	/* Readers may come and go while we scan; size the array until
+	 * it holds them all */
+	while ((ret = scsisim_enumerate_devices(found, max)) > (int)max)
+	{
+		max = ret;
+
+		if ((tmp = realloc(found, max * sizeof(struct scsisim_device_info))) == NULL)
+		{
+			free(found);
+			return SCSISIM_MEMORY_ALLOCATION_ERROR;
+		}
+
+		found = tmp;
+	}
+
+	if (ret < 0)
+	{
+		free(found);
+		return ret;
+	}
+
+	for (i = 0; i < monitor->count; i++)
+	{
+		for (j = 0; j < (unsigned int)ret; j++)
+		{
+			if (monitor_same_reader(&monitor->readers[i], &found[j]))
+				break;
+		}
+
+		if (j == (unsigned int)ret)
+		{
+			monitor_notify(monitor, SCSISIM_MONITOR_REMOVE, &monitor->readers[i]);
+			dispatched++;
+		}
+	}
+
+	for (j = 0; j < (unsigned int)ret; j++)
+	{
+		for (i = 0; i < monitor->count; i++)
+		{
+			if (monitor_same_reader(&monitor->readers[i], &found[j]))
+				break;
+		}
+
+		if (i == monitor->count)
+		{
+			monitor_notify(monitor, SCSISIM_MONITOR_ADD, &found[j]);
+			dispatched++;
+		}
+	}
+
+	free(monitor->readers);
+	monitor->readers = found;
+	monitor->count = ret;
+	monitor->max = max;
+	monitor->resync = false;
+
+	return dispatched;
+}
+
+/**
+ * Function: monitor_handle_uevent
+ *
+ * Parameters:
+ * monitor:	Pointer to monitor.
+ * msg:		The uevent: a header such as "add@/devices/...", then 
+ *		KEY=value strings, each followed by a NUL.
+ * len:		Length of msg (msg[len] must be a NUL).
+ *
+ * Description:
+ * Pick out add and remove events for scsi_generic devices, and pass 
+ * them to monitor_add() or monitor_remove(). Everything else is ignored.
+ *
+ * Return values:
+ * Number of events dispatched, or SCSISIM_MEMORY_ALLOCATION_ERROR.
+ */
+static int monitor_handle_uevent(struct scsisim_monitor *monitor,
+				 const char *msg,
+				 unsigned int len)
+{
+	const char *p, *end = msg + len;
+	const char *action = NULL, *subsystem = NULL, *devname = NULL, *devpath = NULL;
+	const char *name, *slash;
+	struct scsisim_device_info info;
+	int ret;
+
+	/* Skip the header, which repeats ACTION and DEVPATH */
+	for (p = msg + strlen(msg) + 1; p < end; p += strlen(p) + 1)
+	{
+		if (strncmp(p, "ACTION=", 7) == 0)
+			action = p + 7;
+		else if (strncmp(p, "SUBSYSTEM=", 10) == 0)
+			subsystem = p + 10;
+		else if (strncmp(p, "DEVNAME=", 8) == 0)
+			devname = p + 8;
+		else if (strncmp(p, "DEVPATH=", 8) == 0)
+			devpath = p + 8;
+	}
+
+	if (action == NULL || subsystem == NULL || strcmp(subsystem, "scsi_generic") != 0)
+		return 0;
+
+	/* DEVNAME is relative to /dev; the last part of DEVPATH is the 
+	 * same name, in case the kernel didn't send it */
+	if ((name = (devname != NULL) ? devname : devpath) == NULL)
+		return 0;
+
+	if ((slash = strrchr(name, '/')) != NULL)
+		name = slash + 1;
+
+	if (*name == '\0' || strlen(name) >= SCSISIM_DEVICE_NAME_LEN)
+		return 0;
+
+	if (strcmp(action, "remove") == 0)
+		return monitor_remove(monitor, name);
+
+	if (strcmp(action, "add") != 0)
+		return 0;
+
+	/* The class entry exists before the kernel announces it, but the 
+	 * reader may be gone again already */
+	if ((ret = scsisim_identify_device(name, &info)) != SCSISIM_SUCCESS)
+	{
+		if (scsisim_verbose() && ret != SCSISIM_DEVICE_NOT_SUPPORTED)
+			scsisim_pinfo("%s: %s: %s", __func__, name, scsisim_strerror(ret));
+
+		return 0;
+	}
+
+	return monitor_add(monitor, &info);
+}
+
+/**
+ * Function: monitor_add
+ *
+ * Parameters:
+ * monitor:	Pointer to monitor.
+ * info:	Reader that was plugged in.
+ *
+ * Description:
+ * Remember a supported reader and report it, unless it is known already.
+ * If a different reader had the same sg name, its removal was missed, so
+ * it is reported removed first.
+ *
+ * Return values:
+ * Number of events dispatched, or SCSISIM_MEMORY_ALLOCATION_ERROR.
+ */
+static int monitor_add(struct scsisim_monitor *monitor,
+		       const struct scsisim_device_info *info)
+{
+	int i, dispatched = 0;
+	unsigned int max;
+	struct scsisim_device_info *tmp;
+
+	if ((i = monitor_find(monitor, info->name)) >= 0)
+	{
+		if (monitor_same_reader(&monitor->readers[i], info))
+			return 0;
+
+		dispatched = monitor_remove(monitor, info->name);
+	}
+
+	if (monitor->count == monitor->max)
+	{
+		max = (monitor->max > 0) ? monitor->max * 2 : 8;
+
+		if ((tmp = realloc(monitor->readers, max * sizeof(struct scsisim_device_info))) == NULL)
+			return SCSISIM_MEMORY_ALLOCATION_ERROR;
+
+		monitor->readers = tmp;
+		monitor->max = max;
+	}
+
+	monitor->readers[monitor->count++] = *info;
+	monitor_notify(monitor, SCSISIM_MONITOR_ADD, info);
+
+	return dispatched + 1;
+}
+
+/**
+ * Function: monitor_remove
+ *
+ * Parameters:
+ * monitor:	Pointer to monitor.
+ * name:	Name of the sg device that went away.
+ *
+ * Description:
+ * Forget a reader and report it, with what was known about it when it 
+ * was added (sysfs no longer has it). Unknown devices are ignored.
+ *
+ * Return values:
+ * Number of events dispatched (0 or 1).
+ */
+static int monitor_remove(struct scsisim_monitor *monitor, const char *name)
+{
+	int i;
+	struct scsisim_device_info info;
+
+	if ((i = monitor_find(monitor, name)) < 0)
+		return 0;
+
+	info = monitor->readers[i];
+	monitor->readers[i] = monitor->readers[--monitor->count];
+	monitor_notify(monitor, SCSISIM_MONITOR_REMOVE, &info);
+
+	return 1;
+}
+
+/**
+ * Function: monitor_find
+ *
+ * Parameters:
+ * monitor:	Pointer to monitor.
+ * name:	Name of an sg device.
+ *
+ * Description:
+ * Look up a known reader by name.
+ *
+ * Return values:
+ * Index into monitor->readers, or -1 if not found.
+ */
+static int monitor_find(const struct scsisim_monitor *monitor, const char *name)
+{
+	unsigned int i;
+
+	for (i = 0; i < monitor->count; i++)
+	{
+		if (strcmp(monitor->readers[i].name, name) == 0)
+			return i;
+	}
+
+	return -1;
+}
+
+/**
+ * Function: monitor_same_reader
+ *
+ * Parameters:
+ * a:		Pointer to a reader.
+ * b:		Pointer to another reader.
+ *
+ * Description:
+ * Check whether two entries describe the same reader under the same name.
+ *
+ * Return values:
+ * true or false
+ */
+static bool monitor_same_reader(const struct scsisim_device_info *a,
+				const struct scsisim_device_info *b)
+{
+	return strcmp(a->name, b->name) == 0 &&
+	       strcmp(a->usb_path, b->usb_path) == 0 &&
+	       strcmp(a->serial, b->serial) == 0 &&
+	       a->vendor == b->vendor &&
+	       a->product == b->product;
+}
+
+/**
+ * Function: monitor_notify
+ *
+ * Parameters:
+ * monitor:	Pointer to monitor.
+ * action:	SCSISIM_MONITOR_ADD or SCSISIM_MONITOR_REMOVE.
+ * info:	The reader.
+ *
+ * Description:
+ * Invoke the monitor's callback.
+ *
+ * Return value:
+ * None
+ */
+static void monitor_notify(const struct scsisim_monitor *monitor,
+			   int action,
+			   const struct scsisim_device_info *info)
+{
+	struct scsisim_monitor_event event;
+
+	event.action = action;
+	event.info = *info;
+
+	if (scsisim_verbose())
+		scsisim_pinfo("%s: %s %s (%04x:%04x at %s)", __func__,
+			      (action == SCSISIM_MONITOR_ADD) ? "add" : "remove",
+			      info->name, info->vendor, info->product, info->usb_path);
+
+	monitor->callback(&event, monitor->user_data);
+}
+
+/* EOF */
@@ -0,0 +1,320 @@
+/*
+ *  path.c
+ *  Path-based file selection for the scsisim library.
+ *
+ *  Copyright (c) 2017, Chris Coffey <kpuc@sdf.org>
+ *
+ *  Permission to use, copy, modify, and/or distribute this software
+ *  for any purpose with or without fee is hereby granted, provided
+ *  that the above copyright notice and this permission notice appear
+ *  in all copies.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL 
+ *  WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED
+ *  WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE
+ *  AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL
+ *  DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE, DATA
+ *  OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER
+ *  TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ *  PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdbool.h>
+#include <ctype.h>
+
+#include "scsisim.h"
+#include "gsm.h"
+#include "utils.h"
+#include "cache.h"
+
+/* The planner only ever visits directories on the way up from the current
+ * DF or on the way down to the target: that's at most this many */
+#define PATH_MAX_NODES		(2 * SCSISIM_MAX_PATH_DEPTH)
+
+/* Structure to hold a directory visited by the planner */
+struct path_node {
+	uint16_t path[SCSISIM_MAX_PATH_DEPTH];
+	unsigned int depth;
+	int prev;		/* Index of the node we came from, -1 for start */
+};
+
+static int path_parse(const char *str, uint16_t *path, unsigned int *depth);
+static int path_plan(const uint16_t *from,
+		     unsigned int from_depth,
+		     const uint16_t *to,
+		     unsigned int to_depth,
+		     uint16_t *moves);
+
+
+/**
+ * For information about this function, see scsisim.h
+ */
+int scsisim_select_path(const struct scsisim_dev *device, const char *path)
+{
+	int ret, i, num_moves;
+	uint16_t target[SCSISIM_MAX_PATH_DEPTH], cur[SCSISIM_MAX_PATH_DEPTH];
+	uint16_t moves[PATH_MAX_NODES], cur_ef;
+	unsigned int depth, dir_depth, cur_depth;
+
+	if (device == NULL || path == NULL ||
+	    path_parse(path, target, &depth) != SCSISIM_SUCCESS)
+		return SCSISIM_INVALID_PARAM;
+
+	/* The directory we need to be in: the target itself if it is a DF, 
+	 * otherwise its parent */
+	dir_depth = GSM_FILE_IS_DF(target[depth - 1]) ? depth : depth - 1;
+
+	/* Start from the MF if we don't know where we are */
+	if ((cur_depth = cache_get_position(device, cur, &cur_ef)) == 0)
+	{
+		if ((ret = scsisim_select_file(device, GSM_FILE_MF)) < 0)
+			return ret;
+
+		if ((cur_depth = cache_get_position(device, cur, &cur_ef)) == 0)
+		{
+			/* No cache: pretend we are in the MF anyway */
+			cur[0] = GSM_FILE_MF;
+			cur_depth = 1;
+		}
+	}
+
+	num_moves = path_plan(cur, cur_depth, target, dir_depth, moves);
+
+	if (scsisim_verbose())
+		scsisim_pinfo("%s: %s takes %d directory SELECT(s) from depth %u",
+			      __func__, path, num_moves, cur_depth);
+
+	/* The last SELECT gives the return value, so leave it for below */
+	if (dir_depth == depth && num_moves > 0)
+		num_moves--;
+
+	for (i = 0; i < num_moves; i++)
+	{
+		if ((ret = scsisim_select_file(device, moves[i])) < 0)
+			return ret;
+	}
+
+	return scsisim_select_file(device, target[depth - 1]);
+}
+
+/**
+ * For information about this function, see scsisim.h
+ */
+int scsisim_get_current_path(const struct scsisim_dev *device,
+			     char *path,
+			     unsigned int len)
+{
+	uint16_t cur[SCSISIM_MAX_PATH_DEPTH], ef;
+	unsigned int depth, i, pos = 0;
+
+	if (device == NULL || path == NULL)
+		return SCSISIM_INVALID_PARAM;
+
+	if ((depth = cache_get_position(device, cur, &ef)) == 0)
+		return SCSISIM_PATH_UNKNOWN;
+
+	if (ef != 0)
+		cur[depth++] = ef;
+
+	if (len < depth * 5)
+		return SCSISIM_BUFFER_TOO_SMALL;
+
+	for (i = 0; i < depth; i++)
+		pos += sprintf(path + pos, (i == 0) ? "%04X" : "/%04X", cur[i]);
+
+	return SCSISIM_SUCCESS;
+}
+
+/**
+ * Function: path_parse
+ *
+ * Parameters:
+ * str:		Path string, e.g., "3F00/7F10/6F3A".
+ * path:	(Output) File IDs in the path.
+ * depth:	(Output) Number of file IDs in the path.
+ *
+ * Description: 
+ * Parse a path string, and check that every file ID fits its level in the
+ * GSM file tree: the MF, then a 7F DF or a 2F EF, then a 5F DF or a 6F
+ * EF, then a 4F EF. See GSM spec, 6.2
+ *
+ * Return values: 
+ * SCSISIM_SUCCESS
+ * SCSISIM_INVALID_PARAM
+ */
+static int path_parse(const char *str, uint16_t *path, unsigned int *depth)
+{
+	/* File ID prefixes allowed at each level. There is no DF at the 
+	 * deepest level and no EF at the top, so those entries are unused. */
+	static const uint8_t df_prefix[SCSISIM_MAX_PATH_DEPTH] = { 0x3f, 0x7f, 0x5f, 0x00 };
+	static const uint8_t ef_prefix[SCSISIM_MAX_PATH_DEPTH] = { 0x00, 0x2f, 0x6f, 0x4f };
+	unsigned int n = 0, i;
+	uint16_t id;
+
+	for (;;)
+	{
+		if (n == SCSISIM_MAX_PATH_DEPTH)
+			return SCSISIM_INVALID_PARAM;
+
+		for (i = 0, id = 0; i < 4; i++, str++)
+		{
+			if (isxdigit((unsigned char)*str) == 0)
+				return SCSISIM_INVALID_PARAM;
+
+			id = (id << 4) | (isdigit((unsigned char)*str) ? *str - '0' : (tolower((unsigned char)*str) - 'a' + 10));
+		}
+
+		if (n < SCSISIM_MAX_PATH_DEPTH - 1 && (id >> 8) == df_prefix[n])
+			path[n++] = id;
+		else if (n > 0 && (id >> 8) == ef_prefix[n] && *str == '\0')
+			path[n++] = id;	/* An EF can only come last */
+		else
+			return SCSISIM_INVALID_PARAM;
+
+		if (*str == '\0')
+			break;
+
+		if (*str++ != '/')
+			return SCSISIM_INVALID_PARAM;
+	}
+
+	/* There is only one MF */
+	if (path[0] != GSM_FILE_MF)
+		return SCSISIM_INVALID_PARAM;
+
+	*depth = n;
+
+	return SCSISIM_SUCCESS;
+}
+
+/**
+ * Function: path_find_node
+ *
+ * Parameters:
+ * nodes:	Nodes visited so far.
+ * num_nodes:	Number of nodes visited so far.
+ * path:	Path of directory.
+ * depth:	Number of file IDs in path.
+ *
+ * Description: 
+ * Check whether the planner has visited a directory already.
+ *
+ * Return values: 
+ * true - Already visited.
+ * false - Not visited yet.
+ */
+static bool path_find_node(const struct path_node *nodes,
+			   int num_nodes,
+			   const uint16_t *path,
+			   unsigned int depth)
+{
+	int i;
+
+	for (i = 0; i < num_nodes; i++)
+	{
+		if (nodes[i].depth == depth &&
+		    memcmp(nodes[i].path, path, depth * sizeof(uint16_t)) == 0)
+			return true;
+	}
+
+	return false;
+}
+
+/**
+ * Function: path_plan
+ *
+ * Parameters:
+ * from:	Path of the current DF.
+ * from_depth:	Number of file IDs in from.
+ * to:		Path of the target DF (only the first to_depth entries
+ *		are used).
+ * to_depth:	Number of file IDs in to.
+ * moves:	(Output) DFs to select, in order.
+ *
+ * Description: 
+ * Breadth-first search for the shortest sequence of SELECTs that gets
+ * from one DF to another. From any DF, the rules in GSM spec, 6.5 allow
+ * selecting the MF, the parent DF, an immediate child DF, or a sibling 
+ * DF; only moves that lead towards the target (or up) are worth trying.
+ *
+ * Return value: 
+ * Number of moves.
+ */
+static int path_plan(const uint16_t *from,
+		     unsigned int from_depth,
+		     const uint16_t *to,
+		     unsigned int to_depth,
+		     uint16_t *moves)
+{
+	struct path_node nodes[PATH_MAX_NODES * 2];
+	struct path_node next[4];
+	int head = 0, num_nodes = 1, i, j, num_next, num_moves;
+	unsigned int d;
+	const struct path_node *cur;
+
+	memcpy(nodes[0].path, from, from_depth * sizeof(uint16_t));
+	nodes[0].depth = from_depth;
+	nodes[0].prev = -1;
+
+	while (head < num_nodes)
+	{
+		cur = &nodes[head];
+		d = cur->depth;
+
+		if (d == to_depth && memcmp(cur->path, to, d * sizeof(uint16_t)) == 0)
+			break;
+
+		num_next = 0;
+
+		/* The MF is always selectable */
+		next[num_next].path[0] = GSM_FILE_MF;
+		next[num_next++].depth = 1;
+
+		/* The parent */
+		if (d > 1)
+		{
+			memcpy(next[num_next].path, cur->path, (d - 1) * sizeof(uint16_t));
+			next[num_next++].depth = d - 1;
+		}
+
+		/* A child or a sibling on the way to the target: both share 
+		 * everything but their last file ID with the target */
+		for (j = 0; j < 2; j++)
+		{
+			unsigned int depth = (j == 0) ? d + 1 : d;
+
+			if (depth >= 2 && depth <= to_depth &&
+			    memcmp(cur->path, to, (depth - 1) * sizeof(uint16_t)) == 0)
+			{
+				memcpy(next[num_next].path, to, depth * sizeof(uint16_t));
+				next[num_next++].depth = depth;
+			}
+		}
+
+		for (i = 0; i < num_next && num_nodes < PATH_MAX_NODES * 2; i++)
+		{
+			if (path_find_node(nodes, num_nodes, next[i].path, next[i].depth))
+				continue;
+
+			nodes[num_nodes] = next[i];
+			nodes[num_nodes++].prev = head;
+		}
+
+		head++;
+	}
+
+	/* The target is always reachable (via the MF), so walk back from it */
+	for (num_moves = 0, i = head; nodes[i].prev != -1; i = nodes[i].prev)
+		num_moves++;
+
+	for (j = num_moves - 1, i = head; j >= 0; i = nodes[i].prev, j--)
+		moves[j] = nodes[i].path[nodes[i].depth - 1];
+
+	return num_moves;
+}
+
+/* EOF */
+
@@ -0,0 +1,164 @@
+/*
+ *  reactor.c
+ *  Event loop driving many devices for the scsisim library.
+ *
+ *  Copyright (c) 2017, Chris Coffey <kpuc@sdf.org>
+ *
+ *  Permission to use, copy, modify, and/or distribute this software
+ *  for any purpose with or without fee is hereby granted, provided
+ *  that the above copyright notice and this permission notice appear
+ *  in all copies.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL 
+ *  WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED
+ *  WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE
+ *  AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL
+ *  DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE, DATA
+ *  OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER
+ *  TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ *  PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <stdlib.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+
+#include "scsisim.h"
+#include "utils.h"
+
+#define REACTOR_MAX_EVENTS	64	/* Ready devices handled per epoll_wait() */
+
+struct scsisim_reactor {
+	int epfd;
+};
+
+
+/**
+ * For information about this function, see scsisim.h
+ */
+int scsisim_reactor_create(struct scsisim_reactor **reactor)
+{
+	struct scsisim_reactor *new_reactor;
+
+	if (reactor == NULL)
+		return SCSISIM_INVALID_PARAM;
+
+	if ((new_reactor = malloc(sizeof(struct scsisim_reactor))) == NULL)
+		return SCSISIM_MEMORY_ALLOCATION_ERROR;
+
+	if ((new_reactor->epfd = epoll_create1(EPOLL_CLOEXEC)) < 0)
+	{
+		free(new_reactor);
+		return SCSISIM_REACTOR_ERROR;
+	}
+
+	*reactor = new_reactor;
+
+	return SCSISIM_SUCCESS;
+}
+
+/**
+ * For information about this function, see scsisim.h
+ */
+void scsisim_reactor_destroy(struct scsisim_reactor *reactor)
+{
+	if (reactor == NULL)
+		return;
+
+	close(reactor->epfd);
+	free(reactor);
+}
+
+/**
+ * For information about this function, see scsisim.h
+ */
+int scsisim_reactor_add(struct scsisim_reactor *reactor,
+			struct scsisim_dev *device)
+{
+	struct epoll_event ev = { 0 };
+
+	if (reactor == NULL || device == NULL || device->transport == NULL)
+		return SCSISIM_INVALID_PARAM;
+
+	/* The device's fd becomes readable when a command has completed */
+	ev.events = EPOLLIN;
+	ev.data.ptr = device;
+
+	if (epoll_ctl(reactor->epfd, EPOLL_CTL_ADD, device->fd, &ev) != 0)
+		return SCSISIM_REACTOR_ERROR;
+
+	if (scsisim_verbose())
+		scsisim_pinfo("%s: added %s, fd = %d", __func__, device->name, device->fd);
+
+	return SCSISIM_SUCCESS;
+}
+
+/**
+ * For information about this function, see scsisim.h
+ */
+int scsisim_reactor_remove(struct scsisim_reactor *reactor,
+			   struct scsisim_dev *device)
+{
+	if (reactor == NULL || device == NULL)
+		return SCSISIM_INVALID_PARAM;
+
+	if (epoll_ctl(reactor->epfd, EPOLL_CTL_DEL, device->fd, NULL) != 0)
+		return SCSISIM_REACTOR_ERROR;
+
+	return SCSISIM_SUCCESS;
+}
+
+/**
+ * For information about this function, see scsisim.h
+ */
+int scsisim_reactor_run(struct scsisim_reactor *reactor, int timeout)
+{
+	int ret, i, n, dispatched = 0, err = SCSISIM_SUCCESS;
+	struct epoll_event events[REACTOR_MAX_EVENTS];
+	struct scsisim_dev *device;
+	struct scsisim_request req;
+	const struct scsisim_completion *completion;
+
+	if (reactor == NULL)
+		return SCSISIM_INVALID_PARAM;
+
+	if ((n = epoll_wait(reactor->epfd, events, REACTOR_MAX_EVENTS, timeout)) < 0)
+		return (errno == EINTR) ? 0 : SCSISIM_REACTOR_ERROR;
+
+	for (i = 0; i < n; i++)
+	{
+		device = events[i].data.ptr;
+
+		/* Drain everything that has completed on this device, without
+		 * blocking; the callbacks may queue more commands as we go */
+		while ((ret = scsisim_reap(device, &req, 0)) == SCSISIM_SUCCESS)
+		{
+			dispatched++;
+
+			if ((completion = req.user_data) != NULL && completion->callback != NULL)
+				completion->callback(device, &req);
+		}
+
+		/* A reader that went away would otherwise wake us up forever */
+		if ((events[i].events & (EPOLLERR | EPOLLHUP)) && ret == SCSISIM_NO_COMMANDS_PENDING)
+		{
+			epoll_ctl(reactor->epfd, EPOLL_CTL_DEL, device->fd, NULL);
+			ret = SCSISIM_REACTOR_ERROR;
+		}
+
+		if (ret != SCSISIM_TIMEOUT && ret != SCSISIM_NO_COMMANDS_PENDING)
+		{
+			if (scsisim_verbose())
+				scsisim_pinfo("%s: %s: %s", __func__, device->name, scsisim_strerror(ret));
+
+			if (err == SCSISIM_SUCCESS)
+				err = ret;
+		}
+	}
+
+	return (err != SCSISIM_SUCCESS) ? err : dispatched;
+}
+
+/* EOF */
+
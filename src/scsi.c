@@ -21,14 +21,43 @@
 
 #include <stdio.h>
 #include <string.h>
+#include <unistd.h>
+#include <poll.h>
 #include <sys/ioctl.h>
 #include <scsi/sg.h>
 
 #include "scsisim.h"
 #include "scsi.h"
+#include "transport.h"
+#include "usb.h"
 #include "utils.h"
+#include "cache.h"
 
+/* Queue commands at the tail rather than the head of the device queue, so
+ * they execute in submission order. Older <scsi/sg.h> headers lack this. */
+#ifndef SG_FLAG_Q_AT_TAIL
+#define SG_FLAG_Q_AT_TAIL	0x10
+#endif
+
+static int sg_send_cdb(const struct scsisim_dev *device, struct scsi_cmd *my_cmd);
+static int sg_submit_cdb(const struct scsisim_dev *device, struct scsi_cmd *my_cmd);
+static int sg_reap_cdb(const struct scsisim_dev *device,
+		       struct scsi_cmd **my_cmd,
+		       int timeout);
+static int sg_close(struct scsisim_dev *device);
+static void sg_fill_io_hdr(struct sg_io_hdr *io_hdr, struct scsi_cmd *my_cmd);
 static inline void scsi_init_io_hdr(struct sg_io_hdr *io_hdr);
+static void scsi_print_request(struct scsi_cmd *my_cmd, const char *func);
+static void scsi_print_result(struct scsi_cmd *my_cmd, int ret, const char *func);
+
+const struct scsisim_transport scsi_sg_transport = {
+	.name = "sg",
+	.get_vendor_product = usb_get_vendor_product,
+	.send_cdb = sg_send_cdb,
+	.submit_cdb = sg_submit_cdb,
+	.reap_cdb = sg_reap_cdb,
+	.close = sg_close
+};
 
 
 /**
@@ -39,10 +68,10 @@ static inline void scsi_init_io_hdr(struct sg_io_hdr *io_hdr);
  * my_cmd:	Pointer to scsi_cmd struct.
  *
  * Description: 
- * Given a pointer to an scsisim_dev struct, set up the SCSI generic
- * sg_io_hdr struct with the settings passed in the scsi_cmd struct.
- * Then do the actual ioctl() on the device to send the CDB (command
- * data block).
+ * Given a pointer to an scsisim_dev struct, hand the command described by
+ * the scsi_cmd struct to the device's transport backend and wait for it
+ * to complete. For a real reader, the backend is the SCSI generic driver
+ * (see sg_send_cdb).
  *
  * Return values: 
  * SCSISIM_SCSI_SEND_ERROR
@@ -50,43 +79,212 @@ static inline void scsi_init_io_hdr(struct sg_io_hdr *io_hdr);
  */
 int scsi_send_cdb(const struct scsisim_dev *device, struct scsi_cmd *my_cmd)
 {
-	int ret = SCSISIM_SCSI_SEND_ERROR;
-	struct sg_io_hdr io_hdr;
+	int ret;
 
-	/* Initialize the sg_io_hdr struct: */
-	scsi_init_io_hdr(&io_hdr);
+	my_cmd->data_xfered = 0;
+	my_cmd->sense_xfered = 0;
 
-	/* Set the transfer direction: */
-	io_hdr.dxfer_direction =
-		(my_cmd->direction == SIM_WRITE) ? SG_DXFER_TO_DEV : SG_DXFER_FROM_DEV;
+	/* Print some debug info if requested: */
+	if (scsisim_verbose())
+	{
+		scsisim_pinfo("%s: >>> SENDING COMMAND (%s) >>>",
+			      __func__, device->transport->name);
+		scsi_print_request(my_cmd, __func__);
+	}
 
-	/* Set the SCSI command buffer: */
-	io_hdr.cmdp = my_cmd->cdb;
-	io_hdr.cmd_len = my_cmd->cdb_len;
+	/* We're ready -- hand the command to the transport backend: */
+	ret = device->transport->send_cdb(device, my_cmd);
 
-	/* Set the SCSI data buffer: */
-	io_hdr.dxferp = my_cmd->data;
-	io_hdr.dxfer_len = my_cmd->data_len;
+	/* If the reader is in trouble, we no longer know what's in it */
+	if (ret != SCSISIM_SUCCESS)
+		cache_invalidate(device);
 
-	/* Set the SCSI sense buffer: */
-	io_hdr.sbp = my_cmd->sense;
-	io_hdr.mx_sb_len = my_cmd->sense_len;
+	/* Print a whole bunch more debug info if requested: */
+	if (scsisim_verbose())
+		scsi_print_result(my_cmd, ret, __func__);
+
+	return ret;
+}
+
+/**
+ * Function: scsi_submit_cdb
+ *
+ * Parameters:
+ * device:	Pointer to scsisim_dev struct.
+ * my_cmd:	Pointer to scsi_cmd struct.
+ *
+ * Description: 
+ * Queue the command described by the scsi_cmd struct on the device's
+ * transport backend without waiting for it to complete. The scsi_cmd
+ * struct and all of its buffers must stay valid until scsi_reap_cdb()
+ * hands the command back.
+ *
+ * Return values: 
+ * SCSISIM_SCSI_SEND_ERROR
+ * SCSISIM_SUCCESS
+ */
+int scsi_submit_cdb(const struct scsisim_dev *device, struct scsi_cmd *my_cmd)
+{
+	int ret;
+
+	my_cmd->data_xfered = 0;
+	my_cmd->sense_xfered = 0;
 
-	/* Print some debug info if requested: */
 	if (scsisim_verbose())
 	{
-		scsisim_pinfo("%s: >>> SENDING COMMAND >>>", __func__);
-		print_binary_buffer(io_hdr.cmdp, io_hdr.cmd_len);
+		scsisim_pinfo("%s: >>> QUEUEING COMMAND %d (%s) >>>",
+			      __func__, my_cmd->pack_id, device->transport->name);
+		scsi_print_request(my_cmd, __func__);
+	}
+
+	ret = device->transport->submit_cdb(device, my_cmd);
+
+	if (ret != SCSISIM_SUCCESS)
+		cache_invalidate(device);
 
-		if (io_hdr.dxfer_direction == SG_DXFER_TO_DEV)
+	if (scsisim_verbose() && ret != SCSISIM_SUCCESS)
+		scsisim_pinfo("%s: returning %d (%s)",
+			      __func__, ret, scsisim_strerror(ret));
+
+	return ret;
+}
+
+/**
+ * Function: scsi_reap_cdb
+ *
+ * Parameters:
+ * device:	Pointer to scsisim_dev struct.
+ * my_cmd:	(Output) Pointer to the completed scsi_cmd struct.
+ * timeout:	Time to wait in milliseconds (-1 = forever, 0 = don't wait).
+ *
+ * Description: 
+ * Wait for a command queued with scsi_submit_cdb() to complete, and hand
+ * it back with its data_xfered and sense_xfered members filled in.
+ *
+ * Return values: 
+ * SCSISIM_SCSI_RECEIVE_ERROR
+ * SCSISIM_TIMEOUT
+ * SCSISIM_SUCCESS
+ */
+int scsi_reap_cdb(const struct scsisim_dev *device,
+		  struct scsi_cmd **my_cmd,
+		  int timeout)
+{
+	int ret;
+
+	ret = device->transport->reap_cdb(device, my_cmd, timeout);
+
+	if (ret != SCSISIM_SUCCESS && ret != SCSISIM_TIMEOUT)
+		cache_invalidate(device);
+
+	if (scsisim_verbose())
+	{
+		if (ret == SCSISIM_SUCCESS)
 		{
-			scsisim_pinfo("%s: >>> SENDING DATA >>>",
-				      __func__, io_hdr.dxfer_len);
-			print_binary_buffer(io_hdr.dxferp, io_hdr.dxfer_len);
+			scsisim_pinfo("%s: <<< COMPLETED COMMAND %d (%s) <<<",
+				      __func__, (*my_cmd)->pack_id, device->transport->name);
+			scsi_print_result(*my_cmd, ret, __func__);
 		}
+		else if (ret != SCSISIM_TIMEOUT)
+			scsisim_pinfo("%s: returning %d (%s)",
+				      __func__, ret, scsisim_strerror(ret));
+	}
+
+	return ret;
+}
+
+/**
+ * Function: scsi_print_request
+ *
+ * Parameters:
+ * my_cmd:	Pointer to scsi_cmd struct.
+ * func:	Name of calling function.
+ *
+ * Description: 
+ * Print the CDB and any outgoing data of a command.
+ *
+ * Return value: 
+ * None
+ */
+static void scsi_print_request(struct scsi_cmd *my_cmd, const char *func)
+{
+	print_binary_buffer(my_cmd->cdb, my_cmd->cdb_len);
+
+	if (my_cmd->direction == SIM_WRITE)
+	{
+		scsisim_pinfo("%s: >>> SENDING DATA >>>", func);
+		print_binary_buffer(my_cmd->data, my_cmd->data_len);
 	}
+}
+
+/**
+ * Function: scsi_print_result
+ *
+ * Parameters:
+ * my_cmd:	Pointer to scsi_cmd struct.
+ * ret:		Return value of the transport backend.
+ * func:	Name of calling function.
+ *
+ * Description: 
+ * Print the transfer counts, incoming data and sense data of a 
+ * completed command.
+ *
+ * Return value: 
+ * None
+ */
+static void scsi_print_result(struct scsi_cmd *my_cmd, int ret, const char *func)
+{
+	scsisim_pinfo("%s: %d data bytes transferred",
+		      func, my_cmd->data_xfered);
+
+	if (my_cmd->data_len > 0 && my_cmd->data_xfered < my_cmd->data_len)
+	{
+		scsisim_pinfo("%s: data transfer underrun by %d bytes",
+			      func, my_cmd->data_len - my_cmd->data_xfered);
+	}
+
+	if (my_cmd->direction == SIM_READ && my_cmd->data_xfered)
+	{
+		scsisim_pinfo("%s: <<< RECEIVED DATA <<<", func);
+		print_binary_buffer(my_cmd->data, my_cmd->data_xfered);
+	}
+
+	if (my_cmd->sense_xfered)
+	{
+		scsisim_pinfo("%s: received %d bytes of sense data",
+			      func, my_cmd->sense_xfered);
+		print_binary_buffer(my_cmd->sense, my_cmd->sense_xfered);
+	}
+
+	scsisim_pinfo("%s: returning %d (%s)",
+		      func, ret, scsisim_strerror(ret));
+}
+
+/**
+ * Function: sg_send_cdb
+ *
+ * Parameters:
+ * device:	Pointer to scsisim_dev struct.
+ * my_cmd:	Pointer to scsi_cmd struct.
+ *
+ * Description: 
+ * Given a pointer to an scsisim_dev struct, set up the SCSI generic
+ * sg_io_hdr struct with the settings passed in the scsi_cmd struct.
+ * Then do the actual ioctl() on the device to send the CDB (command
+ * data block) and wait for it to complete.
+ *
+ * Return values: 
+ * SCSISIM_SCSI_SEND_ERROR
+ * SCSISIM_SUCCESS
+ */
+static int sg_send_cdb(const struct scsisim_dev *device, struct scsi_cmd *my_cmd)
+{
+	int ret = SCSISIM_SCSI_SEND_ERROR;
+	struct sg_io_hdr io_hdr;
 
-	/* We're ready -- send the command to the SCSI generic kernel driver: */
+	sg_fill_io_hdr(&io_hdr, my_cmd);
+
+	/* Send the command to the SCSI generic kernel driver: */
 	if (ioctl(device->fd, SG_IO, &io_hdr) == 0)
 	{
 		my_cmd->data_xfered = io_hdr.dxfer_len - io_hdr.resid;
@@ -94,38 +292,154 @@ int scsi_send_cdb(const struct scsisim_dev *device, struct scsi_cmd *my_cmd)
 		ret = SCSISIM_SUCCESS;
 	}
 
-	/* Print a whole bunch more debug info if requested: */
 	if (scsisim_verbose())
-	{
-		scsisim_pinfo("%s: io_hdr.status = %d",
-			      __func__, io_hdr.status);
-		scsisim_pinfo("%s: %d data bytes transferred",
-			      __func__, my_cmd->data_xfered);
+		scsisim_pinfo("%s: io_hdr.status = %d", __func__, io_hdr.status);
 
-		if (io_hdr.dxfer_len > 0 && io_hdr.resid > 0)
-		{
-			scsisim_pinfo("%s: data transfer underrun by %d bytes",
-				      __func__, io_hdr.resid);
-		}
+	return ret;
+}
 
-		if (io_hdr.dxfer_direction == SG_DXFER_FROM_DEV && my_cmd->data_xfered)
-		{
-			scsisim_pinfo("%s: <<< RECEIVED DATA <<<", __func__);
-			print_binary_buffer(my_cmd->data, my_cmd->data_xfered);
-		}
+/**
+ * Function: sg_submit_cdb
+ *
+ * Parameters:
+ * device:	Pointer to scsisim_dev struct.
+ * my_cmd:	Pointer to scsi_cmd struct.
+ *
+ * Description: 
+ * Queue a CDB using the asynchronous SCSI generic (sg v3) interface: 
+ * write() the sg_io_hdr struct to the device, tagged with the scsi_cmd 
+ * struct so sg_reap_cdb() can find it again. See 
+ * http://sg.danny.cz/sg/p/sg_v3_ho.html#async
+ *
+ * Return values: 
+ * SCSISIM_SCSI_SEND_ERROR
+ * SCSISIM_SUCCESS
+ */
+static int sg_submit_cdb(const struct scsisim_dev *device, struct scsi_cmd *my_cmd)
+{
+	struct sg_io_hdr io_hdr;
 
-		if (my_cmd->sense_xfered)
-		{
-			scsisim_pinfo("%s: received %d bytes of sense data",
-				      __func__, my_cmd->sense_xfered);
-			print_binary_buffer(my_cmd->sense, my_cmd->sense_xfered);
-		}
+	sg_fill_io_hdr(&io_hdr, my_cmd);
 
-		scsisim_pinfo("%s: returning %d (%s)",
-			      __func__, ret, scsisim_strerror(ret));
-	}
+	io_hdr.flags |= SG_FLAG_Q_AT_TAIL;
+	io_hdr.pack_id = my_cmd->pack_id;
+	io_hdr.usr_ptr = my_cmd;
 
-	return ret;
+	if (write(device->fd, &io_hdr, sizeof(io_hdr)) != (ssize_t)sizeof(io_hdr))
+		return SCSISIM_SCSI_SEND_ERROR;
+
+	return SCSISIM_SUCCESS;
+}
+
+/**
+ * Function: sg_reap_cdb
+ *
+ * Parameters:
+ * device:	Pointer to scsisim_dev struct.
+ * my_cmd:	(Output) Pointer to the completed scsi_cmd struct.
+ * timeout:	Time to wait in milliseconds (-1 = forever, 0 = don't wait).
+ *
+ * Description: 
+ * Wait until the SCSI generic driver has a completed command, then 
+ * read() its sg_io_hdr struct back from the device.
+ *
+ * Return values: 
+ * SCSISIM_SCSI_RECEIVE_ERROR
+ * SCSISIM_TIMEOUT
+ * SCSISIM_SUCCESS
+ */
+static int sg_reap_cdb(const struct scsisim_dev *device,
+		       struct scsi_cmd **my_cmd,
+		       int timeout)
+{
+	int ret;
+	struct pollfd pfd = { .fd = device->fd, .events = POLLIN };
+	struct sg_io_hdr io_hdr;
+
+	ret = poll(&pfd, 1, timeout);
+
+	if (ret == 0)
+		return SCSISIM_TIMEOUT;
+
+	if (ret < 0 || (pfd.revents & POLLIN) == 0)
+		return SCSISIM_SCSI_RECEIVE_ERROR;
+
+	scsi_init_io_hdr(&io_hdr);
+	io_hdr.pack_id = -1;	/* Any completed command will do */
+
+	if (read(device->fd, &io_hdr, sizeof(io_hdr)) != (ssize_t)sizeof(io_hdr) ||
+	    io_hdr.usr_ptr == NULL)
+		return SCSISIM_SCSI_RECEIVE_ERROR;
+
+	*my_cmd = io_hdr.usr_ptr;
+	(*my_cmd)->data_xfered = io_hdr.dxfer_len - io_hdr.resid;
+	(*my_cmd)->sense_xfered = io_hdr.sb_len_wr;
+
+	if (scsisim_verbose())
+		scsisim_pinfo("%s: io_hdr.status = %d", __func__, io_hdr.status);
+
+	return SCSISIM_SUCCESS;
+}
+
+/**
+ * Function: sg_fill_io_hdr
+ *
+ * Parameters:
+ * io_hdr:	Pointer to SCSI generic sg_io_hdr struct.
+ * my_cmd:	Pointer to scsi_cmd struct.
+ *
+ * Description: 
+ * Set up the SCSI generic sg_io_hdr struct with the settings passed in
+ * the scsi_cmd struct.
+ *
+ * Return value: 
+ * None
+ */
+static void sg_fill_io_hdr(struct sg_io_hdr *io_hdr, struct scsi_cmd *my_cmd)
+{
+	/* Initialize the sg_io_hdr struct: */
+	scsi_init_io_hdr(io_hdr);
+
+	/* Set the transfer direction: */
+	io_hdr->dxfer_direction =
+		(my_cmd->direction == SIM_WRITE) ? SG_DXFER_TO_DEV : SG_DXFER_FROM_DEV;
+
+	/* Set the SCSI command buffer: */
+	io_hdr->cmdp = my_cmd->cdb;
+	io_hdr->cmd_len = my_cmd->cdb_len;
+
+	/* Set the SCSI data buffer: */
+	io_hdr->dxferp = my_cmd->data;
+	io_hdr->dxfer_len = my_cmd->data_len;
+
+	/* Set the SCSI sense buffer: */
+	io_hdr->sbp = my_cmd->sense;
+	io_hdr->mx_sb_len = my_cmd->sense_len;
+}
+
+/**
+ * Function: sg_close
+ *
+ * Parameters:
+ * device:	Pointer to scsisim_dev struct.
+ *
+ * Description: 
+ * Close the file descriptor of a SCSI generic device.
+ *
+ * Return values: 
+ * SCSISIM_SUCCESS
+ * SCSISIM_DEVICE_CLOSE_FAILED
+ * SCSISIM_INVALID_FILE_DESCRIPTOR
+ */
+static int sg_close(struct scsisim_dev *device)
+{
+	if (device->fd <= 0)
+		return SCSISIM_INVALID_FILE_DESCRIPTOR;
+
+	if (close(device->fd))
+		return SCSISIM_DEVICE_CLOSE_FAILED;
+
+	return SCSISIM_SUCCESS;
 }
 
 /**
@@ -31,16 +31,39 @@
 #include "scsisim.h"
 #include "gsm.h"
 #include "scsi.h"
+#include "transport.h"
 #include "device.h"
 #include "usb.h"
 #include "utils.h"
-
-static int sim_process_scsi_sense(const struct scsisim_dev *device,
-				  const uint8_t *sense,
-				  unsigned int len);
+#include "sim.h"
+#include "async.h"
+#include "cache.h"
 
 static inline void sim_free_device_name(struct scsisim_dev *device);
+static bool sim_probe_device(struct scsisim_dev *device);
+
+
+/**
+ * For information about this function, see scsisim.h
+ */
+int scsisim_enumerate_devices(struct scsisim_device_info *devices, unsigned int max)
+{
+	if (devices == NULL && max > 0)
+		return SCSISIM_INVALID_PARAM;
+
+	return usb_enumerate_devices(supported_devices, devices, max);
+}
 
+/**
+ * For information about this function, see scsisim.h
+ */
+int scsisim_identify_device(const char *dev_name, struct scsisim_device_info *info)
+{
+	if (dev_name == NULL || info == NULL)
+		return SCSISIM_INVALID_PARAM;
+
+	return usb_identify_device(supported_devices, dev_name, info);
+}
 
 /**
  * For information about this function, see scsisim.h
@@ -60,6 +83,18 @@ int scsisim_open_device(const char *dev_name, struct scsisim_dev *device)
 
 	strcpy(device->name, dev_name);
 
+	device->index = 0;
+	device->transport = &scsi_sg_transport;
+	device->transport_data = NULL;
+	device->async = NULL;
+	device->init_state = SCSISIM_INIT_NONE;
+
+	if ((ret = cache_create(device)) != SCSISIM_SUCCESS)
+	{
+		sim_free_device_name(device);
+		return ret;
+	}
+
 	snprintf(full_path, PATH_MAX, "/dev/%s", device->name);
 
 	if (scsisim_verbose())
@@ -81,6 +116,7 @@ int scsisim_open_device(const char *dev_name, struct scsisim_dev *device)
 	{
 		/* Device open failed, so clean up */
 		sim_free_device_name(device);
+		cache_free(device);
 		ret = SCSISIM_DEVICE_OPEN_FAILED;
 	}
 
@@ -98,23 +134,23 @@ int scsisim_close_device(struct scsisim_dev *device)
 		return SCSISIM_INVALID_PARAM;
 
 	sim_free_device_name(device);
+	async_free(device);
+	cache_free(device);
 
-	if (device->fd > 0)
+	if (device->transport == NULL)
+		return SCSISIM_INVALID_FILE_DESCRIPTOR;
+
+	if ((ret = device->transport->close(device)) == SCSISIM_SUCCESS)
 	{
-		if (close(device->fd))
-			ret = SCSISIM_DEVICE_CLOSE_FAILED;
-		else
-		{
-			if (scsisim_verbose())
-				scsisim_pinfo("%s: device closed", __func__);
+		if (scsisim_verbose())
+			scsisim_pinfo("%s: device closed", __func__);
 
-			device->fd = 0;
-			device->index = 0;
-			ret = SCSISIM_SUCCESS;
-		}
+		device->fd = 0;
+		device->index = 0;
+		device->transport = NULL;
+		device->transport_data = NULL;
+		device->init_state = SCSISIM_INIT_NONE;
 	}
-	else
-		ret = SCSISIM_INVALID_FILE_DESCRIPTOR;
 
 	return ret;
 }
@@ -128,12 +164,13 @@ int scsisim_init_device(struct scsisim_dev *device)
 	unsigned int idVendor, idProduct;
 	struct scsi_cmd my_cmd = { 0 };
 	uint8_t sense[32] = { 0 };
+	uint8_t read_buf[DEVICE_INIT_READ_LEN];
 
 	if (device == NULL)
 		return SCSISIM_INVALID_PARAM;
 
 	/* Obtain the USB vendor and product ID based on the device name */
-	if ((ret = usb_get_vendor_product(device, &idVendor, &idProduct)) != SCSISIM_SUCCESS)
+	if ((ret = device->transport->get_vendor_product(device, &idVendor, &idProduct)) != SCSISIM_SUCCESS)
 		return ret;
 
 	/* Make sure the attached device is a SIM card reader we support.
@@ -141,6 +178,11 @@ int scsisim_init_device(struct scsisim_dev *device)
 	if (usb_is_device_supported(device, idVendor, idProduct, supported_devices) == false)
 		return SCSISIM_DEVICE_NOT_SUPPORTED;
 
+	/* Initializing the reader resets the card, or there may be a new
+	   card in it: either way, forget what we knew */
+	cache_invalidate(device);
+	device->init_state = SCSISIM_INIT_NONE;
+
 	/* If we get this far, we have a supported SIM card reader. Now we can
 	   send 'magic' sequence of SCSI commands to get the device working */
 	for (i = 0; sim_devices[device->index].init_cmd[i].direction != SIM_NO_XFER; i++)
@@ -149,8 +191,16 @@ int scsisim_init_device(struct scsisim_dev *device)
 		my_cmd.direction = sim_devices[device->index].init_cmd[i].direction;
 		my_cmd.cdb = (uint8_t*)sim_devices[device->index].init_cmd[i].cdb;
 		my_cmd.cdb_len = sim_devices[device->index].cdb_len;
-		my_cmd.data = sim_devices[device->index].init_cmd[i].data;
 		my_cmd.data_len = sim_devices[device->index].init_cmd[i].data_len;
+
+		/* Reads go to our own buffer, not one shared by every device */
+		if (my_cmd.direction == SIM_READ)
+		{
+			my_cmd.data = read_buf;
+			my_cmd.data_len = MIN(my_cmd.data_len, sizeof(read_buf));
+		}
+		else
+			my_cmd.data = sim_devices[device->index].init_cmd[i].data;
 		my_cmd.sense = sense;
 		my_cmd.sense_len = (uint8_t)sizeof(sense);
 
@@ -161,9 +211,44 @@ int scsisim_init_device(struct scsisim_dev *device)
 		}
 	}
 
+	if (ret == SCSISIM_SUCCESS)
+		device->init_state = SCSISIM_INIT_FULL;
+
 	return ret;
 }
 
+/**
+ * For information about this function, see scsisim.h
+ */
+int scsisim_init_device_fast(struct scsisim_dev *device)
+{
+	unsigned int idVendor, idProduct;
+
+	if (device == NULL)
+		return SCSISIM_INVALID_PARAM;
+
+	/* Even the probe is only for readers we support. This also sets
+	   device->index, which the probe needs. */
+	if (device->transport->get_vendor_product(device, &idVendor, &idProduct) != SCSISIM_SUCCESS ||
+	    usb_is_device_supported(device, idVendor, idProduct, supported_devices) == false)
+		return scsisim_init_device(device);
+
+	if (sim_probe_device(device))
+	{
+		device->init_state = SCSISIM_INIT_PROBED;
+
+		if (scsisim_verbose())
+			scsisim_pinfo("%s: %s is initialized already", __func__, device->name);
+
+		return SCSISIM_SUCCESS;
+	}
+
+	if (scsisim_verbose())
+		scsisim_pinfo("%s: %s needs initialization", __func__, device->name);
+
+	return scsisim_init_device(device);
+}
+
 /**
  * For information about this function, see scsisim.h
  */
@@ -178,14 +263,14 @@ int scsisim_select_file(const struct scsisim_dev *device, uint16_t file)
 	if (device == NULL)
 		return SCSISIM_INVALID_PARAM;
 
+	/* No need to talk to the card if the file is already selected */
+	if ((ret = cache_select(device, file)) > 0)
+		return ret;
+
 	memset(sense, 0, sizeof(sense));
 
-	/* Get the base SELECT command for the current device */
-	memcpy(cdb, sim_devices[device->index].CDB_select_file, sizeof(cdb));
-
-	/* Set up the data block with the requested file ID */
-	data[0] = file >> 8;
-	data[1] = file & 0xff;
+	/* Build the SELECT command and data block for the requested file ID */
+	sim_prepare_select_file(device, cdb, data, file);
 
 	/* Set up the command block */
 	my_cmd.direction = SIM_WRITE;
@@ -207,6 +292,9 @@ int scsisim_select_file(const struct scsisim_dev *device, uint16_t file)
 			ret = sim_process_scsi_sense(device, my_cmd.sense, my_cmd.sense_xfered);
 		else
 			ret = SCSISIM_SCSI_NO_SENSE_DATA;
+
+		/* Keep track of the current file */
+		cache_selected(device, file, ret);
 	}
 
 	return ret;
@@ -229,13 +317,21 @@ int scsisim_get_response(const struct scsisim_dev *device,
 	if (device == NULL || data == NULL || len <= 0 || resp == NULL)
 		return SCSISIM_INVALID_PARAM;
 
-	memset(sense, 0, sizeof(sense));
+	resp->command = command;
 
-	/* Get the base GET RESPONSE command for the current device */
-	memcpy(cdb, sim_devices[device->index].CDB_get_response, sizeof(cdb));
+	/* No need to talk to the card if we have seen this response before */
+	if ((ret = cache_get_response(device, data, len)) > 0)
+	{
+		if ((ret = gsm_parse_response(data, ret, resp)) != SCSISIM_SUCCESS)
+			scsisim_perror("scsisim_get_response()", ret);
 
-	/* Set the length */
-	cdb[sim_devices[device->index].get_response_len_offset] = len;
+		return ret;
+	}
+
+	memset(sense, 0, sizeof(sense));
+
+	/* Build the GET RESPONSE command */
+	sim_prepare_get_response(device, cdb, len);
 
 	/* Set up the command block */
 	my_cmd.direction = SIM_READ;
@@ -246,8 +342,6 @@ int scsisim_get_response(const struct scsisim_dev *device,
 	my_cmd.sense = sense;
 	my_cmd.sense_len = (uint8_t)sizeof(sense);
 
-	resp->command = command;
-
 	/* Send the command */
 	ret = scsi_send_cdb(device, &my_cmd);
 
@@ -269,6 +363,9 @@ int scsisim_get_response(const struct scsisim_dev *device,
 		/* If there is sense data, process it and use it as the return code instead: */
 		if (my_cmd.sense_xfered)
 			ret = sim_process_scsi_sense(device, my_cmd.sense, my_cmd.sense_xfered);
+
+		if (ret == SCSISIM_SUCCESS)
+			cache_store_response(device, data, my_cmd.data_xfered);
 	}
 
 	return ret;
@@ -312,12 +409,8 @@ int scsisim_read_record(const struct scsisim_dev *device,
 
 	memset(sense, 0, sizeof(sense));
 
-	/* Get the base READ RECORD command for the current device */
-	memcpy(cdb, sim_devices[device->index].CDB_read_record, sizeof(cdb));
-
-	/* Set the record number and length */
-	cdb[sim_devices[device->index].read_record_rec_offset] = recno;
-	cdb[sim_devices[device->index].read_record_len_offset] = len;
+	/* Build the READ RECORD command */
+	sim_prepare_read_record(device, cdb, recno, len);
 
 	/* Set up the command block */
 	my_cmd.direction = SIM_READ;
@@ -363,13 +456,8 @@ int scsisim_read_binary(const struct scsisim_dev *device,
 
 	memset(sense, 0, sizeof(sense));
 
-	/* Get the base READ BINARY command for the current device */
-	memcpy(cdb, sim_devices[device->index].CDB_read_binary, sizeof(cdb));
-
-	/* Set the offsets and length */
-	cdb[sim_devices[device->index].read_binary_hi_offset] = offset >> 8;   /* offset high */
-	cdb[sim_devices[device->index].read_binary_lo_offset] = offset & 0xff; /* offset low */
-	cdb[sim_devices[device->index].read_binary_len_offset] = len;
+	/* Build the READ BINARY command */
+	sim_prepare_read_binary(device, cdb, offset, len);
 
 	/* Set up the command block */
 	my_cmd.direction = SIM_READ;
@@ -415,12 +503,8 @@ int scsisim_update_record(const struct scsisim_dev *device,
 
 	memset(sense, 0, sizeof(sense));
 
-	/* Get the base UPDATE RECORD command for the current device */
-	memcpy(cdb, sim_devices[device->index].CDB_update_record, sizeof(cdb));
-
-	/* Set the record number and length */
-	cdb[sim_devices[device->index].update_record_rec_offset] = recno;
-	cdb[sim_devices[device->index].update_record_len_offset] = len;
+	/* Build the UPDATE RECORD command */
+	sim_prepare_update_record(device, cdb, recno, len);
 
 	/* Set up the command block */
 	my_cmd.direction = SIM_WRITE;
@@ -445,6 +529,10 @@ int scsisim_update_record(const struct scsisim_dev *device,
 	if (my_cmd.sense_xfered)
 		ret = sim_process_scsi_sense(device, my_cmd.sense, my_cmd.sense_xfered);
 
+	/* Keep the record maps in the metadata cache up to date */
+	if (ret == SCSISIM_SUCCESS)
+		cache_record_written(device, recno, data, len);
+
 	return ret;
 }
 
@@ -466,13 +554,8 @@ int scsisim_update_binary(const struct scsisim_dev *device,
 
 	memset(sense, 0, sizeof(sense));
 
-	/* Get the base UPDATE BINARY command for the current device */
-	memcpy(cdb, sim_devices[device->index].CDB_update_binary, sizeof(cdb));
-
-	/* Set the offsets and length */
-	cdb[sim_devices[device->index].update_binary_hi_offset] = offset >> 8;   /* offset high */
-	cdb[sim_devices[device->index].update_binary_lo_offset] = offset & 0xff; /* offset low */
-	cdb[sim_devices[device->index].update_binary_len_offset] = len;
+	/* Build the UPDATE BINARY command */
+	sim_prepare_update_binary(device, cdb, offset, len);
 
 	/* Set up the command block */
 	my_cmd.direction = SIM_WRITE;
@@ -500,6 +583,64 @@ int scsisim_update_binary(const struct scsisim_dev *device,
 	return ret;
 }
 
+/**
+ * For information about this function, see scsisim.h
+ */
+int scsisim_seek(const struct scsisim_dev *device,
+		 uint8_t type,
+		 uint8_t mode,
+		 const uint8_t *pattern,
+		 uint8_t len)
+{
+	int ret;
+	struct scsi_cmd my_cmd = { 0 };
+	struct GSM_response resp;
+	uint8_t cdb[sim_devices[device->index].cdb_len];
+	uint8_t data[len ? len : 1];
+	uint8_t sense[sim_devices[device->index].sense_len];
+	uint8_t recno;
+
+	if (device == NULL || pattern == NULL || len == 0 ||
+	    (type != SIM_SEEK_TYPE_1 && type != SIM_SEEK_TYPE_2) ||
+	    mode > SIM_SEEK_PREVIOUS)
+		return SCSISIM_INVALID_PARAM;
+
+	memset(sense, 0, sizeof(sense));
+
+	/* Build the SEEK command; the pattern is sent as the data block */
+	sim_prepare_seek(device, cdb, type | mode, len);
+	memcpy(data, pattern, len);
+
+	/* Set up the command block */
+	my_cmd.direction = SIM_WRITE;
+	my_cmd.cdb = cdb;
+	my_cmd.cdb_len = (uint8_t)sizeof(cdb);
+	my_cmd.data = data;
+	my_cmd.data_len = len;
+	my_cmd.sense = sense;
+	my_cmd.sense_len = (uint8_t)sizeof(sense);
+
+	/* Send the command */
+	ret = scsi_send_cdb(device, &my_cmd);
+
+	/* No sense data if a type 1 SEEK found a record; a type 2 SEEK
+	 * that found one reports the length of its response instead */
+	if (my_cmd.sense_xfered)
+		ret = sim_process_scsi_sense(device, my_cmd.sense, my_cmd.sense_xfered);
+
+	if (ret <= 0 || type != SIM_SEEK_TYPE_2)
+		return ret;
+
+	/* The response data is now the record number, not the file 
+	 * selected last */
+	cache_forget_selected(device);
+
+	if ((ret = scsisim_get_response(device, &recno, 1, SIM_SEEK, &resp)) != SCSISIM_SUCCESS)
+		return ret;
+
+	return resp.type.seek.record_number;
+}
+
 /**
  * For information about this function, see scsisim.h
  */
@@ -551,6 +692,9 @@ int scsisim_verify_chv(const struct scsisim_dev *device,
 
 	free(data);
 
+	/* The CHV status in the MF and DF responses has changed */
+	cache_forget_responses(device);
+
 	/* No sense data if successful; error condition = sense data */
 	if (my_cmd.sense_xfered)
 		ret = sim_process_scsi_sense(device, my_cmd.sense, my_cmd.sense_xfered);
@@ -591,6 +735,9 @@ int scsisim_send_raw_command(const struct scsisim_dev *device,
 	cdb[sim_devices[device->index].raw_cmd_p2_offset] = P2;
 	cdb[sim_devices[device->index].raw_cmd_p3_offset] = P3;
 
+	/* We can't tell what an arbitrary command does to the card */
+	cache_invalidate(device);
+
 	/* Set up the command block */
 	my_cmd.direction = direction;
 	my_cmd.cdb = cdb;
@@ -617,6 +764,204 @@ int scsisim_send_raw_command(const struct scsisim_dev *device,
 	return ret;
 }
 
+/**
+ * Function: sim_prepare_select_file
+ *
+ * Parameters:
+ * device:	Pointer to scsisim_dev struct.
+ * cdb:		(Output) CDB buffer of at least cdb_len bytes.
+ * data:	(Output) Data buffer of GSM_CMD_SELECT_DATA_LEN bytes.
+ * file:	File ID to select.
+ *
+ * Description: 
+ * Build the CDB and data block of a SELECT command for the current device.
+ * This and the other sim_prepare_*() functions are shared by the 
+ * synchronous functions in this file and the asynchronous ones in async.c.
+ *
+ * Return value: 
+ * None
+ */
+void sim_prepare_select_file(const struct scsisim_dev *device,
+			     uint8_t *cdb,
+			     uint8_t *data,
+			     uint16_t file)
+{
+	/* Get the base SELECT command for the current device */
+	memcpy(cdb, sim_devices[device->index].CDB_select_file, sim_devices[device->index].cdb_len);
+
+	/* Set up the data block with the requested file ID */
+	memset(data, 0, GSM_CMD_SELECT_DATA_LEN);
+	data[0] = file >> 8;
+	data[1] = file & 0xff;
+}
+
+/**
+ * Function: sim_prepare_get_response
+ *
+ * Parameters:
+ * device:	Pointer to scsisim_dev struct.
+ * cdb:		(Output) CDB buffer of at least cdb_len bytes.
+ * len:		Number of response bytes to request.
+ *
+ * Description: 
+ * Build the CDB of a GET RESPONSE command for the current device.
+ *
+ * Return value: 
+ * None
+ */
+void sim_prepare_get_response(const struct scsisim_dev *device,
+			      uint8_t *cdb,
+			      uint8_t len)
+{
+	/* Get the base GET RESPONSE command for the current device */
+	memcpy(cdb, sim_devices[device->index].CDB_get_response, sim_devices[device->index].cdb_len);
+
+	/* Set the length */
+	cdb[sim_devices[device->index].get_response_len_offset] = len;
+}
+
+/**
+ * Function: sim_prepare_read_record
+ *
+ * Parameters:
+ * device:	Pointer to scsisim_dev struct.
+ * cdb:		(Output) CDB buffer of at least cdb_len bytes.
+ * recno:	Record number to read.
+ * len:		Record length.
+ *
+ * Description: 
+ * Build the CDB of a READ RECORD command for the current device.
+ *
+ * Return value: 
+ * None
+ */
+void sim_prepare_read_record(const struct scsisim_dev *device,
+			     uint8_t *cdb,
+			     uint8_t recno,
+			     uint8_t len)
+{
+	/* Get the base READ RECORD command for the current device */
+	memcpy(cdb, sim_devices[device->index].CDB_read_record, sim_devices[device->index].cdb_len);
+
+	/* Set the record number and length */
+	cdb[sim_devices[device->index].read_record_rec_offset] = recno;
+	cdb[sim_devices[device->index].read_record_len_offset] = len;
+}
+
+/**
+ * Function: sim_prepare_read_binary
+ *
+ * Parameters:
+ * device:	Pointer to scsisim_dev struct.
+ * cdb:		(Output) CDB buffer of at least cdb_len bytes.
+ * offset:	Offset from which to begin read.
+ * len:		Number of bytes to read.
+ *
+ * Description: 
+ * Build the CDB of a READ BINARY command for the current device.
+ *
+ * Return value: 
+ * None
+ */
+void sim_prepare_read_binary(const struct scsisim_dev *device,
+			     uint8_t *cdb,
+			     uint16_t offset,
+			     uint8_t len)
+{
+	/* Get the base READ BINARY command for the current device */
+	memcpy(cdb, sim_devices[device->index].CDB_read_binary, sim_devices[device->index].cdb_len);
+
+	/* Set the offsets and length */
+	cdb[sim_devices[device->index].read_binary_hi_offset] = offset >> 8;   /* offset high */
+	cdb[sim_devices[device->index].read_binary_lo_offset] = offset & 0xff; /* offset low */
+	cdb[sim_devices[device->index].read_binary_len_offset] = len;
+}
+
+/**
+ * Function: sim_prepare_update_record
+ *
+ * Parameters:
+ * device:	Pointer to scsisim_dev struct.
+ * cdb:		(Output) CDB buffer of at least cdb_len bytes.
+ * recno:	Record number to update.
+ * len:		Record length.
+ *
+ * Description: 
+ * Build the CDB of an UPDATE RECORD command for the current device.
+ *
+ * Return value: 
+ * None
+ */
+void sim_prepare_update_record(const struct scsisim_dev *device,
+			       uint8_t *cdb,
+			       uint8_t recno,
+			       uint8_t len)
+{
+	/* Get the base UPDATE RECORD command for the current device */
+	memcpy(cdb, sim_devices[device->index].CDB_update_record, sim_devices[device->index].cdb_len);
+
+	/* Set the record number and length */
+	cdb[sim_devices[device->index].update_record_rec_offset] = recno;
+	cdb[sim_devices[device->index].update_record_len_offset] = len;
+}
+
+/**
+ * Function: sim_prepare_update_binary
+ *
+ * Parameters:
+ * device:	Pointer to scsisim_dev struct.
+ * cdb:		(Output) CDB buffer of at least cdb_len bytes.
+ * offset:	Offset from which to begin write.
+ * len:		Number of bytes to write.
+ *
+ * Description: 
+ * Build the CDB of an UPDATE BINARY command for the current device.
+ *
+ * Return value: 
+ * None
+ */
+void sim_prepare_update_binary(const struct scsisim_dev *device,
+			       uint8_t *cdb,
+			       uint16_t offset,
+			       uint8_t len)
+{
+	/* Get the base UPDATE BINARY command for the current device */
+	memcpy(cdb, sim_devices[device->index].CDB_update_binary, sim_devices[device->index].cdb_len);
+
+	/* Set the offsets and length */
+	cdb[sim_devices[device->index].update_binary_hi_offset] = offset >> 8;   /* offset high */
+	cdb[sim_devices[device->index].update_binary_lo_offset] = offset & 0xff; /* offset low */
+	cdb[sim_devices[device->index].update_binary_len_offset] = len;
+}
+
+/**
+ * Function: sim_prepare_seek
+ *
+ * Parameters:
+ * device:	Pointer to scsisim_dev struct.
+ * cdb:		(Output) CDB buffer of at least cdb_len bytes.
+ * type_mode:	SEEK type OR'd with SEEK mode.
+ * len:		Length of the pattern.
+ *
+ * Description: 
+ * Build the CDB of a SEEK command for the current device.
+ *
+ * Return value: 
+ * None
+ */
+void sim_prepare_seek(const struct scsisim_dev *device,
+		      uint8_t *cdb,
+		      uint8_t type_mode,
+		      uint8_t len)
+{
+	/* Get the base SEEK command for the current device */
+	memcpy(cdb, sim_devices[device->index].CDB_seek, sim_devices[device->index].cdb_len);
+
+	/* Set the type/mode and length */
+	cdb[sim_devices[device->index].seek_type_mode_offset] = type_mode;
+	cdb[sim_devices[device->index].seek_len_offset] = len;
+}
+
 /**
  * Function: sim_free_device_name
  *
@@ -636,6 +981,40 @@ static inline void sim_free_device_name(struct scsisim_dev *device)
 	device->name = NULL;
 }
 
+/**
+ * Function: sim_probe_device
+ *
+ * Parameters:
+ * device:	Pointer to a supported scsisim_dev struct.
+ *
+ * Description: 
+ * Check whether a reader is initialized already, with a single GSM STATUS
+ * command. An initialized reader passes it to the card, which answers 
+ * with the data of the current MF or DF; an uninitialized one treats it 
+ * as an ordinary read, so the data won't look like that. STATUS is a 
+ * read, so nothing is written to the reader either way.
+ *
+ * Return values: 
+ * true - The reader is initialized.
+ * false - It is not, or it could not be determined.
+ */
+static bool sim_probe_device(struct scsisim_dev *device)
+{
+	int ret;
+	uint8_t data[GSM_MIN_MF_DF_RESPONSE_LEN] = { 0 };
+	struct GSM_response resp = { .command = SIM_SELECT_MF_DF };
+
+	ret = scsisim_send_raw_command(device, SIM_READ, GSM_CMD_STATUS, 0x00, 0x00,
+				       sizeof(data), data, sizeof(data));
+
+	if (ret != SCSISIM_SUCCESS || gsm_parse_response(data, sizeof(data), &resp) != SCSISIM_SUCCESS)
+		return false;
+
+	/* 01 = MF, 02 = DF; see GSM spec, 9.3 */
+	return GSM_FILE_IS_DF(resp.type.mf_df.file_id) &&
+	       (resp.type.mf_df.file_type == 0x01 || resp.type.mf_df.file_type == 0x02);
+}
+
 /**
  * Function: sim_process_scsi_sense
  *
@@ -655,9 +1034,9 @@ static inline void sim_free_device_name(struct scsisim_dev *device)
  * Number of bytes in response data
  * SCSISIM_GSM_* error code
  */
-static int sim_process_scsi_sense(const struct scsisim_dev *device,
-				  const uint8_t *sense,
-				  unsigned int len)
+int sim_process_scsi_sense(const struct scsisim_dev *device,
+			   const uint8_t *sense,
+			   unsigned int len)
 {
 	int ret;
 
@@ -666,7 +1045,11 @@ static int sim_process_scsi_sense(const struct scsisim_dev *device,
 
 	/* 0x70 = Fixed format, current sense. See SCSI spec for more info */
 	if (sense[sim_devices[device->index].sense_type_offset] != 0x70)
-	    return SCSISIM_SCSI_UNKNOWN_SENSE_DATA;
+	{
+		/* Possibly a reader problem or a card swap */
+		cache_invalidate(device);
+		return SCSISIM_SCSI_UNKNOWN_SENSE_DATA;
+	}
 
 	/* Examine the ASC (additional sense code). This corresponds to 
 	 * 'SW1' (status word 1) in the GSM spec. */
@@ -784,6 +1167,9 @@ static int sim_process_scsi_sense(const struct scsisim_dev *device,
 				      __func__,
 				      sense[sim_devices[device->index].sense_asc_offset],
 				      sense[sim_devices[device->index].sense_ascq_offset]);
+			/* Not a GSM status word: possibly the reader telling 
+			 * us the card was swapped */
+			cache_invalidate(device);
 			ret = SCSISIM_GSM_UNKNOWN_SW1;
 			break;
 	}
@@ -0,0 +1,475 @@
+/*
+ *  simd.c
+ *  SIMD kernels for the scsisim library.
+ *
+ *  Copyright (c) 2017, Chris Coffey <kpuc@sdf.org>
+ *
+ *  Permission to use, copy, modify, and/or distribute this software
+ *  for any purpose with or without fee is hereby granted, provided
+ *  that the above copyright notice and this permission notice appear
+ *  in all copies.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL 
+ *  WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED
+ *  WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE
+ *  AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL
+ *  DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE, DATA
+ *  OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER
+ *  TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ *  PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "simd.h"
+
+#ifdef SIMD_X86
+
+#include <immintrin.h>
+
+/* Unpacking septets: 7 packed bytes hold 8 septets, septet k starting at
+ * bit 7k. We gather the two bytes septet k straddles into a 16-bit lane,
+ * shift it left by 8 - (7k % 8) with a multiply (there is no per-lane
+ * shift for 16-bit lanes before AVX-512), and keep bits 8-14. */
+#define SEPTET_SHUFFLE_LO	0, 1, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6, 7
+#define SEPTET_SHUFFLE_HI	7, 8, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13, 14
+#define SEPTET_MULTIPLIERS	256, 2, 4, 8, 16, 32, 64, 128
+
+
+/**
+ * Function: simd_unpack_septets_ssse3
+ *
+ * Parameters:
+ * packed:	Pointer to buffer of packed septets.
+ * packed_len:	Length of packed buffer in bytes.
+ * unpacked:	(Output) Buffer for unpacked septets.
+ * count:	Number of septets to unpack.
+ *
+ * Description: 
+ * Unpack septets 16 at a time (two 7-byte groups per 128-bit vector), 
+ * for as long as a whole 16-byte load and store fit. The caller unpacks
+ * the rest.
+ *
+ * Return value: 
+ * Number of septets unpacked (a multiple of 16).
+ */
+__attribute__((target("ssse3")))
+unsigned int simd_unpack_septets_ssse3(const uint8_t *packed,
+				       unsigned int packed_len,
+				       uint8_t *unpacked,
+				       unsigned int count)
+{
+	const __m128i shuffle_lo = _mm_setr_epi8(SEPTET_SHUFFLE_LO);
+	const __m128i shuffle_hi = _mm_setr_epi8(SEPTET_SHUFFLE_HI);
+	const __m128i multipliers = _mm_setr_epi16(SEPTET_MULTIPLIERS);
+	const __m128i mask = _mm_set1_epi16(0x7f);
+	__m128i in, lo, hi;
+	unsigned int in_pos = 0, out_pos = 0;
+
+	while (in_pos + 16 <= packed_len && out_pos + 16 <= count)
+	{
+		in = _mm_loadu_si128((const __m128i *)(packed + in_pos));
+
+		lo = _mm_mullo_epi16(_mm_shuffle_epi8(in, shuffle_lo), multipliers);
+		hi = _mm_mullo_epi16(_mm_shuffle_epi8(in, shuffle_hi), multipliers);
+
+		lo = _mm_and_si128(_mm_srli_epi16(lo, 8), mask);
+		hi = _mm_and_si128(_mm_srli_epi16(hi, 8), mask);
+
+		_mm_storeu_si128((__m128i *)(unpacked + out_pos), _mm_packus_epi16(lo, hi));
+
+		in_pos += 14;
+		out_pos += 16;
+	}
+
+	return out_pos;
+}
+
+/**
+ * Function: simd_unpack_septets_avx2
+ *
+ * Parameters:
+ * packed:	Pointer to buffer of packed septets.
+ * packed_len:	Length of packed buffer in bytes.
+ * unpacked:	(Output) Buffer for unpacked septets.
+ * count:	Number of septets to unpack.
+ *
+ * Description: 
+ * Unpack septets 32 at a time. Each 128-bit lane works like the SSSE3
+ * kernel on its own pair of 7-byte groups, so the lanes are loaded from
+ * offsets 0 and 14, and the lane-wise pack puts everything in order.
+ *
+ * Return value: 
+ * Number of septets unpacked (a multiple of 32).
+ */
+__attribute__((target("avx2")))
+unsigned int simd_unpack_septets_avx2(const uint8_t *packed,
+				      unsigned int packed_len,
+				      uint8_t *unpacked,
+				      unsigned int count)
+{
+	const __m256i shuffle_lo = _mm256_setr_epi8(SEPTET_SHUFFLE_LO, SEPTET_SHUFFLE_LO);
+	const __m256i shuffle_hi = _mm256_setr_epi8(SEPTET_SHUFFLE_HI, SEPTET_SHUFFLE_HI);
+	const __m256i multipliers = _mm256_setr_epi16(SEPTET_MULTIPLIERS, SEPTET_MULTIPLIERS);
+	const __m256i mask = _mm256_set1_epi16(0x7f);
+	__m256i in, lo, hi;
+	unsigned int in_pos = 0, out_pos = 0;
+
+	while (in_pos + 30 <= packed_len && out_pos + 32 <= count)
+	{
+		in = _mm256_inserti128_si256(_mm256_castsi128_si256(_mm_loadu_si128((const __m128i *)(packed + in_pos))),
+					     _mm_loadu_si128((const __m128i *)(packed + in_pos + 14)),
+					     1);
+
+		lo = _mm256_mullo_epi16(_mm256_shuffle_epi8(in, shuffle_lo), multipliers);
+		hi = _mm256_mullo_epi16(_mm256_shuffle_epi8(in, shuffle_hi), multipliers);
+
+		lo = _mm256_and_si256(_mm256_srli_epi16(lo, 8), mask);
+		hi = _mm256_and_si256(_mm256_srli_epi16(hi, 8), mask);
+
+		_mm256_storeu_si256((__m256i *)(unpacked + out_pos), _mm256_packus_epi16(lo, hi));
+
+		in_pos += 28;
+		out_pos += 32;
+	}
+
+	return out_pos;
+}
+
+/* Packing septets is the same in reverse: put pairs of septets together 
+ * in 16-bit lanes (14 bits), pairs of those in 32-bit lanes with a 
+ * multiply-add (28 bits), and pairs of those in 64-bit lanes (56 bits, 
+ * i.e. one 7-byte group), then squeeze out the top byte of each group. */
+#define SEPTET_PACK_MULTIPLIERS	1, 1 << 14, 1, 1 << 14, 1, 1 << 14, 1, 1 << 14
+#define SEPTET_PACK_SHUFFLE	0, 1, 2, 3, 4, 5, 6, 8, 9, 10, 11, 12, 13, 14, 0x80, 0x80
+
+/**
+ * Function: simd_pack_septets_ssse3
+ *
+ * Parameters:
+ * unpacked:	Pointer to buffer of septets, one per byte.
+ * count:	Number of septets to pack.
+ * packed:	(Output) Buffer for packed septets.
+ * packed_len:	Length of packed buffer in bytes.
+ *
+ * Description: 
+ * Pack septets 16 at a time (two 7-byte groups per 128-bit vector), for
+ * as long as a whole 16-byte load and store fit. The caller packs the 
+ * rest.
+ *
+ * Return value: 
+ * Number of septets packed (a multiple of 16).
+ */
+__attribute__((target("ssse3")))
+unsigned int simd_pack_septets_ssse3(const uint8_t *unpacked,
+				     unsigned int count,
+				     uint8_t *packed,
+				     unsigned int packed_len)
+{
+	const __m128i shuffle = _mm_setr_epi8(SEPTET_PACK_SHUFFLE);
+	const __m128i multipliers = _mm_setr_epi16(SEPTET_PACK_MULTIPLIERS);
+	const __m128i septet_mask = _mm_set1_epi8(0x7f);
+	const __m128i low_mask = _mm_set1_epi16(0xff);
+	const __m128i group_mask = _mm_set1_epi64x(0x0fffffff);
+	__m128i in;
+	unsigned int in_pos = 0, out_pos = 0;
+
+	while (in_pos + 16 <= count && out_pos + 16 <= packed_len)
+	{
+		in = _mm_and_si128(_mm_loadu_si128((const __m128i *)(unpacked + in_pos)), septet_mask);
+
+		in = _mm_or_si128(_mm_and_si128(in, low_mask),
+				  _mm_slli_epi16(_mm_srli_epi16(in, 8), 7));
+		in = _mm_madd_epi16(in, multipliers);
+		in = _mm_or_si128(_mm_and_si128(in, group_mask),
+				  _mm_slli_epi64(_mm_srli_epi64(in, 32), 28));
+
+		_mm_storeu_si128((__m128i *)(packed + out_pos), _mm_shuffle_epi8(in, shuffle));
+
+		in_pos += 16;
+		out_pos += 14;
+	}
+
+	return in_pos;
+}
+
+/**
+ * Function: simd_pack_septets_avx2
+ *
+ * Parameters:
+ * unpacked:	Pointer to buffer of septets, one per byte.
+ * count:	Number of septets to pack.
+ * packed:	(Output) Buffer for packed septets.
+ * packed_len:	Length of packed buffer in bytes.
+ *
+ * Description: 
+ * Pack septets 32 at a time. Each 128-bit lane works like the SSSE3 
+ * kernel, so the lanes are stored at offsets 0 and 14, the second store
+ * overwriting the two spare bytes of the first.
+ *
+ * Return value: 
+ * Number of septets packed (a multiple of 32).
+ */
+__attribute__((target("avx2")))
+unsigned int simd_pack_septets_avx2(const uint8_t *unpacked,
+				    unsigned int count,
+				    uint8_t *packed,
+				    unsigned int packed_len)
+{
+	const __m256i shuffle = _mm256_setr_epi8(SEPTET_PACK_SHUFFLE, SEPTET_PACK_SHUFFLE);
+	const __m256i multipliers = _mm256_setr_epi16(SEPTET_PACK_MULTIPLIERS, SEPTET_PACK_MULTIPLIERS);
+	const __m256i septet_mask = _mm256_set1_epi8(0x7f);
+	const __m256i low_mask = _mm256_set1_epi16(0xff);
+	const __m256i group_mask = _mm256_set1_epi64x(0x0fffffff);
+	__m256i in;
+	unsigned int in_pos = 0, out_pos = 0;
+
+	while (in_pos + 32 <= count && out_pos + 30 <= packed_len)
+	{
+		in = _mm256_and_si256(_mm256_loadu_si256((const __m256i *)(unpacked + in_pos)), septet_mask);
+
+		in = _mm256_or_si256(_mm256_and_si256(in, low_mask),
+				     _mm256_slli_epi16(_mm256_srli_epi16(in, 8), 7));
+		in = _mm256_madd_epi16(in, multipliers);
+		in = _mm256_or_si256(_mm256_and_si256(in, group_mask),
+				     _mm256_slli_epi64(_mm256_srli_epi64(in, 32), 28));
+		in = _mm256_shuffle_epi8(in, shuffle);
+
+		_mm_storeu_si128((__m128i *)(packed + out_pos), _mm256_castsi256_si128(in));
+		_mm_storeu_si128((__m128i *)(packed + out_pos + 14), _mm256_extracti128_si256(in, 1));
+
+		in_pos += 32;
+		out_pos += 28;
+	}
+
+	return in_pos;
+}
+
+/**
+ * Function: simd_bcd_to_ascii_ssse3
+ *
+ * Parameters:
+ * bcd:			Pointer to packed BCD buffer.
+ * len:			Length of packed BCD buffer.
+ * little_endian:	Whether the nibbles of each byte are little endian.
+ * digits:		The 16 characters the nibble values map to.
+ * ascii:		(Output) Buffer of at least len * 2 bytes.
+ *
+ * Description: 
+ * Convert packed BCD to ASCII 16 bytes at a time: split each byte into 
+ * its nibbles, look both up in the digit table with pshufb, and 
+ * interleave them in the requested order. Stops before the last partial
+ * block, which the caller converts. The output is not null-terminated.
+ *
+ * Return value: 
+ * Number of BCD bytes converted (a multiple of 16).
+ */
+__attribute__((target("ssse3")))
+unsigned int simd_bcd_to_ascii_ssse3(const uint8_t *bcd,
+				     unsigned int len,
+				     bool little_endian,
+				     const char *digits,
+				     char *ascii)
+{
+	const __m128i table = _mm_loadu_si128((const __m128i *)digits);
+	const __m128i mask = _mm_set1_epi8(0x0f);
+	__m128i in, lo, hi;
+	unsigned int i;
+
+	for (i = 0; i + 16 <= len; i += 16)
+	{
+		in = _mm_loadu_si128((const __m128i *)(bcd + i));
+
+		lo = _mm_shuffle_epi8(table, _mm_and_si128(in, mask));
+		hi = _mm_shuffle_epi8(table, _mm_and_si128(_mm_srli_epi16(in, 4), mask));
+
+		/* Swapping the operands of the interleave swaps the nibbles */
+		if (!little_endian)
+		{
+			in = lo;
+			lo = hi;
+			hi = in;
+		}
+
+		_mm_storeu_si128((__m128i *)(ascii + i * 2), _mm_unpacklo_epi8(lo, hi));
+		_mm_storeu_si128((__m128i *)(ascii + i * 2 + 16), _mm_unpackhi_epi8(lo, hi));
+	}
+
+	return i;
+}
+
+/* The GSM characters that are their own ASCII code: LF, CR, space to 
+ * '?' except 0x24 (currency sign), 'A' to 'Z' and 'a' to 'z'. Bytes 
+ * over 0x7f are negative in the signed compares, so never match. */
+#define GSM_ASCII_RANGE(v, lo, hi)	_mm_and_si128(_mm_cmpgt_epi8(v, _mm_set1_epi8((lo) - 1)), \
+						      _mm_cmpgt_epi8(_mm_set1_epi8((hi) + 1), v))
+
+/**
+ * Function: simd_gsm_ascii_sse2
+ *
+ * Parameters:
+ * src:		Pointer to unpacked buffer of GSM character codes.
+ * len:		Number of characters to look at; dest must hold as many.
+ * dest:	(Output) Buffer for the ASCII characters, or NULL.
+ *
+ * Description: 
+ * Copy the leading run of GSM characters that map to the same ASCII 
+ * character, 16 at a time. Only whole 16-byte blocks are looked at, and
+ * bytes of dest past the run may be overwritten. The output is not 
+ * null-terminated. Since these characters are the same both ways, this
+ * also copies ASCII text to GSM character codes; with a NULL dest, it 
+ * only measures the run.
+ *
+ * Return value: 
+ * Length of the run copied.
+ */
+__attribute__((target("sse2")))
+unsigned int simd_gsm_ascii_sse2(const uint8_t *src,
+				 unsigned int len,
+				 char *dest)
+{
+	__m128i in, same;
+	unsigned int i, mask;
+
+	for (i = 0; i + 16 <= len; i += 16)
+	{
+		in = _mm_loadu_si128((const __m128i *)(src + i));
+
+		same = _mm_or_si128(_mm_cmpeq_epi8(in, _mm_set1_epi8('\n')),
+				    _mm_cmpeq_epi8(in, _mm_set1_epi8('\r')));
+		same = _mm_or_si128(same, _mm_andnot_si128(_mm_cmpeq_epi8(in, _mm_set1_epi8(0x24)),
+							   GSM_ASCII_RANGE(in, ' ', '?')));
+		same = _mm_or_si128(same, GSM_ASCII_RANGE(in, 'A', 'Z'));
+		same = _mm_or_si128(same, GSM_ASCII_RANGE(in, 'a', 'z'));
+
+		if (dest != NULL)
+			_mm_storeu_si128((__m128i *)(dest + i), in);
+
+		if ((mask = _mm_movemask_epi8(same)) != 0xffff)
+			return i + __builtin_ctz(~mask);
+	}
+
+	return i;
+}
+
+/* For UCS-2 to UTF-8: the bytes to keep of four 16-bit lanes holding 
+ * one- or two-byte UTF-8 sequences, indexed by which lanes are two 
+ * bytes long. 0x80 makes pshufb write a zero. */
+static const uint8_t ucs2_utf8_shuffle[16][8] = {
+	{ 0, 2, 4, 6, 0x80, 0x80, 0x80, 0x80 },
+	{ 0, 1, 2, 4, 6, 0x80, 0x80, 0x80 },
+	{ 0, 2, 3, 4, 6, 0x80, 0x80, 0x80 },
+	{ 0, 1, 2, 3, 4, 6, 0x80, 0x80 },
+	{ 0, 2, 4, 5, 6, 0x80, 0x80, 0x80 },
+	{ 0, 1, 2, 4, 5, 6, 0x80, 0x80 },
+	{ 0, 2, 3, 4, 5, 6, 0x80, 0x80 },
+	{ 0, 1, 2, 3, 4, 5, 6, 0x80 },
+	{ 0, 2, 4, 6, 7, 0x80, 0x80, 0x80 },
+	{ 0, 1, 2, 4, 6, 7, 0x80, 0x80 },
+	{ 0, 2, 3, 4, 6, 7, 0x80, 0x80 },
+	{ 0, 1, 2, 3, 4, 6, 7, 0x80 },
+	{ 0, 2, 4, 5, 6, 7, 0x80, 0x80 },
+	{ 0, 1, 2, 4, 5, 6, 7, 0x80 },
+	{ 0, 2, 3, 4, 5, 6, 7, 0x80 },
+	{ 0, 1, 2, 3, 4, 5, 6, 7 }
+};
+
+/**
+ * Function: simd_ucs2_to_utf8_ssse3
+ *
+ * Parameters:
+ * src:		Pointer to UCS-2 (UTF-16BE) buffer.
+ * src_len:	Length of src buffer in bytes.
+ * dest:	(Output) Buffer for the UTF-8 characters.
+ * dest_len:	Length of dest buffer.
+ * used:	(Output) Number of bytes written to dest.
+ *
+ * Description: 
+ * Convert UCS-2 to UTF-8 8 characters at a time, for as long as a block
+ * of 8 is either all below U+0800 (one- and two-byte sequences, packed 
+ * together with ucs2_utf8_shuffle) or all from U+0800 up without 
+ * surrogates (three-byte sequences). Stops at the first block that is 
+ * neither, or when dest may not hold another 24 bytes, and leaves the 
+ * rest to the caller. The output is not null-terminated.
+ *
+ * Return value: 
+ * Number of bytes of src converted (a multiple of 16).
+ */
+__attribute__((target("ssse3")))
+unsigned int simd_ucs2_to_utf8_ssse3(const uint8_t *src,
+				     unsigned int src_len,
+				     char *dest,
+				     unsigned int dest_len,
+				     unsigned int *used)
+{
+	const __m128i swap = _mm_setr_epi8(1, 0, 3, 2, 5, 4, 7, 6, 9, 8, 11, 10, 13, 12, 15, 14);
+	/* -1 makes pshufb write a zero */
+	const __m128i three_lo_a = _mm_setr_epi8(0, 8, -1, 1, 9, -1, 2, 10, -1, 3, 11, -1, 4, 12, -1, 5);
+	const __m128i three_lo_b = _mm_setr_epi8(-1, -1, 0, -1, -1, 1, -1, -1, 2, -1, -1, 3, -1, -1, 4, -1);
+	const __m128i three_hi_a = _mm_setr_epi8(13, -1, 6, 14, -1, 7, 15, -1, -1, -1, -1, -1, -1, -1, -1, -1);
+	const __m128i three_hi_b = _mm_setr_epi8(-1, 5, -1, -1, 6, -1, -1, 7, -1, -1, -1, -1, -1, -1, -1, -1);
+	const __m128i high_half = _mm_setr_epi8(0, 0, 0, 0, 0, 0, 0, 0, 8, 8, 8, 8, 8, 8, 8, 8);
+	const __m128i low6 = _mm_set1_epi16(0x3f);
+	const __m128i zero = _mm_setzero_si128();
+	__m128i ucs2, top, two_bytes, encoded, shuffle, lead, middle, last;
+	unsigned int i, out = 0, lanes, lo_len;
+
+	for (i = 0; i + 16 <= src_len && out + 24 <= dest_len; i += 16)
+	{
+		ucs2 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)(src + i)), swap);
+		top = _mm_and_si128(ucs2, _mm_set1_epi16((short)0xf800));
+
+		if (_mm_movemask_epi8(_mm_cmpeq_epi16(top, zero)) == 0xffff)
+		{
+			/* All one- or two-byte sequences: make every lane the 
+			 * two-byte sequence 110xxxxx 10xxxxxx, or the character 
+			 * itself if it is ASCII, then squeeze out the unused 
+			 * high bytes of the ASCII lanes */
+			two_bytes = _mm_cmpgt_epi16(ucs2, _mm_set1_epi16(0x7f));
+			encoded = _mm_or_si128(_mm_or_si128(_mm_srli_epi16(ucs2, 6), _mm_set1_epi16(0xc0)),
+					       _mm_slli_epi16(_mm_or_si128(_mm_and_si128(ucs2, low6), _mm_set1_epi16(0x80)), 8));
+			encoded = _mm_or_si128(_mm_and_si128(two_bytes, encoded),
+					       _mm_andnot_si128(two_bytes, ucs2));
+
+			lanes = _mm_movemask_epi8(_mm_packs_epi16(two_bytes, zero));
+			shuffle = _mm_unpacklo_epi64(_mm_loadl_epi64((const __m128i *)ucs2_utf8_shuffle[lanes & 0xf]),
+						     _mm_loadl_epi64((const __m128i *)ucs2_utf8_shuffle[lanes >> 4]));
+			encoded = _mm_shuffle_epi8(encoded, _mm_add_epi8(shuffle, high_half));
+
+			lo_len = 4 + __builtin_popcount(lanes & 0xf);
+			_mm_storel_epi64((__m128i *)(dest + out), encoded);
+			_mm_storel_epi64((__m128i *)(dest + out + lo_len), _mm_unpackhi_epi64(encoded, encoded));
+			out += lo_len + 4 + __builtin_popcount(lanes >> 4);
+		}
+		else if (_mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi16(top, zero),
+							_mm_cmpeq_epi16(top, _mm_set1_epi16((short)0xd800)))) == 0)
+		{
+			/* All three-byte sequences: 1110xxxx 10xxxxxx 10xxxxxx */
+			lead = _mm_or_si128(_mm_srli_epi16(ucs2, 12), _mm_set1_epi16(0xe0));
+			middle = _mm_or_si128(_mm_and_si128(_mm_srli_epi16(ucs2, 6), low6), _mm_set1_epi16(0x80));
+			last = _mm_or_si128(_mm_and_si128(ucs2, low6), _mm_set1_epi16(0x80));
+
+			lead = _mm_packus_epi16(lead, middle);
+			last = _mm_packus_epi16(last, zero);
+
+			_mm_storeu_si128((__m128i *)(dest + out),
+					 _mm_or_si128(_mm_shuffle_epi8(lead, three_lo_a),
+						      _mm_shuffle_epi8(last, three_lo_b)));
+			_mm_storel_epi64((__m128i *)(dest + out + 16),
+					 _mm_or_si128(_mm_shuffle_epi8(lead, three_hi_a),
+						      _mm_shuffle_epi8(last, three_hi_b)));
+			out += 24;
+		}
+		else
+			break;
+	}
+
+	*used = out;
+
+	return i;
+}
+
+#endif  /* SIMD_X86 */
+
+/* EOF */
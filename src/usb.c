@@ -19,21 +19,74 @@
  *  PERFORMANCE OF THIS SOFTWARE.
  */
 
-#include <unistd.h>
+#include <stdlib.h>
 #include <stdio.h>
+#include <errno.h>
 #include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <pthread.h>
+#include <sys/stat.h>
 #include <linux/limits.h>
 
 #include "scsisim.h"
 #include "usb.h"
+#include "utils.h"
 
 #define VENDOR_FILE	"idVendor"
 #define PRODUCT_FILE	"idProduct"
+#define SERIAL_FILE	"serial"
 
 #define VENDOR_INDEX	0
 #define PRODUCT_INDEX	1
 #define DEVICE_INDEX	2
 
+#define USB_MAX_DEPTH		16	/* Directories to walk up from the sg 
+					   device before giving up */
+#define USB_CACHE_SIZE		256
+
+/* Struct to hold a cached sysfs lookup, including failed ones (an sg 
+ * device that is not on USB, such as a SATA disk). The class entry of 
+ * the sg device identifies the reader: it is created anew when a reader
+ * is plugged in, even under the name of one that went away. Its change 
+ * time is kept along with the inode, since a filesystem may hand a freed
+ * inode number straight to the next new file. */
+struct usb_cache_entry {
+	struct scsisim_device_info info;	/* All but index; name is 
+						   empty if unused */
+	int status;		/* Result of the lookup */
+	dev_t dev;
+	ino_t ino;
+	struct timespec ctime;
+};
+
+static struct usb_cache_entry usb_cache[USB_CACHE_SIZE];
+static unsigned int usb_cache_next;
+static pthread_mutex_t usb_cache_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static int usb_open_class_dir(void);
+static int usb_lookup(int classfd, const char *name, struct scsisim_device_info *info);
+static bool usb_match(unsigned int vendor,
+		      unsigned int product,
+		      const unsigned int supported_devices[][3],
+		      unsigned int *index);
+static bool usb_cache_lookup(const char *name,
+			     const struct stat *st,
+			     struct usb_cache_entry *entry);
+static void usb_cache_store(const struct usb_cache_entry *entry);
+static int usb_find_ids(int dirfd,
+			const struct stat *root,
+			struct scsisim_device_info *info,
+			unsigned int *depth);
+static void usb_find_bus_path(int classfd,
+			      const char *name,
+			      unsigned int depth,
+			      char *usb_path);
+static bool usb_read_attr(int dirfd, const char *name, char *buf, unsigned int len);
+static bool usb_read_id(int dirfd, const char *name, unsigned int *id);
+static int usb_compare_names(const void *a, const void *b);
+
 
 /**
  * Function: usb_get_vendor_product
@@ -44,9 +97,10 @@
  * product:	(Output) USB product number.
  *
  * Description: 
- * Given a pointer to an scsisim_dev struct, traverse the sysfs directory
- * structure for the associated device name to obtain the USB vendor 
- * and product numbers.
+ * Given a pointer to an scsisim_dev struct, find the USB vendor and 
+ * product numbers of the associated device in sysfs (under the root of
+ * the calling thread's context), with usb_lookup(). Nothing changes the
+ * working directory.
  *
  * Return values: 
  * SCSISIM_SYSFS_CHDIR_FAILED
@@ -58,76 +112,29 @@ int usb_get_vendor_product(const struct scsisim_dev *device,
 			   unsigned int *vendor,
 			   unsigned int *product)
 {
-	int ret;
-	char cwd[PATH_MAX], sysfs_sg_full_path[PATH_MAX];
-	FILE *fpVendor = NULL, *fpProduct = NULL;
+	int ret, classfd;
+	struct scsisim_device_info info;
 
 	*vendor = 0;
 	*product = 0;
 
-	snprintf(sysfs_sg_full_path,
-		 PATH_MAX,
-		 "%s/%s",
-		 SYSFS_SG_BASE_PATH,
-		 device->name);
+	if ((classfd = usb_open_class_dir()) < 0)
+		return SCSISIM_SYSFS_CHDIR_FAILED;
 
-	if (scsisim_verbose())
-		scsisim_pinfo("%s: ready to change directory to %s",
-			      __func__, sysfs_sg_full_path);
+	ret = usb_lookup(classfd, device->name, &info);
+	close(classfd);
 
-	/* Change to the physical device directory in sysfs -- equivalent to
-	 * `cd -P /sys/class/scsi_generic/sg[X]` */
-	ret = chdir(sysfs_sg_full_path);
+	if (ret != SCSISIM_SUCCESS)
+		return ret;
 
-	if (ret)
-	{
-		if (scsisim_verbose())
-			scsisim_pinfo("%s: changing to %s failed",
-				      __func__, sysfs_sg_full_path);
-
-		return(SCSISIM_SYSFS_CHDIR_FAILED);
-	}
-
-	if (scsisim_verbose())
-		scsisim_pinfo("%s: current directory is %s",
-			      __func__, getcwd(cwd, PATH_MAX));
-
-	/* Back out to the directory that contains the idProduct and idVendor files.
-	 * This is usually something like /sys/devices/pci0000:00/0000:00:14.0/usb1/1-3 */
-	ret = chdir("../../../../../..");
-
-	if (ret)
-	{
-		return(SCSISIM_SYSFS_CHDIR_FAILED);
-	}
+	*vendor = info.vendor;
+	*product = info.product;
 
 	if (scsisim_verbose())
-		scsisim_pinfo("%s: current directory is %s",
-			      __func__, getcwd(cwd, PATH_MAX));
-
-	/* Get the USB vendor ID */
-	if ((fpVendor = fopen(VENDOR_FILE, "r")) == NULL)
 	{
-		return(SCSISIM_USB_VENDOR_OPEN_FAILED);
-	}
-
-	fscanf(fpVendor, "%x", vendor);
-	fclose(fpVendor);
-
-	if (scsisim_verbose())
 		scsisim_pinfo("%s: device vendor is %x", __func__, *vendor);
-
-	/* Get the USB product ID */
-	if ((fpProduct = fopen(PRODUCT_FILE, "r")) == NULL)
-	{
-		return(SCSISIM_USB_PRODUCT_OPEN_FAILED);
-	}
-
-	fscanf(fpProduct, "%x", product);
-	fclose(fpProduct);
-
-	if (scsisim_verbose())
 		scsisim_pinfo("%s: device product is %x", __func__, *product);
+	}
 
 	return SCSISIM_SUCCESS;
 }
@@ -155,6 +162,243 @@ bool usb_is_device_supported(struct scsisim_dev *device,
 			     unsigned int vendor,
 			     unsigned int product,
 			     const unsigned int supported_devices[][3])
+{
+	unsigned int index;
+
+	if (usb_match(vendor, product, supported_devices, &index) == false)
+		return false;
+
+	/* We have a match */
+	device->index = index;
+
+	if (scsisim_verbose())
+		scsisim_pinfo("%s: device vendor/product is supported", __func__);
+
+	return true;
+}
+
+/**
+ * Function: usb_enumerate_devices
+ *
+ * Parameters:
+ * supported_devices: Array of supported USB devices organized by 
+ * vendor and product number. See device.h
+ * devices:	(Output) Array for the supported readers found.
+ * max:		Number of entries in devices.
+ *
+ * Description: 
+ * Read the scsi_generic class directory once, and look up each sg 
+ * device in it with usb_lookup(), keeping the supported ones. See 
+ * scsisim_enumerate_devices().
+ *
+ * Return values: 
+ * Number of supported readers found (which may be more than max), or 
+ * SCSISIM_SYSFS_CHDIR_FAILED.
+ */
+int usb_enumerate_devices(const unsigned int supported_devices[][3],
+			  struct scsisim_device_info *devices,
+			  unsigned int max)
+{
+	int classfd;
+	unsigned int count = 0;
+	DIR *dir;
+	struct dirent *ent;
+	struct scsisim_device_info info;
+
+	if ((classfd = usb_open_class_dir()) < 0)
+	{
+		/* No scsi_generic class at all just means no sg devices */
+		return (errno == ENOENT) ? 0 : SCSISIM_SYSFS_CHDIR_FAILED;
+	}
+
+	if ((dir = fdopendir(classfd)) == NULL)
+	{
+		close(classfd);
+		return SCSISIM_SYSFS_CHDIR_FAILED;
+	}
+
+	while ((ent = readdir(dir)) != NULL)
+	{
+		if (strncmp(ent->d_name, "sg", 2) != 0)
+			continue;
+
+		/* Anything that is not a USB device, or not a reader we 
+		 * support, is skipped */
+		if (usb_lookup(classfd, ent->d_name, &info) != SCSISIM_SUCCESS ||
+		    usb_match(info.vendor, info.product, supported_devices, &info.index) == false)
+			continue;
+
+		if (count < max)
+			devices[count] = info;
+
+		count++;
+	}
+
+	closedir(dir);
+
+	if (devices != NULL)
+		qsort(devices, MIN(count, max), sizeof(struct scsisim_device_info), usb_compare_names);
+
+	return count;
+}
+
+/**
+ * Function: usb_identify_device
+ *
+ * Parameters:
+ * supported_devices: Array of supported USB devices organized by 
+ * vendor and product number. See device.h
+ * name:	Name of the sg device, such as "sg3".
+ * info:	(Output) What is known about the device.
+ *
+ * Description: 
+ * Look up one sg device with usb_lookup(), and check that it is 
+ * supported. See scsisim_identify_device().
+ *
+ * Return values: 
+ * SCSISIM_SUCCESS
+ * SCSISIM_DEVICE_NOT_SUPPORTED
+ * SCSISIM_SYSFS_CHDIR_FAILED
+ * SCSISIM_USB_VENDOR_OPEN_FAILED
+ * SCSISIM_USB_PRODUCT_OPEN_FAILED
+ */
+int usb_identify_device(const unsigned int supported_devices[][3],
+			const char *name,
+			struct scsisim_device_info *info)
+{
+	int ret, classfd;
+
+	if ((classfd = usb_open_class_dir()) < 0)
+		return SCSISIM_SYSFS_CHDIR_FAILED;
+
+	ret = usb_lookup(classfd, name, info);
+	close(classfd);
+
+	if (ret != SCSISIM_SUCCESS)
+		return ret;
+
+	if (usb_match(info->vendor, info->product, supported_devices, &info->index) == false)
+		return SCSISIM_DEVICE_NOT_SUPPORTED;
+
+	return SCSISIM_SUCCESS;
+}
+
+/**
+ * Function: usb_open_class_dir
+ *
+ * Parameters:
+ * None
+ *
+ * Description: 
+ * Open the scsi_generic class directory under the sysfs root of the 
+ * calling thread's context.
+ *
+ * Return values: 
+ * File descriptor, or -1 with errno set.
+ */
+static int usb_open_class_dir(void)
+{
+	char path[PATH_MAX];
+
+	if (snprintf(path, PATH_MAX, "%s/%s", utils_sysfs_root(), SYSFS_SG_CLASS_DIR) >= PATH_MAX)
+	{
+		errno = ENAMETOOLONG;
+		return -1;
+	}
+
+	return open(path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+}
+
+/**
+ * Function: usb_lookup
+ *
+ * Parameters:
+ * classfd:	The scsi_generic class directory.
+ * name:	Name of the sg device, such as "sg3".
+ * info:	(Output) What is known about the device (all but index).
+ *
+ * Description: 
+ * Find the USB device an sg device belongs to. Opening its class symlink
+ * gets us the physical device directory (the equivalent of 
+ * `cd -P /sys/class/scsi_generic/sg[X]`), and from there the walk goes 
+ * up one parent at a time with openat() until a directory has idVendor 
+ * and idProduct: the USB device, however deep the SCSI host sits below 
+ * it. Results are cached by device name and the inode of its class 
+ * entry (see usb_cache_entry), so looking up the same device again costs
+ * one fstatat().
+ *
+ * Return values: 
+ * SCSISIM_SUCCESS
+ * SCSISIM_SYSFS_CHDIR_FAILED
+ * SCSISIM_USB_VENDOR_OPEN_FAILED
+ * SCSISIM_USB_PRODUCT_OPEN_FAILED
+ */
+static int usb_lookup(int classfd, const char *name, struct scsisim_device_info *info)
+{
+	int dirfd;
+	unsigned int depth = 0;
+	struct stat st, root;
+	struct usb_cache_entry entry;
+
+	/* The class symlink is created along with the device directory, so 
+	 * it identifies the device just as well, without resolving it */
+	if (strlen(name) >= sizeof(entry.info.name) ||
+	    fstatat(classfd, name, &st, AT_SYMLINK_NOFOLLOW) != 0)
+	{
+		if (scsisim_verbose())
+			scsisim_pinfo("%s: %s not found", __func__, name);
+
+		return SCSISIM_SYSFS_CHDIR_FAILED;
+	}
+
+	if (usb_cache_lookup(name, &st, &entry) == false)
+	{
+		memset(&entry, 0, sizeof(entry));
+		strcpy(entry.info.name, name);
+		entry.dev = st.st_dev;
+		entry.ino = st.st_ino;
+		entry.ctime = st.st_ctim;
+
+		if (stat(utils_sysfs_root(), &root) != 0 ||
+		    (dirfd = openat(classfd, name, O_RDONLY | O_DIRECTORY | O_CLOEXEC)) < 0)
+			return SCSISIM_SYSFS_CHDIR_FAILED;
+
+		entry.status = usb_find_ids(dirfd, &root, &entry.info, &depth);
+
+		if (entry.status == SCSISIM_SUCCESS)
+			usb_find_bus_path(classfd, name, depth, entry.info.usb_path);
+
+		usb_cache_store(&entry);
+	}
+	else if (scsisim_verbose())
+		scsisim_pinfo("%s: %s is cached", __func__, name);
+
+	*info = entry.info;
+
+	return entry.status;
+}
+
+/**
+ * Function: usb_match
+ *
+ * Parameters:
+ * vendor:	USB vendor number.
+ * product:	USB product number.
+ * supported_devices: Array of supported USB devices organized by 
+ * vendor and product number. See device.h
+ * index:	(Output) Index into sim_devices[] in device.h.
+ *
+ * Description: 
+ * Look up a USB vendor and product number in the list of supported 
+ * USB devices.
+ *
+ * Return values: 
+ * true if the device is supported, false otherwise.
+ */
+static bool usb_match(unsigned int vendor,
+		      unsigned int product,
+		      const unsigned int supported_devices[][3],
+		      unsigned int *index)
 {
 	int i;
 
@@ -163,12 +407,7 @@ bool usb_is_device_supported(struct scsisim_dev *device,
 		if (supported_devices[i][VENDOR_INDEX] == vendor &&
 			supported_devices[i][PRODUCT_INDEX] == product)
 		{
-			/* We have a match */
-			device->index = supported_devices[i][DEVICE_INDEX];
-
-			if (scsisim_verbose())
-				scsisim_pinfo("%s: device vendor/product is supported", __func__);
-
+			*index = supported_devices[i][DEVICE_INDEX];
 			return true;
 		}
 	}
@@ -176,5 +415,272 @@ bool usb_is_device_supported(struct scsisim_dev *device,
 	return false;
 }
 
-/* EOF */
+/**
+ * Function: usb_find_ids
+ *
+ * Parameters:
+ * dirfd:	Directory of the sg device in sysfs; closed on return.
+ * root:	stat() of the sysfs root, which the walk does not go above.
+ * info:	(Output) Vendor, product and serial number.
+ * depth:	(Output) Number of levels walked up.
+ *
+ * Description: 
+ * Walk up from dirfd to the first directory that has an idVendor file, 
+ * and read it, idProduct and (if there is one) serial. Each ".." is 
+ * resolved by the kernel from the directory itself, so it is the 
+ * physical parent.
+ *
+ * Return values: 
+ * SCSISIM_SUCCESS
+ * SCSISIM_SYSFS_CHDIR_FAILED
+ * SCSISIM_USB_VENDOR_OPEN_FAILED
+ * SCSISIM_USB_PRODUCT_OPEN_FAILED
+ */
+static int usb_find_ids(int dirfd,
+			const struct stat *root,
+			struct scsisim_device_info *info,
+			unsigned int *depth)
+{
+	int ret = SCSISIM_USB_VENDOR_OPEN_FAILED, parent;
+	struct stat st;
+
+	for (*depth = 0; *depth < USB_MAX_DEPTH; (*depth)++)
+	{
+		if (usb_read_id(dirfd, VENDOR_FILE, &info->vendor))
+		{
+			if (usb_read_id(dirfd, PRODUCT_FILE, &info->product))
+			{
+				usb_read_attr(dirfd, SERIAL_FILE, info->serial, sizeof(info->serial));
+				ret = SCSISIM_SUCCESS;
+			}
+			else
+				ret = SCSISIM_USB_PRODUCT_OPEN_FAILED;
+
+			break;
+		}
+
+		if (fstat(dirfd, &st) != 0)
+		{
+			ret = SCSISIM_SYSFS_CHDIR_FAILED;
+			break;
+		}
+
+		/* Don't leave the sysfs tree */
+		if (st.st_dev == root->st_dev && st.st_ino == root->st_ino)
+			break;
+
+		if ((parent = openat(dirfd, "..", O_RDONLY | O_DIRECTORY | O_CLOEXEC)) < 0)
+		{
+			ret = SCSISIM_SYSFS_CHDIR_FAILED;
+			break;
+		}
+
+		close(dirfd);
+		dirfd = parent;
+	}
+
+	close(dirfd);
+
+	return ret;
+}
+
+/**
+ * Function: usb_find_bus_path
+ *
+ * Parameters:
+ * classfd:	The scsi_generic class directory.
+ * name:	Name of the sg device, such as "sg3".
+ * depth:	Number of levels above the sg device the USB device is.
+ * usb_path:	(Output) Buffer of SCSISIM_USB_PATH_LEN bytes.
+ *
+ * Description: 
+ * Get the USB bus path of the device (such as "1-3.2", its directory 
+ * name in sysfs) from the target of the class symlink: everything under
+ * /sys/devices is a real directory, so the name depth components from 
+ * the end of the target is the one the walk stopped at. Left empty if 
+ * the class entry is not a symlink.
+ *
+ * Return values: 
+ * None
+ */
+static void usb_find_bus_path(int classfd,
+			      const char *name,
+			      unsigned int depth,
+			      char *usb_path)
+{
+	char target[PATH_MAX], *end, *start;
+	ssize_t len;
+
+	if ((len = readlinkat(classfd, name, target, sizeof(target) - 1)) <= 0)
+		return;
 
+	target[len] = '\0';
+
+	/* Drop depth components from the end */
+	while (depth-- > 0)
+	{
+		if ((end = strrchr(target, '/')) == NULL)
+			return;
+
+		*end = '\0';
+	}
+
+	start = strrchr(target, '/');
+	start = (start != NULL) ? start + 1 : target;
+
+	if (strcmp(start, "..") != 0 && strcmp(start, ".") != 0 &&
+	    strlen(start) < SCSISIM_USB_PATH_LEN)
+		strcpy(usb_path, start);
+}
+
+/**
+ * Function: usb_read_attr
+ *
+ * Parameters:
+ * dirfd:	Directory to read from.
+ * name:	Name of a sysfs attribute file.
+ * buf:		(Output) Buffer for its value, without the newline.
+ * len:		Length of buf.
+ *
+ * Description: 
+ * Read a one-line sysfs attribute. A value too long for buf is cut short.
+ *
+ * Return values: 
+ * true if the file exists and was read, false otherwise.
+ */
+static bool usb_read_attr(int dirfd, const char *name, char *buf, unsigned int len)
+{
+	int fd;
+	ssize_t n;
+
+	if ((fd = openat(dirfd, name, O_RDONLY | O_CLOEXEC)) < 0)
+		return false;
+
+	n = read(fd, buf, len - 1);
+	close(fd);
+
+	if (n < 0)
+		return false;
+
+	buf[n] = '\0';
+	buf[strcspn(buf, "\n")] = '\0';
+
+	return true;
+}
+
+/**
+ * Function: usb_read_id
+ *
+ * Parameters:
+ * dirfd:	Directory to read from.
+ * name:	Name of a file holding a hexadecimal ID, e.g., "idVendor".
+ * id:		(Output) The ID.
+ *
+ * Description: 
+ * Read a USB ID from a sysfs attribute file.
+ *
+ * Return values: 
+ * true if the file exists and holds a hexadecimal number, false otherwise.
+ */
+static bool usb_read_id(int dirfd, const char *name, unsigned int *id)
+{
+	char buf[16], *end;
+
+	if (usb_read_attr(dirfd, name, buf, sizeof(buf)) == false)
+		return false;
+
+	*id = strtoul(buf, &end, 16);
+
+	return end != buf;
+}
+
+/**
+ * Function: usb_cache_lookup
+ *
+ * Parameters:
+ * name:	Device name, such as "sg3".
+ * st:		stat() of the device's sysfs directory.
+ * entry:	(Output) The cached lookup.
+ *
+ * Description: 
+ * Look up a device in the cache of earlier lookups.
+ *
+ * Return values: 
+ * true if found, false otherwise.
+ */
+static bool usb_cache_lookup(const char *name,
+			     const struct stat *st,
+			     struct usb_cache_entry *entry)
+{
+	unsigned int i;
+	bool found = false;
+
+	pthread_mutex_lock(&usb_cache_lock);
+
+	for (i = 0; i < USB_CACHE_SIZE; i++)
+	{
+		if (usb_cache[i].ino == st->st_ino && usb_cache[i].dev == st->st_dev &&
+		    usb_cache[i].ctime.tv_sec == st->st_ctim.tv_sec &&
+		    usb_cache[i].ctime.tv_nsec == st->st_ctim.tv_nsec &&
+		    strcmp(usb_cache[i].info.name, name) == 0)
+		{
+			*entry = usb_cache[i];
+			found = true;
+			break;
+		}
+	}
+
+	pthread_mutex_unlock(&usb_cache_lock);
+
+	return found;
+}
+
+/**
+ * Function: usb_cache_store
+ *
+ * Parameters:
+ * entry:	Lookup to remember.
+ *
+ * Description: 
+ * Remember a lookup, replacing the oldest one once the cache is full.
+ *
+ * Return values: 
+ * None
+ */
+static void usb_cache_store(const struct usb_cache_entry *entry)
+{
+	pthread_mutex_lock(&usb_cache_lock);
+
+	usb_cache[usb_cache_next] = *entry;
+	usb_cache_next = (usb_cache_next + 1) % USB_CACHE_SIZE;
+
+	pthread_mutex_unlock(&usb_cache_lock);
+}
+
+/**
+ * Function: usb_compare_names
+ *
+ * Parameters:
+ * a:		Pointer to scsisim_device_info struct.
+ * b:		Pointer to scsisim_device_info struct.
+ *
+ * Description: 
+ * qsort() comparison function: order devices by number, so sg2 comes 
+ * before sg10.
+ *
+ * Return values: 
+ * Negative, zero or positive, as for strcmp().
+ */
+static int usb_compare_names(const void *a, const void *b)
+{
+	const char *name_a = ((const struct scsisim_device_info *)a)->name;
+	const char *name_b = ((const struct scsisim_device_info *)b)->name;
+	size_t len_a = strlen(name_a), len_b = strlen(name_b);
+
+	if (len_a != len_b)
+		return (len_a < len_b) ? -1 : 1;
+
+	return strcmp(name_a, name_b);
+}
+
+/* EOF */
@@ -29,17 +29,70 @@
 
 #include "scsisim.h"
 #include "utils.h"
+#include "simd.h"
 
 #define ROW_SIZE	16
 
 #define MAX_STRERROR	128
+#define MAX_LOG_LEN	512
+
+/* Struct to hold a library context: see scsisim_ctx_create() */
+struct scsisim_ctx {
+	bool verbose;		/* Read and written atomically */
+	void (*log)(void *user_data, int level, const char *msg);
+	void *log_data;
+	char *sysfs_root;	/* NULL for SYSFS_ROOT */
+};
+
+/* Used by every thread that has not bound a context of its own */
+static struct scsisim_ctx default_ctx = { false, NULL, NULL, NULL };
 
-static bool verbose_output = false;
+static __thread struct scsisim_ctx *thread_ctx = NULL;
+
+static inline struct scsisim_ctx *utils_ctx(void);
 
 static const char BCD_basic_digits[]="0123456789abcdef";
 static const char BCD_telecom_digits[]="0123456789*#,--f";
 
-static char error_buf[MAX_STRERROR];
+/* Every byte value converted to its two digits, low nibble first,
+ * so converting a byte is a single two-character copy */
+static const char BCD_basic_pairs[] =
+	"00102030405060708090a0b0c0d0e0f0"
+	"01112131415161718191a1b1c1d1e1f1"
+	"02122232425262728292a2b2c2d2e2f2"
+	"03132333435363738393a3b3c3d3e3f3"
+	"04142434445464748494a4b4c4d4e4f4"
+	"05152535455565758595a5b5c5d5e5f5"
+	"06162636465666768696a6b6c6d6e6f6"
+	"07172737475767778797a7b7c7d7e7f7"
+	"08182838485868788898a8b8c8d8e8f8"
+	"09192939495969798999a9b9c9d9e9f9"
+	"0a1a2a3a4a5a6a7a8a9aaabacadaeafa"
+	"0b1b2b3b4b5b6b7b8b9babbbcbdbebfb"
+	"0c1c2c3c4c5c6c7c8c9cacbcccdcecfc"
+	"0d1d2d3d4d5d6d7d8d9dadbdcdddedfd"
+	"0e1e2e3e4e5e6e7e8e9eaebecedeeefe"
+	"0f1f2f3f4f5f6f7f8f9fafbfcfdfefff";
+
+static const char BCD_telecom_pairs[] =
+	"00102030405060708090*0#0,0-0-0f0"
+	"01112131415161718191*1#1,1-1-1f1"
+	"02122232425262728292*2#2,2-2-2f2"
+	"03132333435363738393*3#3,3-3-3f3"
+	"04142434445464748494*4#4,4-4-4f4"
+	"05152535455565758595*5#5,5-5-5f5"
+	"06162636465666768696*6#6,6-6-6f6"
+	"07172737475767778797*7#7,7-7-7f7"
+	"08182838485868788898*8#8,8-8-8f8"
+	"09192939495969798999*9#9,9-9-9f9"
+	"0*1*2*3*4*5*6*7*8*9***#*,*-*-*f*"
+	"0#1#2#3#4#5#6#7#8#9#*###,#-#-#f#"
+	"0,1,2,3,4,5,6,7,8,9,*,#,,,-,-,f,"
+	"0-1-2-3-4-5-6-7-8-9-*-#-,-----f-"
+	"0-1-2-3-4-5-6-7-8-9-*-#-,-----f-"
+	"0f1f2f3f4f5f6f7f8f9f*f#f,f-f-fff";
+
+static __thread char error_buf[MAX_STRERROR];
 
 static const char *error_list[] = {
 	"Operation succeeded",				/* 0 - SCSISIM_SUCCESS */
@@ -83,6 +136,16 @@ static const char *error_list[] = {
 	"GSM: Increase cannot be performed (max value reached)", /* 38 - SCSISIM_GSM_INCREASE_FAILED */
 	"GSM: Security error",				/* 39 - SCSISIM_GSM_SECURITY_ERROR */
 	"GSM: Invalid ADN record",			/* 40 - SCSISIM_GSM_INVALID_ADN_RECORD */
+	"read() for SCSI receive failed",		/* 41 - SCSISIM_SCSI_RECEIVE_ERROR */
+	"Timed out waiting for command",		/* 42 - SCSISIM_TIMEOUT */
+	"Too many commands pending",			/* 43 - SCSISIM_QUEUE_FULL */
+	"No commands pending",				/* 44 - SCSISIM_NO_COMMANDS_PENDING */
+	"epoll() operation failed",			/* 45 - SCSISIM_REACTOR_ERROR */
+	"Buffer too small",				/* 46 - SCSISIM_BUFFER_TOO_SMALL */
+	"Current file unknown",				/* 47 - SCSISIM_PATH_UNKNOWN */
+	"Character not in GSM alphabet",		/* 48 - SCSISIM_GSM_INVALID_CHAR */
+	"Not enough free records",			/* 49 - SCSISIM_NO_FREE_RECORDS */
+	"Hotplug monitor error",			/* 50 - SCSISIM_MONITOR_ERROR */
 };
 
 #define MAXERR	(sizeof(error_list) / sizeof(error_list[0]))
@@ -144,45 +207,87 @@ char *scsisim_packed_bcd_to_ascii(const uint8_t *bcd,
 				  bool strip_sign_flag,
 				  bool use_telecom_digits)
 {
-	unsigned int i;
-	uint8_t lo_nibble, hi_nibble;
-	char lo_char, hi_char, *ascii = NULL, *tmp = NULL;
+	char *ascii = NULL;
 
 	if (bcd == NULL ||
 	    len <= 0 ||
 	    (ascii = malloc((size_t)len * 2 + 1)) == NULL)
 		return NULL;
 
-	tmp = ascii;
+	scsisim_packed_bcd_to_ascii_buf(bcd,
+					len,
+					little_endian,
+					strip_sign_flag,
+					use_telecom_digits,
+					ascii,
+					len * 2 + 1);
 
-	for (i = 0; i < len; i++)
+	return ascii;
+}
+
+/**
+ * For information about this function, see scsisim.h
+ */
+int scsisim_packed_bcd_to_ascii_buf(const uint8_t *bcd,
+				    unsigned int len,
+				    bool little_endian,
+				    bool strip_sign_flag,
+				    bool use_telecom_digits,
+				    char *ascii,
+				    unsigned int ascii_len)
+{
+	unsigned int i;
+	const char *pair, *pairs;
+	char *tmp = ascii;
+
+	if ((bcd == NULL && len > 0) || ascii == NULL)
+		return SCSISIM_INVALID_PARAM;
+
+	if (ascii_len < len * 2 + 1)
+		return SCSISIM_BUFFER_TOO_SMALL;
+
+	i = 0;
+
+#ifdef SIMD_X86
+	/* Most BCD numbers are shorter than one vector, so only 
+	 * longer buffers are worth the SIMD path */
+	if (len >= 16 && simd_have_ssse3())
 	{
-		lo_nibble = bcd[i] & 0xf;
-		hi_nibble = bcd[i] >> 4;
+		i = simd_bcd_to_ascii_ssse3(bcd,
+					    len,
+					    little_endian,
+					    use_telecom_digits ? BCD_telecom_digits : BCD_basic_digits,
+					    ascii);
+		tmp += i * 2;
+	}
+#endif
 
-		lo_char = use_telecom_digits ? BCD_telecom_digits[lo_nibble] : BCD_basic_digits[lo_nibble];
-		hi_char = use_telecom_digits ? BCD_telecom_digits[hi_nibble] : BCD_basic_digits[hi_nibble];
+	pairs = use_telecom_digits ? BCD_telecom_pairs : BCD_basic_pairs;
+
+	for (; i < len; i++)
+	{
+		pair = &pairs[bcd[i] * 2];
 
 		if (little_endian)
 		{
-			*tmp++ = lo_char;
-			*tmp++ = hi_char;
+			*tmp++ = pair[0];
+			*tmp++ = pair[1];
 		}
 		else
 		{
-			*tmp++ = hi_char;
-			*tmp++ = lo_char;
+			*tmp++ = pair[1];
+			*tmp++ = pair[0];
 		}
 	}
 
 	/* Strip off any trailing 'f' characters from the string that are 
 	 * functioning as the sign flag */
-	if ( strip_sign_flag && *(tmp - 1) == 'f' )
-		*(tmp - 1) = '\0';
-	else
-		*tmp = '\0';
+	if ( strip_sign_flag && tmp > ascii && *(tmp - 1) == 'f' )
+		tmp--;
 
-	return ascii;
+	*tmp = '\0';
+
+	return tmp - ascii;
 }
 
 /**
@@ -194,64 +299,391 @@ void scsisim_unpack_septets(const unsigned int num_septets,
 			    uint8_t **unpacked,
 			    unsigned int *unpacked_len)
 {
-	unsigned int i, cur_pos;
-	uint8_t tmp, *ptr = NULL;
-
 	if (num_septets <= 0 || packed == NULL || packed_len <= 0)
 		return;
 
-	/* Calculate the length of the unpacked buffer */
-	*unpacked_len = packed_len * 8 / 7;
-
-	if ((*unpacked = malloc((size_t)*unpacked_len)) == NULL)
+	/* Allocate for every septet the packed buffer can hold */
+	if ((*unpacked = malloc((size_t)packed_len * 8 / 7)) == NULL)
 		return;
 
-	ptr = *unpacked;
+	*unpacked_len = scsisim_unpack_septets_buf(num_septets,
+						   packed,
+						   packed_len,
+						   *unpacked,
+						   packed_len * 8 / 7);
+}
 
-	if (scsisim_verbose())
-		scsisim_pinfo("%s: unpacked_len = %d septets",
-			      __func__, *unpacked_len);
+/**
+ * For information about this function, see scsisim.h
+ */
+unsigned int scsisim_unpack_septets_buf(unsigned int num_septets,
+					const uint8_t *packed,
+					unsigned int packed_len,
+					uint8_t *unpacked,
+					unsigned int unpacked_len)
+{
+	unsigned int count, done = 0, i, k, group_len;
+	uint64_t group;
+
+	if (packed == NULL || unpacked == NULL)
+		return 0;
+
+	/* Every 7 packed bytes hold 8 septets; unpack no more than
+	 * were asked for, or than will fit */
+	count = MIN(MIN(num_septets, packed_len * 8 / 7), unpacked_len);
+
+#ifdef SIMD_X86
+	if (simd_have_avx2())
+		done = simd_unpack_septets_avx2(packed, packed_len, unpacked, count);
+
+	/* The 128-bit kernel needs less input, so it can also pick up 
+	 * where the 256-bit one left off */
+	if (simd_have_ssse3())
+		done += simd_unpack_septets_ssse3(packed + done / 8 * 7,
+						  packed_len - done / 8 * 7,
+						  unpacked + done,
+						  count - done);
+#endif
+
+	/* Unpack whatever is left a 7-byte group at a time. The SIMD
+	 * kernels only ever stop on a group boundary. */
+	for (i = done / 8 * 7; done < count; i += 7)
+	{
+		group_len = MIN(7, packed_len - i);
+		group = 0;
+
+		for (k = 0; k < group_len; k++)
+			group |= (uint64_t)packed[i + k] << (8 * k);
+
+		for (k = 0; k < 8 && done < count; k++)
+			unpacked[done++] = (group >> (7 * k)) & 0x7f;
+	}
+
+	return count;
+}
 
-	for (i = 0; i < packed_len; i++)
+/**
+ * For information about this function, see scsisim.h
+ */
+unsigned int scsisim_pack_septets_buf(unsigned int num_septets,
+				      const uint8_t *unpacked,
+				      uint8_t *packed,
+				      unsigned int packed_len)
+{
+	unsigned int count, done = 0, i, k, group_len;
+	uint64_t group;
+
+	if (unpacked == NULL || packed == NULL)
+		return 0;
+
+	/* Every 7 packed bytes hold 8 septets; pack no more than will 
+	 * fit, and don't touch the bytes after the last septet */
+	count = MIN(num_septets, packed_len * 8 / 7);
+	packed_len = (count * 7 + 7) / 8;
+
+#ifdef SIMD_X86
+	if (simd_have_avx2())
+		done = simd_pack_septets_avx2(unpacked, count, packed, packed_len);
+
+	if (simd_have_ssse3())
+		done += simd_pack_septets_ssse3(unpacked + done,
+						count - done,
+						packed + done / 8 * 7,
+						packed_len - done / 8 * 7);
+#endif
+
+	/* Pack whatever is left 8 septets (one 7-byte group) at a 
+	 * time. The SIMD kernels only ever stop on a group boundary. */
+	for (i = done / 8 * 7; done < count; i += 7)
 	{
-		cur_pos = i % 7;
-		tmp = packed[i];
+		group = 0;
 
-		/* The first septet in a 7-byte group doesn't require any bit 
-		 * shifting, but subsequent septets do: */
-		if (cur_pos > 0)
-		{
-			/* Shift the high bits into position: */
-			tmp <<= cur_pos;
+		for (k = 0; k < 8 && done < count; k++)
+			group |= (uint64_t)(unpacked[done++] & 0x7f) << (7 * k);
+
+		/* The last group may hold fewer than 8 septets */
+		group_len = (k * 7 + 7) / 8;
+
+		for (k = 0; k < group_len; k++)
+			packed[i + k] = group >> (8 * k);
+	}
+
+	return packed_len;
+}
+
+/**
+ * For information about this function, see scsisim.h
+ */
+int scsisim_ucs2_to_utf8(const uint8_t *src,
+			 unsigned int src_len,
+			 char *dest,
+			 unsigned int dest_len)
+{
+	unsigned int i = 0, used = 0, simd_from = 0, len;
+	uint32_t ch, low;
+	char utf8[4];
+
+	if ((src == NULL && src_len > 0) || dest == NULL)
+		return SCSISIM_INVALID_PARAM;
 
-			/* Get the low bits from the previous byte: */
-			tmp |= packed[i-1] >> (8 - cur_pos);
+	if (dest_len == 0)
+		return SCSISIM_BUFFER_TOO_SMALL;
+
+	/* A trailing odd byte isn't a character, so ignore it */
+	while (i + 1 < src_len)
+	{
+#ifdef SIMD_X86
+		/* Convert blocks of 8 characters with SIMD; after a block 
+		 * it can't handle, give the scalar code the next 8 */
+		if (i >= simd_from && src_len - i >= 16 && 
+		    dest_len - used > 24 && simd_have_ssse3())
+		{
+			unsigned int out;
+
+			i += simd_ucs2_to_utf8_ssse3(src + i,
+						     src_len - i,
+						     dest + used,
+						     dest_len - used - 1,
+						     &out);
+			used += out;
+			simd_from = i + 16;
+
+			if (i + 1 >= src_len)
+				break;
 		}
+#endif
+
+		ch = (src[i] << 8) | src[i + 1];
+		i += 2;
 
-		tmp &= 0x7f;
+		/* Combine a surrogate pair into one character, and replace 
+		 * a surrogate without its other half */
+		if (ch >= 0xd800 && ch <= 0xdbff && i + 1 < src_len &&
+		    (low = (src[i] << 8) | src[i + 1]) >= 0xdc00 && low <= 0xdfff)
+		{
+			ch = 0x10000 + ((ch - 0xd800) << 10) + (low - 0xdc00);
+			i += 2;
+		}
+		else if (ch >= 0xd800 && ch <= 0xdfff)
+			ch = 0xfffd;
 
-		*ptr++ = tmp;
+		len = utf8_encode(ch, utf8);
 
-		/* If we're at the end of a 7-byte group, we need to grab the
-		 * last (eighth) septet: */
-		if (cur_pos == 6)
+		/* Leave room for the null-terminating character */
+		if (used + len >= dest_len)
 		{
-			tmp = packed[i] >> 1;
-			*ptr++ = tmp;
+			dest[used] = '\0';
+			return SCSISIM_BUFFER_TOO_SMALL;
 		}
 
+		memcpy(dest + used, utf8, len);
+		used += len;
 	}
 
-	/* By rounding up packed_len earlier to ensure a whole byte, there
-	 * may now be an extra 'unpacked' character -- if so, remove it: */
-	if (*unpacked_len > num_septets)
+	dest[used] = '\0';
+
+	return used;
+}
+
+/**
+ * For information about this function, see scsisim.h
+ */
+int scsisim_utf8_to_ucs2(const char *src,
+			 unsigned int src_len,
+			 uint8_t *dest,
+			 unsigned int dest_len)
+{
+	unsigned int consumed;
+	int ret;
+
+	if (src == NULL || dest == NULL)
+		return SCSISIM_INVALID_PARAM;
+
+	ret = utf8_to_ucs2(src, src_len, dest, dest_len, &consumed);
+
+	if (ret >= 0 && consumed < src_len)
+		return SCSISIM_BUFFER_TOO_SMALL;
+
+	return ret;
+}
+
+/**
+ * Function: utf8_encode
+ *
+ * Parameters:
+ * ch:		Unicode code point, up to U+10FFFF.
+ * utf8:	(Output) Buffer of at least 4 bytes.
+ *
+ * Description: 
+ * Encode a Unicode code point as UTF-8. The output is not 
+ * null-terminated.
+ *
+ * Return value: 
+ * Length of the UTF-8 sequence (1 to 4 bytes).
+ */
+unsigned int utf8_encode(uint32_t ch, char *utf8)
+{
+	if (ch < 0x80)
 	{
-		if (scsisim_verbose())
-			scsisim_pinfo("%s: fixing mismatch between unpacked_len (%d) and num_septets (%d)",
-				      __func__, *unpacked_len, num_septets);
+		utf8[0] = ch;
+		return 1;
+	}
 
-		*unpacked_len = num_septets;
+	if (ch < 0x800)
+	{
+		utf8[0] = 0xc0 | (ch >> 6);
+		utf8[1] = 0x80 | (ch & 0x3f);
+		return 2;
 	}
+
+	if (ch < 0x10000)
+	{
+		utf8[0] = 0xe0 | (ch >> 12);
+		utf8[1] = 0x80 | ((ch >> 6) & 0x3f);
+		utf8[2] = 0x80 | (ch & 0x3f);
+		return 3;
+	}
+
+	utf8[0] = 0xf0 | (ch >> 18);
+	utf8[1] = 0x80 | ((ch >> 12) & 0x3f);
+	utf8[2] = 0x80 | ((ch >> 6) & 0x3f);
+	utf8[3] = 0x80 | (ch & 0x3f);
+	return 4;
+}
+
+/**
+ * Function: utf8_decode
+ *
+ * Parameters:
+ * utf8:	Pointer to a UTF-8 sequence.
+ * len:		Number of bytes available at utf8.
+ * ch:		(Output) Unicode code point.
+ *
+ * Description: 
+ * Decode one UTF-8 sequence. Truncated sequences, overlong forms and 
+ * surrogates are rejected.
+ *
+ * Return value: 
+ * Length of the UTF-8 sequence (1 to 4 bytes), or 0 if it is malformed.
+ */
+unsigned int utf8_decode(const char *utf8, unsigned int len, uint32_t *ch)
+{
+	const uint8_t *s = (const uint8_t *)utf8;
+	unsigned int n, i;
+	uint32_t min;
+
+	if (len == 0)
+		return 0;
+
+	if (s[0] < 0x80)
+	{
+		*ch = s[0];
+		return 1;
+	}
+
+	if ((s[0] & 0xe0) == 0xc0)
+	{
+		n = 2;
+		min = 0x80;
+		*ch = s[0] & 0x1f;
+	}
+	else if ((s[0] & 0xf0) == 0xe0)
+	{
+		n = 3;
+		min = 0x800;
+		*ch = s[0] & 0x0f;
+	}
+	else if ((s[0] & 0xf8) == 0xf0)
+	{
+		n = 4;
+		min = 0x10000;
+		*ch = s[0] & 0x07;
+	}
+	else
+		return 0;
+
+	if (len < n)
+		return 0;
+
+	for (i = 1; i < n; i++)
+	{
+		if ((s[i] & 0xc0) != 0x80)
+			return 0;
+
+		*ch = (*ch << 6) | (s[i] & 0x3f);
+	}
+
+	if (*ch < min || *ch > 0x10ffff || (*ch >= 0xd800 && *ch <= 0xdfff))
+		return 0;
+
+	return n;
+}
+
+/**
+ * Function: utf8_to_ucs2
+ *
+ * Parameters:
+ * src:		Pointer to UTF-8 text.
+ * src_len:	Length of src in bytes.
+ * dest:	(Output) Buffer for UCS-2 (UTF-16BE) text.
+ * dest_len:	Length of dest buffer.
+ * consumed:	(Output) Number of bytes of src converted.
+ *
+ * Description: 
+ * Convert as much UTF-8 text to UCS-2 as fits in dest, characters past 
+ * U+FFFF becoming surrogate pairs, which are never split. Stopping 
+ * early is not an error, so a long text can be converted one SMS at a 
+ * time.
+ *
+ * Return values: 
+ * Number of bytes written to dest, or SCSISIM_INVALID_PARAM if src is 
+ * not valid UTF-8.
+ */
+int utf8_to_ucs2(const char *src,
+		 unsigned int src_len,
+		 uint8_t *dest,
+		 unsigned int dest_len,
+		 unsigned int *consumed)
+{
+	unsigned int i = 0, used = 0, n;
+	uint32_t ch;
+
+	while (i < src_len)
+	{
+		if ((uint8_t)src[i] < 0x80)
+		{
+			ch = (uint8_t)src[i];
+			n = 1;
+		}
+		else if ((n = utf8_decode(src + i, src_len - i, &ch)) == 0)
+			return SCSISIM_INVALID_PARAM;
+
+		if (ch > 0xffff)
+		{
+			if (dest_len - used < 4)
+				break;
+
+			ch -= 0x10000;
+			dest[used++] = 0xd8 | (ch >> 18);
+			dest[used++] = (ch >> 10) & 0xff;
+			dest[used++] = 0xdc | ((ch >> 8) & 0x03);
+			dest[used++] = ch & 0xff;
+		}
+		else
+		{
+			if (dest_len - used < 2)
+				break;
+
+			dest[used++] = ch >> 8;
+			dest[used++] = ch & 0xff;
+		}
+
+		i += n;
+	}
+
+	*consumed = i;
+
+	return used;
 }
 
 /**
@@ -288,20 +720,30 @@ bool is_digit_string(const char *str)
  */
 char *scsisim_strerror(int err)
 {
+	scsisim_strerror_r(err, error_buf, sizeof(error_buf));
+
+	return error_buf;
+}
+
+/**
+ * For information about this function, see scsisim.h
+ */
+int scsisim_strerror_r(int err, char *buf, unsigned int len)
+{
+	int ret;
+
+	if (buf == NULL || len == 0)
+		return SCSISIM_INVALID_PARAM;
+
 	/* Remove negative value */
 	err = abs(err);
 
 	if ((unsigned)err >= MAXERR || error_list[err] == NULL)
-	{
-		snprintf(error_buf, MAX_STRERROR, "Unknown error %d", err);
-	}
+		ret = snprintf(buf, len, "Unknown error %d", err);
 	else
-	{
-		strncpy(error_buf, error_list[err], MAX_STRERROR - 1);
-		error_buf[MAX_STRERROR - 1] = '\0';
-	}
+		ret = snprintf(buf, len, "%s", error_list[err]);
 
-	return error_buf;
+	return ((unsigned int)ret >= len) ? SCSISIM_BUFFER_TOO_SMALL : SCSISIM_SUCCESS;
 }
 
 /**
@@ -309,10 +751,20 @@ char *scsisim_strerror(int err)
  */
 void scsisim_perror(const char *str, int err)
 {
+	struct scsisim_ctx *ctx = utils_ctx();
+	char msg[MAX_LOG_LEN], error[MAX_STRERROR];
+
+	scsisim_strerror_r(err, error, sizeof(error));
+
 	if (str == NULL || str[0] == '\0')
-		fprintf(stderr, "[ERROR: %s]\n", scsisim_strerror(err));
+		snprintf(msg, sizeof(msg), "%s", error);
 	else
-		fprintf(stderr, "[ERROR: %s: %s]\n", str, scsisim_strerror(err));
+		snprintf(msg, sizeof(msg), "%s: %s", str, error);
+
+	if (ctx->log != NULL)
+		ctx->log(ctx->log_data, SCSISIM_LOG_ERROR, msg);
+	else
+		fprintf(stderr, "[ERROR: %s]\n", msg);
 }
 
 /**
@@ -321,12 +773,19 @@ void scsisim_perror(const char *str, int err)
 void scsisim_pinfo(const char* format, ...)
 {
 	va_list args;
+	struct scsisim_ctx *ctx = utils_ctx();
+	char msg[MAX_LOG_LEN];
 
-	fprintf(stderr, "[INFO: ");
+	/* Format the whole message first, so that messages from 
+	 * different threads don't interleave */
 	va_start(args, format);
-	vfprintf(stderr, format, args);
+	vsnprintf(msg, sizeof(msg), format, args);
 	va_end(args);
-	fprintf(stderr, "]\n");
+
+	if (ctx->log != NULL)
+		ctx->log(ctx->log_data, SCSISIM_LOG_INFO, msg);
+	else
+		fprintf(stderr, "[INFO: %s]\n", msg);
 }
 
 /**
@@ -346,7 +805,7 @@ void scsisim_printf(const char* format, ...)
  */
 bool scsisim_verbose(void)
 {
-    return verbose_output;
+    return __atomic_load_n(&utils_ctx()->verbose, __ATOMIC_RELAXED);
 }
 
 /**
@@ -354,7 +813,7 @@ bool scsisim_verbose(void)
  */
 void scsisim_verbose_enable(void)
 {
-    verbose_output = true;
+    __atomic_store_n(&utils_ctx()->verbose, true, __ATOMIC_RELAXED);
 }
 
 /**
@@ -362,7 +821,117 @@ void scsisim_verbose_enable(void)
  */
 void scsisim_verbose_disable(void)
 {
-    verbose_output = false;
+    __atomic_store_n(&utils_ctx()->verbose, false, __ATOMIC_RELAXED);
+}
+
+/**
+ * For information about this function, see scsisim.h
+ */
+int scsisim_ctx_create(struct scsisim_ctx **ctx)
+{
+	if (ctx == NULL)
+		return SCSISIM_INVALID_PARAM;
+
+	if ((*ctx = calloc(1, sizeof(struct scsisim_ctx))) == NULL)
+		return SCSISIM_MEMORY_ALLOCATION_ERROR;
+
+	return SCSISIM_SUCCESS;
+}
+
+/**
+ * For information about this function, see scsisim.h
+ */
+void scsisim_ctx_destroy(struct scsisim_ctx *ctx)
+{
+	if (ctx == NULL)
+		return;
+
+	if (thread_ctx == ctx)
+		thread_ctx = NULL;
+
+	free(ctx->sysfs_root);
+	free(ctx);
+}
+
+/**
+ * For information about this function, see scsisim.h
+ */
+void scsisim_ctx_set_log(struct scsisim_ctx *ctx,
+			 void (*log)(void *user_data, int level, const char *msg),
+			 void *user_data)
+{
+	if (ctx == NULL)
+		return;
+
+	ctx->log = log;
+	ctx->log_data = user_data;
+}
+
+/**
+ * For information about this function, see scsisim.h
+ */
+int scsisim_ctx_set_sysfs_root(struct scsisim_ctx *ctx, const char *root)
+{
+	char *tmp = NULL;
+
+	if (ctx == NULL)
+		return SCSISIM_INVALID_PARAM;
+
+	if (root != NULL && (tmp = strdup(root)) == NULL)
+		return SCSISIM_MEMORY_ALLOCATION_ERROR;
+
+	free(ctx->sysfs_root);
+	ctx->sysfs_root = tmp;
+
+	return SCSISIM_SUCCESS;
+}
+
+/**
+ * Function: utils_sysfs_root
+ *
+ * Parameters:
+ * None
+ *
+ * Description: 
+ * Get the sysfs mount point of the calling thread's context.
+ *
+ * Return value: 
+ * Path of the sysfs root, without a trailing slash.
+ */
+const char *utils_sysfs_root(void)
+{
+	const char *root = utils_ctx()->sysfs_root;
+
+	return (root != NULL) ? root : SYSFS_ROOT;
+}
+
+/**
+ * For information about this function, see scsisim.h
+ */
+struct scsisim_ctx *scsisim_ctx_bind(struct scsisim_ctx *ctx)
+{
+	struct scsisim_ctx *prev = thread_ctx;
+
+	thread_ctx = ctx;
+
+	return prev;
+}
+
+/**
+ * Function: utils_ctx
+ *
+ * Parameters:
+ * None
+ *
+ * Description: 
+ * Get the context of the calling thread.
+ *
+ * Return value: 
+ * Pointer to the bound context, or to the default context.
+ */
+static inline struct scsisim_ctx *utils_ctx(void)
+{
+	return (thread_ctx != NULL) ? thread_ctx : &default_ctx;
 }
 
 /* EOF */
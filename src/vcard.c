@@ -0,0 +1,1430 @@
+/*
+ *  vcard.c
+ *  In-memory virtual SIM card backend for the scsisim library.
+ *
+ *  Copyright (c) 2017, Chris Coffey <kpuc@sdf.org>
+ *
+ *  Permission to use, copy, modify, and/or distribute this software
+ *  for any purpose with or without fee is hereby granted, provided
+ *  that the above copyright notice and this permission notice appear
+ *  in all copies.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL
+ *  WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED
+ *  WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE
+ *  AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL
+ *  DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE, DATA
+ *  OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER
+ *  TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ *  PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdbool.h>
+#include <time.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/timerfd.h>
+
+#include "scsisim.h"
+#include "gsm.h"
+#include "scsi.h"
+#include "transport.h"
+#include "device.h"
+#include "utils.h"
+#include "cache.h"
+
+#define VCARD_NAME		"vcard"
+
+#define VCARD_FILE_TYPE_MF	0x01	/* See GSM spec, 9.3 */
+#define VCARD_FILE_TYPE_DF	0x02
+#define VCARD_FILE_TYPE_EF	0x04
+
+#define VCARD_NUM_CHVS		2
+#define VCARD_CHV_ATTEMPTS	3	/* Default CHV attempts */
+#define VCARD_UNBLOCK_ATTEMPTS	10	/* Default UNBLOCK CHV attempts */
+#define VCARD_FREE_MEMORY	0x1000	/* Reported as free memory in MF/DF responses */
+#define VCARD_MAX_RESPONSE_LEN	32
+
+/* USB IDs the virtual reader reports; this must match an entry in
+ * supported_devices[] in device.h */
+#define VCARD_USB_VENDOR	0x0420
+#define VCARD_USB_PRODUCT	0x1307
+
+/* Structure to hold a file (MF, DF or EF) on the virtual card */
+struct vcard_file {
+	uint16_t id;
+	uint8_t type;
+	uint8_t structure;		/* EF only */
+	uint8_t record_len;		/* EF only */
+	uint16_t size;			/* EF only */
+	uint8_t read_ac;		/* EF only */
+	uint8_t update_ac;		/* EF only */
+	uint8_t *contents;		/* EF only */
+	uint8_t record_ptr;		/* EF only: current record, 0 if unset */
+	struct vcard_file *parent;
+	struct vcard_file *child;	/* First child of an MF or DF */
+	struct vcard_file *next;	/* Next sibling */
+};
+
+/* Structure to hold a CHV (PIN) on the virtual card */
+struct vcard_chv {
+	bool initialized;
+	bool enabled;
+	bool verified;
+	uint8_t attempts;		/* Attempts left */
+	uint8_t max_attempts;		/* Attempts after a correct VERIFY */
+	uint8_t pin[GSM_CMD_VERIFY_CHV_DATA_LEN];
+};
+
+/* Structure to hold a command queued with the asynchronous interface */
+struct vcard_queued {
+	struct scsi_cmd *cmd;
+	struct timespec due;
+};
+
+struct scsisim_vcard {
+	struct vcard_file mf;
+	struct vcard_file *cur_df;	/* Current directory (MF or DF) */
+	struct vcard_file *cur_ef;	/* Current EF, or NULL */
+	struct vcard_chv chv[VCARD_NUM_CHVS];
+	uint8_t response[VCARD_MAX_RESPONSE_LEN];	/* Data for GET RESPONSE */
+	unsigned int response_len;
+	unsigned int latency;		/* Per-command latency in microseconds */
+	unsigned long commands;		/* Number of commands processed */
+	bool attached;			/* Attached to an open scsisim_dev */
+	bool reader_ready;		/* Reader passes GSM commands to the card */
+	unsigned int init_cmds;		/* Reader-level commands while not ready */
+	/* Asynchronous interface: commands already executed, waiting for
+	 * their simulated latency to pass before they can be reaped */
+	struct vcard_queued queue[SCSISIM_MAX_PENDING];
+	unsigned int queue_head;
+	unsigned int queue_count;
+	struct timespec last_due;	/* Due time of the newest queued command */
+	int timer_fd;			/* Readable when the oldest is due */
+};
+
+static int vcard_get_vendor_product(const struct scsisim_dev *device,
+				    unsigned int *vendor,
+				    unsigned int *product);
+static int vcard_send_cdb(const struct scsisim_dev *device, struct scsi_cmd *my_cmd);
+static int vcard_submit_cdb(const struct scsisim_dev *device, struct scsi_cmd *my_cmd);
+static int vcard_reap_cdb(const struct scsisim_dev *device,
+			  struct scsi_cmd **my_cmd,
+			  int timeout);
+static int vcard_close(struct scsisim_dev *device);
+static struct vcard_file *vcard_find_file(struct vcard_file *dir, uint16_t id);
+static void vcard_free_file(struct vcard_file *file);
+
+const struct scsisim_transport vcard_transport = {
+	.name = VCARD_NAME,
+	.get_vendor_product = vcard_get_vendor_product,
+	.send_cdb = vcard_send_cdb,
+	.submit_cdb = vcard_submit_cdb,
+	.reap_cdb = vcard_reap_cdb,
+	.close = vcard_close
+};
+
+/* Sample contents for scsisim_vcard_load_default(): */
+static const uint8_t vcard_default_iccid[10] = {
+	0x98, 0x44, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x71
+};
+
+static const uint8_t vcard_default_imsi[9] = {
+	0x08, 0x09, 0x10, 0x10, 0x10, 0x32, 0x54, 0x76, 0x98
+};
+
+static const char vcard_default_spn[] = "Virtual SIM";
+
+/* Two contacts: "Alice" 0123456789 and "Voicemail" 123 */
+static const uint8_t vcard_default_adn[][14] = {
+	{ 'A', 'l', 'i', 'c', 'e', 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff },
+	{ 0x06, 0x81, 0x10, 0x32, 0x54, 0x76, 0x98, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff },
+	{ 'V', 'o', 'i', 'c', 'e', 'm', 'a', 'i', 'l', 0xff, 0xff, 0xff, 0xff, 0xff },
+	{ 0x03, 0x81, 0x21, 0xf3, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff }
+};
+
+/* A received SMS-DELIVER: "Hello from the virtual SIM" from 0123456789 */
+static const uint8_t vcard_default_sms[] = {
+	0x01,						/* Status: read */
+	0x07, 0x91, 0x44, 0x77, 0x00, 0x09, 0x00, 0x00,	/* SMSC */
+	0x04,						/* TP-MTI, TP-MMS */
+	0x0a, 0x81, 0x10, 0x32, 0x54, 0x76, 0x98,	/* TP-OA */
+	0x00,						/* TP-PID */
+	0x00,						/* TP-DCS */
+	0x42, 0x50, 0x10, 0x21, 0x03, 0x54, 0x00,	/* TP-SCTS */
+	0x1a,						/* TP-UDL */
+	0xc8, 0x32, 0x9b, 0xfd, 0x06, 0x99, 0xe5, 0xef,	/* TP-UD */
+	0x36, 0x88, 0x8e, 0x2e, 0x83, 0xec, 0x69, 0x39,
+	0xbd, 0x1e, 0x66, 0x83, 0xa6, 0xc9, 0x26
+};
+
+
+/**
+ * For information about this function, see scsisim.h
+ */
+int scsisim_vcard_create(struct scsisim_vcard **card)
+{
+	int i;
+	struct scsisim_vcard *new_card;
+
+	if (card == NULL)
+		return SCSISIM_INVALID_PARAM;
+
+	if ((new_card = calloc(1, sizeof(struct scsisim_vcard))) == NULL)
+		return SCSISIM_MEMORY_ALLOCATION_ERROR;
+
+	new_card->mf.id = GSM_FILE_MF;
+	new_card->mf.type = VCARD_FILE_TYPE_MF;
+	new_card->cur_df = &new_card->mf;
+	new_card->timer_fd = -1;
+	new_card->reader_ready = true;
+
+	for (i = 0; i < VCARD_NUM_CHVS; i++)
+	{
+		new_card->chv[i].attempts = VCARD_CHV_ATTEMPTS;
+		new_card->chv[i].max_attempts = VCARD_CHV_ATTEMPTS;
+	}
+
+	/* CHV2 can't be disabled */
+	new_card->chv[1].enabled = true;
+
+	*card = new_card;
+
+	return SCSISIM_SUCCESS;
+}
+
+/**
+ * For information about this function, see scsisim.h
+ */
+void scsisim_vcard_destroy(struct scsisim_vcard *card)
+{
+	if (card == NULL)
+		return;
+
+	vcard_free_file(card->mf.child);
+	free(card);
+}
+
+/**
+ * Function: vcard_add_file
+ *
+ * Parameters:
+ * card:	Pointer to virtual SIM card.
+ * parent:	ID of the MF or DF that will contain the new file.
+ * file:	ID of the new file.
+ * type:	VCARD_FILE_TYPE_DF or VCARD_FILE_TYPE_EF.
+ * new_file:	(Output) Pointer to the new file.
+ *
+ * Description:
+ * Allocate a new file and link it into the file tree of a virtual card.
+ *
+ * Return values:
+ * SCSISIM_SUCCESS
+ * SCSISIM_INVALID_PARAM
+ * SCSISIM_GSM_FILE_NOT_FOUND
+ * SCSISIM_MEMORY_ALLOCATION_ERROR
+ */
+static int vcard_add_file(struct scsisim_vcard *card,
+			  uint16_t parent,
+			  uint16_t file,
+			  uint8_t type,
+			  struct vcard_file **new_file)
+{
+	struct vcard_file *dir, *tmp;
+
+	if (card == NULL || file == GSM_FILE_MF)
+		return SCSISIM_INVALID_PARAM;
+
+	if ((dir = vcard_find_file(&card->mf, parent)) == NULL ||
+	    dir->type == VCARD_FILE_TYPE_EF)
+		return SCSISIM_GSM_FILE_NOT_FOUND;
+
+	/* File IDs must be unique within a directory */
+	for (tmp = dir->child; tmp != NULL; tmp = tmp->next)
+	{
+		if (tmp->id == file)
+			return SCSISIM_INVALID_PARAM;
+	}
+
+	if ((tmp = calloc(1, sizeof(struct vcard_file))) == NULL)
+		return SCSISIM_MEMORY_ALLOCATION_ERROR;
+
+	tmp->id = file;
+	tmp->type = type;
+	tmp->parent = dir;
+	tmp->next = dir->child;
+	dir->child = tmp;
+
+	*new_file = tmp;
+
+	return SCSISIM_SUCCESS;
+}
+
+/**
+ * For information about this function, see scsisim.h
+ */
+int scsisim_vcard_add_df(struct scsisim_vcard *card,
+			 uint16_t parent,
+			 uint16_t file)
+{
+	struct vcard_file *df;
+
+	return vcard_add_file(card, parent, file, VCARD_FILE_TYPE_DF, &df);
+}
+
+/**
+ * For information about this function, see scsisim.h
+ */
+int scsisim_vcard_add_ef(struct scsisim_vcard *card,
+			 uint16_t parent,
+			 uint16_t file,
+			 uint8_t structure,
+			 uint16_t file_size,
+			 uint8_t record_len,
+			 const uint8_t *contents)
+{
+	int ret;
+	struct vcard_file *ef;
+	uint8_t *buf;
+
+	if (file_size == 0 ||
+	    (structure != SIM_EF_TRANSPARENT &&
+	     structure != SIM_EF_LINEAR_FIXED &&
+	     structure != SIM_EF_CYCLIC))
+		return SCSISIM_INVALID_PARAM;
+
+	/* Record-based files must hold a whole number of records */
+	if (structure != SIM_EF_TRANSPARENT &&
+	    (record_len == 0 || file_size % record_len != 0 ||
+	     file_size / record_len > 0xff))
+		return SCSISIM_INVALID_PARAM;
+
+	if ((buf = malloc((size_t)file_size)) == NULL)
+		return SCSISIM_MEMORY_ALLOCATION_ERROR;
+
+	if ((ret = vcard_add_file(card, parent, file, VCARD_FILE_TYPE_EF, &ef)) != SCSISIM_SUCCESS)
+	{
+		free(buf);
+		return ret;
+	}
+
+	if (contents != NULL)
+		memcpy(buf, contents, (size_t)file_size);
+	else
+		memset(buf, 0xff, (size_t)file_size);
+
+	ef->structure = structure;
+	ef->size = file_size;
+	ef->record_len = (structure == SIM_EF_TRANSPARENT) ? 0 : record_len;
+	ef->read_ac = SIM_AC_ALWAYS;
+	ef->update_ac = SIM_AC_ALWAYS;
+	ef->contents = buf;
+
+	return SCSISIM_SUCCESS;
+}
+
+/**
+ * For information about this function, see scsisim.h
+ */
+int scsisim_vcard_set_access(struct scsisim_vcard *card,
+			     uint16_t parent,
+			     uint16_t file,
+			     uint8_t read_ac,
+			     uint8_t update_ac)
+{
+	struct vcard_file *dir, *ef;
+
+	if (card == NULL || read_ac > 0xf || update_ac > 0xf)
+		return SCSISIM_INVALID_PARAM;
+
+	if ((dir = vcard_find_file(&card->mf, parent)) == NULL ||
+	    dir->type == VCARD_FILE_TYPE_EF)
+		return SCSISIM_GSM_FILE_NOT_FOUND;
+
+	for (ef = dir->child; ef != NULL; ef = ef->next)
+	{
+		if (ef->id == file && ef->type == VCARD_FILE_TYPE_EF)
+		{
+			ef->read_ac = read_ac;
+			ef->update_ac = update_ac;
+			return SCSISIM_SUCCESS;
+		}
+	}
+
+	return SCSISIM_GSM_FILE_NOT_FOUND;
+}
+
+/**
+ * For information about this function, see scsisim.h
+ */
+int scsisim_vcard_set_chv(struct scsisim_vcard *card,
+			  uint8_t chv,
+			  const char *pin,
+			  bool enabled,
+			  uint8_t attempts)
+{
+	struct vcard_chv *tmp;
+
+	if (card == NULL || pin == NULL || chv < 1 || chv > VCARD_NUM_CHVS ||
+	    attempts > 0x0f)
+		return SCSISIM_INVALID_PARAM;
+
+	if (is_digit_string(pin) == false || strlen(pin) > GSM_CMD_VERIFY_CHV_DATA_LEN)
+		return SCSISIM_INVALID_PIN;
+
+	tmp = &card->chv[chv - 1];
+
+	memset(tmp->pin, 0xff, sizeof(tmp->pin));
+	memcpy(tmp->pin, pin, strlen(pin));
+
+	tmp->initialized = true;
+	tmp->enabled = (chv == 2) ? true : enabled;
+	tmp->verified = false;
+	tmp->attempts = attempts;
+	tmp->max_attempts = attempts;
+
+	return SCSISIM_SUCCESS;
+}
+
+/**
+ * For information about this function, see scsisim.h
+ */
+void scsisim_vcard_set_latency(struct scsisim_vcard *card, unsigned int usecs)
+{
+	if (card != NULL)
+		card->latency = usecs;
+}
+
+/**
+ * For information about this function, see scsisim.h
+ */
+void scsisim_vcard_set_reader_initialized(struct scsisim_vcard *card, bool initialized)
+{
+	if (card == NULL)
+		return;
+
+	card->reader_ready = initialized;
+	card->init_cmds = 0;
+}
+
+/**
+ * For information about this function, see scsisim.h
+ */
+unsigned long scsisim_vcard_get_command_count(const struct scsisim_vcard *card)
+{
+	return (card == NULL) ? 0 : card->commands;
+}
+
+/**
+ * For information about this function, see scsisim.h
+ */
+int scsisim_vcard_load_default(struct scsisim_vcard *card)
+{
+	int ret, i;
+	uint8_t buf[50 * GSM_SMS_RECORD_LEN];	/* Big enough for EF-ADN too */
+
+	if ((ret = scsisim_vcard_add_ef(card, GSM_FILE_MF, GSM_FILE_EF_ICCID,
+					SIM_EF_TRANSPARENT, sizeof(vcard_default_iccid),
+					0, vcard_default_iccid)) != SCSISIM_SUCCESS)
+		return ret;
+
+	/* DF-TELECOM */
+	if ((ret = scsisim_vcard_add_df(card, GSM_FILE_MF, GSM_FILE_DF_TELECOM)) != SCSISIM_SUCCESS)
+		return ret;
+
+	memset(buf, 0xff, sizeof(buf));
+	memcpy(buf, vcard_default_adn, sizeof(vcard_default_adn));
+
+	if ((ret = scsisim_vcard_add_ef(card, GSM_FILE_DF_TELECOM, GSM_FILE_EF_ADN,
+					SIM_EF_LINEAR_FIXED, 250 * 28, 28, buf)) != SCSISIM_SUCCESS ||
+	    (ret = scsisim_vcard_add_ef(card, GSM_FILE_DF_TELECOM, GSM_FILE_EF_FDN,
+					SIM_EF_LINEAR_FIXED, 10 * 28, 28, NULL)) != SCSISIM_SUCCESS ||
+	    (ret = scsisim_vcard_add_ef(card, GSM_FILE_DF_TELECOM, GSM_FILE_EF_MSISDN,
+					SIM_EF_LINEAR_FIXED, 2 * 28, 28, NULL)) != SCSISIM_SUCCESS ||
+	    (ret = scsisim_vcard_add_ef(card, GSM_FILE_DF_TELECOM, GSM_FILE_EF_EXT1,
+					SIM_EF_LINEAR_FIXED, 10 * 13, 13, NULL)) != SCSISIM_SUCCESS)
+		return ret;
+
+	/* Unused SMS records have status 0x00, followed by 0xff padding */
+	memset(buf, 0xff, 50 * GSM_SMS_RECORD_LEN);
+
+	for (i = 0; i < 50; i++)
+		buf[i * GSM_SMS_RECORD_LEN] = 0x00;
+
+	memcpy(buf, vcard_default_sms, sizeof(vcard_default_sms));
+
+	if ((ret = scsisim_vcard_add_ef(card, GSM_FILE_DF_TELECOM, GSM_FILE_EF_SMS,
+					SIM_EF_LINEAR_FIXED, 50 * GSM_SMS_RECORD_LEN,
+					GSM_SMS_RECORD_LEN, buf)) != SCSISIM_SUCCESS)
+		return ret;
+
+	/* Phonebook and messages are protected by CHV1, like on a real card */
+	scsisim_vcard_set_access(card, GSM_FILE_DF_TELECOM, GSM_FILE_EF_ADN, SIM_AC_CHV1, SIM_AC_CHV1);
+	scsisim_vcard_set_access(card, GSM_FILE_DF_TELECOM, GSM_FILE_EF_SMS, SIM_AC_CHV1, SIM_AC_CHV1);
+	scsisim_vcard_set_access(card, GSM_FILE_DF_TELECOM, GSM_FILE_EF_FDN, SIM_AC_CHV1, SIM_AC_CHV2);
+
+	/* DF-GSM */
+	if ((ret = scsisim_vcard_add_df(card, GSM_FILE_MF, GSM_FILE_DF_GSM)) != SCSISIM_SUCCESS ||
+	    (ret = scsisim_vcard_add_ef(card, GSM_FILE_DF_GSM, GSM_FILE_EF_IMSI,
+					SIM_EF_TRANSPARENT, sizeof(vcard_default_imsi),
+					0, vcard_default_imsi)) != SCSISIM_SUCCESS)
+		return ret;
+
+	memset(buf, 0xff, 17);
+	buf[0] = 0x00;	/* Display condition */
+	memcpy(buf + 1, vcard_default_spn, strlen(vcard_default_spn));
+
+	if ((ret = scsisim_vcard_add_ef(card, GSM_FILE_DF_GSM, GSM_FILE_EF_SPN,
+					SIM_EF_TRANSPARENT, 17, 0, buf)) != SCSISIM_SUCCESS)
+		return ret;
+
+	scsisim_vcard_set_access(card, GSM_FILE_DF_GSM, GSM_FILE_EF_IMSI, SIM_AC_CHV1, SIM_AC_ADM);
+
+	return SCSISIM_SUCCESS;
+}
+
+/**
+ * For information about this function, see scsisim.h
+ */
+int scsisim_open_virtual_device(struct scsisim_vcard *card,
+				struct scsisim_dev *device)
+{
+	if (card == NULL || device == NULL || card->attached)
+		return SCSISIM_INVALID_PARAM;
+
+	if ((device->name = malloc(sizeof(VCARD_NAME))) == NULL)
+		return SCSISIM_MEMORY_ALLOCATION_ERROR;
+
+	strcpy(device->name, VCARD_NAME);
+
+	if (cache_create(device) != SCSISIM_SUCCESS)
+	{
+		free(device->name);
+		device->name = NULL;
+		return SCSISIM_MEMORY_ALLOCATION_ERROR;
+	}
+
+	/* The device's file descriptor is a timer that becomes readable 
+	 * when an asynchronous command completes, like an sg device does */
+	if ((card->timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC)) < 0)
+	{
+		free(device->name);
+		device->name = NULL;
+		cache_free(device);
+		return SCSISIM_DEVICE_OPEN_FAILED;
+	}
+
+	device->fd = card->timer_fd;
+	device->index = 0;
+	device->transport = &vcard_transport;
+	device->transport_data = card;
+	device->async = NULL;
+	device->init_state = SCSISIM_INIT_NONE;
+
+	/* Inserting the card resets it: the MF is selected and no CHV has
+	 * been verified yet */
+	card->attached = true;
+	card->cur_df = &card->mf;
+	card->cur_ef = NULL;
+	card->response_len = 0;
+	card->chv[0].verified = false;
+	card->chv[1].verified = false;
+	card->queue_head = 0;
+	card->queue_count = 0;
+
+	if (scsisim_verbose())
+		scsisim_pinfo("%s: virtual device opened, name = %s",
+			      __func__, device->name);
+
+	return SCSISIM_SUCCESS;
+}
+
+/**
+ * Function: vcard_get_vendor_product
+ *
+ * Parameters:
+ * device:	Pointer to scsisim_dev struct.
+ * vendor:	(Output) USB vendor number.
+ * product:	(Output) USB product number.
+ *
+ * Description:
+ * Report the USB vendor and product numbers of the reader the virtual
+ * card pretends to be inserted in.
+ *
+ * Return values:
+ * SCSISIM_SUCCESS
+ */
+static int vcard_get_vendor_product(const struct scsisim_dev *device,
+				    unsigned int *vendor,
+				    unsigned int *product)
+{
+	(void)device;
+
+	*vendor = VCARD_USB_VENDOR;
+	*product = VCARD_USB_PRODUCT;
+
+	return SCSISIM_SUCCESS;
+}
+
+/**
+ * Function: vcard_close
+ *
+ * Parameters:
+ * device:	Pointer to scsisim_dev struct.
+ *
+ * Description:
+ * Detach a virtual card from a device. The card itself is not freed, but
+ * any asynchronous commands that have not been reaped are dropped.
+ *
+ * Return values:
+ * SCSISIM_SUCCESS
+ * SCSISIM_INVALID_FILE_DESCRIPTOR
+ */
+static int vcard_close(struct scsisim_dev *device)
+{
+	struct scsisim_vcard *card = device->transport_data;
+
+	if (card == NULL)
+		return SCSISIM_INVALID_FILE_DESCRIPTOR;
+
+	close(card->timer_fd);
+	card->timer_fd = -1;
+	card->queue_count = 0;
+	card->attached = false;
+
+	return SCSISIM_SUCCESS;
+}
+
+/**
+ * Function: vcard_find_file
+ *
+ * Parameters:
+ * dir:		Directory to start searching from.
+ * id:		ID of the file to find.
+ *
+ * Description:
+ * Depth-first search of the file tree for a file with the given ID.
+ *
+ * Return value:
+ * Pointer to the file, or NULL if not found.
+ */
+static struct vcard_file *vcard_find_file(struct vcard_file *dir, uint16_t id)
+{
+	struct vcard_file *tmp, *found;
+
+	if (dir->id == id)
+		return dir;
+
+	for (tmp = dir->child; tmp != NULL; tmp = tmp->next)
+	{
+		if ((found = vcard_find_file(tmp, id)) != NULL)
+			return found;
+	}
+
+	return NULL;
+}
+
+/**
+ * Function: vcard_free_file
+ *
+ * Parameters:
+ * file:	First file in a list of siblings.
+ *
+ * Description:
+ * Free a list of sibling files and all of their children.
+ *
+ * Return values:
+ * None
+ */
+static void vcard_free_file(struct vcard_file *file)
+{
+	struct vcard_file *next;
+
+	while (file != NULL)
+	{
+		next = file->next;
+		vcard_free_file(file->child);
+		free(file->contents);
+		free(file);
+		file = next;
+	}
+}
+
+/**
+ * Function: vcard_count_children
+ *
+ * Parameters:
+ * dir:		MF or DF.
+ * type:	Type of children to count.
+ *
+ * Description:
+ * Count the children of a given type in a directory.
+ *
+ * Return value:
+ * Number of children.
+ */
+static uint8_t vcard_count_children(const struct vcard_file *dir, uint8_t type)
+{
+	uint8_t count = 0;
+	const struct vcard_file *tmp;
+
+	for (tmp = dir->child; tmp != NULL; tmp = tmp->next)
+	{
+		if (tmp->type == type)
+			count++;
+	}
+
+	return count;
+}
+
+/**
+ * Function: vcard_chv_status
+ *
+ * Parameters:
+ * chv:		Pointer to a CHV.
+ *
+ * Description:
+ * Encode a CHV status byte for an MF/DF response; see GSM spec, 9.2.1
+ *
+ * Return value:
+ * CHV status byte.
+ */
+static uint8_t vcard_chv_status(const struct vcard_chv *chv)
+{
+	return (chv->initialized ? 0x80 : 0x00) | (chv->attempts & 0x0f);
+}
+
+/**
+ * Function: vcard_build_response
+ *
+ * Parameters:
+ * card:	Pointer to virtual SIM card.
+ * file:	File whose response data to build.
+ *
+ * Description:
+ * Build the GET RESPONSE data for a selected file, in the layout that
+ * gsm_parse_response() expects. See GSM spec, 9.2.1
+ *
+ * Return values:
+ * None
+ */
+static void vcard_build_response(struct scsisim_vcard *card,
+				 const struct vcard_file *file)
+{
+	uint8_t *resp = card->response;
+
+	memset(resp, 0, sizeof(card->response));
+
+	resp[4] = file->id >> 8;
+	resp[5] = file->id & 0xff;
+	resp[6] = file->type;
+
+	if (file->type == VCARD_FILE_TYPE_EF)
+	{
+		resp[2] = file->size >> 8;
+		resp[3] = file->size & 0xff;
+		resp[8] = (file->read_ac << 4) | file->update_ac;
+		resp[9] = 0xff;		/* INCREASE: never */
+		resp[10] = 0x44;	/* REHABILITATE / INVALIDATE: ADM */
+		resp[11] = 0x01;	/* Not invalidated */
+		resp[12] = GSM_MIN_EF_RESPONSE_LEN - 13;
+		resp[13] = file->structure;
+		resp[14] = file->record_len;
+		card->response_len = GSM_MIN_EF_RESPONSE_LEN;
+	}
+	else
+	{
+		resp[2] = VCARD_FREE_MEMORY >> 8;
+		resp[3] = VCARD_FREE_MEMORY & 0xff;
+		resp[12] = GSM_MIN_MF_DF_RESPONSE_LEN - 13;
+		resp[13] = card->chv[0].enabled ? 0x00 : 0x80;
+		resp[14] = vcard_count_children(file, VCARD_FILE_TYPE_DF);
+		resp[15] = vcard_count_children(file, VCARD_FILE_TYPE_EF);
+		resp[16] = 2 * VCARD_NUM_CHVS;	/* CHVs and UNBLOCK CHVs */
+		resp[18] = vcard_chv_status(&card->chv[0]);
+		resp[19] = 0x80 | VCARD_UNBLOCK_ATTEMPTS;
+		resp[20] = vcard_chv_status(&card->chv[1]);
+		resp[21] = 0x80 | VCARD_UNBLOCK_ATTEMPTS;
+		card->response_len = GSM_MIN_MF_DF_RESPONSE_LEN;
+	}
+}
+
+/**
+ * Function: vcard_lookup_selectable
+ *
+ * Parameters:
+ * card:	Pointer to virtual SIM card.
+ * id:		ID of the file to select.
+ *
+ * Description:
+ * Find a file that may be selected from the current directory, following
+ * the file selection rules in GSM spec, 6.5: the MF, the current DF, its
+ * parent, its immediate children, and any DF that is an immediate child
+ * of its parent.
+ *
+ * Return value:
+ * Pointer to the file, or NULL if no such file may be selected.
+ */
+static struct vcard_file *vcard_lookup_selectable(struct scsisim_vcard *card,
+						  uint16_t id)
+{
+	struct vcard_file *cur = card->cur_df, *tmp;
+
+	if (id == card->mf.id)
+		return &card->mf;
+
+	if (id == cur->id)
+		return cur;
+
+	for (tmp = cur->child; tmp != NULL; tmp = tmp->next)
+	{
+		if (tmp->id == id)
+			return tmp;
+	}
+
+	if (cur->parent == NULL)
+		return NULL;
+
+	if (id == cur->parent->id)
+		return cur->parent;
+
+	for (tmp = cur->parent->child; tmp != NULL; tmp = tmp->next)
+	{
+		if (tmp->id == id && tmp->type == VCARD_FILE_TYPE_DF)
+			return tmp;
+	}
+
+	return NULL;
+}
+
+/**
+ * Function: vcard_check_access
+ *
+ * Parameters:
+ * card:	Pointer to virtual SIM card.
+ * ac:		Access condition (SIM_AC_* constant).
+ *
+ * Description:
+ * Determine whether an access condition is currently fulfilled.
+ *
+ * Return values:
+ * true - Access granted.
+ * false - Access denied.
+ */
+static bool vcard_check_access(const struct scsisim_vcard *card, uint8_t ac)
+{
+	switch (ac)
+	{
+		case SIM_AC_ALWAYS:
+			return true;
+		case SIM_AC_CHV1:
+			return (card->chv[0].enabled == false || card->chv[0].verified);
+		case SIM_AC_CHV2:
+			return card->chv[1].verified;
+		default:
+			return false;
+	}
+}
+
+/**
+ * Function: vcard_record_offset
+ *
+ * Parameters:
+ * ef:		Currently selected EF.
+ * recno:	Record number from P1.
+ * mode:	Record mode from P2: 02 = next, 03 = previous, 04 = absolute.
+ * offset:	(Output) Offset of the record in the EF contents.
+ *
+ * Description:
+ * Resolve the record addressed by a READ RECORD or UPDATE RECORD command
+ * and move the record pointer to it. See GSM spec, 8.5
+ *
+ * Return values:
+ * GSM status word (0x9000 if the record exists)
+ */
+static uint16_t vcard_record_offset(struct vcard_file *ef,
+				    uint8_t recno,
+				    uint8_t mode,
+				    unsigned int *offset)
+{
+	unsigned int num_records = ef->size / ef->record_len;
+
+	switch (mode)
+	{
+		case 0x02:	/* Next record */
+			recno = ef->record_ptr + 1;
+			if (recno > num_records)
+			{
+				if (ef->structure != SIM_EF_CYCLIC)
+					return 0x9402;
+				recno = 1;
+			}
+			break;
+		case 0x03:	/* Previous record */
+			if (ef->record_ptr <= 1)
+			{
+				if (ef->structure != SIM_EF_CYCLIC || ef->record_ptr == 0)
+					return 0x9402;
+				recno = num_records;
+			}
+			else
+				recno = ef->record_ptr - 1;
+			break;
+		case 0x04:	/* Absolute */
+			break;
+		default:
+			return 0x6b00;
+	}
+
+	if (recno == 0 || recno > num_records)
+		return 0x9402;
+
+	ef->record_ptr = recno;
+	*offset = (recno - 1) * ef->record_len;
+
+	return 0x9000;
+}
+
+/**
+ * Function: vcard_seek
+ *
+ * Parameters:
+ * ef:		Currently selected EF.
+ * mode:	SEEK mode from the low nibble of P2.
+ * pattern:	Pattern to look for.
+ * len:		Length of pattern.
+ *
+ * Description:
+ * Look for the first record, in the direction given by mode, that starts
+ * with the pattern, and move the record pointer to it. The record 
+ * pointer is left alone if nothing matches. See GSM spec, 8.7
+ *
+ * Return values:
+ * Number of the matching record
+ * 0 if no record matches
+ */
+static uint8_t vcard_seek(struct vcard_file *ef,
+			  uint8_t mode,
+			  const uint8_t *pattern,
+			  uint8_t len)
+{
+	int num_records = ef->size / ef->record_len;
+	int recno, step;
+
+	switch (mode)
+	{
+		case SIM_SEEK_FROM_START:
+			recno = 1;
+			step = 1;
+			break;
+		case SIM_SEEK_FROM_END:
+			recno = num_records;
+			step = -1;
+			break;
+		case SIM_SEEK_NEXT:
+			recno = ef->record_ptr + 1;
+			step = 1;
+			break;
+		default:	/* SIM_SEEK_PREVIOUS */
+			recno = ef->record_ptr ? ef->record_ptr - 1 : num_records;
+			step = -1;
+			break;
+	}
+
+	for (; recno >= 1 && recno <= num_records; recno += step)
+	{
+		if (memcmp(ef->contents + (recno - 1) * ef->record_len, pattern, len) == 0)
+		{
+			ef->record_ptr = recno;
+			return recno;
+		}
+	}
+
+	return 0;
+}
+
+/**
+ * Function: vcard_execute
+ *
+ * Parameters:
+ * card:	Pointer to virtual SIM card.
+ * ins:		GSM instruction code.
+ * P1, P2, P3:	GSM command parameters.
+ * data:	Command or response data buffer.
+ * data_len:	Length of data buffer.
+ * data_xfered:	(Output) Number of response bytes written to data.
+ *
+ * Description:
+ * Execute one GSM command on the virtual card. See GSM spec, section 9.
+ *
+ * Return value:
+ * GSM status word (SW1 in high byte, SW2 in low byte)
+ */
+static uint16_t vcard_execute(struct scsisim_vcard *card,
+			      uint8_t ins,
+			      uint8_t P1,
+			      uint8_t P2,
+			      uint8_t P3,
+			      uint8_t *data,
+			      unsigned int data_len,
+			      unsigned int *data_xfered)
+{
+	uint16_t sw, file_id;
+	unsigned int offset, len;
+	struct vcard_file *ef = card->cur_ef, *file;
+	struct vcard_chv *chv;
+
+	*data_xfered = 0;
+
+	switch (ins)
+	{
+		case GSM_CMD_SELECT:
+			if (data_len < GSM_CMD_SELECT_DATA_LEN)
+				return 0x6700;
+
+			file_id = (data[0] << 8) | data[1];
+
+			if ((file = vcard_lookup_selectable(card, file_id)) == NULL)
+				return 0x9404;
+
+			if (file->type == VCARD_FILE_TYPE_EF)
+			{
+				card->cur_ef = file;
+				file->record_ptr = 0;
+			}
+			else
+			{
+				card->cur_df = file;
+				card->cur_ef = NULL;
+			}
+
+			vcard_build_response(card, file);
+			return 0x9f00 | card->response_len;
+
+		case GSM_CMD_STATUS:
+			vcard_build_response(card, card->cur_df);
+			/* Fall through */
+		case GSM_CMD_GET_RESPONSE:
+			if (card->response_len == 0)
+				return 0x6f00;
+
+			len = MIN(MIN(P3, card->response_len), data_len);
+			memcpy(data, card->response, len);
+			*data_xfered = len;
+			return 0x9000;
+
+		case GSM_CMD_READ_BINARY:
+		case GSM_CMD_UPDATE_BINARY:
+			if (ef == NULL)
+				return 0x9400;
+
+			if (ef->structure != SIM_EF_TRANSPARENT)
+				return 0x9408;
+
+			if (vcard_check_access(card, (ins == GSM_CMD_READ_BINARY) ? ef->read_ac : ef->update_ac) == false)
+				return 0x9804;
+
+			offset = (P1 << 8) | P2;
+
+			if (offset >= ef->size)
+				return 0x6b00;
+
+			if (P3 == 0 || offset + P3 > ef->size || P3 > data_len)
+				return 0x6700 | MIN(ef->size - offset, 0xffu);
+
+			if (ins == GSM_CMD_READ_BINARY)
+			{
+				memcpy(data, ef->contents + offset, P3);
+				*data_xfered = P3;
+			}
+			else
+				memcpy(ef->contents + offset, data, P3);
+
+			return 0x9000;
+
+		case GSM_CMD_READ_RECORD:
+		case GSM_CMD_UPDATE_RECORD:
+			if (ef == NULL)
+				return 0x9400;
+
+			if (ef->structure == SIM_EF_TRANSPARENT)
+				return 0x9408;
+
+			if (vcard_check_access(card, (ins == GSM_CMD_READ_RECORD) ? ef->read_ac : ef->update_ac) == false)
+				return 0x9804;
+
+			if (P3 != ef->record_len || P3 > data_len)
+				return 0x6700 | ef->record_len;
+
+			if ((sw = vcard_record_offset(ef, P1, P2, &offset)) != 0x9000)
+				return sw;
+
+			if (ins == GSM_CMD_READ_RECORD)
+			{
+				memcpy(data, ef->contents + offset, P3);
+				*data_xfered = P3;
+			}
+			else
+				memcpy(ef->contents + offset, data, P3);
+
+			return 0x9000;
+
+		case GSM_CMD_SEEK:
+			if (ef == NULL)
+				return 0x9400;
+
+			if (ef->structure == SIM_EF_TRANSPARENT)
+				return 0x9408;
+
+			if (vcard_check_access(card, ef->read_ac) == false)
+				return 0x9804;
+
+			if ((P2 & 0xf0) > SIM_SEEK_TYPE_2 || (P2 & 0x0f) > SIM_SEEK_PREVIOUS)
+				return 0x6b00;
+
+			if (P3 == 0 || P3 > ef->record_len || P3 > data_len)
+				return 0x6700 | ef->record_len;
+
+			if ((len = vcard_seek(ef, P2 & 0x0f, data, P3)) == 0)
+				return 0x9404;
+
+			if ((P2 & 0xf0) == SIM_SEEK_TYPE_1)
+				return 0x9000;
+
+			/* Type 2: the record number is fetched with GET RESPONSE */
+			card->response[0] = len;
+			card->response_len = 1;
+			return 0x9f01;
+
+		case GSM_CMD_VERIFY_CHV:
+			if (P2 < 1 || P2 > VCARD_NUM_CHVS)
+				return 0x6b00;
+
+			if (P3 != GSM_CMD_VERIFY_CHV_DATA_LEN || data_len < GSM_CMD_VERIFY_CHV_DATA_LEN)
+				return 0x6700 | GSM_CMD_VERIFY_CHV_DATA_LEN;
+
+			chv = &card->chv[P2 - 1];
+
+			if (chv->initialized == false)
+				return 0x9802;
+
+			if (chv->enabled == false)
+				return 0x9808;
+
+			if (chv->attempts == 0)
+				return 0x9840;
+
+			if (memcmp(chv->pin, data, GSM_CMD_VERIFY_CHV_DATA_LEN) != 0)
+			{
+				chv->verified = false;
+				return (--chv->attempts == 0) ? 0x9840 : 0x9804;
+			}
+
+			chv->verified = true;
+			chv->attempts = chv->max_attempts;
+			return 0x9000;
+
+		default:
+			return 0x6d00;
+	}
+}
+
+/**
+ * Function: vcard_is_gsm_cdb
+ *
+ * Parameters:
+ * device:	Pointer to scsisim_dev struct.
+ * cdb:		SCSI CDB.
+ *
+ * Description:
+ * Determine whether a CDB carries a GSM command, i.e., whether it matches
+ * the device's raw command template everywhere except in the direction,
+ * command, and parameter bytes. Anything else is a reader-level command,
+ * such as the initialization commands in device.h.
+ *
+ * Return values:
+ * true - The CDB carries a GSM command.
+ * false - The CDB is a reader-level command.
+ */
+static bool vcard_is_gsm_cdb(const struct scsisim_dev *device, const uint8_t *cdb)
+{
+	const struct device *dev = &sim_devices[device->index];
+	unsigned int i;
+
+	for (i = 0; i < dev->cdb_len; i++)
+	{
+		if (i == dev->raw_cmd_direction_offset || i == dev->raw_cmd_gsm_cmd_offset ||
+		    i == dev->raw_cmd_p1_offset || i == dev->raw_cmd_p2_offset ||
+		    i == dev->raw_cmd_p3_offset)
+			continue;
+
+		if (cdb[i] != dev->CDB_raw_cmd[i])
+			return false;
+	}
+
+	return true;
+}
+
+/**
+ * Function: vcard_process_cdb
+ *
+ * Parameters:
+ * device:	Pointer to scsisim_dev struct.
+ * my_cmd:	Pointer to scsi_cmd struct.
+ *
+ * Description:
+ * Execute a SCSI command on the virtual card, as the reader would. GSM
+ * commands are decoded from the CDB using the device definitions in
+ * device.h, and any status word other than 90 00 is reported as fixed
+ * format sense data with SW1 in the ASC and SW2 in the ASCQ, just like
+ * the real reader does. Reader-level commands complete without data.
+ *
+ * Return values:
+ * SCSISIM_SUCCESS
+ * SCSISIM_SCSI_SEND_ERROR
+ */
+static int vcard_process_cdb(const struct scsisim_dev *device, struct scsi_cmd *my_cmd)
+{
+	const struct device *dev = &sim_devices[device->index];
+	struct scsisim_vcard *card = device->transport_data;
+	unsigned int sense_len;
+	uint16_t sw = 0x9000;
+
+	if (card == NULL || my_cmd->cdb_len != dev->cdb_len)
+		return SCSISIM_SCSI_SEND_ERROR;
+
+	card->commands++;
+
+	if (card->reader_ready && vcard_is_gsm_cdb(device, my_cmd->cdb))
+	{
+		sw = vcard_execute(card,
+				   my_cmd->cdb[dev->raw_cmd_gsm_cmd_offset],
+				   my_cmd->cdb[dev->raw_cmd_p1_offset],
+				   my_cmd->cdb[dev->raw_cmd_p2_offset],
+				   my_cmd->cdb[dev->raw_cmd_p3_offset],
+				   my_cmd->data,
+				   my_cmd->data_len,
+				   &my_cmd->data_xfered);
+
+		if (my_cmd->direction == SIM_WRITE && (sw == 0x9000 || (sw >> 8) == 0x9f))
+			my_cmd->data_xfered = my_cmd->data_len;
+	}
+	else
+	{
+		/* Reader-level command, or any command to a reader that is
+		 * not initialized: accept it and transfer nothing meaningful */
+		if (my_cmd->direction == SIM_READ && my_cmd->data != NULL)
+			memset(my_cmd->data, 0, my_cmd->data_len);
+
+		my_cmd->data_xfered = my_cmd->data_len;
+
+		/* The reader is ready once it has seen as many commands as 
+		 * the initialization sequence has */
+		if (card->reader_ready == false && vcard_is_gsm_cdb(device, my_cmd->cdb) == false &&
+		    dev->init_cmd[++card->init_cmds].direction == SIM_NO_XFER)
+			card->reader_ready = true;
+	}
+
+	if (sw != 0x9000 && my_cmd->sense != NULL)
+	{
+		sense_len = MIN(dev->sense_len, my_cmd->sense_len);
+
+		if (sense_len > dev->sense_ascq_offset)
+		{
+			memset(my_cmd->sense, 0, sense_len);
+			my_cmd->sense[dev->sense_type_offset] = 0x70;
+			my_cmd->sense[dev->sense_asc_offset] = sw >> 8;
+			my_cmd->sense[dev->sense_ascq_offset] = sw & 0xff;
+			my_cmd->sense_xfered = sense_len;
+		}
+	}
+
+	return SCSISIM_SUCCESS;
+}
+
+/**
+ * Function: vcard_send_cdb
+ *
+ * Parameters:
+ * device:	Pointer to scsisim_dev struct.
+ * my_cmd:	Pointer to scsi_cmd struct.
+ *
+ * Description:
+ * Execute a SCSI command on the virtual card and sleep for the simulated
+ * per-command latency, like a blocking SG_IO ioctl() would.
+ *
+ * Return values:
+ * SCSISIM_SUCCESS
+ * SCSISIM_SCSI_SEND_ERROR
+ */
+static int vcard_send_cdb(const struct scsisim_dev *device, struct scsi_cmd *my_cmd)
+{
+	struct scsisim_vcard *card = device->transport_data;
+	struct timespec delay;
+	int ret;
+
+	if ((ret = vcard_process_cdb(device, my_cmd)) != SCSISIM_SUCCESS)
+		return ret;
+
+	if (card->latency)
+	{
+		delay.tv_sec = card->latency / 1000000;
+		delay.tv_nsec = (card->latency % 1000000) * 1000L;
+
+		while (nanosleep(&delay, &delay) != 0)
+			;
+	}
+
+	return SCSISIM_SUCCESS;
+}
+
+/**
+ * Function: vcard_arm_timer
+ *
+ * Parameters:
+ * card:	Pointer to virtual SIM card.
+ *
+ * Description:
+ * Arm the card's timer to expire when the oldest queued command is due,
+ * or disarm it if the queue is empty.
+ *
+ * Return values:
+ * None
+ */
+static void vcard_arm_timer(struct scsisim_vcard *card)
+{
+	struct itimerspec its = { { 0, 0 }, { 0, 0 } };
+	uint64_t expirations;
+
+	/* Clear any pending expiration first */
+	if (read(card->timer_fd, &expirations, sizeof(expirations)) < 0)
+		expirations = 0;
+
+	if (card->queue_count)
+		its.it_value = card->queue[card->queue_head].due;
+
+	timerfd_settime(card->timer_fd, TFD_TIMER_ABSTIME, &its, NULL);
+}
+
+/**
+ * Function: vcard_submit_cdb
+ *
+ * Parameters:
+ * device:	Pointer to scsisim_dev struct.
+ * my_cmd:	Pointer to scsi_cmd struct.
+ *
+ * Description:
+ * Execute a SCSI command on the virtual card right away, but hold the 
+ * result back until the simulated latency has passed. Like a real reader,
+ * the card works on one command at a time, so a command queued behind 
+ * others completes one latency period after the previous one.
+ *
+ * Return values:
+ * SCSISIM_SUCCESS
+ * SCSISIM_SCSI_SEND_ERROR
+ */
+static int vcard_submit_cdb(const struct scsisim_dev *device, struct scsi_cmd *my_cmd)
+{
+	struct scsisim_vcard *card = device->transport_data;
+	struct vcard_queued *entry;
+	struct timespec now;
+	int ret;
+
+	if (card == NULL || card->queue_count == SCSISIM_MAX_PENDING)
+		return SCSISIM_SCSI_SEND_ERROR;
+
+	if ((ret = vcard_process_cdb(device, my_cmd)) != SCSISIM_SUCCESS)
+		return ret;
+
+	entry = &card->queue[(card->queue_head + card->queue_count) % SCSISIM_MAX_PENDING];
+	entry->cmd = my_cmd;
+
+	/* Start from now, or from when the previous command completes */
+	clock_gettime(CLOCK_MONOTONIC, &now);
+
+	if (card->queue_count == 0 ||
+	    now.tv_sec > card->last_due.tv_sec ||
+	    (now.tv_sec == card->last_due.tv_sec && now.tv_nsec > card->last_due.tv_nsec))
+		entry->due = now;
+	else
+		entry->due = card->last_due;
+
+	entry->due.tv_sec += card->latency / 1000000;
+	entry->due.tv_nsec += (card->latency % 1000000) * 1000L;
+
+	if (entry->due.tv_nsec >= 1000000000L)
+	{
+		entry->due.tv_sec++;
+		entry->due.tv_nsec -= 1000000000L;
+	}
+
+	card->last_due = entry->due;
+
+	if (card->queue_count++ == 0)
+		vcard_arm_timer(card);
+
+	return SCSISIM_SUCCESS;
+}
+
+/**
+ * Function: vcard_reap_cdb
+ *
+ * Parameters:
+ * device:	Pointer to scsisim_dev struct.
+ * my_cmd:	(Output) Pointer to the completed scsi_cmd struct.
+ * timeout:	Time to wait in milliseconds (-1 = forever, 0 = don't wait).
+ *
+ * Description:
+ * Wait for the oldest queued command to become due and hand it back.
+ *
+ * Return values:
+ * SCSISIM_SUCCESS
+ * SCSISIM_TIMEOUT
+ * SCSISIM_SCSI_RECEIVE_ERROR
+ */
+static int vcard_reap_cdb(const struct scsisim_dev *device,
+			  struct scsi_cmd **my_cmd,
+			  int timeout)
+{
+	struct scsisim_vcard *card = device->transport_data;
+	struct vcard_queued *entry;
+	struct pollfd pfd;
+	struct timespec now;
+	int ret;
+
+	if (card == NULL || card->queue_count == 0)
+		return SCSISIM_SCSI_RECEIVE_ERROR;
+
+	entry = &card->queue[card->queue_head];
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+
+	if (now.tv_sec < entry->due.tv_sec ||
+	    (now.tv_sec == entry->due.tv_sec && now.tv_nsec < entry->due.tv_nsec))
+	{
+		/* Not due yet: wait for the timer */
+		pfd.fd = card->timer_fd;
+		pfd.events = POLLIN;
+
+		if ((ret = poll(&pfd, 1, timeout)) == 0)
+			return SCSISIM_TIMEOUT;
+
+		if (ret < 0)
+			return SCSISIM_SCSI_RECEIVE_ERROR;
+	}
+
+	*my_cmd = entry->cmd;
+
+	card->queue_head = (card->queue_head + 1) % SCSISIM_MAX_PENDING;
+	card->queue_count--;
+
+	vcard_arm_timer(card);
+
+	return SCSISIM_SUCCESS;
+}
+
+/* EOF */
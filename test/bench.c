@@ -0,0 +1,303 @@
+/*
+ *  bench.c
+ *  Time the text and SMS decoding paths, with the scalar septet
+ *  unpacking loop the library used to have for comparison.
+ *
+ *  Copyright (c) 2017, Chris Coffey <kpuc@sdf.org>
+ *
+ *  Permission to use, copy, modify, and/or distribute this software
+ *  for any purpose with or without fee is hereby granted, provided
+ *  that the above copyright notice and this permission notice appear
+ *  in all copies.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL
+ *  WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED
+ *  WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE
+ *  AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL
+ *  DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE, DATA
+ *  OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER
+ *  TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ *  PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+
+#include "scsisim.h"
+#include "gsm.h"
+
+#define BENCH_ITERATIONS	200000	/* Default calls per benchmark */
+#define BENCH_SEPTETS		160	/* A full single SMS */
+
+/* A benchmark: one call of the code to time */
+struct bench {
+	const char *name;
+	void (*run)(void);
+};
+
+static uint8_t packed[BENCH_SEPTETS * 7 / 8];
+static uint8_t septets[BENCH_SEPTETS];
+static uint8_t bcd[10];			/* An ICCID */
+static uint8_t ucs2[140];		/* 70 characters: a full UCS-2 SMS */
+static char text[SCSISIM_SMS_MAX_TEXT_LEN];
+static uint8_t sms_deliver[GSM_SMS_RECORD_LEN];
+static uint8_t sms_deliver_ucs2[GSM_SMS_RECORD_LEN];
+static uint8_t sms_submit[GSM_SMS_RECORD_LEN];
+static uint8_t sms_status_report[GSM_SMS_RECORD_LEN];
+static uint8_t sms_command[GSM_SMS_RECORD_LEN];
+static volatile unsigned int sink;
+
+/* A received SMS-STATUS-REPORT with all optional fields and some text */
+static const uint8_t status_report[] = {
+	0x01,						/* Status: read */
+	0x07, 0x91, 0x44, 0x77, 0x00, 0x09, 0x00, 0xf9,	/* SMSC */
+	0x26,						/* TP-MTI, TP-MMS, TP-SRQ */
+	0x42,						/* TP-MR */
+	0x0c, 0x91, 0x44, 0x77, 0x00, 0x09, 0x10, 0x32,	/* TP-RA */
+	0x42, 0x50, 0x10, 0x21, 0x03, 0x54, 0x80,	/* TP-SCTS */
+	0x42, 0x50, 0x10, 0x21, 0x13, 0x25, 0x80,	/* TP-DT */
+	0x00,						/* TP-ST: delivered */
+	0x07,						/* TP-PI */
+	0x00,						/* TP-PID */
+	0x00,						/* TP-DCS */
+	0x04, 0xc4, 0xb7, 0xbb, 0x0c			/* TP-UDL, TP-UD: "Done" */
+};
+
+/* A sent SMS-COMMAND */
+static const uint8_t command[] = {
+	0x05,						/* Status: sent */
+	0x07, 0x91, 0x44, 0x77, 0x00, 0x09, 0x00, 0xf9,	/* SMSC */
+	0x02,						/* TP-MTI */
+	0x43,						/* TP-MR */
+	0x00,						/* TP-PID */
+	0x02,						/* TP-CT: delete */
+	0x07,						/* TP-MN */
+	0x0c, 0x91, 0x44, 0x77, 0x00, 0x09, 0x10, 0x32,	/* TP-DA */
+	0x00						/* TP-CDL */
+};
+
+/* Internal functions */
+static void setup(void);
+static void scalar_unpack_septets(void);
+static void lib_unpack_septets(void);
+static void lib_pack_septets(void);
+static void lib_map_gsm_chars(void);
+static void lib_bcd_to_ascii(void);
+static void lib_ucs2_to_utf8(void);
+static void decode_deliver(void);
+static void decode_deliver_ucs2(void);
+static void decode_submit(void);
+static void decode_status_report(void);
+static void decode_command(void);
+
+static const struct bench benches[] = {
+	{ "unpack 160 septets, scalar loop", scalar_unpack_septets },
+	{ "scsisim_unpack_septets_buf, 160 septets", lib_unpack_septets },
+	{ "scsisim_pack_septets_buf, 160 septets", lib_pack_septets },
+	{ "scsisim_map_gsm_chars_buf, 160 chars", lib_map_gsm_chars },
+	{ "scsisim_packed_bcd_to_ascii_buf, ICCID", lib_bcd_to_ascii },
+	{ "scsisim_ucs2_to_utf8, 70 chars", lib_ucs2_to_utf8 },
+	{ "scsisim_decode_sms, SMS-DELIVER (GSM)", decode_deliver },
+	{ "scsisim_decode_sms, SMS-DELIVER (UCS-2)", decode_deliver_ucs2 },
+	{ "scsisim_decode_sms, SMS-SUBMIT", decode_submit },
+	{ "scsisim_decode_sms, SMS-STATUS-REPORT", decode_status_report },
+	{ "scsisim_decode_sms, SMS-COMMAND", decode_command }
+};
+
+
+/**
+ * Function: main
+ *
+ * Description: Run every benchmark, optionally for the number of calls
+ * given on the command line, and print the time per call. The library
+ * and this program are built with the same flags, so the scalar loop is
+ * a fair baseline for the unpacking kernels.
+ */
+int main(int argc, char *argv[])
+{
+	unsigned int i, n, iterations = BENCH_ITERATIONS;
+	struct timespec start, end;
+	double ns;
+
+	if (argc > 1 && (iterations = strtoul(argv[1], NULL, 10)) == 0)
+	{
+		fprintf(stderr, "Usage: %s [iterations]\n", argv[0]);
+		return EXIT_FAILURE;
+	}
+
+	setup();
+
+	for (i = 0; i < sizeof(benches) / sizeof(benches[0]); i++)
+	{
+		/* Warm up the caches and the branch predictor */
+		for (n = 0; n < iterations / 10; n++)
+			benches[i].run();
+
+		clock_gettime(CLOCK_MONOTONIC, &start);
+
+		for (n = 0; n < iterations; n++)
+			benches[i].run();
+
+		clock_gettime(CLOCK_MONOTONIC, &end);
+
+		ns = ((end.tv_sec - start.tv_sec) * 1e9 + (end.tv_nsec - start.tv_nsec)) / iterations;
+		printf("%-45s %10.1f ns\n", benches[i].name, ns);
+	}
+
+	return EXIT_SUCCESS;
+}
+
+/**
+ * Function: setup
+ *
+ * Description: Build the input of every benchmark, and check the SMS
+ * records decode.
+ */
+static void setup(void)
+{
+	unsigned int i;
+	struct scsisim_sms sms;
+	static const char gsm_text[] =
+		"The quick brown fox jumps over the lazy dog, then naps in the sun "
+		"for a while; later on it wakes up, eats, and runs off into the wood "
+		"again. The end (really) 12345";
+	static const char ucs2_text[] =
+		"Привет! Это сообщение в кодировке UCS-2, оно занимает всю запись SMS!";
+
+	for (i = 0; i < sizeof(septets); i++)
+		septets[i] = gsm_text[i % (sizeof(gsm_text) - 1)];
+
+	scsisim_pack_septets_buf(BENCH_SEPTETS, septets, packed, sizeof(packed));
+
+	for (i = 0; i < sizeof(bcd); i++)
+		bcd[i] = 0x98 - i;
+
+	scsisim_utf8_to_ucs2(ucs2_text, strlen(ucs2_text), ucs2, sizeof(ucs2));
+
+	memset(&sms, 0, sizeof(sms));
+	sms.status = SIM_SMS_READ;
+	strcpy(sms.smsc, "+447700900009");
+	strcpy(sms.address, "+447700900123");
+	sms.has_timestamp = true;
+
+	if (scsisim_encode_sms(&sms, gsm_text, BENCH_SEPTETS, sms_deliver, sizeof(sms_deliver)) != 1 ||
+	    scsisim_encode_sms(&sms, ucs2_text, strlen(ucs2_text),
+			       sms_deliver_ucs2, sizeof(sms_deliver_ucs2)) != 1)
+		exit(EXIT_FAILURE);
+
+	sms.status = SIM_SMS_SENT;
+	sms.message_ref = 0x42;
+
+	if (scsisim_encode_sms(&sms, gsm_text, 100, sms_submit, sizeof(sms_submit)) != 1)
+		exit(EXIT_FAILURE);
+
+	memset(sms_status_report, 0xff, sizeof(sms_status_report));
+	memcpy(sms_status_report, status_report, sizeof(status_report));
+	memset(sms_command, 0xff, sizeof(sms_command));
+	memcpy(sms_command, command, sizeof(command));
+
+	/* Time decoding, not failing to decode */
+	if (scsisim_decode_sms(sms_deliver, sizeof(sms_deliver), &sms, text, sizeof(text)) != SCSISIM_SUCCESS ||
+	    scsisim_decode_sms(sms_deliver_ucs2, sizeof(sms_deliver_ucs2), &sms, text, sizeof(text)) != SCSISIM_SUCCESS ||
+	    scsisim_decode_sms(sms_submit, sizeof(sms_submit), &sms, text, sizeof(text)) != SCSISIM_SUCCESS ||
+	    scsisim_decode_sms(sms_status_report, sizeof(sms_status_report), &sms, text, sizeof(text)) != SCSISIM_SUCCESS ||
+	    scsisim_decode_sms(sms_command, sizeof(sms_command), &sms, text, sizeof(text)) != SCSISIM_SUCCESS)
+		exit(EXIT_FAILURE);
+}
+
+/**
+ * Function: scalar_unpack_septets
+ *
+ * Description: The byte-at-a-time loop scsisim_unpack_septets() used
+ * before it had SIMD kernels, without the malloc.
+ */
+static void scalar_unpack_septets(void)
+{
+	unsigned int i, cur_pos;
+	uint8_t tmp, *ptr = septets;
+
+	for (i = 0; i < sizeof(packed); i++)
+	{
+		cur_pos = i % 7;
+		tmp = packed[i];
+
+		if (cur_pos > 0)
+		{
+			tmp <<= cur_pos;
+			tmp |= packed[i - 1] >> (8 - cur_pos);
+		}
+
+		*ptr++ = tmp & 0x7f;
+
+		if (cur_pos == 6)
+			*ptr++ = packed[i] >> 1;
+	}
+
+	sink = septets[BENCH_SEPTETS - 1];
+}
+
+/* The other benchmarks: one call of a library function each */
+static void lib_unpack_septets(void)
+{
+	sink = scsisim_unpack_septets_buf(BENCH_SEPTETS, packed, sizeof(packed), septets, sizeof(septets));
+}
+
+static void lib_pack_septets(void)
+{
+	sink = scsisim_pack_septets_buf(BENCH_SEPTETS, septets, packed, sizeof(packed));
+}
+
+static void lib_map_gsm_chars(void)
+{
+	sink = scsisim_map_gsm_chars_buf(septets, sizeof(septets), text, sizeof(text));
+}
+
+static void lib_bcd_to_ascii(void)
+{
+	sink = scsisim_packed_bcd_to_ascii_buf(bcd, sizeof(bcd), true, true, false, text, sizeof(text));
+}
+
+static void lib_ucs2_to_utf8(void)
+{
+	sink = scsisim_ucs2_to_utf8(ucs2, sizeof(ucs2), text, sizeof(text));
+}
+
+static void decode_deliver(void)
+{
+	struct scsisim_sms sms;
+
+	sink = scsisim_decode_sms(sms_deliver, sizeof(sms_deliver), &sms, text, sizeof(text));
+}
+
+static void decode_deliver_ucs2(void)
+{
+	struct scsisim_sms sms;
+
+	sink = scsisim_decode_sms(sms_deliver_ucs2, sizeof(sms_deliver_ucs2), &sms, text, sizeof(text));
+}
+
+static void decode_submit(void)
+{
+	struct scsisim_sms sms;
+
+	sink = scsisim_decode_sms(sms_submit, sizeof(sms_submit), &sms, text, sizeof(text));
+}
+
+static void decode_status_report(void)
+{
+	struct scsisim_sms sms;
+
+	sink = scsisim_decode_sms(sms_status_report, sizeof(sms_status_report), &sms, text, sizeof(text));
+}
+
+static void decode_command(void)
+{
+	struct scsisim_sms sms;
+
+	sink = scsisim_decode_sms(sms_command, sizeof(sms_command), &sms, text, sizeof(text));
+}
+
+/* EOF */
@@ -0,0 +1,526 @@
+/*
+ *  test_encode.c
+ *  Round-trip the encoders through the decoders they invert: GSM 7-bit
+ *  text; the addresses and time stamps of SMS records; SMS records
+ *  stored on a virtual card; and the names and numbers of contacts.
+ *
+ *  Copyright (c) 2017, Chris Coffey <kpuc@sdf.org>
+ *
+ *  Permission to use, copy, modify, and/or distribute this software
+ *  for any purpose with or without fee is hereby granted, provided
+ *  that the above copyright notice and this permission notice appear
+ *  in all copies.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL
+ *  WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED
+ *  WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE
+ *  AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL
+ *  DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE, DATA
+ *  OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER
+ *  TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ *  PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdbool.h>
+
+#include "scsisim.h"
+#include "gsm.h"
+
+/* The characters of the extension table: see GSM 03.38, 6.2.1.1 */
+static const uint8_t gsm_extension[] = { 0x0a, 0x14, 0x28, 0x29, 0x2f, 0x3c, 0x3d, 0x3e, 0x40, 0x65 };
+
+static unsigned int failures;
+
+/* Internal functions */
+static void check(bool ok, const char *what, unsigned int arg);
+static void test_gsm_chars(void);
+static void test_gsm_text(void);
+static void test_sms_fields(void);
+static void test_store_sms(void);
+static void test_adn_names(void);
+static void test_adn_numbers(void);
+
+
+/**
+ * Function: main
+ *
+ * Description: Run each round trip.
+ */
+int main(void)
+{
+	test_gsm_chars();
+	test_gsm_text();
+	test_sms_fields();
+	test_store_sms();
+	test_adn_names();
+	test_adn_numbers();
+
+	if (failures > 0)
+	{
+		printf("test_encode: %u failures\n", failures);
+		return EXIT_FAILURE;
+	}
+
+	printf("test_encode: all passed\n");
+
+	return EXIT_SUCCESS;
+}
+
+/**
+ * Function: check
+ *
+ * Parameters:
+ * ok:		Whether the check passed.
+ * what:	What was checked.
+ * arg:		What the check was run for: a character code or a length.
+ *
+ * Description: Count and report a failed check.
+ */
+static void check(bool ok, const char *what, unsigned int arg)
+{
+	if (ok)
+		return;
+
+	failures++;
+	printf("FAIL: %s (0x%02x)\n", what, arg);
+}
+
+/**
+ * Function: test_gsm_chars
+ *
+ * Description: Every character of the default alphabet and of its
+ * extension table must encode back to the code it decodes from.
+ */
+static void test_gsm_chars(void)
+{
+	uint8_t code[2], encoded[4];
+	char utf8[8];
+	unsigned int i, septets, segments;
+	int len, ret;
+
+	for (i = 0; i < 128 + sizeof(gsm_extension); i++)
+	{
+		/* The escape character on its own is not a character */
+		if (i == GSM_ESCAPE_CHAR)
+			continue;
+
+		if (i < 128)
+		{
+			code[0] = i;
+			len = 1;
+		}
+		else
+		{
+			code[0] = GSM_ESCAPE_CHAR;
+			code[1] = gsm_extension[i - 128];
+			len = 2;
+		}
+
+		ret = scsisim_map_gsm_chars_buf(code, len, utf8, sizeof(utf8));
+		check(ret > 0, "character decodes", i);
+
+		if (ret <= 0)
+			continue;
+
+		check(scsisim_encode_gsm_chars(utf8, ret, encoded, sizeof(encoded)) == len &&
+		      memcmp(encoded, code, len) == 0,
+		      "character encodes back", i);
+		check(scsisim_gsm_septet_count(utf8, ret, 0, &septets, &segments) == SCSISIM_SUCCESS &&
+		      septets == (unsigned int)len && segments == 1,
+		      "character counted", i);
+	}
+
+	/* Not in the GSM alphabet at all */
+	check(scsisim_encode_gsm_chars("\xd0\x94", 2, encoded, sizeof(encoded)) == SCSISIM_GSM_INVALID_CHAR,
+	      "Cyrillic letter", 0x0414);
+	check(scsisim_encode_gsm_chars("\xe2\x82", 2, encoded, sizeof(encoded)) == SCSISIM_GSM_INVALID_CHAR,
+	      "truncated UTF-8", 0x20ac);
+}
+
+/**
+ * Function: test_gsm_text
+ *
+ * Description: Text growing a piece at a time to over two messages, mixing
+ * ASCII runs (for the SIMD paths) with accented and extension
+ * characters, must come back the same after encoding, packing,
+ * unpacking and decoding; and the encoder must write exactly as many
+ * septets as scsisim_gsm_septet_count() says.
+ */
+static void test_gsm_text(void)
+{
+	static const char *pieces[] = { "Hello, world! ", "\xc3\xa9t\xc3\xa9 ", "[\xe2\x82\xac" "5] ", "@{}~\n" };
+	char text[400], decoded[800];
+	uint8_t septets[2 * sizeof(text)], packed[2 * sizeof(text)], unpacked[2 * sizeof(text)];
+	unsigned int len = 0, count, segments, i;
+	int ret;
+
+	for (i = 0; len + strlen(pieces[i % 4]) < sizeof(text); i++)
+	{
+		memcpy(text + len, pieces[i % 4], strlen(pieces[i % 4]));
+		len += strlen(pieces[i % 4]);
+
+		ret = scsisim_encode_gsm_chars(text, len, septets, sizeof(septets));
+		check(ret > 0, "text encodes", len);
+
+		if (ret <= 0)
+			continue;
+
+		check(scsisim_gsm_septet_count(text, len, 0, &count, &segments) == SCSISIM_SUCCESS &&
+		      count == (unsigned int)ret,
+		      "septet count", len);
+		check(scsisim_pack_septets_buf(ret, septets, packed, sizeof(packed)) == ((unsigned int)ret * 7 + 7) / 8 &&
+		      scsisim_unpack_septets_buf(ret, packed, sizeof(packed), unpacked, sizeof(unpacked)) == (unsigned int)ret,
+		      "septets pack and unpack", len);
+		check(scsisim_map_gsm_chars_buf(unpacked, ret, decoded, sizeof(decoded)) == (int)len &&
+		      memcmp(decoded, text, len) == 0,
+		      "text decodes back", len);
+	}
+
+	check(scsisim_encode_gsm_chars(text, len, septets, 10) == SCSISIM_BUFFER_TOO_SMALL,
+	      "buffer too small", len);
+}
+
+/**
+ * Function: test_sms_fields
+ *
+ * Description: Addresses of every length, with and without a '+', with
+ * their own TON/NPI, the SMSC, and time stamps across the year, day and
+ * time zone ranges must decode to what they were encoded from.
+ */
+static void test_sms_fields(void)
+{
+	static const char digits[] = "+4477009001234567890";
+	static const int8_t timezones[] = { 0, 1, -1, 8, -20, 56, -56 };
+	uint8_t record[GSM_SMS_RECORD_LEN];
+	char text[SCSISIM_SMS_MAX_TEXT_LEN];
+	struct scsisim_sms sms, decoded;
+	unsigned int len, i;
+
+	memset(&sms, 0, sizeof(sms));
+	sms.status = SIM_SMS_UNREAD;
+	sms.charset = SIM_SMS_CHARSET_GSM;
+	strcpy(sms.smsc, "+447700900900");
+	sms.timestamp.year = 2024;
+	sms.timestamp.month = 1;
+	sms.timestamp.day = 1;
+
+	/* 1 to 19 digits, international and not; the decoder takes no 
+	 * fewer than 3, so neither does the encoder */
+	for (len = 2; len < sizeof(digits); len++)
+	{
+		memcpy(sms.address, digits, len);
+		sms.address[len] = '\0';
+		sms.address_ton_npi = 0;
+
+		if (len < 4)
+		{
+			check(scsisim_encode_sms(&sms, "Hi", 2, record, sizeof(record)) == SCSISIM_SMS_INVALID_ADDRESS,
+			      "address too short", len - 1);
+			continue;
+		}
+
+		check(scsisim_encode_sms(&sms, "Hi", 2, record, sizeof(record)) == 1 &&
+		      scsisim_decode_sms(record, sizeof(record), &decoded, text, sizeof(text)) == SCSISIM_SUCCESS &&
+		      strcmp(decoded.address, sms.address + 1) == 0 && decoded.address_ton_npi == 0x91,
+		      "international address", len - 1);
+
+		memmove(sms.address, sms.address + 1, len);
+		sms.address_ton_npi = 0xa1;
+
+		check(scsisim_encode_sms(&sms, "Hi", 2, record, sizeof(record)) == 1 &&
+		      scsisim_decode_sms(record, sizeof(record), &decoded, text, sizeof(text)) == SCSISIM_SUCCESS &&
+		      strcmp(decoded.address, sms.address) == 0 && decoded.address_ton_npi == 0xa1,
+		      "national address", len - 1);
+	}
+
+	strcpy(sms.address, "*100#");
+	check(scsisim_encode_sms(&sms, "Hi", 2, record, sizeof(record)) == SCSISIM_SMS_INVALID_ADDRESS,
+	      "address not digits", 5);
+
+	strcpy(sms.address, "+447700900123");
+	sms.address_ton_npi = 0;
+	check(scsisim_encode_sms(&sms, "Hi", 2, record, sizeof(record)) == 1 &&
+	      scsisim_decode_sms(record, sizeof(record), &decoded, text, sizeof(text)) == SCSISIM_SUCCESS &&
+	      strcmp(decoded.smsc, "447700900900") == 0 && decoded.smsc_ton_npi == 0x91,
+	      "SMSC", 12);
+
+	for (i = 0; i < 100; i++)
+	{
+		sms.timestamp.year = 2000 + i;
+		sms.timestamp.month = 1 + i % 12;
+		sms.timestamp.day = 1 + i % 31;
+		sms.timestamp.hour = i % 24;
+		sms.timestamp.minute = i % 60;
+		sms.timestamp.second = (i * 7) % 60;
+		sms.timestamp.timezone = timezones[i % sizeof(timezones)];
+
+		check(scsisim_encode_sms(&sms, "Hi", 2, record, sizeof(record)) == 1 &&
+		      scsisim_decode_sms(record, sizeof(record), &decoded, text, sizeof(text)) == SCSISIM_SUCCESS &&
+		      decoded.has_timestamp && decoded.timestamp.year == sms.timestamp.year &&
+		      decoded.timestamp.month == sms.timestamp.month &&
+		      decoded.timestamp.day == sms.timestamp.day &&
+		      decoded.timestamp.hour == sms.timestamp.hour &&
+		      decoded.timestamp.minute == sms.timestamp.minute &&
+		      decoded.timestamp.second == sms.timestamp.second &&
+		      decoded.timestamp.timezone == sms.timestamp.timezone,
+		      "time stamp", i);
+	}
+}
+
+/**
+ * Function: test_store_sms
+ *
+ * Description: Store messages on a virtual card in one batch, read them
+ * back, and decode them; then free one record and fill the gaps with 
+ * scsisim_write_free_records().
+ */
+static void test_store_sms(void)
+{
+	struct scsisim_vcard *card;
+	struct scsisim_dev device;
+	struct scsisim_sms sms, decoded;
+	struct GSM_response resp;
+	uint8_t records[4 * GSM_SMS_RECORD_LEN], recnos[4];
+	char text[400], part[SCSISIM_SMS_MAX_TEXT_LEN];
+	int status[4], ret, num_records;
+
+	if (scsisim_vcard_create(&card) != SCSISIM_SUCCESS)
+	{
+		check(false, "scsisim_vcard_create", 0);
+		return;
+	}
+
+	if (scsisim_vcard_load_default(card) != SCSISIM_SUCCESS ||
+	    scsisim_open_virtual_device(card, &device) != SCSISIM_SUCCESS)
+	{
+		check(false, "open virtual card", 0);
+		scsisim_vcard_destroy(card);
+		return;
+	}
+
+	check(scsisim_init_device(&device) == SCSISIM_SUCCESS &&
+	      scsisim_select_file(&device, GSM_FILE_DF_TELECOM) > 0,
+	      "DF-TELECOM", 0);
+
+	/* A two-part message and a single one, in one buffer */
+	memset(&sms, 0, sizeof(sms));
+	sms.status = SIM_SMS_UNSENT;
+	sms.charset = SIM_SMS_CHARSET_GSM;
+	strcpy(sms.smsc, "+447700900900");
+	strcpy(sms.address, "+447700900123");
+	sms.concat_ref = 0x42;
+	memset(text, 'x', 200);
+
+	num_records = scsisim_encode_sms(&sms, text, 200, records, sizeof(records));
+	check(num_records == 2, "long message encoded", 200);
+
+	sms.status = SIM_SMS_READ;
+	ret = scsisim_encode_sms(&sms, "Got it", 6, records + 2 * GSM_SMS_RECORD_LEN,
+				 sizeof(records) - 2 * GSM_SMS_RECORD_LEN);
+	check(ret == 1, "short message encoded", 6);
+	num_records += ret;
+
+	/* Record 1 of the default card holds a message already */
+	check(scsisim_store_sms(&device, records, sizeof(records), num_records, recnos, status) == SCSISIM_SUCCESS &&
+	      recnos[0] == 2 && recnos[1] == 3 && recnos[2] == 4 && status[2] == SCSISIM_SUCCESS,
+	      "messages stored", num_records);
+
+	memset(records, 0, sizeof(records));
+	check(scsisim_read_records_range(&device, GSM_FILE_EF_SMS, 2, 3, records, sizeof(records),
+					 &resp, NULL, 0) == SCSISIM_SUCCESS,
+	      "messages read back", 3);
+
+	check(scsisim_decode_sms(records, GSM_SMS_RECORD_LEN, &decoded, part, sizeof(part)) == SCSISIM_SUCCESS &&
+	      decoded.status == SIM_SMS_UNSENT && decoded.concat_ref == 0x42 && decoded.concat_seq == 1 &&
+	      decoded.text_len == 153,
+	      "first part", 2);
+	check(scsisim_decode_sms(records + GSM_SMS_RECORD_LEN, GSM_SMS_RECORD_LEN, &decoded, part,
+				 sizeof(part)) == SCSISIM_SUCCESS &&
+	      decoded.concat_seq == 2 && decoded.text_len == 47 && strspn(part, "x") == 47,
+	      "second part", 3);
+	check(scsisim_decode_sms(records + 2 * GSM_SMS_RECORD_LEN, GSM_SMS_RECORD_LEN, &decoded, part,
+				 sizeof(part)) == SCSISIM_SUCCESS &&
+	      decoded.status == SIM_SMS_READ && strcmp(part, "Got it") == 0,
+	      "short message", 4);
+
+	/* Delete the second part: the next two records go to 3 and 5 */
+	memset(records, 0xff, GSM_SMS_RECORD_LEN);
+	records[0] = SIM_SMS_FREE;
+	check(scsisim_select_file(&device, GSM_FILE_EF_SMS) > 0 &&
+	      scsisim_update_record(&device, 3, records, GSM_SMS_RECORD_LEN) == SCSISIM_SUCCESS,
+	      "record 3 freed", 3);
+
+	sms.status = SIM_SMS_SENT;
+	check(scsisim_encode_sms(&sms, "One", 3, records, sizeof(records)) == 1 &&
+	      scsisim_encode_sms(&sms, "Two", 3, records + GSM_SMS_RECORD_LEN,
+				 sizeof(records) - GSM_SMS_RECORD_LEN) == 1,
+	      "two more encoded", 2);
+	check(scsisim_write_free_records(&device, GSM_FILE_EF_SMS, SIM_SMS_FREE, records, sizeof(records),
+					 2, recnos, status) == SCSISIM_SUCCESS &&
+	      recnos[0] == 3 && recnos[1] == 5,
+	      "free records filled", 2);
+	check(scsisim_read_record(&device, 5, records, GSM_SMS_RECORD_LEN) == SCSISIM_SUCCESS &&
+	      scsisim_decode_sms(records, GSM_SMS_RECORD_LEN, &decoded, part, sizeof(part)) == SCSISIM_SUCCESS &&
+	      strcmp(part, "Two") == 0,
+	      "record 5 read back", 5);
+
+	/* 45 free records are left */
+	check(scsisim_write_free_records(&device, GSM_FILE_EF_SMS, SIM_SMS_FREE, records,
+					 sizeof(records), 47, NULL, NULL) == SCSISIM_NO_FREE_RECORDS,
+	      "not enough free records", 47);
+	check(scsisim_write_free_records(&device, GSM_FILE_EF_SMS, SIM_SMS_FREE, records, sizeof(records),
+					 5, NULL, NULL) == SCSISIM_BUFFER_TOO_SMALL,
+	      "buffer too small", 5);
+
+	check(scsisim_close_device(&device) == SCSISIM_SUCCESS, "scsisim_close_device", 0);
+	scsisim_vcard_destroy(card);
+}
+
+/**
+ * Function: test_adn_names
+ *
+ * Description: Names in the GSM alphabet and in each UCS-2 coding of 
+ * GSM 11.11, Annex B must decode to what they were encoded from, in 
+ * records of several lengths; a name too long is cut at a character.
+ */
+static void test_adn_names(void)
+{
+	static const struct {
+		const char *name;
+		uint8_t coding;		/* First byte of the alpha identifier */
+	} names[] = {
+		{ "Alice", 'A' },
+		{ "[Bob] \xe2\x82\xac", 0x1b },	/* Extension characters */
+		{ "Zo\xc3\xab", 0x81 },		/* Latin-1, close together */
+		{ "\xd0\x94\xd0\xbc\xd0\xb8\xd1\x82\xd1\x80\xd0\xb8\xd0\xb9", 0x81 },
+		{ "\xe6\xbc\xa2\xe5\xad\x97", 0x80 },	/* Far apart */
+		{ "A\xe6\xbc\xa2\xd0\x94", 0x80 }
+	};
+	static const uint8_t record_lens[] = { 28, 34, 64 };
+	uint8_t record[64];
+	char alpha[SCSISIM_ADN_MAX_ALPHA_LEN];
+	struct scsisim_adn adn;
+	unsigned int i, j;
+
+	for (i = 0; i < sizeof(names) / sizeof(names[0]); i++)
+	{
+		for (j = 0; j < sizeof(record_lens); j++)
+		{
+			check(scsisim_encode_adn(GSM_FILE_EF_ADN, names[i].name, "123", 0, record,
+						 record_lens[j], NULL, NULL, 0) == 0 &&
+			      record[0] == names[i].coding &&
+			      scsisim_decode_adn(GSM_FILE_EF_ADN, record, record_lens[j], &adn, alpha,
+						 sizeof(alpha)) == SCSISIM_SUCCESS &&
+			      strcmp(alpha, names[i].name) == 0 && adn.alpha_len == strlen(names[i].name),
+			      "name", i * 0x10 + j);
+		}
+	}
+
+	/* 14 bytes of alpha identifier: 14 GSM characters, 6 in 0x80 */
+	check(scsisim_encode_adn(GSM_FILE_EF_ADN, "Bartholomew Jones", "123", 0, record, 28,
+				 NULL, NULL, 0) == 0 &&
+	      scsisim_decode_adn(GSM_FILE_EF_ADN, record, 28, &adn, alpha, sizeof(alpha)) == SCSISIM_SUCCESS &&
+	      strcmp(alpha, "Bartholomew Jo") == 0,
+	      "GSM name cut short", 14);
+	check(scsisim_encode_adn(GSM_FILE_EF_ADN, "\xe6\xbc\xa2\xe5\xad\x97\xe6\xbc\xa2\xe5\xad\x97"
+				 "\xe6\xbc\xa2\xe5\xad\x97\xe6\xbc\xa2", "123", 0, record, 28,
+				 NULL, NULL, 0) == 0 &&
+	      scsisim_decode_adn(GSM_FILE_EF_ADN, record, 28, &adn, alpha, sizeof(alpha)) == SCSISIM_SUCCESS &&
+	      adn.alpha_len == 6 * 3,
+	      "UCS-2 name cut short", 6);
+
+	/* EF-BDN has one byte less for the name */
+	check(scsisim_encode_adn(GSM_FILE_EF_BDN, "Bartholomew Jones", "123", 0, record, 28,
+				 NULL, NULL, 0) == 0 &&
+	      scsisim_decode_adn(GSM_FILE_EF_BDN, record, 28, &adn, alpha, sizeof(alpha)) == SCSISIM_SUCCESS &&
+	      strcmp(alpha, "Bartholomew J") == 0 && adn.comparison == 0xff,
+	      "EF-BDN name", 13);
+
+	/* No room for a name at all */
+	check(scsisim_encode_adn(GSM_FILE_EF_ADN, "Alice", "123", 0, record, 14, NULL, NULL, 0) == 0 &&
+	      scsisim_decode_adn(GSM_FILE_EF_ADN, record, 14, &adn, alpha, sizeof(alpha)) == SCSISIM_SUCCESS &&
+	      alpha[0] == '\0' && strcmp(adn.number, "123") == 0,
+	      "no alpha identifier", 14);
+}
+
+/**
+ * Function: test_adn_numbers
+ *
+ * Description: Numbers of every length that fits a record, with the 
+ * telecom digits and with and without a '+', must decode to what they 
+ * were encoded from; longer ones continue in extension records.
+ */
+static void test_adn_numbers(void)
+{
+	static const char digits[] = "+0123456789*#,9876543210";
+	static const uint8_t ext_recnos[] = { 7, 9 };
+	uint8_t record[28], ext[2 * SCSISIM_EXT_RECORD_LEN];
+	char alpha[SCSISIM_ADN_MAX_ALPHA_LEN], number[sizeof(digits)];
+	struct scsisim_adn adn;
+	unsigned int len;
+
+	for (len = 1; len < sizeof(digits); len++)
+	{
+		memcpy(number, digits, len);
+		number[len] = '\0';
+
+		/* Just the '+' is no number */
+		if (len == 1)
+			continue;
+
+		check(scsisim_encode_adn(GSM_FILE_EF_ADN, NULL, number, 0, record, sizeof(record),
+					 ext_recnos, ext, sizeof(ext)) == (len - 1 > SCSISIM_ADN_MAX_DIGITS) &&
+		      scsisim_decode_adn(GSM_FILE_EF_ADN, record, sizeof(record), &adn, alpha,
+					 sizeof(alpha)) == SCSISIM_SUCCESS &&
+		      adn.used && adn.ton_npi == 0x91 &&
+		      strncmp(adn.number, number + 1, SCSISIM_ADN_MAX_DIGITS) == 0 &&
+		      strlen(adn.number) == ((len - 1 < SCSISIM_ADN_MAX_DIGITS) ? len - 1 : SCSISIM_ADN_MAX_DIGITS),
+		      "international number", len - 1);
+
+		check(scsisim_encode_adn(GSM_FILE_EF_ADN, NULL, number + 1, 0x81, record, sizeof(record),
+					 ext_recnos, ext, sizeof(ext)) >= 0 &&
+		      scsisim_decode_adn(GSM_FILE_EF_ADN, record, sizeof(record), &adn, alpha,
+					 sizeof(alpha)) == SCSISIM_SUCCESS &&
+		      adn.ton_npi == 0x81 && strncmp(adn.number, number + 1, SCSISIM_ADN_MAX_DIGITS) == 0,
+		      "national number", len - 1);
+
+		/* The BCD is padded with 0xf */
+		check((len - 1) % 2 == 0 || (len - 1) > SCSISIM_ADN_MAX_DIGITS ||
+		      (record[sizeof(record) - 14 + 2 + (len - 1) / 2] & 0xf0) == 0xf0,
+		      "number padded", len - 1);
+	}
+
+	/* The rest of a long number goes in an extension record, which 
+	 * points nowhere */
+	check(scsisim_encode_adn(GSM_FILE_EF_ADN, "Long", "012345678901234567890123456789", 0,
+				 record, sizeof(record), ext_recnos, ext, sizeof(ext)) == 1 &&
+	      scsisim_decode_adn(GSM_FILE_EF_ADN, record, sizeof(record), &adn, alpha,
+				 sizeof(alpha)) == SCSISIM_SUCCESS &&
+	      adn.ext == 7 && ext[0] == 0x02 && ext[1] == 5 && ext[2] == 0x10 && ext[6] == 0x98 &&
+	      ext[12] == 0xff,
+	      "extension record", 30);
+	check(scsisim_encode_adn(GSM_FILE_EF_ADN, NULL, "0123456789012345678901234567890123456789012", 0,
+				 record, sizeof(record), ext_recnos, ext, sizeof(ext)) == 2 &&
+	      ext[12] == 9 && ext[SCSISIM_EXT_RECORD_LEN + 1] == 2,
+	      "chained extension records", 43);
+	check(scsisim_encode_adn(GSM_FILE_EF_ADN, NULL, "0123456789012345678901234567890123456789012", 0,
+				 record, sizeof(record), ext_recnos, ext, SCSISIM_EXT_RECORD_LEN) ==
+	      SCSISIM_BUFFER_TOO_SMALL,
+	      "too few extension records", 43);
+
+	/* Neither name nor number */
+	check(scsisim_encode_adn(GSM_FILE_EF_ADN, NULL, NULL, 0, record, sizeof(record), NULL, NULL, 0) == 0 &&
+	      scsisim_decode_adn(GSM_FILE_EF_ADN, record, sizeof(record), &adn, alpha,
+				 sizeof(alpha)) == SCSISIM_SUCCESS &&
+	      adn.used == false,
+	      "empty record", 0);
+	check(scsisim_encode_adn(GSM_FILE_EF_ADN, NULL, "12a", 0, record, sizeof(record), NULL, NULL, 0) ==
+	      SCSISIM_INVALID_PARAM,
+	      "not a telecom digit", 3);
+}
+
+/* EOF */
@@ -0,0 +1,695 @@
+/*
+ *  test_simd.c
+ *  Check the SIMD kernels, and the functions that use them, against
+ *  plain scalar code.
+ *
+ *  Copyright (c) 2017, Chris Coffey <kpuc@sdf.org>
+ *
+ *  Permission to use, copy, modify, and/or distribute this software
+ *  for any purpose with or without fee is hereby granted, provided
+ *  that the above copyright notice and this permission notice appear
+ *  in all copies.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL
+ *  WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED
+ *  WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE
+ *  AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL
+ *  DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE, DATA
+ *  OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER
+ *  TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ *  PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdbool.h>
+
+#include "scsisim.h"
+#include "simd.h"
+
+#define TEST_MAX_SEPTETS	160	/* Longest single SMS */
+#define TEST_MAX_BCD		80	/* Longer than any BCD field */
+#define TEST_MAX_UCS2		160	/* UCS-2 characters, longer than an SMS */
+#define TEST_ROUNDS		16	/* Random buffers per length */
+#define TEST_GUARD		32	/* Bytes past each output to check */
+#define TEST_GUARD_BYTE		0xa5
+
+static const char BCD_basic_digits[] = "0123456789abcdef";
+static const char BCD_telecom_digits[] = "0123456789*#,--f";
+
+static unsigned int failures;
+static uint32_t rand_state = 0x2017;
+static bool gsm_same_as_ascii[128];
+
+/* Internal functions */
+static void check(bool ok, const char *what, unsigned int len);
+static uint8_t rand_byte(void);
+static bool guard_intact(const uint8_t *buf, unsigned int len);
+static unsigned int ref_unpack_septets(unsigned int num_septets,
+				       const uint8_t *packed,
+				       unsigned int packed_len,
+				       uint8_t *unpacked);
+static unsigned int ref_pack_septets(unsigned int count, const uint8_t *unpacked, uint8_t *packed);
+static unsigned int ref_bcd_to_ascii(const uint8_t *bcd,
+				     unsigned int len,
+				     bool little_endian,
+				     bool strip_sign_flag,
+				     bool use_telecom_digits,
+				     char *ascii);
+static unsigned int ref_ucs2_to_utf8(const uint8_t *src, unsigned int src_len, char *dest);
+static void test_unpack(void);
+static void test_pack(void);
+static void test_bcd(void);
+static void test_gsm_ascii(void);
+static void test_ucs2(void);
+
+
+/**
+ * Function: main
+ *
+ * Description: Check every SIMD kernel the CPU supports, and the public
+ * functions that dispatch to them, against plain scalar code, for every
+ * length up to a full SMS and more. Kernels the CPU lacks are skipped;
+ * the public functions are checked either way.
+ */
+int main(void)
+{
+	unsigned int i;
+	char out[8];
+
+	/* Learn which GSM characters map to themselves from the scalar path,
+	 * one character at a time */
+	for (i = 0; i < 128; i++)
+	{
+		uint8_t ch = i;
+
+		gsm_same_as_ascii[i] = i != 0x1b &&
+				       scsisim_map_gsm_chars_buf(&ch, 1, out, sizeof(out)) == 1 &&
+				       (uint8_t)out[0] == i;
+	}
+
+#ifdef SIMD_X86
+	printf("SSE2: %s, SSSE3: %s, AVX2: %s\n",
+	       simd_have_sse2() ? "yes" : "no",
+	       simd_have_ssse3() ? "yes" : "no",
+	       simd_have_avx2() ? "yes" : "no");
+#else
+	printf("No SIMD kernels on this platform\n");
+#endif
+
+	test_unpack();
+	test_pack();
+	test_bcd();
+	test_gsm_ascii();
+	test_ucs2();
+
+	if (failures > 0)
+	{
+		printf("test_simd: %u failures\n", failures);
+		return EXIT_FAILURE;
+	}
+
+	printf("test_simd: all passed\n");
+
+	return EXIT_SUCCESS;
+}
+
+/**
+ * Function: check
+ *
+ * Parameters:
+ * ok:		Result of the check.
+ * what:	What was checked.
+ * len:		Length the check was run for.
+ *
+ * Description: Count and report a failed check.
+ */
+static void check(bool ok, const char *what, unsigned int len)
+{
+	if (ok)
+		return;
+
+	if (failures++ < 20)
+		printf("FAIL: %s, length %u\n", what, len);
+}
+
+/**
+ * Function: rand_byte
+ *
+ * Description: A small fixed-seed generator, so every run tests the same
+ * data.
+ */
+static uint8_t rand_byte(void)
+{
+	rand_state ^= rand_state << 13;
+	rand_state ^= rand_state >> 17;
+	rand_state ^= rand_state << 5;
+
+	return rand_state >> 24;
+}
+
+/**
+ * Function: guard_intact
+ *
+ * Parameters:
+ * buf:		Start of the guard bytes.
+ * len:		Number of guard bytes.
+ *
+ * Description: Check that nothing was written past the end of an output.
+ */
+static bool guard_intact(const uint8_t *buf, unsigned int len)
+{
+	unsigned int i;
+
+	for (i = 0; i < len; i++)
+	{
+		if (buf[i] != TEST_GUARD_BYTE)
+			return false;
+	}
+
+	return true;
+}
+
+/**
+ * Function: ref_unpack_septets
+ *
+ * Description: The scalar unpacking loop scsisim_unpack_septets() used
+ * before it had SIMD kernels, writing to a caller buffer of at least
+ * packed_len * 8 / 7 bytes.
+ */
+static unsigned int ref_unpack_septets(unsigned int num_septets,
+				       const uint8_t *packed,
+				       unsigned int packed_len,
+				       uint8_t *unpacked)
+{
+	unsigned int i, cur_pos, unpacked_len = packed_len * 8 / 7;
+	uint8_t tmp, *ptr = unpacked;
+
+	for (i = 0; i < packed_len; i++)
+	{
+		cur_pos = i % 7;
+		tmp = packed[i];
+
+		if (cur_pos > 0)
+		{
+			tmp <<= cur_pos;
+			tmp |= packed[i - 1] >> (8 - cur_pos);
+		}
+
+		*ptr++ = tmp & 0x7f;
+
+		if (cur_pos == 6)
+			*ptr++ = packed[i] >> 1;
+	}
+
+	return (unpacked_len > num_septets) ? num_septets : unpacked_len;
+}
+
+/**
+ * Function: ref_pack_septets
+ *
+ * Description: Pack septets one bit at a time. Returns the number of
+ * bytes written.
+ */
+static unsigned int ref_pack_septets(unsigned int count, const uint8_t *unpacked, uint8_t *packed)
+{
+	unsigned int i, bit, len = (count * 7 + 7) / 8;
+
+	memset(packed, 0, len);
+
+	for (i = 0; i < count * 7; i++)
+	{
+		bit = (unpacked[i / 7] >> (i % 7)) & 1;
+		packed[i / 8] |= bit << (i % 8);
+	}
+
+	return len;
+}
+
+/**
+ * Function: ref_bcd_to_ascii
+ *
+ * Description: The nibble-by-nibble loop scsisim_packed_bcd_to_ascii()
+ * used before it had a lookup table and a SIMD kernel. Returns the length
+ * of the string.
+ */
+static unsigned int ref_bcd_to_ascii(const uint8_t *bcd,
+				     unsigned int len,
+				     bool little_endian,
+				     bool strip_sign_flag,
+				     bool use_telecom_digits,
+				     char *ascii)
+{
+	unsigned int i;
+	const char *digits = use_telecom_digits ? BCD_telecom_digits : BCD_basic_digits;
+	char *tmp = ascii;
+
+	for (i = 0; i < len; i++)
+	{
+		if (little_endian)
+		{
+			*tmp++ = digits[bcd[i] & 0xf];
+			*tmp++ = digits[bcd[i] >> 4];
+		}
+		else
+		{
+			*tmp++ = digits[bcd[i] >> 4];
+			*tmp++ = digits[bcd[i] & 0xf];
+		}
+	}
+
+	if (strip_sign_flag && tmp > ascii && *(tmp - 1) == 'f')
+		tmp--;
+
+	*tmp = '\0';
+
+	return tmp - ascii;
+}
+
+/**
+ * Function: ref_ucs2_to_utf8
+ *
+ * Description: Convert UCS-2 (UTF-16BE) to UTF-8 one character at a
+ * time, joining surrogate pairs and replacing a lone surrogate with
+ * U+FFFD. Returns the length of the string.
+ */
+static unsigned int ref_ucs2_to_utf8(const uint8_t *src, unsigned int src_len, char *dest)
+{
+	unsigned int i = 0;
+	uint32_t ch, low;
+	uint8_t *out = (uint8_t *)dest;
+
+	while (i + 1 < src_len)
+	{
+		ch = (src[i] << 8) | src[i + 1];
+		i += 2;
+
+		if (ch >= 0xd800 && ch <= 0xdbff && i + 1 < src_len &&
+		    (low = (src[i] << 8) | src[i + 1]) >= 0xdc00 && low <= 0xdfff)
+		{
+			ch = 0x10000 + ((ch - 0xd800) << 10) + (low - 0xdc00);
+			i += 2;
+		}
+		else if (ch >= 0xd800 && ch <= 0xdfff)
+			ch = 0xfffd;
+
+		if (ch < 0x80)
+			*out++ = ch;
+		else if (ch < 0x800)
+		{
+			*out++ = 0xc0 | (ch >> 6);
+			*out++ = 0x80 | (ch & 0x3f);
+		}
+		else if (ch < 0x10000)
+		{
+			*out++ = 0xe0 | (ch >> 12);
+			*out++ = 0x80 | ((ch >> 6) & 0x3f);
+			*out++ = 0x80 | (ch & 0x3f);
+		}
+		else
+		{
+			*out++ = 0xf0 | (ch >> 18);
+			*out++ = 0x80 | ((ch >> 12) & 0x3f);
+			*out++ = 0x80 | ((ch >> 6) & 0x3f);
+			*out++ = 0x80 | (ch & 0x3f);
+		}
+	}
+
+	*out = '\0';
+
+	return out - (uint8_t *)dest;
+}
+
+/**
+ * Function: test_unpack
+ *
+ * Description: Unpack random data of every length from 0 to
+ * TEST_MAX_SEPTETS septets, with the public functions and with each
+ * kernel on its own.
+ */
+static void test_unpack(void)
+{
+	unsigned int len, round, i, packed_len, n, out_len;
+	uint8_t packed[TEST_MAX_SEPTETS];
+	uint8_t ref[TEST_MAX_SEPTETS + 8];
+	uint8_t out[TEST_MAX_SEPTETS + TEST_GUARD];
+	uint8_t *alloc;
+
+	for (len = 0; len <= TEST_MAX_SEPTETS; len++)
+	{
+		packed_len = (len * 7 + 7) / 8;
+
+		for (round = 0; round < TEST_ROUNDS; round++)
+		{
+			for (i = 0; i < packed_len; i++)
+				packed[i] = rand_byte();
+
+			ref_unpack_septets(len, packed, packed_len, ref);
+
+			memset(out, TEST_GUARD_BYTE, sizeof(out));
+			n = scsisim_unpack_septets_buf(len, packed, packed_len, out, len);
+			check(n == len && memcmp(out, ref, len) == 0, "scsisim_unpack_septets_buf", len);
+			check(guard_intact(out + len, TEST_GUARD), "scsisim_unpack_septets_buf guard", len);
+
+			if (len > 0)
+			{
+				alloc = NULL;
+				out_len = 0;
+				scsisim_unpack_septets(len, packed, packed_len, &alloc, &out_len);
+				check(alloc != NULL && out_len == len && memcmp(alloc, ref, len) == 0,
+				      "scsisim_unpack_septets", len);
+				free(alloc);
+			}
+
+#ifdef SIMD_X86
+			if (simd_have_ssse3())
+			{
+				memset(out, TEST_GUARD_BYTE, sizeof(out));
+				n = simd_unpack_septets_ssse3(packed, packed_len, out, len);
+				check(n % 16 == 0 && n <= len && memcmp(out, ref, n) == 0,
+				      "simd_unpack_septets_ssse3", len);
+				check(guard_intact(out + len, TEST_GUARD), "simd_unpack_septets_ssse3 guard", len);
+			}
+
+			if (simd_have_avx2())
+			{
+				memset(out, TEST_GUARD_BYTE, sizeof(out));
+				n = simd_unpack_septets_avx2(packed, packed_len, out, len);
+				check(n % 32 == 0 && n <= len && memcmp(out, ref, n) == 0,
+				      "simd_unpack_septets_avx2", len);
+				check(guard_intact(out + len, TEST_GUARD), "simd_unpack_septets_avx2 guard", len);
+			}
+#endif
+		}
+	}
+}
+
+/**
+ * Function: test_pack
+ *
+ * Description: Pack random bytes (top bit included, which must be
+ * ignored) of every length from 0 to TEST_MAX_SEPTETS septets, and
+ * unpack them again.
+ */
+static void test_pack(void)
+{
+	unsigned int len, round, i, packed_len, n;
+	uint8_t septets[TEST_MAX_SEPTETS];
+	uint8_t ref[TEST_MAX_SEPTETS];
+	uint8_t out[TEST_MAX_SEPTETS + TEST_GUARD];
+	uint8_t back[TEST_MAX_SEPTETS];
+
+	for (len = 0; len <= TEST_MAX_SEPTETS; len++)
+	{
+		packed_len = (len * 7 + 7) / 8;
+
+		for (round = 0; round < TEST_ROUNDS; round++)
+		{
+			for (i = 0; i < len; i++)
+				septets[i] = rand_byte();
+
+			ref_pack_septets(len, septets, ref);
+
+			memset(out, TEST_GUARD_BYTE, sizeof(out));
+			n = scsisim_pack_septets_buf(len, septets, out, packed_len);
+			check(n == packed_len && memcmp(out, ref, packed_len) == 0, "scsisim_pack_septets_buf", len);
+			check(guard_intact(out + packed_len, TEST_GUARD), "scsisim_pack_septets_buf guard", len);
+
+			/* The same with room to spare must not touch it */
+			memset(out, TEST_GUARD_BYTE, sizeof(out));
+			n = scsisim_pack_septets_buf(len, septets, out, sizeof(out));
+			check(n == packed_len && memcmp(out, ref, packed_len) == 0 &&
+			      guard_intact(out + packed_len, sizeof(out) - packed_len),
+			      "scsisim_pack_septets_buf with spare room", len);
+
+			scsisim_unpack_septets_buf(len, out, packed_len, back, len);
+
+			for (i = 0; i < len; i++)
+				check(back[i] == (septets[i] & 0x7f), "pack/unpack round trip", len);
+
+#ifdef SIMD_X86
+			if (simd_have_ssse3())
+			{
+				memset(out, TEST_GUARD_BYTE, sizeof(out));
+				n = simd_pack_septets_ssse3(septets, len, out, packed_len);
+				check(n % 16 == 0 && n <= len && memcmp(out, ref, n / 8 * 7) == 0,
+				      "simd_pack_septets_ssse3", len);
+				check(guard_intact(out + packed_len, TEST_GUARD), "simd_pack_septets_ssse3 guard", len);
+			}
+
+			if (simd_have_avx2())
+			{
+				memset(out, TEST_GUARD_BYTE, sizeof(out));
+				n = simd_pack_septets_avx2(septets, len, out, packed_len);
+				check(n % 32 == 0 && n <= len && memcmp(out, ref, n / 8 * 7) == 0,
+				      "simd_pack_septets_avx2", len);
+				check(guard_intact(out + packed_len, TEST_GUARD), "simd_pack_septets_avx2 guard", len);
+			}
+#endif
+		}
+	}
+}
+
+/**
+ * Function: test_bcd
+ *
+ * Description: Convert random packed BCD of every length from 0 to
+ * TEST_MAX_BCD bytes, for every combination of options.
+ */
+static void test_bcd(void)
+{
+	unsigned int len, round, i, opts;
+	int n;
+	bool little_endian, strip, telecom;
+	uint8_t bcd[TEST_MAX_BCD];
+	char ref[TEST_MAX_BCD * 2 + 1];
+	char out[TEST_MAX_BCD * 2 + 1 + TEST_GUARD];
+	char *alloc;
+
+	for (len = 0; len <= TEST_MAX_BCD; len++)
+	{
+		for (round = 0; round < TEST_ROUNDS; round++)
+		{
+			for (i = 0; i < len; i++)
+				bcd[i] = rand_byte();
+
+			/* Make the sign flag show up in half the rounds */
+			if (len > 0 && round % 2 == 0)
+				bcd[len - 1] |= 0xf0;
+
+			for (opts = 0; opts < 8; opts++)
+			{
+				little_endian = opts & 1;
+				strip = opts & 2;
+				telecom = opts & 4;
+
+				ref_bcd_to_ascii(bcd, len, little_endian, strip, telecom, ref);
+
+				memset(out, TEST_GUARD_BYTE, sizeof(out));
+				n = scsisim_packed_bcd_to_ascii_buf(bcd, len, little_endian, strip, telecom,
+								    out, len * 2 + 1);
+				check(n == (int)strlen(ref) && strcmp(out, ref) == 0,
+				      "scsisim_packed_bcd_to_ascii_buf", len);
+				check(guard_intact((uint8_t *)out + len * 2 + 1, TEST_GUARD),
+				      "scsisim_packed_bcd_to_ascii_buf guard", len);
+
+				if (len > 0)
+				{
+					alloc = scsisim_packed_bcd_to_ascii(bcd, len, little_endian, strip, telecom);
+					check(alloc != NULL && strcmp(alloc, ref) == 0,
+					      "scsisim_packed_bcd_to_ascii", len);
+					free(alloc);
+				}
+
+#ifdef SIMD_X86
+				if (simd_have_ssse3() && strip == false)
+				{
+					memset(out, TEST_GUARD_BYTE, sizeof(out));
+					n = simd_bcd_to_ascii_ssse3(bcd,
+								    len,
+								    little_endian,
+								    telecom ? BCD_telecom_digits : BCD_basic_digits,
+								    out);
+					check(n % 16 == 0 && n <= (int)len && memcmp(out, ref, n * 2) == 0,
+					      "simd_bcd_to_ascii_ssse3", len);
+					check(guard_intact((uint8_t *)out + len * 2, TEST_GUARD),
+					      "simd_bcd_to_ascii_ssse3 guard", len);
+				}
+#endif
+			}
+		}
+	}
+}
+
+/**
+ * Function: test_gsm_ascii
+ *
+ * Description: Map runs of GSM characters that are the same in ASCII,
+ * broken at a random place (or not at all) by one that is not, for every
+ * length from 0 to TEST_MAX_SEPTETS characters. The escape character is
+ * left out, so the scalar mapping of each character on its own is the
+ * reference.
+ */
+static void test_gsm_ascii(void)
+{
+	unsigned int len, round, i, run, ref_len, n;
+	int ret;
+	uint8_t src[TEST_MAX_SEPTETS];
+	char ref[TEST_MAX_SEPTETS * 4 + 1];
+	char out[TEST_MAX_SEPTETS * 4 + 1];
+	uint8_t ch;
+
+	for (len = 0; len <= TEST_MAX_SEPTETS; len++)
+	{
+		for (round = 0; round < TEST_ROUNDS; round++)
+		{
+			/* Where the run ends: past the end in a quarter of
+			 * the rounds */
+			run = (len > 0 && round % 4 != 0) ? rand_byte() % len : len;
+
+			for (i = 0; i < len; i++)
+			{
+				do
+				{
+					ch = rand_byte() & 0x7f;
+				}
+				while (ch == 0x1b || (i < run && gsm_same_as_ascii[ch] == false) ||
+				       (i == run && gsm_same_as_ascii[ch]));
+
+				src[i] = ch;
+			}
+
+			ref_len = 0;
+
+			for (i = 0; i < len; i++)
+			{
+				ret = scsisim_map_gsm_chars_buf(&src[i], 1, ref + ref_len, sizeof(ref) - ref_len);
+				check(ret > 0, "scsisim_map_gsm_chars_buf of one character", len);
+
+				if (ret > 0)
+					ref_len += ret;
+			}
+
+			ref[ref_len] = '\0';
+
+			ret = scsisim_map_gsm_chars_buf(src, len, out, sizeof(out));
+			check(ret == (int)ref_len && strcmp(out, ref) == 0, "scsisim_map_gsm_chars_buf", len);
+			check(scsisim_map_gsm_chars_len(src, len) == ref_len, "scsisim_map_gsm_chars_len", len);
+
+#ifdef SIMD_X86
+			if (simd_have_sse2())
+			{
+				/* Only whole blocks of 16 are looked at */
+				n = simd_gsm_ascii_sse2(src, len, out);
+				check(n == ((run < len / 16 * 16) ? run : len / 16 * 16) &&
+				      memcmp(out, src, n) == 0,
+				      "simd_gsm_ascii_sse2", len);
+				check(simd_gsm_ascii_sse2(src, len, NULL) == n, "simd_gsm_ascii_sse2 measuring", len);
+			}
+#endif
+		}
+	}
+}
+
+/**
+ * Function: test_ucs2
+ *
+ * Description: Convert random UCS-2 of every length from 0 to
+ * TEST_MAX_UCS2 characters. Each block of 8 characters is drawn from one
+ * class (by their UTF-8 length, mixed, or with surrogates), so
+ * every path of the kernel gets used, including blocks it must leave to
+ * the scalar code.
+ */
+static void test_ucs2(void)
+{
+	unsigned int len, round, i, cls = 0, src_len, ref_len, n, used;
+	int ret;
+	uint16_t ch;
+	uint8_t src[TEST_MAX_UCS2 * 2 + 1];
+	char ref[TEST_MAX_UCS2 * 3 + 1];
+	char out[TEST_MAX_UCS2 * 3 + 1 + TEST_GUARD];
+
+	for (len = 0; len <= TEST_MAX_UCS2; len++)
+	{
+		for (round = 0; round < TEST_ROUNDS; round++)
+		{
+			for (i = 0; i < len; i++)
+			{
+				if (i % 8 == 0)
+					cls = rand_byte() % 7;
+
+				switch (cls)
+				{
+					case 0:		/* ASCII */
+						ch = rand_byte() & 0x7f;
+						break;
+					case 1:		/* Two bytes in UTF-8 */
+						ch = 0x80 + ((rand_byte() << 8 | rand_byte()) % 0x780);
+						break;
+					case 2:		/* One or two bytes, e.g., Cyrillic */
+						ch = (rand_byte() % 2) ? rand_byte() & 0x7f : 0x400 + rand_byte();
+						break;
+					case 3:		/* Three bytes, no surrogates */
+						do
+						{
+							ch = rand_byte() << 8 | rand_byte();
+						}
+						while (ch < 0x800 || (ch >= 0xd800 && ch <= 0xdfff));
+						break;
+					case 4:		/* Anything but surrogates */
+						do
+						{
+							ch = rand_byte() << 8 | rand_byte();
+						}
+						while (ch >= 0xd800 && ch <= 0xdfff);
+						break;
+					case 5:		/* Surrogate pairs */
+						ch = (i % 2 == 0) ? 0xd800 + (rand_byte() & 0x3ff) :
+								    0xdc00 + (rand_byte() & 0x3ff);
+						break;
+					default:	/* Lone surrogates among ASCII */
+						ch = (rand_byte() % 4 == 0) ? 0xd800 + (rand_byte() << 3) : 'x';
+						break;
+				}
+
+				src[i * 2] = ch >> 8;
+				src[i * 2 + 1] = ch & 0xff;
+			}
+
+			/* A trailing odd byte must be ignored */
+			src_len = len * 2 + (round % 5 == 0);
+			src[len * 2] = rand_byte();
+
+			ref_len = ref_ucs2_to_utf8(src, src_len, ref);
+
+			memset(out, TEST_GUARD_BYTE, sizeof(out));
+			ret = scsisim_ucs2_to_utf8(src, src_len, out, len * 3 + 1);
+			check(ret == (int)ref_len && strcmp(out, ref) == 0, "scsisim_ucs2_to_utf8", len);
+			check(guard_intact((uint8_t *)out + len * 3 + 1, TEST_GUARD),
+			      "scsisim_ucs2_to_utf8 guard", len);
+
+#ifdef SIMD_X86
+			if (simd_have_ssse3())
+			{
+				char part[TEST_MAX_UCS2 * 3 + 1];
+
+				memset(out, TEST_GUARD_BYTE, sizeof(out));
+				n = simd_ucs2_to_utf8_ssse3(src, src_len, out, len * 3, &used);
+
+				/* Whatever it converted must match the scalar
+				 * conversion of the same characters */
+				check(n % 16 == 0 && n <= src_len &&
+				      used == ref_ucs2_to_utf8(src, n, part) &&
+				      memcmp(out, part, used) == 0,
+				      "simd_ucs2_to_utf8_ssse3", len);
+				check(guard_intact((uint8_t *)out + len * 3, TEST_GUARD),
+				      "simd_ucs2_to_utf8_ssse3 guard", len);
+			}
+#endif
+		}
+	}
+}
+
+/* EOF */
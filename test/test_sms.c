@@ -0,0 +1,676 @@
+/*
+ *  test_sms.c
+ *  Check the decoding of SMS-DELIVER, SMS-SUBMIT, SMS-STATUS-REPORT and
+ *  SMS-COMMAND records, including every combination of the optional 
+ *  fields of a status report, User Data Headers and alphanumeric 
+ *  addresses; the exact records the encoder builds; that reassembly 
+ *  skips free records; and how many septets each part of a concatenated
+ *  SMS holds.
+ *
+ *  Copyright (c) 2017, Chris Coffey <kpuc@sdf.org>
+ *
+ *  Permission to use, copy, modify, and/or distribute this software
+ *  for any purpose with or without fee is hereby granted, provided
+ *  that the above copyright notice and this permission notice appear
+ *  in all copies.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL
+ *  WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED
+ *  WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE
+ *  AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL
+ *  DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE, DATA
+ *  OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER
+ *  TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ *  PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdbool.h>
+
+#include "scsisim.h"
+#include "gsm.h"
+
+/* The start of a received SMS-STATUS-REPORT, up to and including TP-ST */
+static const uint8_t report_head[] = {
+	SIM_SMS_READ,					/* Status */
+	0x07, 0x91, 0x44, 0x77, 0x00, 0x09, 0x00, 0xf9,	/* SMSC */
+	0x26,						/* TP-MTI, TP-MMS, TP-SRQ */
+	0x42,						/* TP-MR */
+	0x0c, 0x91, 0x44, 0x77, 0x00, 0x09, 0x10, 0x32,	/* TP-RA */
+	0x42, 0x50, 0x10, 0x21, 0x03, 0x54, 0x80,	/* TP-SCTS */
+	0x42, 0x50, 0x10, 0x21, 0x13, 0x25, 0x4a,	/* TP-DT */
+	0x00						/* TP-ST: delivered */
+};
+
+/* A sent SMS-COMMAND: delete message 7 sent to +447700900123 */
+static const uint8_t command_record[] = {
+	SIM_SMS_SENT,					/* Status */
+	0x07, 0x91, 0x44, 0x77, 0x00, 0x09, 0x00, 0xf9,	/* SMSC */
+	0x02,						/* TP-MTI */
+	0x43,						/* TP-MR */
+	0x00,						/* TP-PID */
+	0x02,						/* TP-CT: delete */
+	0x07,						/* TP-MN */
+	0x0c, 0x91, 0x44, 0x77, 0x00, 0x09, 0x10, 0x32,	/* TP-DA */
+	0x00						/* TP-CDL */
+};
+
+/* The start of a received SMS-DELIVER from an alphanumeric sender, up
+ * to and including TP-SCTS */
+static const uint8_t alpha_head[] = {
+	SIM_SMS_READ,					/* Status */
+	0x07, 0x91, 0x44, 0x77, 0x00, 0x09, 0x00, 0xf9,	/* SMSC */
+	0x04,						/* TP-MTI, TP-MMS */
+	0x0d, 0xd0, 0xd3, 0xf1, 0x3c, 0x3d, 0x4d, 0xb7,	/* TP-OA: "ScsiSim", */
+	0x01,						/* 13 semi-octets */
+	0x00, 0x00,					/* TP-PID, TP-DCS */
+	0x42, 0x50, 0x10, 0x21, 0x03, 0x54, 0x80	/* TP-SCTS */
+};
+
+/* The start of a received SMS-DELIVER, up to and including TP-SCTS */
+static const uint8_t deliver_head[] = {
+	SIM_SMS_READ,					/* Status */
+	0x07, 0x91, 0x44, 0x77, 0x00, 0x09, 0x00, 0xf9,	/* SMSC */
+	0x04,						/* TP-MTI, TP-MMS */
+	0x0c, 0x91, 0x44, 0x77, 0x00, 0x09, 0x10, 0x32,	/* TP-OA */
+	0x00, 0x00,					/* TP-PID, TP-DCS */
+	0x42, 0x50, 0x10, 0x21, 0x03, 0x54, 0x80	/* TP-SCTS */
+};
+
+/* The start of a sent SMS-SUBMIT without a validity period, up to and
+ * including TP-DCS */
+static const uint8_t submit_head[] = {
+	SIM_SMS_SENT,					/* Status */
+	0x07, 0x91, 0x44, 0x77, 0x00, 0x09, 0x00, 0xf9,	/* SMSC */
+	0x01,						/* TP-MTI */
+	0x43,						/* TP-MR */
+	0x0c, 0x91, 0x44, 0x77, 0x00, 0x09, 0x10, 0x32,	/* TP-DA */
+	0x00, 0x00					/* TP-PID, TP-DCS */
+};
+
+/* "Done" in the GSM 7-bit alphabet, and "Да" in UCS-2 */
+static const uint8_t gsm_done[] = { 0x04, 0xc4, 0xb7, 0xbb, 0x0c };
+static const uint8_t ucs2_da[] = { 0x04, 0x04, 0x14, 0x04, 0x30 };
+
+static unsigned int failures;
+
+/* Internal functions */
+static void check(bool ok, const char *what, unsigned int arg);
+static void build_record(uint8_t *record, const uint8_t *head, unsigned int head_len,
+			 const uint8_t *tail, unsigned int tail_len);
+static bool same_time(const struct scsisim_sms_time *time,
+		      uint8_t hour, uint8_t minute, uint8_t second, int8_t timezone);
+static void test_deliver_submit(void);
+static void test_udh(void);
+static void test_encoder_output(void);
+static void test_status_report(void);
+static void test_command(void);
+static void test_alpha_address(void);
+static void count_message(const struct scsisim_concat_sms *msg, void *user_data);
+static void test_concat_free(void);
+static void test_concat_capacity(void);
+
+
+/**
+ * Function: main
+ *
+ * Description: Decode status reports with every TP-PI, a command, and
+ * alphanumeric addresses, and feed free records to reassembly.
+ */
+int main(void)
+{
+	test_deliver_submit();
+	test_udh();
+	test_encoder_output();
+	test_status_report();
+	test_command();
+	test_alpha_address();
+	test_concat_free();
+	test_concat_capacity();
+
+	if (failures > 0)
+	{
+		printf("test_sms: %u failures\n", failures);
+		return EXIT_FAILURE;
+	}
+
+	printf("test_sms: all passed\n");
+
+	return EXIT_SUCCESS;
+}
+
+/**
+ * Function: check
+ *
+ * Parameters:
+ * ok:		Result of the check.
+ * what:	What was checked.
+ * arg:		What the check was run for: the TP-PI of a status
+ *		report, or a length.
+ *
+ * Description: Count and report a failed check.
+ */
+static void check(bool ok, const char *what, unsigned int arg)
+{
+	if (ok)
+		return;
+
+	failures++;
+	printf("FAIL: %s (0x%02x)\n", what, arg);
+}
+
+/**
+ * Function: build_record
+ *
+ * Description: Put a record together from two parts, padded with 0xff.
+ */
+static void build_record(uint8_t *record, const uint8_t *head, unsigned int head_len,
+			 const uint8_t *tail, unsigned int tail_len)
+{
+	memset(record, 0xff, GSM_SMS_RECORD_LEN);
+	memcpy(record, head, head_len);
+	memcpy(record + head_len, tail, tail_len);
+}
+
+/**
+ * Function: same_time
+ *
+ * Description: Check the time of day and time zone of a time stamp
+ * from 1 May 2024.
+ */
+static bool same_time(const struct scsisim_sms_time *time,
+		      uint8_t hour, uint8_t minute, uint8_t second, int8_t timezone)
+{
+	return time->year == 2024 && time->month == 5 && time->day == 1 &&
+	       time->hour == hour && time->minute == minute && time->second == second &&
+	       time->timezone == timezone;
+}
+
+/**
+ * Function: test_deliver_submit
+ *
+ * Description: Decode a received SMS-DELIVER and sent SMS-SUBMITs, with
+ * and without a validity period, in both character sets.
+ */
+static void test_deliver_submit(void)
+{
+	uint8_t record[GSM_SMS_RECORD_LEN];
+	uint8_t tail[1 + sizeof(ucs2_da)];
+	char text[SCSISIM_SMS_MAX_TEXT_LEN];
+	struct scsisim_sms sms;
+
+	build_record(record, deliver_head, sizeof(deliver_head), gsm_done, sizeof(gsm_done));
+
+	check(scsisim_decode_sms(record, sizeof(record), &sms, text, sizeof(text)) == SCSISIM_SUCCESS,
+	      "deliver decodes", 0);
+	check(sms.status == SIM_SMS_READ && sms.mti == SIM_SMS_MTI_DELIVER, "deliver TP-MTI", 0);
+	check(strcmp(sms.smsc, "44770090009") == 0 && sms.smsc_ton_npi == 0x91, "deliver SMSC", 0);
+	check(strcmp(sms.address, "447700900123") == 0 && sms.address_ton_npi == 0x91, "TP-OA", 0);
+	check(sms.pid == 0x00 && sms.dcs == 0x00 && sms.charset == SIM_SMS_CHARSET_GSM,
+	      "deliver TP-PID, TP-DCS", 0);
+	check(sms.has_timestamp && same_time(&sms.timestamp, 12, 30, 45, 8), "deliver TP-SCTS", 0);
+	check(sms.udhi == false && sms.concat_total == 0, "deliver without UDH", 0);
+	check(sms.udl == 4 && strcmp(text, "Done") == 0 && sms.text_len == 4, "deliver text", 0);
+
+	build_record(record, submit_head, sizeof(submit_head), gsm_done, sizeof(gsm_done));
+
+	check(scsisim_decode_sms(record, sizeof(record), &sms, text, sizeof(text)) == SCSISIM_SUCCESS,
+	      "submit decodes", 0);
+	check(sms.status == SIM_SMS_SENT && sms.mti == SIM_SMS_MTI_SUBMIT && sms.message_ref == 0x43,
+	      "submit TP-MTI, TP-MR", 0);
+	check(strcmp(sms.address, "447700900123") == 0 && sms.address_ton_npi == 0x91, "TP-DA", 0);
+	check(sms.has_timestamp == false, "submit without TP-SCTS", 0);
+	check(strcmp(text, "Done") == 0, "submit text", 0);
+
+	/* UCS-2, after a relative validity period */
+	tail[0] = 0xa7;
+	memcpy(tail + 1, ucs2_da, sizeof(ucs2_da));
+	build_record(record, submit_head, sizeof(submit_head), tail, sizeof(tail));
+	record[9] |= 0x10;	/* TP-VPF: relative */
+	record[sizeof(submit_head) - 1] = 0x08;
+
+	check(scsisim_decode_sms(record, sizeof(record), &sms, text, sizeof(text)) == SCSISIM_SUCCESS &&
+	      sms.charset == SIM_SMS_CHARSET_UCS2 && sms.udl == 4 && strcmp(text, "Да") == 0,
+	      "submit with TP-VP", 0x10);
+
+	/* An absolute validity period is a time stamp */
+	build_record(record, submit_head, sizeof(submit_head), deliver_head + sizeof(deliver_head) - 7, 7);
+	memcpy(record + sizeof(submit_head) + 7, gsm_done, sizeof(gsm_done));
+	record[9] |= 0x18;	/* TP-VPF: absolute */
+
+	check(scsisim_decode_sms(record, sizeof(record), &sms, text, sizeof(text)) == SCSISIM_SUCCESS &&
+	      strcmp(text, "Done") == 0,
+	      "submit with absolute TP-VP", 0x18);
+}
+
+/**
+ * Function: test_udh
+ *
+ * Description: Decode a User Data Header with an 8-bit (IEI 0x00) and a
+ * 16-bit (IEI 0x08) concatenated SMS element, in front of 8-bit UCS-2 
+ * text and of 7-bit text padded to the next septet. Other elements must
+ * be skipped.
+ */
+static void test_udh(void)
+{
+	static const uint8_t udh_8bit[] = { 0x05, 0x00, 0x03, 0x2a, 0x03, 0x02 };
+	static const uint8_t udh_16bit[] = { 0x06, 0x08, 0x04, 0x12, 0x34, 0x03, 0x03 };
+	static const uint8_t udh_other[] = { 0x09, 0x0a, 0x02, 0x00, 0x01, 0x00, 0x03, 0x07, 0x02, 0x01 };
+	static const uint8_t done[] = { 0x44, 0x6f, 0x6e, 0x65 };
+	uint8_t record[GSM_SMS_RECORD_LEN];
+	uint8_t tail[32], septets[8 + sizeof(done)];
+	char text[SCSISIM_SMS_MAX_TEXT_LEN];
+	struct scsisim_sms sms;
+
+	/* UCS-2: the header is counted in octets */
+	tail[0] = sizeof(udh_8bit) + 4;
+	memcpy(tail + 1, udh_8bit, sizeof(udh_8bit));
+	memcpy(tail + 1 + sizeof(udh_8bit), ucs2_da + 1, 4);
+	build_record(record, deliver_head, sizeof(deliver_head), tail, 1 + sizeof(udh_8bit) + 4);
+	record[9] |= 0x40;				/* TP-UDHI */
+	record[sizeof(deliver_head) - 8] = 0x08;	/* TP-DCS */
+
+	check(scsisim_decode_sms(record, sizeof(record), &sms, text, sizeof(text)) == SCSISIM_SUCCESS &&
+	      sms.udhi && strcmp(text, "Да") == 0,
+	      "UCS-2 after a UDH", 0x00);
+	check(sms.concat_ref == 0x2a && sms.concat_total == 3 && sms.concat_seq == 2,
+	      "8-bit reference", 0x00);
+
+	tail[0] = sizeof(udh_16bit) + 4;
+	memcpy(tail + 1, udh_16bit, sizeof(udh_16bit));
+	memcpy(tail + 1 + sizeof(udh_16bit), ucs2_da + 1, 4);
+	memset(record + sizeof(deliver_head), 0xff, sizeof(record) - sizeof(deliver_head));
+	memcpy(record + sizeof(deliver_head), tail, 1 + sizeof(udh_16bit) + 4);
+
+	check(scsisim_decode_sms(record, sizeof(record), &sms, text, sizeof(text)) == SCSISIM_SUCCESS &&
+	      strcmp(text, "Да") == 0 && sms.concat_ref == 0x1234 && sms.concat_total == 3 &&
+	      sms.concat_seq == 3,
+	      "16-bit reference", 0x08);
+
+	/* Another element first, and the concatenation one after it */
+	tail[0] = sizeof(udh_other) + 4;
+	memcpy(tail + 1, udh_other, sizeof(udh_other));
+	memcpy(tail + 1 + sizeof(udh_other), ucs2_da + 1, 4);
+	memset(record + sizeof(deliver_head), 0xff, sizeof(record) - sizeof(deliver_head));
+	memcpy(record + sizeof(deliver_head), tail, 1 + sizeof(udh_other) + 4);
+
+	check(scsisim_decode_sms(record, sizeof(record), &sms, text, sizeof(text)) == SCSISIM_SUCCESS &&
+	      strcmp(text, "Да") == 0 && sms.concat_ref == 0x07 && sms.concat_total == 2 &&
+	      sms.concat_seq == 1,
+	      "element after another", 0x0a);
+
+	/* 7-bit: the 6-byte header takes 7 septets, and TP-UDL counts them */
+	memset(septets, 0, sizeof(septets));
+	memcpy(septets + 7, done, sizeof(done));
+	memset(tail, 0, sizeof(tail));
+	tail[0] = 7 + sizeof(done);
+	scsisim_pack_septets_buf(7 + sizeof(done), septets, tail + 1, sizeof(tail) - 1);
+	memcpy(tail + 1, udh_8bit, sizeof(udh_8bit));
+	build_record(record, deliver_head, sizeof(deliver_head), tail, 1 + (tail[0] * 7 + 7) / 8);
+	record[9] |= 0x40;
+
+	check(scsisim_decode_sms(record, sizeof(record), &sms, text, sizeof(text)) == SCSISIM_SUCCESS &&
+	      strcmp(text, "Done") == 0 && sms.text_len == 4 && sms.concat_ref == 0x2a,
+	      "7-bit text after a UDH", 0x00);
+
+	/* A header longer than the user data is not taken for one */
+	tail[0] = 4;
+	memcpy(tail + 1, udh_8bit, sizeof(udh_8bit));
+	build_record(record, deliver_head, sizeof(deliver_head), tail, 1 + 4);
+	record[9] |= 0x40;
+	record[sizeof(deliver_head) - 8] = 0x08;
+
+	check(scsisim_decode_sms(record, sizeof(record), &sms, text, sizeof(text)) == SCSISIM_SUCCESS &&
+	      sms.concat_total == 0,
+	      "UDH longer than TP-UDL", 0x05);
+}
+
+/**
+ * Function: test_encoder_output
+ *
+ * Description: scsisim_encode_sms() must build exactly the records the
+ * decoding tests start from: an SMS-DELIVER, an SMS-SUBMIT, and UCS-2
+ * picked for text outside the GSM alphabet.
+ */
+static void test_encoder_output(void)
+{
+	uint8_t record[GSM_SMS_RECORD_LEN], expected[GSM_SMS_RECORD_LEN];
+	struct scsisim_sms sms;
+
+	memset(&sms, 0, sizeof(sms));
+	sms.status = SIM_SMS_READ;
+	strcpy(sms.smsc, "+44770090009");
+	strcpy(sms.address, "+447700900123");
+	sms.charset = SIM_SMS_CHARSET_GSM;
+	sms.timestamp.year = 2024;
+	sms.timestamp.month = 5;
+	sms.timestamp.day = 1;
+	sms.timestamp.hour = 12;
+	sms.timestamp.minute = 30;
+	sms.timestamp.second = 45;
+	sms.timestamp.timezone = 8;
+
+	build_record(expected, deliver_head, sizeof(deliver_head), gsm_done, sizeof(gsm_done));
+	check(scsisim_encode_sms(&sms, "Done", 4, record, sizeof(record)) == 1 &&
+	      memcmp(record, expected, sizeof(record)) == 0,
+	      "deliver record", 0);
+
+	sms.status = SIM_SMS_SENT;
+	sms.message_ref = 0x43;
+
+	build_record(expected, submit_head, sizeof(submit_head), gsm_done, sizeof(gsm_done));
+	check(scsisim_encode_sms(&sms, "Done", 4, record, sizeof(record)) == 1 &&
+	      memcmp(record, expected, sizeof(record)) == 0,
+	      "submit record", 0);
+
+	build_record(expected, submit_head, sizeof(submit_head), ucs2_da, sizeof(ucs2_da));
+	expected[sizeof(submit_head) - 1] = 0x08;
+	check(scsisim_encode_sms(&sms, "Да", strlen("Да"), record, sizeof(record)) == 1 &&
+	      memcmp(record, expected, sizeof(record)) == 0,
+	      "UCS-2 picked", 0x08);
+
+	/* The message class of a general data coding TP-DCS is kept */
+	sms.dcs = 0x11;
+	expected[sizeof(submit_head) - 1] = 0x19;
+	check(scsisim_encode_sms(&sms, "Да", strlen("Да"), record, sizeof(record)) == 1 &&
+	      memcmp(record, expected, sizeof(record)) == 0,
+	      "message class kept", 0x11);
+
+	sms.status = SIM_SMS_FREE;
+	check(scsisim_encode_sms(&sms, "Done", 4, record, sizeof(record)) == SCSISIM_SMS_INVALID_STATUS,
+	      "free record", 0);
+}
+
+/**
+ * Function: test_status_report
+ *
+ * Description: Decode a status report without TP-PI, and with every
+ * combination of the TP-PID, TP-DCS and TP-UDL bits of it. The fixed
+ * fields must come out the same every time, each optional field only
+ * when its bit is set, and the text only with TP-UDL.
+ */
+static void test_status_report(void)
+{
+	unsigned int pi, len;
+	uint8_t record[GSM_SMS_RECORD_LEN];
+	uint8_t tail[16];
+	char text[SCSISIM_SMS_MAX_TEXT_LEN];
+	struct scsisim_sms sms;
+	bool ucs2;
+
+	/* 0x100 stands for no TP-PI at all, just padding */
+	for (pi = 0; pi <= 0x100; pi = (pi == 0x07) ? 0x100 : pi + 1)
+	{
+		len = 0;
+		ucs2 = (pi == 0x06);
+
+		if (pi != 0x100)
+		{
+			tail[len++] = pi;
+
+			if (pi & 0x01)
+				tail[len++] = 0x00;			/* TP-PID */
+
+			if (pi & 0x02)
+				tail[len++] = ucs2 ? 0x08 : 0x00;	/* TP-DCS */
+
+			if (pi & 0x04)
+			{
+				memcpy(tail + len, ucs2 ? ucs2_da : gsm_done, sizeof(gsm_done));
+				len += sizeof(gsm_done);
+			}
+		}
+
+		build_record(record, report_head, sizeof(report_head), tail, len);
+
+		check(scsisim_decode_sms(record, sizeof(record), &sms, text, sizeof(text)) == SCSISIM_SUCCESS,
+		      "status report decodes", pi);
+
+		/* The fixed fields */
+		check(sms.mti == SIM_SMS_MTI_STATUS_REPORT, "TP-MTI", pi);
+		check(sms.message_ref == 0x42, "TP-MR", pi);
+		check(strcmp(sms.smsc, "44770090009") == 0 && sms.smsc_ton_npi == 0x91, "SMSC", pi);
+		check(strcmp(sms.address, "447700900123") == 0 && sms.address_ton_npi == 0x91, "TP-RA", pi);
+		check(sms.has_timestamp && same_time(&sms.timestamp, 12, 30, 45, 8), "TP-SCTS", pi);
+		check(same_time(&sms.discharge_time, 12, 31, 52, -24), "TP-DT", pi);
+		check(sms.report_status == 0x00, "TP-ST", pi);
+
+		/* The optional ones */
+		check(sms.pid == 0x00, "TP-PID", pi);
+		check(sms.dcs == ((pi != 0x100 && ucs2) ? 0x08 : 0x00), "TP-DCS", pi);
+
+		if (pi != 0x100 && (pi & 0x04))
+		{
+			check(sms.udl == 4, "TP-UDL", pi);
+			check(strcmp(text, ucs2 ? "Да" : "Done") == 0, "text", pi);
+		}
+		else
+		{
+			check(sms.udl == 0, "no TP-UDL", pi);
+			check(text[0] == '\0' && sms.text_len == 0, "no text", pi);
+		}
+	}
+
+	/* A TP-PI of 0x01 with a non-zero TP-PID */
+	tail[0] = 0x01;
+	tail[1] = 0x7f;
+	build_record(record, report_head, sizeof(report_head), tail, 2);
+	check(scsisim_decode_sms(record, sizeof(record), &sms, text, sizeof(text)) == SCSISIM_SUCCESS &&
+	      sms.pid == 0x7f && sms.dcs == 0x00 && sms.udl == 0, "TP-PID value", 0x01);
+
+	/* A failed delivery */
+	build_record(record, report_head, sizeof(report_head) - 1, (const uint8_t *)"\x41", 1);
+	check(scsisim_decode_sms(record, sizeof(record), &sms, text, sizeof(text)) == SCSISIM_SUCCESS &&
+	      sms.report_status == 0x41, "TP-ST of a failed delivery", 0x100);
+
+	/* A bad recipient address must not be read past */
+	memcpy(record, report_head, sizeof(report_head));
+	record[11] = 0x20;
+	check(scsisim_decode_sms(record, sizeof(record), &sms, text, sizeof(text)) == SCSISIM_SMS_INVALID_ADDRESS,
+	      "TP-RA too long", 0x100);
+}
+
+/**
+ * Function: test_command
+ *
+ * Description: Decode a sent SMS-COMMAND, and check that the same TPDU
+ * type in a received record is taken as a status report instead.
+ */
+static void test_command(void)
+{
+	uint8_t record[GSM_SMS_RECORD_LEN];
+	char text[SCSISIM_SMS_MAX_TEXT_LEN];
+	struct scsisim_sms sms;
+
+	build_record(record, command_record, sizeof(command_record), NULL, 0);
+
+	check(scsisim_decode_sms(record, sizeof(record), &sms, text, sizeof(text)) == SCSISIM_SUCCESS,
+	      "command decodes", 0);
+	check(sms.mti == SIM_SMS_MTI_COMMAND && sms.message_ref == 0x43 && sms.pid == 0x00,
+	      "command TP-MTI, TP-MR, TP-PID", 0);
+	check(sms.command_type == 0x02 && sms.message_number == 0x07, "command TP-CT, TP-MN", 0);
+	check(strcmp(sms.address, "447700900123") == 0 && sms.address_ton_npi == 0x91, "command TP-DA", 0);
+	check(sms.udl == 0 && text[0] == '\0' && sms.has_timestamp == false, "command TP-CDL", 0);
+
+	/* Received, it is read as a status report, whose TP-RA would start
+	 * where the TP-PID of the command is: an empty address */
+	record[0] = SIM_SMS_READ;
+
+	check(scsisim_decode_sms(record, sizeof(record), &sms, text, sizeof(text)) == SCSISIM_SMS_INVALID_ADDRESS &&
+	      sms.message_ref == 0x43 && sms.command_type == 0, "received TP-MTI 2 is a status report", 0);
+}
+
+/**
+ * Function: test_alpha_address
+ *
+ * Description: Decode an alphanumeric sender whose last byte is only
+ * partly used, and round-trip names of every length through
+ * scsisim_encode_sms(). The length of the field is in semi-octets, so
+ * padding bits must not come out as a trailing '@'.
+ */
+static void test_alpha_address(void)
+{
+	static const char name[] = "ScsiSim Ltd 42";
+	uint8_t record[GSM_SMS_RECORD_LEN];
+	char text[SCSISIM_SMS_MAX_TEXT_LEN];
+	struct scsisim_sms sms;
+	unsigned int len;
+
+	build_record(record, alpha_head, sizeof(alpha_head), gsm_done, sizeof(gsm_done));
+
+	check(scsisim_decode_sms(record, sizeof(record), &sms, text, sizeof(text)) == SCSISIM_SUCCESS &&
+	      strcmp(sms.address, "ScsiSim") == 0 && sms.address_ton_npi == 0xd0,
+	      "alphanumeric TP-OA", 7);
+	check(strcmp(text, "Done") == 0 && same_time(&sms.timestamp, 12, 30, 45, 8),
+	      "fields after the alphanumeric TP-OA", 7);
+
+	/* From the shortest name the decoder takes, two septets in two
+	 * bytes, to the longest, 13 septets in 12 bytes */
+	for (len = 2; len < sizeof(name); len++)
+	{
+		memset(&sms, 0, sizeof(sms));
+		sms.status = SIM_SMS_READ;
+		strcpy(sms.smsc, "+447700900009");
+		memcpy(sms.address, name, len);
+		sms.address[len] = '\0';
+		sms.address_ton_npi = 0xd0;
+
+		if (len == sizeof(name) - 1)
+		{
+			check(scsisim_encode_sms(&sms, "Hi", 2, record, sizeof(record)) ==
+			      SCSISIM_SMS_INVALID_ADDRESS,
+			      "alphanumeric address too long", len);
+			break;
+		}
+
+		check(scsisim_encode_sms(&sms, "Hi", 2, record, sizeof(record)) == 1 &&
+		      record[10] == (len * 7 + (4 - 1)) / 4,
+		      "alphanumeric TP-OA length in semi-octets", len);
+		check(scsisim_decode_sms(record, sizeof(record), &sms, text, sizeof(text)) == SCSISIM_SUCCESS &&
+		      strncmp(sms.address, name, len) == 0 && sms.address[len] == '\0' &&
+		      strcmp(text, "Hi") == 0,
+		      "alphanumeric TP-OA round trip", len);
+	}
+}
+
+/**
+ * Function: count_message
+ *
+ * Description: Reassembly callback: count the messages passed on.
+ */
+static void count_message(const struct scsisim_concat_sms *msg, void *user_data)
+{
+	(void)msg;
+
+	(*(unsigned int *)user_data)++;
+}
+
+/**
+ * Function: test_concat_free
+ *
+ * Description: Free records, never used or left over from a deleted
+ * message, must be skipped without being decoded.
+ */
+static void test_concat_free(void)
+{
+	struct scsisim_concat *concat;
+	uint8_t record[GSM_SMS_RECORD_LEN];
+	unsigned int messages = 0;
+
+	if (scsisim_concat_create(&concat, 4, count_message, &messages) != SCSISIM_SUCCESS)
+	{
+		check(false, "scsisim_concat_create", 0);
+		return;
+	}
+
+	/* Never used: nothing but padding, not even an SMSC */
+	memset(record, 0xff, sizeof(record));
+	record[0] = SIM_SMS_FREE;
+	check(scsisim_concat_add(concat, record, sizeof(record)) == SCSISIM_SUCCESS,
+	      "empty free record skipped", 0);
+
+	/* Deleted: the old message is still there */
+	build_record(record, alpha_head, sizeof(alpha_head), gsm_done, sizeof(gsm_done));
+	record[0] = SIM_SMS_FREE;
+	check(scsisim_concat_add(concat, record, sizeof(record)) == SCSISIM_SUCCESS,
+	      "deleted record skipped", 0);
+	check(messages == 0 && scsisim_concat_pending(concat) == 0, "nothing passed on", 0);
+
+	/* The same record in use */
+	record[0] = SIM_SMS_READ;
+	check(scsisim_concat_add(concat, record, sizeof(record)) == SCSISIM_SUCCESS && messages == 1,
+	      "record in use passed on", 0);
+
+	scsisim_concat_destroy(concat);
+}
+
+/**
+ * Function: test_concat_capacity
+ *
+ * Description: Each part of a concatenated SMS holds 153 septets after
+ * a header with an 8-bit reference, and 152 after one with a 16-bit 
+ * reference, less one when an escape sequence would be split. The 
+ * count and the encoder must agree on that.
+ */
+static void test_concat_capacity(void)
+{
+	static const uint16_t refs[] = { 0x12, 0x1234 };
+	static const unsigned int part_len[][3] = { { 153, 153, 0 }, { 152, 152, 2 } };
+	struct scsisim_sms sms, decoded;
+	uint8_t records[3 * GSM_SMS_RECORD_LEN];
+	char text[320], part[SCSISIM_SMS_MAX_TEXT_LEN];
+	unsigned int septets, segments, i, j;
+	int ret;
+
+	/* 151 + '€' + 151: the escape sequence goes whole into part 1 of a
+	 * 153-septet split, and whole into part 2 of a 152-septet one */
+	memset(text, 'a', 151);
+	memcpy(text + 151, "\xe2\x82\xac", 3);
+	memset(text + 154, 'a', 151);
+
+	check(scsisim_gsm_septet_count(text, 305, 0x12, &septets, &segments) == SCSISIM_SUCCESS &&
+	      septets == 304 && segments == 2,
+	      "septet count, 8-bit reference", 0x12);
+	check(scsisim_gsm_septet_count(text, 305, 0x1234, &septets, &segments) == SCSISIM_SUCCESS &&
+	      septets == 304 && segments == 3,
+	      "septet count, 16-bit reference", 0x1234);
+	check(scsisim_gsm_septet_count(text, 160, 0x1234, &septets, &segments) == SCSISIM_SUCCESS &&
+	      segments == 1,
+	      "one message at 160 septets", 160);
+
+	/* Plain ASCII, counted 16 at a time where SSE2 is there */
+	memset(text, 'a', 306);
+	check(scsisim_gsm_septet_count(text, 306, 0x12, &septets, &segments) == SCSISIM_SUCCESS &&
+	      segments == 2,
+	      "306 septets, 8-bit reference", 0x12);
+	check(scsisim_gsm_septet_count(text, 306, 0x1234, &septets, &segments) == SCSISIM_SUCCESS &&
+	      segments == 3,
+	      "306 septets, 16-bit reference", 0x1234);
+
+	memset(&sms, 0, sizeof(sms));
+	sms.status = SIM_SMS_UNSENT;
+	strcpy(sms.smsc, "+447700900900");
+	strcpy(sms.address, "+447700900123");
+	sms.charset = SIM_SMS_CHARSET_GSM;
+
+	for (i = 0; i < 2; i++)
+	{
+		sms.concat_ref = refs[i];
+		ret = scsisim_encode_sms(&sms, text, 306, records, sizeof(records));
+		check(ret == (part_len[i][2] ? 3 : 2), "parts encoded", refs[i]);
+
+		for (j = 0; ret > 0 && j < (unsigned int)ret; j++)
+		{
+			check(scsisim_decode_sms(records + j * GSM_SMS_RECORD_LEN, GSM_SMS_RECORD_LEN,
+						 &decoded, part, sizeof(part)) == SCSISIM_SUCCESS &&
+			      decoded.concat_ref == refs[i] && decoded.concat_total == ret &&
+			      decoded.concat_seq == j + 1 && decoded.text_len == part_len[i][j],
+			      "part decoded", j + 1);
+		}
+	}
+}
+
+/* EOF */
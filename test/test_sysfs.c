@@ -0,0 +1,601 @@
+/*
+ *  test_sysfs.c
+ *  Enumerate, look up and monitor readers in fake sysfs trees built in
+ *  a temporary directory, the way the kernel lays out USB mass storage
+ *  devices. The monitor reads made-up uevents from a socketpair.
+ *
+ *  Copyright (c) 2017, Chris Coffey <kpuc@sdf.org>
+ *
+ *  Permission to use, copy, modify, and/or distribute this software
+ *  for any purpose with or without fee is hereby granted, provided
+ *  that the above copyright notice and this permission notice appear
+ *  in all copies.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL
+ *  WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED
+ *  WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE
+ *  AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL
+ *  DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE, DATA
+ *  OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER
+ *  TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ *  PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#define _XOPEN_SOURCE 700
+
+#include <stdio.h>
+#include <stdarg.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <errno.h>
+#include <ftw.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <linux/limits.h>
+
+#include "scsisim.h"
+
+/* The reader in device.h, and a USB stick that is not one */
+#define READER_VENDOR	0x0420
+#define READER_PRODUCT	0x1307
+#define OTHER_VENDOR	0x0781
+#define OTHER_PRODUCT	0x5567
+
+/* Where the USB devices of the fake tree live, below its root */
+#define USB_BUS_DIR	"devices/pci0000:00/0000:00:14.0/usb1"
+
+/* Readers plugged in for the enumeration besides sg2 and sg10 */
+#define MANY_READERS	20
+
+/* Most events a dispatch of the monitor test may produce */
+#define MAX_EVENTS	8
+
+static char tmp_dir[] = "/tmp/scsisim-sysfs.XXXXXX";
+static char sysfs_root[PATH_MAX];
+static unsigned int failures;
+
+/* What the monitor's callback was called with */
+static struct scsisim_monitor_event events[MAX_EVENTS];
+static unsigned int event_count;
+
+/* Internal functions */
+static void check(bool ok, const char *what);
+static char *sysfs_path(char *buf, const char *format, ...);
+static bool make_dirs(const char *path);
+static bool write_file(const char *path, const char *value);
+static bool add_reader(const char *sg, const char *port,
+		       const char *vendor, const char *product, const char *serial);
+static bool remove_reader(const char *sg, const char *port);
+static int remove_entry(const char *path, const struct stat *st, int flag, struct FTW *ftw);
+static bool identify(const char *sg, int expected, unsigned int vendor, unsigned int product);
+static bool send_uevent(int fd, const char *action, const char *subsystem,
+			const char *devpath, const char *devname);
+static void monitor_callback(const struct scsisim_monitor_event *event, void *user_data);
+static bool got_event(unsigned int i, int action, const char *sg, const char *port, const char *serial);
+static void test_enumerate(void);
+static void test_lookup(void);
+static void test_monitor(void);
+
+
+/**
+ * Function: main
+ *
+ * Description: Run each test on a fake sysfs tree of its own, with a
+ * context pointed at it, and remove the trees.
+ */
+int main(void)
+{
+	static const struct {
+		const char *dir;
+		void (*run)(void);
+	} tests[] = {
+		{ "enumerate", test_enumerate },
+		{ "lookup", test_lookup },
+		{ "monitor", test_monitor }
+	};
+	struct scsisim_ctx *ctx;
+	unsigned int i;
+
+	if (mkdtemp(tmp_dir) == NULL)
+	{
+		perror("test_sysfs: mkdtemp");
+		return EXIT_FAILURE;
+	}
+
+	if (scsisim_ctx_create(&ctx) != SCSISIM_SUCCESS)
+	{
+		printf("test_sysfs: cannot create context\n");
+		return EXIT_FAILURE;
+	}
+
+	scsisim_ctx_bind(ctx);
+
+	for (i = 0; i < sizeof(tests) / sizeof(tests[0]); i++)
+	{
+		/* The trees are directories below tmp_dir, so that there can
+		 * be IDs above them that a lookup must not find */
+		snprintf(sysfs_root, sizeof(sysfs_root), "%s/%s", tmp_dir, tests[i].dir);
+
+		if (mkdir(sysfs_root, 0755) != 0 ||
+		    scsisim_ctx_set_sysfs_root(ctx, sysfs_root) != SCSISIM_SUCCESS)
+		{
+			printf("test_sysfs: cannot create %s\n", sysfs_root);
+			failures++;
+			break;
+		}
+
+		tests[i].run();
+	}
+
+	scsisim_ctx_bind(NULL);
+	scsisim_ctx_destroy(ctx);
+
+	nftw(tmp_dir, remove_entry, 16, FTW_DEPTH | FTW_PHYS);
+
+	if (failures > 0)
+	{
+		printf("test_sysfs: %u failures\n", failures);
+		return EXIT_FAILURE;
+	}
+
+	printf("test_sysfs: all passed\n");
+
+	return EXIT_SUCCESS;
+}
+
+/**
+ * Function: check
+ *
+ * Description: Count and report a failed check.
+ */
+static void check(bool ok, const char *what)
+{
+	if (ok)
+		return;
+
+	failures++;
+	printf("FAIL: %s\n", what);
+}
+
+/**
+ * Function: sysfs_path
+ *
+ * Parameters:
+ * buf:		(Output) Buffer of PATH_MAX bytes.
+ * format:	printf() format of a path relative to the sysfs root.
+ *
+ * Description: Make the full path of a file in the fake tree.
+ *
+ * Return value: buf
+ */
+static char *sysfs_path(char *buf, const char *format, ...)
+{
+	va_list args;
+	int len;
+
+	len = snprintf(buf, PATH_MAX, "%s/", sysfs_root);
+
+	va_start(args, format);
+	vsnprintf(buf + len, PATH_MAX - len, format, args);
+	va_end(args);
+
+	return buf;
+}
+
+/**
+ * Function: make_dirs
+ *
+ * Description: Create a directory and any missing parents, like
+ * `mkdir -p`.
+ */
+static bool make_dirs(const char *path)
+{
+	char buf[PATH_MAX], *p;
+
+	snprintf(buf, sizeof(buf), "%s", path);
+
+	for (p = buf + 1; *p != '\0'; p++)
+	{
+		if (*p != '/')
+			continue;
+
+		*p = '\0';
+
+		if (mkdir(buf, 0755) != 0 && errno != EEXIST)
+			return false;
+
+		*p = '/';
+	}
+
+	return mkdir(buf, 0755) == 0 || errno == EEXIST;
+}
+
+/**
+ * Function: write_file
+ *
+ * Description: Write a one-line sysfs attribute.
+ */
+static bool write_file(const char *path, const char *value)
+{
+	FILE *fp;
+
+	if ((fp = fopen(path, "w")) == NULL)
+		return false;
+
+	fprintf(fp, "%s\n", value);
+
+	return fclose(fp) == 0;
+}
+
+/**
+ * Function: add_reader
+ *
+ * Parameters:
+ * sg:		Name of the sg device, such as "sg3".
+ * port:	USB bus path, such as "1-3".
+ * vendor:	(Can be NULL) Contents of idVendor.
+ * product:	(Can be NULL) Contents of idProduct.
+ * serial:	(Can be NULL) Contents of serial.
+ *
+ * Description: Plug in a USB mass storage device: its device directory
+ * with the SCSI host several levels below it, the sg device at the
+ * bottom, and the class entry, a relative symlink to the sg device.
+ */
+static bool add_reader(const char *sg, const char *port,
+		       const char *vendor, const char *product, const char *serial)
+{
+	char path[PATH_MAX], target[PATH_MAX];
+
+	if (make_dirs(sysfs_path(path, USB_BUS_DIR "/%s/%s:1.0/host6/target6:0:0/6:0:0:0/scsi_generic/%s",
+				 port, port, sg)) == false ||
+	    (vendor != NULL && write_file(sysfs_path(path, USB_BUS_DIR "/%s/idVendor", port), vendor) == false) ||
+	    (product != NULL && write_file(sysfs_path(path, USB_BUS_DIR "/%s/idProduct", port), product) == false) ||
+	    (serial != NULL && write_file(sysfs_path(path, USB_BUS_DIR "/%s/serial", port), serial) == false) ||
+	    make_dirs(sysfs_path(path, "class/scsi_generic")) == false)
+		return false;
+
+	snprintf(target, sizeof(target), "../../" USB_BUS_DIR "/%s/%s:1.0/host6/target6:0:0/6:0:0:0/scsi_generic/%s",
+		 port, port, sg);
+
+	return symlink(target, sysfs_path(path, "class/scsi_generic/%s", sg)) == 0;
+}
+
+/**
+ * Function: remove_reader
+ *
+ * Description: Unplug a device added with add_reader().
+ */
+static bool remove_reader(const char *sg, const char *port)
+{
+	char path[PATH_MAX];
+
+	if (unlink(sysfs_path(path, "class/scsi_generic/%s", sg)) != 0)
+		return false;
+
+	return nftw(sysfs_path(path, USB_BUS_DIR "/%s", port), remove_entry, 16, FTW_DEPTH | FTW_PHYS) == 0;
+}
+
+/**
+ * Function: remove_entry
+ *
+ * Description: nftw() callback to remove a tree, like `rm -r`.
+ */
+static int remove_entry(const char *path, const struct stat *st, int flag, struct FTW *ftw)
+{
+	(void)st;
+	(void)flag;
+	(void)ftw;
+
+	return remove(path);
+}
+
+/**
+ * Function: identify
+ *
+ * Description: Look up an sg device, and check the result and, on
+ * success, the IDs.
+ */
+static bool identify(const char *sg, int expected, unsigned int vendor, unsigned int product)
+{
+	struct scsisim_device_info info;
+	int ret;
+
+	ret = scsisim_identify_device(sg, &info);
+
+	if (ret != expected)
+	{
+		printf("%s: got %d, expected %d\n", sg, ret, expected);
+		return false;
+	}
+
+	return ret != SCSISIM_SUCCESS || (info.vendor == vendor && info.product == product);
+}
+
+/**
+ * Function: send_uevent
+ *
+ * Parameters:
+ * fd:		Socket to send the uevent to.
+ * action:	Such as "add".
+ * subsystem:	Such as "scsi_generic".
+ * devpath:	Path of the device below the sysfs root.
+ * devname:	(Can be NULL) Name of the device node below /dev.
+ *
+ * Description: Send a uevent the way the kernel does: a header, then
+ * KEY=value strings, each followed by a NUL.
+ */
+static bool send_uevent(int fd, const char *action, const char *subsystem,
+			const char *devpath, const char *devname)
+{
+	char msg[1024];
+	int len;
+
+	len = snprintf(msg, sizeof(msg), "%s@%s", action, devpath) + 1;
+	len += snprintf(msg + len, sizeof(msg) - len, "ACTION=%s", action) + 1;
+	len += snprintf(msg + len, sizeof(msg) - len, "DEVPATH=%s", devpath) + 1;
+	len += snprintf(msg + len, sizeof(msg) - len, "SUBSYSTEM=%s", subsystem) + 1;
+
+	if (devname != NULL)
+		len += snprintf(msg + len, sizeof(msg) - len, "DEVNAME=%s", devname) + 1;
+
+	len += snprintf(msg + len, sizeof(msg) - len, "SEQNUM=%u", 4000 + event_count) + 1;
+
+	return send(fd, msg, len, 0) == len;
+}
+
+/**
+ * Function: monitor_callback
+ *
+ * Description: Monitor callback: record the event.
+ */
+static void monitor_callback(const struct scsisim_monitor_event *event, void *user_data)
+{
+	check(user_data == events, "callback user data");
+
+	if (event_count < MAX_EVENTS)
+		events[event_count] = *event;
+
+	event_count++;
+}
+
+/**
+ * Function: got_event
+ *
+ * Description: Check one of the recorded events.
+ */
+static bool got_event(unsigned int i, int action, const char *sg, const char *port, const char *serial)
+{
+	return i < event_count && i < MAX_EVENTS && events[i].action == action &&
+	       strcmp(events[i].info.name, sg) == 0 && strcmp(events[i].info.usb_path, port) == 0 &&
+	       strcmp(events[i].info.serial, serial) == 0 &&
+	       events[i].info.vendor == READER_VENDOR && events[i].info.product == READER_PRODUCT;
+}
+
+/**
+ * Function: test_enumerate
+ *
+ * Description: Enumerate an empty tree, then readers mixed with other
+ * sg devices: the readers must come out sorted by number, with their
+ * details, however many entries there is room for. Unplug one reader,
+ * and plug it in again with another serial number.
+ */
+static void test_enumerate(void)
+{
+	struct scsisim_device_info devices[MANY_READERS + 4];
+	char name[16], port[16];
+	unsigned int i;
+	bool ok;
+
+	/* Not even a scsi_generic class directory yet */
+	check(scsisim_enumerate_devices(devices, MANY_READERS + 4) == 0, "nothing to enumerate");
+
+	ok = add_reader("sg10", "1-4.2", "0420", "1307", "B0000010") &&
+	     add_reader("sg2", "1-2", "0420", "1307", NULL) &&
+	     add_reader("sg1", "1-1", "0781", "5567", "C0000001") &&
+	     add_reader("sg0", "ata1", NULL, NULL, NULL);
+
+	for (i = 0; i < MANY_READERS; i++)
+	{
+		snprintf(name, sizeof(name), "sg%u", 20 + i);
+		snprintf(port, sizeof(port), "2-%u", i + 1);
+		ok = ok && add_reader(name, port, "0420", "1307", NULL);
+	}
+
+	check(ok, "build the fake tree");
+
+	check(scsisim_enumerate_devices(devices, MANY_READERS + 4) == MANY_READERS + 2,
+	      "every reader, and only readers, enumerated");
+	check(strcmp(devices[0].name, "sg2") == 0 && strcmp(devices[0].usb_path, "1-2") == 0 &&
+	      devices[0].serial[0] == '\0' && devices[0].index == 0,
+	      "first reader is sg2");
+	check(strcmp(devices[1].name, "sg10") == 0 && strcmp(devices[1].usb_path, "1-4.2") == 0 &&
+	      strcmp(devices[1].serial, "B0000010") == 0 &&
+	      devices[1].vendor == READER_VENDOR && devices[1].product == READER_PRODUCT,
+	      "second reader is sg10");
+
+	for (i = 0; i < MANY_READERS; i++)
+	{
+		snprintf(name, sizeof(name), "sg%u", 20 + i);
+		snprintf(port, sizeof(port), "2-%u", i + 1);
+		ok = ok && strcmp(devices[i + 2].name, name) == 0 && strcmp(devices[i + 2].usb_path, port) == 0;
+	}
+
+	check(ok, "the other readers in order");
+
+	/* Less room than readers: the count is still of all of them */
+	memset(devices, 0, sizeof(devices));
+	check(scsisim_enumerate_devices(devices, 3) == MANY_READERS + 2 &&
+	      devices[2].name[0] != '\0' && devices[3].name[0] == '\0',
+	      "three entries filled in");
+	check(scsisim_enumerate_devices(NULL, 0) == MANY_READERS + 2, "count only");
+	check(scsisim_enumerate_devices(NULL, 1) == SCSISIM_INVALID_PARAM, "no array");
+
+	/* Unplug sg2, and plug it in again with a serial number */
+	check(remove_reader("sg2", "1-2"), "unplug sg2");
+	check(scsisim_enumerate_devices(devices, MANY_READERS + 4) == MANY_READERS + 1 &&
+	      strcmp(devices[0].name, "sg10") == 0,
+	      "sg2 gone");
+
+	check(add_reader("sg2", "1-2", "0420", "1307", "B0000002"), "replug sg2");
+	check(scsisim_enumerate_devices(devices, MANY_READERS + 4) == MANY_READERS + 2 &&
+	      strcmp(devices[0].name, "sg2") == 0 && strcmp(devices[0].serial, "B0000002") == 0,
+	      "sg2 back, with its serial number");
+}
+
+/**
+ * Function: test_lookup
+ *
+ * Description: Look up a reader, a device that is not one and devices
+ * with missing IDs; check that a second lookup comes from the cache,
+ * and that a device plugged in again under the same name is looked up
+ * afresh.
+ */
+static void test_lookup(void)
+{
+	struct scsisim_device_info info;
+	char path[PATH_MAX];
+
+	check(add_reader("sg3", "1-3", "0420", "1307", "A0000123") &&
+	      add_reader("sg4", "1-4", "0781", "5567", NULL) &&
+	      add_reader("sg5", "1-5", "0420", NULL, NULL) &&
+	      add_reader("sg6", "1-6", NULL, NULL, NULL),
+	      "build the fake tree");
+
+	/* IDs above the sysfs root, which sg6 must not reach */
+	snprintf(path, sizeof(path), "%s/idVendor", tmp_dir);
+	write_file(path, "0420");
+	snprintf(path, sizeof(path), "%s/idProduct", tmp_dir);
+	write_file(path, "1307");
+
+	check(scsisim_identify_device("sg3", &info) == SCSISIM_SUCCESS &&
+	      strcmp(info.name, "sg3") == 0 && strcmp(info.usb_path, "1-3") == 0 &&
+	      strcmp(info.serial, "A0000123") == 0 &&
+	      info.vendor == READER_VENDOR && info.product == READER_PRODUCT && info.index == 0,
+	      "reader found, with its bus path and serial number");
+	check(identify("sg4", SCSISIM_DEVICE_NOT_SUPPORTED, 0, 0), "other USB device not supported");
+	check(identify("sg5", SCSISIM_USB_PRODUCT_OPEN_FAILED, 0, 0), "no idProduct");
+	check(identify("sg6", SCSISIM_USB_VENDOR_OPEN_FAILED, 0, 0), "no IDs up to the sysfs root");
+	check(identify("sg7", SCSISIM_SYSFS_CHDIR_FAILED, 0, 0), "no such sg device");
+	check(identify("sda", SCSISIM_SYSFS_CHDIR_FAILED, 0, 0), "not an sg device");
+
+	/* A lookup of the same class entry comes from the cache, so a
+	 * change to its attributes goes unseen */
+	check(write_file(sysfs_path(path, USB_BUS_DIR "/1-3/idProduct"), "5567"), "change idProduct");
+	check(identify("sg3", SCSISIM_SUCCESS, READER_VENDOR, READER_PRODUCT), "second lookup is cached");
+
+	/* Another device plugged in as sg3 has a new class entry */
+	check(remove_reader("sg3", "1-3") &&
+	      add_reader("sg3", "1-3", "0781", "5567", NULL),
+	      "replug sg3");
+	check(identify("sg3", SCSISIM_DEVICE_NOT_SUPPORTED, 0, 0), "replugged sg3 looked up again");
+	check(scsisim_identify_device("sg3", &info) == SCSISIM_DEVICE_NOT_SUPPORTED &&
+	      info.vendor == OTHER_VENDOR && info.product == OTHER_PRODUCT && info.serial[0] == '\0',
+	      "replugged sg3 has the new IDs");
+
+	/* And back again, as a reader */
+	check(remove_reader("sg3", "1-3") &&
+	      add_reader("sg3", "1-3", "0420", "1307", NULL),
+	      "replug sg3 again");
+	check(identify("sg3", SCSISIM_SUCCESS, READER_VENDOR, READER_PRODUCT), "reader is back");
+}
+
+/**
+ * Function: test_monitor
+ *
+ * Description: Feed a monitor uevents over a socketpair, as the kernel
+ * would send them when readers and other devices come and go, and check
+ * that only supported readers are reported, each change once.
+ */
+static void test_monitor(void)
+{
+	struct scsisim_monitor *monitor;
+	int sv[2];
+
+	check(add_reader("sg1", "1-1", "0420", "1307", "A0000001"), "build the fake tree");
+
+	if (socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0, sv) != 0)
+	{
+		check(false, "socketpair");
+		return;
+	}
+
+	check(scsisim_monitor_create(&monitor, sv[0], NULL, NULL) == SCSISIM_INVALID_PARAM, "no callback");
+
+	if (scsisim_monitor_create(&monitor, sv[0], monitor_callback, events) != SCSISIM_SUCCESS)
+	{
+		check(false, "scsisim_monitor_create");
+		close(sv[0]);
+		close(sv[1]);
+		return;
+	}
+
+	check(scsisim_monitor_get_fd(monitor) == sv[0], "monitor socket");
+
+	/* The reader that is already there, found without a uevent */
+	check(scsisim_monitor_dispatch(monitor, 1000) == 1 && got_event(0, SCSISIM_MONITOR_ADD, "sg1", "1-1", "A0000001"),
+	      "reader present at start");
+	event_count = 0;
+	check(scsisim_monitor_dispatch(monitor, 0) == 0 && event_count == 0, "nothing more");
+
+	/* A reader and a USB stick plugged in. The USB layers of each send
+	 * uevents too, a reader may be announced twice, and a device may be
+	 * gone before its uevent is read */
+	check(add_reader("sg2", "1-2", "0420", "1307", NULL) &&
+	      add_reader("sg3", "1-3", "0781", "5567", "C0000003"),
+	      "plug in sg2 and sg3");
+	check(send_uevent(sv[1], "add", "usb", "/" USB_BUS_DIR "/1-2", "bus/usb/001/005") &&
+	      send_uevent(sv[1], "add", "scsi_generic",
+			  "/" USB_BUS_DIR "/1-2/1-2:1.0/host6/target6:0:0/6:0:0:0/scsi_generic/sg2", "sg2") &&
+	      send_uevent(sv[1], "add", "scsi_generic",
+			  "/" USB_BUS_DIR "/1-3/1-3:1.0/host6/target6:0:0/6:0:0:0/scsi_generic/sg3", NULL) &&
+	      send_uevent(sv[1], "bind", "usb", "/" USB_BUS_DIR "/1-2", NULL) &&
+	      send_uevent(sv[1], "add", "scsi_generic",
+			  "/" USB_BUS_DIR "/1-2/1-2:1.0/host6/target6:0:0/6:0:0:0/scsi_generic/sg2", "sg2") &&
+	      send_uevent(sv[1], "add", "scsi_generic",
+			  "/" USB_BUS_DIR "/1-9/1-9:1.0/host6/target6:0:0/6:0:0:0/scsi_generic/sg9", "sg9") &&
+	      send(sv[1], "garbage", 7, 0) == 7,
+	      "send uevents");
+	check(scsisim_monitor_dispatch(monitor, 1000) == 1 && event_count == 1 &&
+	      got_event(0, SCSISIM_MONITOR_ADD, "sg2", "1-2", ""),
+	      "only sg2 added");
+
+	/* sg1 unplugged: its removal is reported with what was known when
+	 * it was added, since sysfs no longer has it */
+	event_count = 0;
+	check(remove_reader("sg1", "1-1"), "unplug sg1");
+	check(send_uevent(sv[1], "remove", "scsi_generic",
+			  "/" USB_BUS_DIR "/1-1/1-1:1.0/host6/target6:0:0/6:0:0:0/scsi_generic/sg1", "sg1") &&
+	      send_uevent(sv[1], "remove", "scsi_generic",
+			  "/" USB_BUS_DIR "/1-3/1-3:1.0/host6/target6:0:0/6:0:0:0/scsi_generic/sg3", "sg3") &&
+	      send_uevent(sv[1], "remove", "scsi_generic",
+			  "/" USB_BUS_DIR "/1-1/1-1:1.0/host6/target6:0:0/6:0:0:0/scsi_generic/sg1", "sg1"),
+	      "send uevents");
+	check(scsisim_monitor_dispatch(monitor, 1000) == 1 && event_count == 1 &&
+	      got_event(0, SCSISIM_MONITOR_REMOVE, "sg1", "1-1", "A0000001"),
+	      "only sg1 removed");
+
+	/* The removal of sg2 is missed, and another reader takes its name */
+	event_count = 0;
+	check(remove_reader("sg2", "1-2") &&
+	      add_reader("sg2", "1-7", "0420", "1307", "A0000007"),
+	      "replug sg2");
+	check(send_uevent(sv[1], "add", "scsi_generic",
+			  "/" USB_BUS_DIR "/1-7/1-7:1.0/host6/target6:0:0/6:0:0:0/scsi_generic/sg2", "sg2"),
+	      "send uevent");
+	check(scsisim_monitor_dispatch(monitor, 1000) == 2 && event_count == 2 &&
+	      got_event(0, SCSISIM_MONITOR_REMOVE, "sg2", "1-2", "") &&
+	      got_event(1, SCSISIM_MONITOR_ADD, "sg2", "1-7", "A0000007"),
+	      "old sg2 removed, new sg2 added");
+
+	/* Nothing more, even once the other end is closed */
+	event_count = 0;
+	check(scsisim_monitor_dispatch(monitor, 50) == 0 && event_count == 0, "no more events");
+	close(sv[1]);
+	check(scsisim_monitor_dispatch(monitor, 50) == 0 && event_count == 0, "other end closed");
+
+	scsisim_monitor_destroy(monitor);
+}
+
+/* EOF */
@@ -0,0 +1,268 @@
+/*
+ *  test_threads.c
+ *  Stress test: drive several virtual SIM cards at once, one per
+ *  thread, each thread with its own library context. Build it with
+ *  'make tsan' to run it under ThreadSanitizer.
+ *
+ *  Copyright (c) 2017, Chris Coffey <kpuc@sdf.org>
+ *
+ *  Permission to use, copy, modify, and/or distribute this software
+ *  for any purpose with or without fee is hereby granted, provided
+ *  that the above copyright notice and this permission notice appear
+ *  in all copies.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL
+ *  WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED
+ *  WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE
+ *  AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL
+ *  DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE, DATA
+ *  OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER
+ *  TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ *  PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdbool.h>
+#include <pthread.h>
+
+#include "scsisim.h"
+#include "gsm.h"
+
+#define TEST_THREADS		8	/* Devices driven at once */
+#define TEST_ITERATIONS		20	/* Times each thread opens a card */
+#define TEST_ADN_RECORDS	250	/* Records of EF-ADN on the default card */
+#define TEST_ADN_RECORD_LEN	28
+
+/* Struct to hold the state of one thread */
+struct worker {
+	pthread_t thread;
+	pthread_t self;			/* Set by the thread itself */
+	unsigned int id;
+	unsigned int failures;
+	unsigned long messages;		/* Logged through its own context */
+	bool foreign_message;		/* Logged from another thread */
+	uint8_t adn[TEST_ADN_RECORDS * TEST_ADN_RECORD_LEN];
+	int status[TEST_ADN_RECORDS];
+};
+
+static struct worker workers[TEST_THREADS];
+
+/* Internal functions */
+static void *worker_main(void *arg);
+static void worker_log(void *user_data, int level, const char *msg);
+static void run_card(struct worker *w, unsigned int iteration);
+static void check(struct worker *w, bool ok, const char *what);
+
+
+/**
+ * Function: main
+ *
+ * Description: Start TEST_THREADS workers, toggle the verbose setting of
+ * the default context while they run (which must not reach them), and
+ * check what every worker saw. Verbose mode also dumps every APDU to
+ * stderr, so that goes away.
+ */
+int main(void)
+{
+	unsigned int i, k, failures = 0;
+
+	if (freopen("/dev/null", "w", stderr) == NULL)
+	{
+		perror("test_threads: /dev/null");
+		return EXIT_FAILURE;
+	}
+
+	for (i = 0; i < TEST_THREADS; i++)
+	{
+		workers[i].id = i;
+
+		if (pthread_create(&workers[i].thread, NULL, worker_main, &workers[i]) != 0)
+		{
+			printf("test_threads: cannot start thread %u\n", i);
+			return EXIT_FAILURE;
+		}
+	}
+
+	for (k = 0; k < 1000; k++)
+	{
+		scsisim_verbose_enable();
+		scsisim_verbose_disable();
+	}
+
+	for (i = 0; i < TEST_THREADS; i++)
+	{
+		pthread_join(workers[i].thread, NULL);
+
+		if (workers[i].messages == 0 || workers[i].foreign_message)
+		{
+			printf("FAIL: thread %u: %lu messages%s\n", i, workers[i].messages,
+			       workers[i].foreign_message ? ", some from another thread" : "");
+			workers[i].failures++;
+		}
+
+		failures += workers[i].failures;
+	}
+
+	if (failures > 0)
+	{
+		printf("test_threads: %u failures\n", failures);
+		return EXIT_FAILURE;
+	}
+
+	printf("test_threads: all passed (%u threads, %u cards each)\n", TEST_THREADS, TEST_ITERATIONS);
+
+	return EXIT_SUCCESS;
+}
+
+/**
+ * Function: worker_main
+ *
+ * Parameters:
+ * arg:		Pointer to the worker struct.
+ *
+ * Description: Bind a verbose context of its own that logs to
+ * worker_log(), and open, use and close a virtual card over and over.
+ */
+static void *worker_main(void *arg)
+{
+	struct worker *w = arg;
+	struct scsisim_ctx *ctx;
+	unsigned int i;
+
+	w->self = pthread_self();
+
+	if (scsisim_ctx_create(&ctx) != SCSISIM_SUCCESS)
+	{
+		w->failures++;
+		return NULL;
+	}
+
+	scsisim_ctx_set_log(ctx, worker_log, w);
+	scsisim_ctx_bind(ctx);
+	scsisim_verbose_enable();
+
+	for (i = 0; i < TEST_ITERATIONS; i++)
+		run_card(w, i);
+
+	scsisim_ctx_bind(NULL);
+	scsisim_ctx_destroy(ctx);
+
+	return NULL;
+}
+
+/**
+ * Function: worker_log
+ *
+ * Description: Log handler of a worker's context: count the messages,
+ * and note any that come from a thread the context is not bound to.
+ */
+static void worker_log(void *user_data, int level, const char *msg)
+{
+	struct worker *w = user_data;
+
+	(void)level;
+	(void)msg;
+
+	if (pthread_equal(pthread_self(), w->self) == 0)
+		w->foreign_message = true;
+
+	w->messages++;
+}
+
+/**
+ * Function: run_card
+ *
+ * Parameters:
+ * w:		Worker.
+ * iteration:	How many cards the worker has run before.
+ *
+ * Description: Open a new virtual card with the default contents,
+ * import contacts with pipelined writes (one with a long number, for
+ * the extension EF), read the whole EF back, and check the contacts
+ * came back with this worker's names, along with a few error strings.
+ */
+static void run_card(struct worker *w, unsigned int iteration)
+{
+	struct scsisim_vcard *card;
+	struct scsisim_dev device;
+	struct GSM_response resp;
+	struct scsisim_adn adn;
+	char name[32], alpha[SCSISIM_ADN_MAX_ALPHA_LEN], msg[64];
+	uint8_t recnos[3], bitmap[SCSISIM_RECORD_BITMAP_LEN];
+	unsigned int i;
+	struct scsisim_contact contacts[3] = {
+		{ name, "+15551234567", 0 },
+		{ "Дмитрий", "1234567890123456789012345", 0 },
+		{ "x", "1", 0 }
+	};
+
+	snprintf(name, sizeof(name), "Thread %u/%u", w->id, iteration);
+
+	if (scsisim_vcard_create(&card) != SCSISIM_SUCCESS)
+	{
+		check(w, false, "scsisim_vcard_create");
+		return;
+	}
+
+	if (scsisim_vcard_load_default(card) != SCSISIM_SUCCESS ||
+	    scsisim_open_virtual_device(card, &device) != SCSISIM_SUCCESS)
+	{
+		check(w, false, "open virtual device");
+		scsisim_vcard_destroy(card);
+		return;
+	}
+
+	check(w, scsisim_init_device(&device) == SCSISIM_SUCCESS, "scsisim_init_device");
+	check(w, scsisim_select_path(&device, "3F00/7F10") >= 0, "scsisim_select_path");
+
+	check(w, scsisim_import_adn(&device, GSM_FILE_EF_ADN, GSM_FILE_EF_EXT1,
+				    contacts, 3, recnos, NULL) == SCSISIM_SUCCESS,
+	      "scsisim_import_adn");
+
+	/* The default card has two contacts, so nothing else is used */
+	check(w, scsisim_find_free_adn(&device, GSM_FILE_EF_ADN, bitmap, sizeof(bitmap)) ==
+		 TEST_ADN_RECORDS - 5,
+	      "scsisim_find_free_adn");
+
+	check(w, scsisim_read_records_range(&device, GSM_FILE_EF_ADN, 1, 0, w->adn, sizeof(w->adn),
+					    &resp, w->status, TEST_ADN_RECORDS) == SCSISIM_SUCCESS,
+	      "scsisim_read_records_range");
+
+	for (i = 0; i < 3; i++)
+	{
+		check(w, recnos[i] >= 1 && recnos[i] <= TEST_ADN_RECORDS &&
+			 scsisim_decode_adn(GSM_FILE_EF_ADN, w->adn + (recnos[i] - 1) * TEST_ADN_RECORD_LEN,
+					    TEST_ADN_RECORD_LEN, &adn, alpha, sizeof(alpha)) == SCSISIM_SUCCESS &&
+			 strcmp(alpha, contacts[i].name) == 0,
+		      "contact read back");
+	}
+
+	/* Error strings, both kinds, while other threads make their own */
+	check(w, strcmp(scsisim_strerror(SCSISIM_INVALID_PARAM), scsisim_strerror(SCSISIM_INVALID_PARAM)) == 0,
+	      "scsisim_strerror");
+	check(w, scsisim_strerror_r(SCSISIM_NO_FREE_RECORDS, msg, sizeof(msg)) == SCSISIM_SUCCESS &&
+		 strcmp(msg, scsisim_strerror(SCSISIM_NO_FREE_RECORDS)) == 0,
+	      "scsisim_strerror_r");
+
+	scsisim_close_device(&device);
+	scsisim_vcard_destroy(card);
+}
+
+/**
+ * Function: check
+ *
+ * Description: Count and report a failed check of a worker.
+ */
+static void check(struct worker *w, bool ok, const char *what)
+{
+	if (ok)
+		return;
+
+	if (w->failures++ < 5)
+		printf("FAIL: thread %u: %s\n", w->id, what);
+}
+
+/* EOF */
@@ -0,0 +1,875 @@
+/*
+ *  test_vcard.c
+ *  Drive the virtual SIM card through the public interface: SELECT,
+ *  READ and UPDATE, SEEK, CHVs and the errors they map to, and the
+ *  asynchronous, reactor, bulk read, path, cache, bitmap and batch write
+ *  layers on top of them.
+ *
+ *  Copyright (c) 2017, Chris Coffey <kpuc@sdf.org>
+ *
+ *  Permission to use, copy, modify, and/or distribute this software
+ *  for any purpose with or without fee is hereby granted, provided
+ *  that the above copyright notice and this permission notice appear
+ *  in all copies.
+ *
+ *  THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL
+ *  WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED
+ *  WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE
+ *  AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL
+ *  DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE, DATA
+ *  OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER
+ *  TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ *  PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdbool.h>
+
+#include "scsisim.h"
+#include "gsm.h"
+
+/* A linear fixed EF added to DF-TELECOM of the default card, whose
+ * records start with a status byte like those of EF-SMS, and then their
+ * own number */
+#define TEST_EF			GSM_FILE_EF_SDN
+#define TEST_RECORDS		6
+#define TEST_RECORD_LEN		10
+
+static const uint8_t test_status[TEST_RECORDS] = { 0x01, 0x00, 0x03, 0x00, 0x01, 0x03 };
+
+static unsigned int failures;
+
+/* A command driven by the reactor, and how many completed */
+struct test_completion {
+	struct scsisim_completion completion;	/* Must be first */
+	unsigned int *done;
+	int status;
+};
+
+/* Internal functions */
+static void check(bool ok, const char *what);
+static bool open_card(struct scsisim_vcard **card, struct scsisim_dev *device);
+static void close_card(struct scsisim_vcard *card, struct scsisim_dev *device);
+static int chv1_attempts(struct scsisim_dev *device);
+static void test_open(void);
+static void test_files(void);
+static void test_errors(void);
+static void test_seek(void);
+static void test_chv(void);
+static void test_async(void);
+static void reactor_done(struct scsisim_dev *device, const struct scsisim_request *req);
+static void test_reactor(void);
+static void test_bulk_read(void);
+static void test_path_and_cache(void);
+static void test_bitmaps(void);
+static void test_import_adn(void);
+
+
+/**
+ * Function: main
+ *
+ * Description: Run each test on a fresh virtual card.
+ */
+int main(void)
+{
+	test_open();
+	test_files();
+	test_errors();
+	test_seek();
+	test_chv();
+	test_async();
+	test_reactor();
+	test_bulk_read();
+	test_path_and_cache();
+	test_bitmaps();
+	test_import_adn();
+
+	if (failures > 0)
+	{
+		printf("test_vcard: %u failures\n", failures);
+		return EXIT_FAILURE;
+	}
+
+	printf("test_vcard: all passed\n");
+
+	return EXIT_SUCCESS;
+}
+
+/**
+ * Function: check
+ *
+ * Description: Count and report a failed check.
+ */
+static void check(bool ok, const char *what)
+{
+	if (ok)
+		return;
+
+	failures++;
+	printf("FAIL: %s\n", what);
+}
+
+/**
+ * Function: open_card
+ *
+ * Parameters:
+ * card:	(Output) New virtual card.
+ * device:	(Output) Device it is open as.
+ *
+ * Description: Create a card with the default contents plus TEST_EF,
+ * open it and initialize the reader.
+ */
+static bool open_card(struct scsisim_vcard **card, struct scsisim_dev *device)
+{
+	uint8_t contents[TEST_RECORDS * TEST_RECORD_LEN];
+	unsigned int i;
+
+	memset(contents, 0xff, sizeof(contents));
+
+	for (i = 0; i < TEST_RECORDS; i++)
+	{
+		contents[i * TEST_RECORD_LEN] = test_status[i];
+		contents[i * TEST_RECORD_LEN + 1] = i + 1;
+	}
+
+	if (scsisim_vcard_create(card) != SCSISIM_SUCCESS)
+	{
+		check(false, "scsisim_vcard_create");
+		return false;
+	}
+
+	if (scsisim_vcard_load_default(*card) != SCSISIM_SUCCESS ||
+	    scsisim_vcard_add_ef(*card, GSM_FILE_DF_TELECOM, TEST_EF, SIM_EF_LINEAR_FIXED,
+				 sizeof(contents), TEST_RECORD_LEN, contents) != SCSISIM_SUCCESS ||
+	    scsisim_open_virtual_device(*card, device) != SCSISIM_SUCCESS)
+	{
+		check(false, "open virtual card");
+		scsisim_vcard_destroy(*card);
+		return false;
+	}
+
+	if (scsisim_init_device(device) != SCSISIM_SUCCESS)
+	{
+		check(false, "scsisim_init_device");
+		close_card(*card, device);
+		return false;
+	}
+
+	return true;
+}
+
+/**
+ * Function: close_card
+ *
+ * Description: Close and free a card opened with open_card().
+ */
+static void close_card(struct scsisim_vcard *card, struct scsisim_dev *device)
+{
+	check(scsisim_close_device(device) == SCSISIM_SUCCESS, "scsisim_close_device");
+	scsisim_vcard_destroy(card);
+}
+
+/**
+ * Function: chv1_attempts
+ *
+ * Description: Select the MF afresh and get the CHV1 attempts left from
+ * its GET RESPONSE data, or -1 on failure.
+ */
+static int chv1_attempts(struct scsisim_dev *device)
+{
+	struct GSM_response resp;
+	uint8_t data[64];
+	int ret;
+
+	/* The cached response would have the count as it was */
+	scsisim_cache_invalidate(device);
+
+	if ((ret = scsisim_select_file(device, GSM_FILE_MF)) <= 0 ||
+	    scsisim_get_response(device, data, ret, SIM_SELECT_MF_DF, &resp) != SCSISIM_SUCCESS)
+		return -1;
+
+	return resp.type.mf_df.CHV1_attempts_remaining;
+}
+
+/**
+ * Function: test_open
+ *
+ * Description: A device opened on a virtual card starts out
+ * uninitialized, whatever the struct held; the fast initialization
+ * then finds the reader ready, or initializes it.
+ */
+static void test_open(void)
+{
+	struct scsisim_vcard *card;
+	struct scsisim_dev device;
+
+	if (scsisim_vcard_create(&card) != SCSISIM_SUCCESS)
+	{
+		check(false, "scsisim_vcard_create");
+		return;
+	}
+
+	memset(&device, 0, sizeof(device));
+	device.init_state = SCSISIM_INIT_FULL;
+
+	check(scsisim_open_virtual_device(card, &device) == SCSISIM_SUCCESS &&
+	      device.init_state == SCSISIM_INIT_NONE,
+	      "opened uninitialized");
+	check(scsisim_open_virtual_device(card, &device) == SCSISIM_INVALID_PARAM, "card open twice");
+	check(scsisim_init_device_fast(&device) == SCSISIM_SUCCESS &&
+	      device.init_state == SCSISIM_INIT_PROBED,
+	      "ready reader probed");
+	check(scsisim_close_device(&device) == SCSISIM_SUCCESS &&
+	      device.init_state == SCSISIM_INIT_NONE,
+	      "closed");
+
+	scsisim_vcard_set_reader_initialized(card, false);
+	check(scsisim_open_virtual_device(card, &device) == SCSISIM_SUCCESS &&
+	      scsisim_init_device_fast(&device) == SCSISIM_SUCCESS &&
+	      device.init_state == SCSISIM_INIT_FULL,
+	      "unready reader initialized");
+
+	close_card(card, &device);
+}
+
+/**
+ * Function: test_files
+ *
+ * Description: Select the MF, a DF and EFs, read their GET RESPONSE
+ * data, and read and update records and binary data.
+ */
+static void test_files(void)
+{
+	struct scsisim_vcard *card;
+	struct scsisim_dev device;
+	struct GSM_response resp;
+	uint8_t data[64], record[TEST_RECORD_LEN], iccid[10];
+	int ret;
+
+	if (open_card(&card, &device) == false)
+		return;
+
+	ret = scsisim_select_file(&device, GSM_FILE_MF);
+	check(ret > 0 && scsisim_get_response(&device, data, ret, SIM_SELECT_MF_DF, &resp) == SCSISIM_SUCCESS &&
+	      resp.type.mf_df.file_id == GSM_FILE_MF && resp.type.mf_df.df_children == 2,
+	      "MF");
+
+	ret = scsisim_select_file(&device, GSM_FILE_EF_ICCID);
+	check(ret > 0 && scsisim_get_response(&device, data, ret, SIM_SELECT_EF, &resp) == SCSISIM_SUCCESS &&
+	      resp.type.ef.file_id == GSM_FILE_EF_ICCID && resp.type.ef.file_size == sizeof(iccid) &&
+	      resp.type.ef.structure == SIM_EF_TRANSPARENT,
+	      "EF-ICCID");
+
+	/* Write the ICCID back reversed, and read it again */
+	check(scsisim_read_binary(&device, iccid, 0, sizeof(iccid)) == SCSISIM_SUCCESS, "read EF-ICCID");
+	memcpy(data, iccid, sizeof(iccid));
+	data[0] = iccid[9];
+	data[9] = iccid[0];
+	check(scsisim_update_binary(&device, data, 0, sizeof(iccid)) == SCSISIM_SUCCESS &&
+	      scsisim_read_binary(&device, data + 16, 0, sizeof(iccid)) == SCSISIM_SUCCESS &&
+	      memcmp(data, data + 16, sizeof(iccid)) == 0,
+	      "update EF-ICCID");
+	check(scsisim_read_binary(&device, data, 8, 2) == SCSISIM_SUCCESS && data[1] == iccid[0],
+	      "read EF-ICCID from an offset");
+
+	ret = scsisim_select_file(&device, GSM_FILE_DF_TELECOM);
+	check(ret > 0, "DF-TELECOM");
+
+	ret = scsisim_select_file(&device, TEST_EF);
+	check(ret > 0 && scsisim_get_response(&device, data, ret, SIM_SELECT_EF, &resp) == SCSISIM_SUCCESS &&
+	      resp.type.ef.file_size == TEST_RECORDS * TEST_RECORD_LEN &&
+	      resp.type.ef.structure == SIM_EF_LINEAR_FIXED &&
+	      resp.type.ef.record_len == TEST_RECORD_LEN,
+	      "linear fixed EF");
+
+	check(scsisim_read_record(&device, 3, record, sizeof(record)) == SCSISIM_SUCCESS &&
+	      record[0] == test_status[2] && record[1] == 3 && record[2] == 0xff,
+	      "read record 3");
+
+	memset(record, 0x5a, sizeof(record));
+	check(scsisim_update_record(&device, 6, record, sizeof(record)) == SCSISIM_SUCCESS, "update record 6");
+	memset(record, 0, sizeof(record));
+	check(scsisim_read_record(&device, 6, record, sizeof(record)) == SCSISIM_SUCCESS &&
+	      record[0] == 0x5a && record[TEST_RECORD_LEN - 1] == 0x5a,
+	      "record 6 read back");
+	check(scsisim_read_record(&device, 5, record, sizeof(record)) == SCSISIM_SUCCESS && record[1] == 5,
+	      "record 5 untouched");
+
+	close_card(card, &device);
+}
+
+/**
+ * Function: test_errors
+ *
+ * Description: Provoke each status word the card answers a bad command
+ * with, and check the error it is mapped to.
+ */
+static void test_errors(void)
+{
+	struct scsisim_vcard *card;
+	struct scsisim_dev device;
+	uint8_t data[TEST_RECORD_LEN + 1];
+
+	if (open_card(&card, &device) == false)
+		return;
+
+	check(scsisim_select_file(&device, 0x6fff) == SCSISIM_GSM_FILE_NOT_FOUND, "94 04: no such file");
+	check(scsisim_select_file(&device, GSM_FILE_MF) > 0 &&
+	      scsisim_read_binary(&device, data, 0, 1) == SCSISIM_GSM_NO_EF_SELECTED,
+	      "94 00: no EF selected");
+	check(scsisim_select_file(&device, GSM_FILE_EF_ICCID) > 0 &&
+	      scsisim_read_binary(&device, data, 10, 1) == SCSISIM_GSM_ERROR_PARAM_1_OR_2,
+	      "6B 00: offset past the end");
+	check(scsisim_read_binary(&device, data, 8, 4) == SCSISIM_GSM_ERROR_PARAM_3,
+	      "67 XX: read past the end");
+	check(scsisim_read_record(&device, 1, data, TEST_RECORD_LEN) == SCSISIM_GSM_FILE_INCONSISTENT_WITH_COMMAND,
+	      "94 08: record of a transparent EF");
+
+	check(scsisim_select_file(&device, GSM_FILE_DF_TELECOM) > 0 &&
+	      scsisim_select_file(&device, TEST_EF) > 0 &&
+	      scsisim_read_record(&device, TEST_RECORDS + 1, data, TEST_RECORD_LEN) == SCSISIM_GSM_INVALID_ADDRESS,
+	      "94 02: no such record");
+	check(scsisim_read_record(&device, 1, data, TEST_RECORD_LEN + 1) == SCSISIM_GSM_ERROR_PARAM_3,
+	      "67 XX: wrong record length");
+	check(scsisim_read_binary(&device, data, 0, 1) == SCSISIM_GSM_FILE_INCONSISTENT_WITH_COMMAND,
+	      "94 08: binary of a linear fixed EF");
+
+	/* EF-ADN needs CHV1 once CHV1 is enabled */
+	check(scsisim_vcard_set_chv(card, 1, "1234", true, 3) == SCSISIM_SUCCESS, "set CHV1");
+	check(scsisim_select_file(&device, GSM_FILE_EF_ADN) > 0 &&
+	      scsisim_read_record(&device, 1, data, 28) == SCSISIM_GSM_CHV_VERIFICATION_FAILED,
+	      "98 04: access condition not fulfilled");
+
+	check(scsisim_send_raw_command(&device, SIM_READ, 0x12, 0, 0, 1, data, 1) == SCSISIM_GSM_UNKNOWN_INSTRUCTION,
+	      "6D 00: unknown instruction");
+
+	close_card(card, &device);
+}
+
+/**
+ * Function: test_seek
+ *
+ * Description: Look for records by their first bytes in each direction,
+ * with and without the record number, and check the record pointer is
+ * left on the match.
+ */
+static void test_seek(void)
+{
+	static const uint8_t unread[] = { 0x03 }, free_record[] = { 0x00 }, nothing[] = { 0x07 };
+	static const uint8_t read4[] = { 0x00, 0x04 };
+	struct scsisim_vcard *card;
+	struct scsisim_dev device;
+	uint8_t record[TEST_RECORD_LEN];
+
+	if (open_card(&card, &device) == false)
+		return;
+
+	check(scsisim_select_file(&device, GSM_FILE_DF_TELECOM) > 0 &&
+	      scsisim_select_file(&device, TEST_EF) > 0,
+	      "select the EF");
+
+	check(scsisim_seek(&device, SIM_SEEK_TYPE_2, SIM_SEEK_FROM_START, unread, 1) == 3, "first unread");
+	check(scsisim_seek(&device, SIM_SEEK_TYPE_2, SIM_SEEK_NEXT, unread, 1) == 6, "next unread");
+	check(scsisim_seek(&device, SIM_SEEK_TYPE_2, SIM_SEEK_NEXT, unread, 1) == SCSISIM_GSM_FILE_NOT_FOUND,
+	      "no more unread");
+	check(scsisim_seek(&device, SIM_SEEK_TYPE_2, SIM_SEEK_PREVIOUS, unread, 1) == 3,
+	      "previous unread, from where the pointer was left");
+	check(scsisim_seek(&device, SIM_SEEK_TYPE_2, SIM_SEEK_FROM_END, free_record, 1) == 4, "last free");
+	check(scsisim_seek(&device, SIM_SEEK_TYPE_2, SIM_SEEK_FROM_START, read4, sizeof(read4)) == 4,
+	      "two-byte pattern");
+	check(scsisim_seek(&device, SIM_SEEK_TYPE_2, SIM_SEEK_FROM_START, nothing, 1) == SCSISIM_GSM_FILE_NOT_FOUND,
+	      "no match");
+
+	/* Type 1 only moves the pointer: read on from it */
+	check(scsisim_seek(&device, SIM_SEEK_TYPE_1, SIM_SEEK_FROM_START, free_record, 1) == SCSISIM_SUCCESS,
+	      "type 1 match");
+	check(scsisim_send_raw_command(&device, SIM_READ, GSM_CMD_READ_RECORD, 0, 0x02,
+				       TEST_RECORD_LEN, record, sizeof(record)) == SCSISIM_SUCCESS &&
+	      record[1] == 3,
+	      "next record after the match");
+
+	check(scsisim_seek(&device, SIM_SEEK_TYPE_2, SIM_SEEK_FROM_START, unread, 0) == SCSISIM_INVALID_PARAM,
+	      "empty pattern");
+
+	close_card(card, &device);
+}
+
+/**
+ * Function: test_chv
+ *
+ * Description: Verify CHVs: uninitialized, disabled, wrong, right and
+ * blocked. A correct VERIFY restores the number of attempts the CHV was
+ * set up with, not a fixed number.
+ */
+static void test_chv(void)
+{
+	struct scsisim_vcard *card;
+	struct scsisim_dev device;
+	uint8_t imsi[9];
+
+	if (open_card(&card, &device) == false)
+		return;
+
+	check(scsisim_verify_chv(&device, 2, "5678") == SCSISIM_GSM_NO_CHV_INITIALIZED, "98 02: no CHV2");
+	check(scsisim_vcard_set_chv(card, 1, "1234", false, 5) == SCSISIM_SUCCESS &&
+	      scsisim_verify_chv(&device, 1, "1234") == SCSISIM_GSM_CHV_STATUS_CONTRADICTION,
+	      "98 08: CHV1 disabled");
+	check(scsisim_verify_chv(&device, 1, "12a4") == SCSISIM_INVALID_PIN, "PIN not digits");
+
+	check(scsisim_vcard_set_chv(card, 1, "1234", true, 5) == SCSISIM_SUCCESS &&
+	      scsisim_vcard_set_chv(card, 2, "5678", true, 2) == SCSISIM_SUCCESS,
+	      "set CHV1 and CHV2");
+	check(chv1_attempts(&device) == 5, "five attempts");
+
+	check(scsisim_select_file(&device, GSM_FILE_DF_GSM) > 0 &&
+	      scsisim_select_file(&device, GSM_FILE_EF_IMSI) > 0 &&
+	      scsisim_read_binary(&device, imsi, 0, sizeof(imsi)) == SCSISIM_GSM_CHV_VERIFICATION_FAILED,
+	      "EF-IMSI needs CHV1");
+
+	check(scsisim_verify_chv(&device, 1, "4321") == SCSISIM_GSM_CHV_VERIFICATION_FAILED &&
+	      scsisim_verify_chv(&device, 1, "1243") == SCSISIM_GSM_CHV_VERIFICATION_FAILED,
+	      "wrong CHV1");
+	check(chv1_attempts(&device) == 3, "two attempts used");
+
+	check(scsisim_verify_chv(&device, 1, "1234") == SCSISIM_SUCCESS, "right CHV1");
+	check(chv1_attempts(&device) == 5, "attempts restored to those set up");
+	check(scsisim_select_file(&device, GSM_FILE_DF_GSM) > 0 &&
+	      scsisim_select_file(&device, GSM_FILE_EF_IMSI) > 0 &&
+	      scsisim_read_binary(&device, imsi, 0, sizeof(imsi)) == SCSISIM_SUCCESS,
+	      "EF-IMSI after CHV1");
+
+	/* Two wrong tries block CHV2, and then even the right one fails */
+	check(scsisim_verify_chv(&device, 2, "0000") == SCSISIM_GSM_CHV_VERIFICATION_FAILED &&
+	      scsisim_verify_chv(&device, 2, "0000") == SCSISIM_GSM_CHV_BLOCKED,
+	      "98 40: CHV2 blocked");
+	check(scsisim_verify_chv(&device, 2, "5678") == SCSISIM_GSM_CHV_BLOCKED, "blocked CHV2 stays blocked");
+
+	close_card(card, &device);
+}
+
+/**
+ * Function: test_async
+ *
+ * Description: Queue a SELECT and the reads and writes of every record,
+ * reap them in order, and check the queue limit and an empty queue.
+ */
+static void test_async(void)
+{
+	struct scsisim_vcard *card;
+	struct scsisim_dev device;
+	struct scsisim_request req;
+	uint8_t records[TEST_RECORDS][TEST_RECORD_LEN], update[TEST_RECORD_LEN];
+	unsigned int i, tags[TEST_RECORDS + 2];
+	int ret;
+
+	if (open_card(&card, &device) == false)
+		return;
+
+	check(scsisim_reap(&device, &req, 0) == SCSISIM_NO_COMMANDS_PENDING, "nothing to reap");
+
+	memset(update, 0x77, sizeof(update));
+
+	check(scsisim_select_file(&device, GSM_FILE_DF_TELECOM) > 0 &&
+	      scsisim_submit_select_file(&device, TEST_EF, &tags[0]) == SCSISIM_SUCCESS &&
+	      scsisim_submit_update_record(&device, 2, update, sizeof(update), &tags[1]) == SCSISIM_SUCCESS,
+	      "submit SELECT and UPDATE RECORD");
+
+	for (i = 0; i < TEST_RECORDS; i++)
+		check(scsisim_submit_read_record(&device, i + 1, records[i], TEST_RECORD_LEN,
+						 &tags[i + 2]) == SCSISIM_SUCCESS,
+		      "submit READ RECORD");
+
+	check(scsisim_pending(&device) == TEST_RECORDS + 2, "all pending");
+
+	for (i = 0; i < TEST_RECORDS + 2; i++)
+	{
+		ret = scsisim_reap(&device, &req, 1000);
+		check(ret == SCSISIM_SUCCESS && req.user_data == &tags[i], "reaped in order");
+		check(i == 0 ? req.status > 0 : req.status == SCSISIM_SUCCESS, "status of the command");
+	}
+
+	check(scsisim_pending(&device) == 0, "none pending");
+
+	for (i = 0; i < TEST_RECORDS; i++)
+		check(records[i][0] == (i == 1 ? 0x77 : test_status[i]) &&
+		      records[i][1] == (i == 1 ? 0x77 : i + 1),
+		      "record read asynchronously");
+
+	/* No more than SCSISIM_MAX_PENDING at a time */
+	for (i = 0; i < SCSISIM_MAX_PENDING; i++)
+		scsisim_submit_read_record(&device, 1, records[0], TEST_RECORD_LEN, NULL);
+
+	check(scsisim_submit_read_record(&device, 1, records[0], TEST_RECORD_LEN, NULL) == SCSISIM_QUEUE_FULL,
+	      "queue full");
+
+	while (scsisim_reap(&device, &req, 1000) == SCSISIM_SUCCESS)
+		;
+
+	check(scsisim_pending(&device) == 0, "queue drained");
+
+	close_card(card, &device);
+}
+
+/**
+ * Function: reactor_done
+ *
+ * Description: Completion callback of a command driven by the reactor.
+ */
+static void reactor_done(struct scsisim_dev *device, const struct scsisim_request *req)
+{
+	struct test_completion *c = req->user_data;
+
+	(void)device;
+
+	c->status = req->status;
+	(*c->done)++;
+}
+
+/**
+ * Function: test_reactor
+ *
+ * Description: Drive two cards from one reactor, with some latency, and
+ * check that every command completes through its callback.
+ */
+static void test_reactor(void)
+{
+	struct scsisim_vcard *card[2];
+	struct scsisim_dev device[2];
+	struct scsisim_reactor *reactor;
+	struct test_completion c[2][TEST_RECORDS];
+	uint8_t records[2][TEST_RECORDS][TEST_RECORD_LEN];
+	unsigned int i, j, done = 0;
+	int ret;
+
+	if (open_card(&card[0], &device[0]) == false)
+		return;
+
+	if (open_card(&card[1], &device[1]) == false)
+	{
+		close_card(card[0], &device[0]);
+		return;
+	}
+
+	if (scsisim_reactor_create(&reactor) != SCSISIM_SUCCESS)
+	{
+		check(false, "scsisim_reactor_create");
+		close_card(card[0], &device[0]);
+		close_card(card[1], &device[1]);
+		return;
+	}
+
+	for (i = 0; i < 2; i++)
+	{
+		scsisim_vcard_set_latency(card[i], 1000);
+		check(scsisim_reactor_add(reactor, &device[i]) == SCSISIM_SUCCESS, "scsisim_reactor_add");
+		check(scsisim_select_file(&device[i], GSM_FILE_DF_TELECOM) > 0 &&
+		      scsisim_select_file(&device[i], TEST_EF) > 0,
+		      "select the EF");
+
+		for (j = 0; j < TEST_RECORDS; j++)
+		{
+			c[i][j].completion.callback = reactor_done;
+			c[i][j].done = &done;
+			c[i][j].status = 1;
+			check(scsisim_submit_read_record(&device[i], j + 1, records[i][j], TEST_RECORD_LEN,
+							 &c[i][j]) == SCSISIM_SUCCESS,
+			      "submit READ RECORD");
+		}
+	}
+
+	while (done < 2 * TEST_RECORDS)
+	{
+		if ((ret = scsisim_reactor_run(reactor, 1000)) <= 0)
+		{
+			check(false, "scsisim_reactor_run");
+			break;
+		}
+	}
+
+	for (i = 0; i < 2; i++)
+	{
+		for (j = 0; j < TEST_RECORDS; j++)
+			check(c[i][j].status == SCSISIM_SUCCESS && records[i][j][1] == j + 1,
+			      "record read through the reactor");
+
+		check(scsisim_reactor_remove(reactor, &device[i]) == SCSISIM_SUCCESS, "scsisim_reactor_remove");
+		close_card(card[i], &device[i]);
+	}
+
+	scsisim_reactor_destroy(reactor);
+}
+
+/**
+ * Function: test_bulk_read
+ *
+ * Description: Read a whole linear fixed EF, a range of its records and
+ * a transparent EF in one call each.
+ */
+static void test_bulk_read(void)
+{
+	struct scsisim_vcard *card;
+	struct scsisim_dev device;
+	struct GSM_response resp;
+	uint8_t data[TEST_RECORDS * TEST_RECORD_LEN], iccid[10];
+	int status[TEST_RECORDS];
+	unsigned int i;
+	bool ok = true;
+
+	if (open_card(&card, &device) == false)
+		return;
+
+	check(scsisim_select_file(&device, GSM_FILE_EF_ICCID) > 0 &&
+	      scsisim_read_binary(&device, iccid, 0, sizeof(iccid)) == SCSISIM_SUCCESS &&
+	      scsisim_read_file(&device, GSM_FILE_EF_ICCID, data, sizeof(data), &resp, status, 1) == SCSISIM_SUCCESS &&
+	      resp.type.ef.file_size == sizeof(iccid) && memcmp(data, iccid, sizeof(iccid)) == 0,
+	      "transparent EF");
+
+	check(scsisim_select_file(&device, GSM_FILE_DF_TELECOM) > 0, "DF-TELECOM");
+	check(scsisim_read_file(&device, TEST_EF, NULL, 0, &resp, NULL, 0) == SCSISIM_BUFFER_TOO_SMALL &&
+	      resp.type.ef.file_size == sizeof(data),
+	      "size of the EF");
+
+	memset(status, 1, sizeof(status));
+	check(scsisim_read_file(&device, TEST_EF, data, sizeof(data), &resp, status, TEST_RECORDS) == SCSISIM_SUCCESS,
+	      "linear fixed EF");
+
+	for (i = 0; i < TEST_RECORDS; i++)
+		ok = ok && status[i] == SCSISIM_SUCCESS &&
+		     data[i * TEST_RECORD_LEN] == test_status[i] && data[i * TEST_RECORD_LEN + 1] == i + 1;
+
+	check(ok, "every record in place");
+
+	memset(data, 0, sizeof(data));
+	check(scsisim_read_records_range(&device, TEST_EF, 4, 0, data, sizeof(data), &resp, status,
+					 TEST_RECORDS) == SCSISIM_SUCCESS &&
+	      data[1] == 4 && data[2 * TEST_RECORD_LEN + 1] == 6 && data[3 * TEST_RECORD_LEN] == 0,
+	      "records 4 to the end");
+	check(scsisim_read_records_range(&device, TEST_EF, 5, 3, data, sizeof(data), &resp, status,
+					 TEST_RECORDS) == SCSISIM_GSM_INVALID_ADDRESS,
+	      "range past the end");
+
+	close_card(card, &device);
+}
+
+/**
+ * Function: test_path_and_cache
+ *
+ * Description: Count the commands a path selection takes from different
+ * places, and check that selecting a file again, or getting a response
+ * seen before, takes none.
+ */
+static void test_path_and_cache(void)
+{
+	struct scsisim_vcard *card;
+	struct scsisim_dev device;
+	struct GSM_response resp;
+	uint8_t data[64];
+	char path[SCSISIM_MAX_PATH_LEN];
+	unsigned long count;
+	int ret;
+
+	if (open_card(&card, &device) == false)
+		return;
+
+	/* The current directory is unknown after initialization: MF first */
+	count = scsisim_vcard_get_command_count(card);
+	check(scsisim_select_path(&device, "3F00/7F10/6F3A") > 0 &&
+	      scsisim_vcard_get_command_count(card) - count == 3,
+	      "EF-ADN from nowhere");
+	check(scsisim_get_current_path(&device, path, sizeof(path)) == SCSISIM_SUCCESS &&
+	      strcmp(path, "3F00/7F10/6F3A") == 0,
+	      "current path");
+
+	/* From DF-TELECOM into DF-GSM takes the DF and the EF */
+	count = scsisim_vcard_get_command_count(card);
+	check(scsisim_select_path(&device, "3F00/7F20/6F07") > 0 &&
+	      scsisim_vcard_get_command_count(card) - count == 2,
+	      "EF-IMSI from DF-TELECOM");
+
+	/* A sibling EF takes one */
+	count = scsisim_vcard_get_command_count(card);
+	check(scsisim_select_path(&device, "3F00/7F20/6F46") > 0 &&
+	      scsisim_vcard_get_command_count(card) - count == 1,
+	      "EF-SPN from EF-IMSI");
+
+	check(scsisim_select_path(&device, "3F00/7F20/0006") == SCSISIM_INVALID_PARAM, "00xx file ID");
+	check(scsisim_select_path(&device, "7F20/6F46") == SCSISIM_INVALID_PARAM, "path not from the MF");
+	check(scsisim_get_current_path(&device, path, 5) == SCSISIM_BUFFER_TOO_SMALL, "path buffer too small");
+
+	/* The current file, and a response seen before, come from the cache */
+	ret = scsisim_select_file(&device, GSM_FILE_EF_SPN);
+	check(ret > 0 && scsisim_get_response(&device, data, ret, SIM_SELECT_EF, &resp) == SCSISIM_SUCCESS,
+	      "EF-SPN response");
+
+	count = scsisim_vcard_get_command_count(card);
+	check(scsisim_select_file(&device, GSM_FILE_EF_SPN) == ret &&
+	      scsisim_get_response(&device, data, ret, SIM_SELECT_EF, &resp) == SCSISIM_SUCCESS &&
+	      resp.type.ef.file_id == GSM_FILE_EF_SPN &&
+	      scsisim_vcard_get_command_count(card) == count,
+	      "EF-SPN again, from the cache");
+
+	/* EF-IMSI was selected on the way to EF-SPN, but its response was
+	 * never asked for */
+	check((ret = scsisim_select_file(&device, GSM_FILE_EF_IMSI)) > 0 &&
+	      scsisim_get_response(&device, data, ret, SIM_SELECT_EF, &resp) == SCSISIM_SUCCESS &&
+	      resp.type.ef.file_id == GSM_FILE_EF_IMSI &&
+	      scsisim_vcard_get_command_count(card) - count == 2,
+	      "EF-IMSI: SELECT and GET RESPONSE");
+
+	scsisim_cache_invalidate(&device);
+	count = scsisim_vcard_get_command_count(card);
+	check(scsisim_select_file(&device, GSM_FILE_EF_IMSI) > 0 &&
+	      scsisim_vcard_get_command_count(card) - count == 1,
+	      "SELECT sent after invalidating");
+	check(scsisim_get_current_path(&device, path, sizeof(path)) == SCSISIM_PATH_UNKNOWN,
+	      "path unknown after invalidating");
+
+	close_card(card, &device);
+}
+
+/**
+ * Function: test_bitmaps
+ *
+ * Description: Find records by their first byte, and the free records
+ * of EF-ADN, and check that the result stays up to date through
+ * updates without asking the card again.
+ */
+static void test_bitmaps(void)
+{
+	struct scsisim_vcard *card;
+	struct scsisim_dev device;
+	uint8_t bitmap[SCSISIM_RECORD_BITMAP_LEN], record[TEST_RECORD_LEN], adn[28];
+	unsigned long count;
+
+	if (open_card(&card, &device) == false)
+		return;
+
+	check(scsisim_select_file(&device, GSM_FILE_DF_TELECOM) > 0, "DF-TELECOM");
+
+	check(scsisim_find_records(&device, TEST_EF, 0x00, bitmap, sizeof(bitmap)) == 2 &&
+	      SCSISIM_RECORD_IS_SET(bitmap, 2) && SCSISIM_RECORD_IS_SET(bitmap, 4) &&
+	      !SCSISIM_RECORD_IS_SET(bitmap, 1) && !SCSISIM_RECORD_IS_SET(bitmap, 3),
+	      "free records");
+	check(scsisim_find_records(&device, TEST_EF, 0x03, bitmap, sizeof(bitmap)) == 2 &&
+	      SCSISIM_RECORD_IS_SET(bitmap, 3) && SCSISIM_RECORD_IS_SET(bitmap, 6),
+	      "unread records");
+
+	/* Free record 1, and fill record 4 */
+	memset(record, 0xff, sizeof(record));
+	record[0] = 0x00;
+	check(scsisim_select_file(&device, TEST_EF) > 0 &&
+	      scsisim_update_record(&device, 1, record, sizeof(record)) == SCSISIM_SUCCESS,
+	      "free record 1");
+	record[0] = 0x01;
+	check(scsisim_update_record(&device, 4, record, sizeof(record)) == SCSISIM_SUCCESS, "fill record 4");
+
+	count = scsisim_vcard_get_command_count(card);
+	check(scsisim_find_records(&device, TEST_EF, 0x00, bitmap, sizeof(bitmap)) == 2 &&
+	      SCSISIM_RECORD_IS_SET(bitmap, 1) && SCSISIM_RECORD_IS_SET(bitmap, 2) &&
+	      !SCSISIM_RECORD_IS_SET(bitmap, 4),
+	      "free records after the updates");
+	check(scsisim_vcard_get_command_count(card) == count, "free records from the cache");
+
+	check(scsisim_find_records(&device, TEST_EF, 0x00, bitmap, 0) == SCSISIM_BUFFER_TOO_SMALL,
+	      "bitmap too small");
+
+	/* The default EF-ADN has two contacts in 250 records; a record with
+	 * only a number is not free */
+	check(scsisim_find_free_adn(&device, GSM_FILE_EF_ADN, bitmap, sizeof(bitmap)) == 248 &&
+	      !SCSISIM_RECORD_IS_SET(bitmap, 1) && SCSISIM_RECORD_IS_SET(bitmap, 250),
+	      "free contacts");
+
+	memset(adn, 0xff, sizeof(adn));
+	adn[14] = 0x02;
+	adn[15] = 0x81;
+	adn[16] = 0x21;
+	check(scsisim_select_file(&device, GSM_FILE_EF_ADN) > 0 &&
+	      scsisim_update_record(&device, 250, adn, sizeof(adn)) == SCSISIM_SUCCESS &&
+	      scsisim_find_free_adn(&device, GSM_FILE_EF_ADN, bitmap, sizeof(bitmap)) == 247 &&
+	      !SCSISIM_RECORD_IS_SET(bitmap, 250),
+	      "number-only contact is not free");
+
+	close_card(card, &device);
+}
+
+/**
+ * Function: test_import_adn
+ *
+ * Description: Import contacts, one with a number long enough for an
+ * extension record, and check where they went; then make the ADN 
+ * records fail to write, and check the extension records are freed 
+ * again.
+ */
+static void test_import_adn(void)
+{
+	static const struct scsisim_contact contacts[] = {
+		{ "Alice", "+441234567890", 0 },
+		{ "Bob", "0012345678901234567890123456", 0 },
+		{ NULL, "112", 0 }
+	};
+	struct scsisim_vcard *card;
+	struct scsisim_dev device;
+	struct scsisim_adn adn;
+	uint8_t bitmap[SCSISIM_RECORD_BITMAP_LEN], recnos[3], record[28], ext[SCSISIM_EXT_RECORD_LEN];
+	char alpha[SCSISIM_ADN_MAX_ALPHA_LEN];
+	int status[3];
+
+	if (open_card(&card, &device) == false)
+		return;
+
+	check(scsisim_select_file(&device, GSM_FILE_DF_TELECOM) > 0, "DF-TELECOM");
+	check(scsisim_import_adn(&device, GSM_FILE_EF_ADN, GSM_FILE_EF_EXT1, contacts, 3,
+				 recnos, status) == SCSISIM_SUCCESS &&
+	      status[0] == SCSISIM_SUCCESS && status[2] == SCSISIM_SUCCESS,
+	      "import contacts");
+	check(recnos[0] == 3 && recnos[1] == 4 && recnos[2] == 5, "first free records");
+
+	check(scsisim_select_file(&device, GSM_FILE_EF_ADN) > 0 &&
+	      scsisim_read_record(&device, 3, record, sizeof(record)) == SCSISIM_SUCCESS &&
+	      scsisim_decode_adn(GSM_FILE_EF_ADN, record, sizeof(record), &adn, alpha, sizeof(alpha)) == SCSISIM_SUCCESS &&
+	      strcmp(alpha, "Alice") == 0 && strcmp(adn.number, "441234567890") == 0 &&
+	      adn.ton_npi == 0x91 && adn.ext == 0xff,
+	      "short number");
+	check(scsisim_read_record(&device, 5, record, sizeof(record)) == SCSISIM_SUCCESS &&
+	      scsisim_decode_adn(GSM_FILE_EF_ADN, record, sizeof(record), &adn, alpha, sizeof(alpha)) == SCSISIM_SUCCESS &&
+	      adn.used && adn.alpha_len == 0 && strcmp(adn.number, "112") == 0,
+	      "number without a name");
+
+	/* Digits 21 to 28 are in the first extension record */
+	check(scsisim_read_record(&device, 4, record, sizeof(record)) == SCSISIM_SUCCESS &&
+	      scsisim_decode_adn(GSM_FILE_EF_ADN, record, sizeof(record), &adn, alpha, sizeof(alpha)) == SCSISIM_SUCCESS &&
+	      strcmp(adn.number, "00123456789012345678") == 0 && adn.ext == 1,
+	      "long number");
+	check(scsisim_select_file(&device, GSM_FILE_EF_EXT1) > 0 &&
+	      scsisim_read_record(&device, 1, ext, sizeof(ext)) == SCSISIM_SUCCESS &&
+	      ext[0] == 0x02 && ext[1] == 4 && ext[2] == 0x09 && ext[5] == 0x65 && ext[12] == 0xff,
+	      "extension record");
+
+	/* Now the extension record can be written, but not the contact */
+	check(scsisim_vcard_set_access(card, GSM_FILE_DF_TELECOM, GSM_FILE_EF_ADN,
+				       SIM_AC_CHV1, SIM_AC_ADM) == SCSISIM_SUCCESS,
+	      "EF-ADN updated by ADM only");
+	check(scsisim_import_adn(&device, GSM_FILE_EF_ADN, GSM_FILE_EF_EXT1, &contacts[1], 1,
+				 recnos, status) == SCSISIM_GSM_CHV_VERIFICATION_FAILED &&
+	      status[0] == SCSISIM_GSM_CHV_VERIFICATION_FAILED,
+	      "contact not written");
+	check(scsisim_select_file(&device, GSM_FILE_EF_EXT1) > 0 &&
+	      scsisim_read_record(&device, 2, ext, sizeof(ext)) == SCSISIM_SUCCESS &&
+	      ext[0] == 0xff && ext[1] == 0xff && ext[12] == 0xff,
+	      "its extension record freed");
+
+	scsisim_cache_invalidate(&device);
+	check(scsisim_select_file(&device, GSM_FILE_DF_TELECOM) > 0 &&
+	      scsisim_find_records(&device, GSM_FILE_EF_EXT1, 0xff, bitmap, sizeof(bitmap)) == 9 &&
+	      !SCSISIM_RECORD_IS_SET(bitmap, 1),
+	      "only the first extension record used");
+	check(scsisim_find_free_adn(&device, GSM_FILE_EF_ADN, bitmap, sizeof(bitmap)) == 245,
+	      "three contacts added");
+
+	close_card(card, &device);
+}
+
+/* EOF */